@@ -0,0 +1,443 @@
+/* Copyright (C) 2014 John Bartholomew. For licensing terms, see the header file nfa.h */
+
+/* Benchmarks for libnfa: a set of pattern families, each run over a generated corpus through
+ * every entry point. Results are written to stdout as JSON, so that runs can be compared.
+ * See run.sh. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* allocations made by libnfa are counted (it's included below, so these apply to it too) */
+static void *bench_malloc(size_t size);
+static void *bench_realloc(void *p, size_t size);
+static void bench_free(void *p);
+#define malloc(size) bench_malloc(size)
+#define realloc(p, size) bench_realloc((p), (size))
+#define free(p) bench_free(p)
+
+#define NFA_API static
+#include "nfa.c"
+
+/* ----- ALLOCATION TRACKING ----- */
+
+struct AllocStats {
+   long count;    /* allocations since the last reset */
+   size_t live;   /* bytes currently allocated */
+   size_t base;   /* bytes allocated at the last reset */
+   size_t peak;   /* most bytes allocated at once since the last reset */
+};
+
+static struct AllocStats ALLOCS;
+
+/* each block has a header with its size (big enough to keep the block aligned) */
+union AllocHeader {
+   size_t size;
+   double align_d;
+   void *align_p;
+};
+
+static void *bench_malloc(size_t size) {
+   union AllocHeader *h = (union AllocHeader*)(malloc)(sizeof(union AllocHeader) + size);
+   if (!h) { return NULL; }
+   h->size = size;
+   ++ALLOCS.count;
+   ALLOCS.live += size;
+   if (ALLOCS.live > ALLOCS.peak) { ALLOCS.peak = ALLOCS.live; }
+   return h + 1;
+}
+
+static void *bench_realloc(void *p, size_t size) {
+   union AllocHeader *h;
+   if (!p) { return bench_malloc(size); }
+   h = (union AllocHeader*)p - 1;
+   ALLOCS.live -= h->size;
+   h = (union AllocHeader*)(realloc)(h, sizeof(union AllocHeader) + size);
+   if (!h) { return NULL; }
+   h->size = size;
+   ++ALLOCS.count;
+   ALLOCS.live += size;
+   if (ALLOCS.live > ALLOCS.peak) { ALLOCS.peak = ALLOCS.live; }
+   return h + 1;
+}
+
+static void bench_free(void *p) {
+   union AllocHeader *h;
+   if (!p) { return; }
+   h = (union AllocHeader*)p - 1;
+   ALLOCS.live -= h->size;
+   (free)(h);
+}
+
+static void reset_alloc_stats(void) {
+   ALLOCS.count = 0;
+   ALLOCS.base = ALLOCS.peak = ALLOCS.live;
+}
+
+/* ----- CORPORA ----- */
+
+/* a corpus is a set of lines (stored end to end, without the newlines) */
+struct Corpus {
+   const char *name;
+   char *text;
+   size_t size;
+   size_t *starts; /* nlines + 1 entries */
+   int nlines;
+};
+
+enum { CORPUS_SIZE = 1 << 20 };
+
+static uint32_t RNG_STATE;
+
+static uint32_t rng(void) {
+   /* xorshift32 */
+   RNG_STATE ^= RNG_STATE << 13;
+   RNG_STATE ^= RNG_STATE >> 17;
+   RNG_STATE ^= RNG_STATE << 5;
+   return RNG_STATE;
+}
+
+static const char *pick(const char * const *list, int count) {
+   return list[rng() % (uint32_t)count];
+}
+
+typedef int (*LineFn)(char *buf);
+
+static int filename_line(char *buf) {
+   static const char * const DIRS[] = { "src", "include", "lib", "tests", "docs", "build", "tools", "vendor" };
+   static const char * const WORDS[] = { "parser", "lexer", "util", "main", "config", "net", "io", "file", "cache", "index" };
+   static const char * const EXTS[] = { "c", "h", "cpp", "txt", "md", "o", "json", "py" };
+   int n = sprintf(buf, "%s/", pick(DIRS, 8));
+   if (rng() % 2) { n += sprintf(buf + n, "%s_%u/", pick(WORDS, 10), (unsigned)(rng() % 40)); }
+   n += sprintf(buf + n, "%s_%u.%s", pick(WORDS, 10), (unsigned)(rng() % 1000), pick(EXTS, 8));
+   return n;
+}
+
+static int log_line(char *buf) {
+   static const char * const LEVELS[] = { "DEBUG", "INFO", "INFO", "INFO", "WARN", "ERROR" };
+   static const char * const MESSAGES[] = {
+      "request served", "cache miss", "connection reset by peer", "upstream timeout",
+      "retrying request", "slow query", "user logged in", "configuration reloaded"
+   };
+   return sprintf(buf, "2014-%02u-%02u %02u:%02u:%02u %s [worker-%u] %s id=%08x status=%u time=%ums",
+      (unsigned)(rng() % 12 + 1), (unsigned)(rng() % 28 + 1), (unsigned)(rng() % 24),
+      (unsigned)(rng() % 60), (unsigned)(rng() % 60), pick(LEVELS, 6), (unsigned)(rng() % 16),
+      pick(MESSAGES, 8), (unsigned)rng(), (unsigned)(rng() % 4 ? 200 : 500), (unsigned)(rng() % 2000));
+}
+
+static int random_line(char *buf) {
+   int i, n = 16 + (int)(rng() % 240);
+   for (i = 0; i < n; ++i) { buf[i] = (char)(rng() & 0xFFu); }
+   return n;
+}
+
+static int pathological_line(char *buf) {
+   memset(buf, 'a', 27);
+   return 27;
+}
+
+static int make_corpus(struct Corpus *corpus, const char *name, LineFn line, size_t size, uint32_t seed) {
+   char buf[512];
+   int capacity = 1024;
+   size_t at = 0;
+   RNG_STATE = seed;
+   corpus->name = name;
+   corpus->text = (char*)malloc(size);
+   corpus->starts = (size_t*)malloc(capacity * sizeof(size_t));
+   corpus->nlines = 0;
+   if (!corpus->text || !corpus->starts) { return 0; }
+   while (1) {
+      const int n = line(buf);
+      if (at + n > size) { break; }
+      if (corpus->nlines + 1 >= capacity) {
+         capacity *= 2;
+         corpus->starts = (size_t*)realloc(corpus->starts, capacity * sizeof(size_t));
+         if (!corpus->starts) { return 0; }
+      }
+      memcpy(corpus->text + at, buf, n);
+      corpus->starts[corpus->nlines++] = at;
+      at += n;
+   }
+   corpus->starts[corpus->nlines] = at;
+   corpus->size = at;
+   return 1;
+}
+
+static void free_corpus(struct Corpus *corpus) {
+   free(corpus->text);
+   free(corpus->starts);
+}
+
+/* ----- PATTERNS ----- */
+
+enum { CORPUS_FILENAMES, CORPUS_LOGS, CORPUS_RANDOM, CORPUS_PATHOLOGICAL, NCORPORA };
+
+struct Pattern {
+   const char *family;
+   const char *name;
+   int corpus;
+   int ncaptures;
+   const char *regex; /* NULL for a generated pattern */
+};
+
+static const struct Pattern PATTERNS[] = {
+   { "literal",     "literal-prefix",   CORPUS_LOGS,         0, "2014-07-" },
+   { "literal",     "literal-search",   CORPUS_LOGS,         0, ".*timeout" },
+   { "glob",        "glob-ext",         CORPUS_FILENAMES,    0, "[^/]*/(.*/)?[^/]*\\.c$" },
+   { "glob",        "glob-dir",         CORPUS_FILENAMES,    0, "src/.*_1[0-9]*\\.[ch]$" },
+   { "class",       "class-log",        CORPUS_LOGS,         0, "[0-9]{4}-[0-9]{2}-[0-9]{2} [0-9:]+ (WARN|ERROR) \\[[a-z]+-[0-9]+\\]" },
+   { "class",       "class-random",     CORPUS_RANDOM,       0, "[^\n\r]*[\001-\037][a-zA-Z0-9]{2}" },
+   { "alternation", "alternation-200",  CORPUS_FILENAMES,    0, NULL },
+   { "nested",      "nested-repeat",    CORPUS_FILENAMES,    0, "(([a-z]+_?)*[0-9]*/)*([a-z]+(_[0-9]+)?)+\\.(c|h)$" },
+   { "nested",      "nested-random",    CORPUS_RANDOM,       0, "((.?.?)*[\200-\377])+[\001-\037]" },
+   { "captures",    "captures-path",    CORPUS_FILENAMES,    5, "(([^/]*)/)(.*/)?([a-z]+)_([0-9]+)\\.(.*)" },
+   { "captures",    "captures-log",     CORPUS_LOGS,         6, "([0-9-]+) ([0-9:]+) ([A-Z]+) \\[(.*)\\] (.*) id=([0-9a-f]+)" },
+   { "pathological", "a?^27a^27",       CORPUS_PATHOLOGICAL, 0, NULL },
+   { 0, 0, 0, 0, 0 }
+};
+
+static char *generated_regex(const struct Pattern *pattern) {
+   static const char * const WORDS[] = { "parser", "lexer", "util", "main", "config", "net", "io", "file", "cache", "index" };
+   char *regex;
+   int i, n = 0;
+   if (strcmp(pattern->name, "alternation-200") == 0) {
+      /* 200 file names */
+      regex = (char*)malloc(200 * 24 + 16);
+      if (!regex) { return NULL; }
+      n += sprintf(regex + n, ".*/(");
+      for (i = 0; i < 200; ++i) {
+         n += sprintf(regex + n, "%s%s_%d", (i ? "|" : ""), WORDS[i % 10], (i * 37) % 1000);
+      }
+      sprintf(regex + n, ")\\.");
+   } else {
+      /* the same pattern as test_exp.sh */
+      regex = (char*)malloc(4 * 27 + 1);
+      if (!regex) { return NULL; }
+      for (i = 0; i < 27; ++i) { n += sprintf(regex + n, "a?"); }
+      for (i = 0; i < 27; ++i) { regex[n++] = 'a'; }
+      regex[n] = '\0';
+   }
+   return regex;
+}
+
+/* ----- RUNNING ----- */
+
+enum { ENTRY_BUILD, ENTRY_MATCH, ENTRY_EXEC_STEP, ENTRY_JIT_BUILD, ENTRY_JIT, NENTRIES };
+
+static const char * const ENTRY_NAMES[] = { "build", "nfa_match", "nfa_exec_step", "nfa_jit_init", "nfa_jit_match" };
+
+struct Result {
+   long iterations; /* matches (or builds) */
+   double bytes;    /* input bytes processed */
+   long matched;    /* matches that succeeded (in one pass over the corpus) */
+   double seconds;
+   long allocs;
+   size_t peak_bytes;
+};
+
+static Nfa *build(const char *regex, int ncaptures) {
+   NfaBuilder builder;
+   Nfa *nfa;
+   nfa_builder_init(&builder);
+   builder.flags = NFA_BUILDER_OPTIMIZE;
+   nfa_build_regex(&builder, regex, -1, (ncaptures ? 0 : NFA_REGEX_NO_CAPTURES));
+   nfa = nfa_builder_output(&builder);
+   if (!nfa) { fprintf(stderr, "bench: could not build /%s/: %s\n", regex, nfa_error_string(builder.error)); }
+   nfa_builder_free(&builder);
+   return nfa;
+}
+
+static int step_match(NfaMachine *vm, const char *text, size_t length) {
+   size_t i;
+   nfa_exec_start(vm, 0, NFA_EXEC_AT_START | (length ? 0 : NFA_EXEC_AT_END));
+   for (i = 0; i < length && !nfa_exec_is_finished(vm); ++i) {
+      nfa_exec_step(vm, text[i], (int)i, (i + 1 == length ? NFA_EXEC_AT_END : 0));
+   }
+   return nfa_exec_is_accepted(vm);
+}
+
+/* one pass of an entry point over the corpus (or, for the build entries, one build) */
+static void run_once(int entry, const char *regex, int ncaptures, const Nfa *nfa, const struct Corpus *corpus,
+      NfaMachine *vm, const NfaJit *jit, struct Result *result) {
+   NfaCapture captures[8];
+   int i;
+   if (entry == ENTRY_BUILD) {
+      free(build(regex, ncaptures));
+      ++result->iterations;
+      return;
+   }
+   if (entry == ENTRY_JIT_BUILD) {
+      NfaJit built;
+      if (nfa_jit_init(&built, nfa) == NFA_NO_ERROR) { nfa_jit_free(&built); }
+      ++result->iterations;
+      return;
+   }
+   for (i = 0; i < corpus->nlines; ++i) {
+      const char *line = corpus->text + corpus->starts[i];
+      const size_t length = corpus->starts[i + 1] - corpus->starts[i];
+      int matched = 0;
+      switch (entry) {
+         case ENTRY_MATCH: matched = nfa_match(nfa, captures, ncaptures, line, length); break;
+         case ENTRY_EXEC_STEP: matched = step_match(vm, line, length); break;
+         case ENTRY_JIT: matched = nfa_jit_match(jit, line, length); break;
+      }
+      if (matched == 1) { ++result->matched; }
+   }
+   result->iterations += corpus->nlines;
+   result->bytes += (double)corpus->size;
+}
+
+static void write_json_string(FILE *to, const char *s) {
+   fputc('"', to);
+   for (; *s; ++s) {
+      const unsigned char c = (unsigned char)*s;
+      if (c == '"' || c == '\\') {
+         fprintf(to, "\\%c", c);
+      } else if (c < 32 || c >= 127) {
+         fprintf(to, "\\u%04x", (unsigned)c);
+      } else {
+         fputc(c, to);
+      }
+   }
+   fputc('"', to);
+}
+
+static double MIN_SECONDS = 0.5;
+
+static int run_benchmark(const struct Pattern *pattern, const char *regex, int entry, const struct Corpus *corpus, int first, FILE *to) {
+   struct Result result;
+   NfaMachine vm;
+   NfaJit jit;
+   Nfa *nfa = NULL;
+   clock_t start;
+   long matched;
+   int have_vm = 0, have_jit = 0;
+
+   /* peak memory includes the NFA and the matcher (but not the JIT's code pages) */
+   reset_alloc_stats();
+   memset(&result, 0, sizeof(result));
+   if (entry != ENTRY_BUILD) {
+      nfa = build(regex, pattern->ncaptures);
+      if (!nfa) { return 0; }
+   }
+   if (entry == ENTRY_EXEC_STEP) {
+      nfa_exec_init(&vm, nfa, pattern->ncaptures);
+      have_vm = 1;
+   }
+   if (entry == ENTRY_JIT || entry == ENTRY_JIT_BUILD) {
+      if (nfa_jit_init(&jit, nfa) != NFA_NO_ERROR) {
+         /* (the DFA is too big) */
+         free(nfa);
+         return 0;
+      }
+      have_jit = 1;
+   }
+
+   /* one untimed pass (which counts the matches), then as many as fit in MIN_SECONDS */
+   run_once(entry, regex, pattern->ncaptures, nfa, corpus, &vm, &jit, &result);
+   matched = result.matched;
+   memset(&result, 0, sizeof(result));
+   ALLOCS.count = 0;
+   start = clock();
+   do {
+      run_once(entry, regex, pattern->ncaptures, nfa, corpus, &vm, &jit, &result);
+      result.seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+   } while (result.seconds < MIN_SECONDS);
+   result.matched = matched;
+   result.allocs = ALLOCS.count;
+   result.peak_bytes = ALLOCS.peak - ALLOCS.base;
+
+   if (have_vm) { nfa_exec_free(&vm); }
+   if (have_jit) { nfa_jit_free(&jit); }
+   free(nfa);
+
+   fprintf(to, "%s\n    {\"name\": ", (first ? "" : ","));
+   {
+      char name[128];
+      sprintf(name, "%s/%s", pattern->name, ENTRY_NAMES[entry]);
+      write_json_string(to, name);
+   }
+   fprintf(to, ", \"family\": ");
+   write_json_string(to, pattern->family);
+   fprintf(to, ", \"entry\": ");
+   write_json_string(to, ENTRY_NAMES[entry]);
+   fprintf(to, ", \"corpus\": ");
+   write_json_string(to, corpus->name);
+   fprintf(to, ",\n     \"pattern\": ");
+   if (strlen(regex) > 200) {
+      char prefix[204];
+      memcpy(prefix, regex, 200);
+      strcpy(prefix + 200, "...");
+      write_json_string(to, prefix);
+   } else {
+      write_json_string(to, regex);
+   }
+   fprintf(to, ",\n     \"iterations\": %ld, \"seconds\": %.6f", result.iterations, result.seconds);
+   if (result.bytes > 0.0) {
+      fprintf(to, ", \"matched\": %ld, \"mb_per_s\": %.3f", result.matched, result.bytes / (1024.0 * 1024.0) / result.seconds);
+   }
+   fprintf(to, ", \"ns_per_%s\": %.1f", ((entry == ENTRY_BUILD || entry == ENTRY_JIT_BUILD) ? "build" : "match"),
+      result.seconds * 1e9 / (double)result.iterations);
+   fprintf(to, ", \"allocs_per_%s\": %.3f, \"peak_bytes\": %lu}",
+      ((entry == ENTRY_BUILD || entry == ENTRY_JIT_BUILD) ? "build" : "match"),
+      (double)result.allocs / (double)result.iterations, (unsigned long)result.peak_bytes);
+   fflush(to);
+   return 1;
+}
+
+int main(int argc, char **argv) {
+   static const struct { const char *name; LineFn line; size_t size; } CORPORA[NCORPORA] = {
+      { "filenames", filename_line, CORPUS_SIZE },
+      { "logs", log_line, CORPUS_SIZE },
+      { "random", random_line, CORPUS_SIZE },
+      { "pathological", pathological_line, 27 }
+   };
+   struct Corpus corpora[NCORPORA];
+   const char *filter = NULL;
+   int i, entry, first = 1;
+
+   for (i = 1; i < argc; ++i) {
+      if (strncmp(argv[i], "--min-time=", 11) == 0) {
+         MIN_SECONDS = atof(argv[i] + 11);
+      } else if (argv[i][0] != '-' && !filter) {
+         filter = argv[i];
+      } else {
+         fprintf(stderr, "usage: bench [--min-time=SECONDS] [FILTER]\n");
+         return 1;
+      }
+   }
+
+   for (i = 0; i < NCORPORA; ++i) {
+      if (!make_corpus(corpora + i, CORPORA[i].name, CORPORA[i].line, CORPORA[i].size, 2463534242u + (uint32_t)i)) {
+         fprintf(stderr, "bench: out of memory\n");
+         return 1;
+      }
+   }
+
+   fprintf(stdout, "{\"libnfa_bench\": 1, \"min_seconds\": %.3f,\n \"corpora\": [", MIN_SECONDS);
+   for (i = 0; i < NCORPORA; ++i) {
+      fprintf(stdout, "%s{\"name\": \"%s\", \"bytes\": %lu, \"lines\": %d}", (i ? ", " : ""),
+         corpora[i].name, (unsigned long)corpora[i].size, corpora[i].nlines);
+   }
+   fprintf(stdout, "],\n \"benchmarks\": [");
+
+   for (i = 0; PATTERNS[i].name; ++i) {
+      const struct Pattern *pattern = PATTERNS + i;
+      char *generated = (pattern->regex ? NULL : generated_regex(pattern));
+      const char *regex = (pattern->regex ? pattern->regex : generated);
+      if (!regex) { continue; }
+      for (entry = 0; entry < NENTRIES; ++entry) {
+         char name[128];
+         sprintf(name, "%s/%s", pattern->name, ENTRY_NAMES[entry]);
+         if (filter && !strstr(name, filter)) { continue; }
+         if (run_benchmark(pattern, regex, entry, corpora + pattern->corpus, first, stdout)) { first = 0; }
+      }
+      free(generated);
+   }
+   fprintf(stdout, "\n ]}\n");
+
+   for (i = 0; i < NCORPORA; ++i) { free_corpus(corpora + i); }
+   return 0;
+}
+/* vim: set ts=8 sts=3 sw=3 et: */
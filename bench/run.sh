@@ -0,0 +1,10 @@
+#!/bin/sh
+
+# builds and runs the benchmarks (from the top-level directory), writing JSON to stdout;
+# e.g.: bench/run.sh > before.json; bench/run.sh glob > glob.json
+
+BUILDDIR="${BUILDDIR:-/tmp}"
+
+set -e
+gcc -std=c89 -pedantic -Wall -Wextra -Wno-unused-function -O2 -DNDEBUG -I. -o "$BUILDDIR"/nfa-bench bench/bench.c
+exec "$BUILDDIR"/nfa-bench "$@"
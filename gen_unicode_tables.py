@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# Copyright (C) 2014 John Bartholomew. For licensing terms, see the header file nfa.h
+
+# Regenerates the Unicode tables in nfa.c (between the BEGIN/END GENERATED markers) from
+# the Unicode Character Database that comes with Python's unicodedata module.
+# Run from the top-level directory: python3 gen_unicode_tables.py
+
+import sys
+import unicodedata
+
+BEGIN = '/* BEGIN GENERATED UNICODE TABLES */\n'
+END = '/* END GENERATED UNICODE TABLES */\n'
+
+# (the category index is stored in 5 bits; Cn, unassigned, must be 0)
+CATEGORIES = ['Cn', 'Lu', 'Ll', 'Lt', 'Lm', 'Lo', 'Mn', 'Mc', 'Me', 'Nd', 'Nl', 'No',
+              'Pc', 'Pd', 'Ps', 'Pe', 'Pi', 'Pf', 'Po', 'Sm', 'Sc', 'Sk', 'So',
+              'Zs', 'Zl', 'Zp', 'Cc', 'Cf', 'Cs', 'Co']
+MAX_CODEPOINT = 0x10FFFF
+
+def category_runs():
+   runs, prev = [], None
+   for cp in range(MAX_CODEPOINT + 1):
+      cat = CATEGORIES.index(unicodedata.category(chr(cp)))
+      if cat != prev:
+         runs.append((cp << 5) | cat)
+         prev = cat
+   return runs
+
+def simple_fold(cp):
+   # simple case folding (statuses C and S of CaseFolding.txt): use the full folding if
+   # it is a single code point, otherwise the lower-case mapping if that is
+   s = chr(cp)
+   for f in (s.casefold(), s.lower()):
+      if len(f) == 1:
+         return ord(f)
+   return cp
+
+def fold_orbits():
+   # each orbit is a set of code points which are equal under simple case folding;
+   # map each member to the next one (in code point order, wrapping around)
+   members = {}
+   for cp in range(MAX_CODEPOINT + 1):
+      if 0xD800 <= cp <= 0xDFFF:
+         continue
+      f = simple_fold(cp)
+      if f != cp:
+         members.setdefault(f, set([f])).add(cp)
+   nexts = {}
+   for orbit in members.values():
+      orbit = sorted(orbit)
+      for i, cp in enumerate(orbit):
+         nexts[cp] = orbit[(i + 1) % len(orbit)]
+   return sorted(nexts.items())
+
+def fold_ranges(items):
+   # compress into (first, last, delta) ranges; delta None means alternately +1 and -1
+   # (a run of pairs of code points which map to each other)
+   out, i = [], 0
+   while i < len(items):
+      cp, nxt = items[i]
+      delta = nxt - cp
+      j = i
+      if delta == 1:
+         while (j + 1 < len(items) and items[j + 1][0] == items[j][0] + 1 and
+               items[j + 1][1] - items[j + 1][0] == (-1 if (j + 1 - i) % 2 else 1)):
+            j += 1
+         if (j - i) % 2 == 0:
+            j -= 1 # (the run has to end with the second of a pair)
+         if j > i:
+            out.append((cp, items[j][0], None))
+            i = j + 1
+            continue
+         j = i
+      while (j + 1 < len(items) and items[j + 1][0] == items[j][0] + 1 and
+            items[j + 1][1] - items[j + 1][0] == delta):
+         j += 1
+      out.append((cp, items[j][0], delta))
+      i = j + 1
+   return out
+
+def generate():
+   runs = category_runs()
+   folds = fold_ranges(fold_orbits())
+   lines = []
+   lines.append('/* generated by gen_unicode_tables.py from the Unicode Character Database (version %s) */\n' %
+         unicodedata.unidata_version)
+   lines.append('\n')
+   lines.append('enum {\n')
+   lines.append('   NFAI_UNICODE_NCATEGORIES = %d,\n' % len(CATEGORIES))
+   lines.append('   NFAI_UNICODE_NCATEGORY_RUNS = %d,\n' % len(runs))
+   lines.append('   NFAI_UNICODE_NFOLDS = %d\n' % len(folds))
+   lines.append('};\n')
+   lines.append('\n')
+   lines.append('/* two-letter general category names, in the order of their indexes */\n')
+   lines.append('NFAI_INTERNAL const char NFAI_UNICODE_CATEGORY_NAMES[] =\n   "%s";\n' % ''.join(CATEGORIES))
+   lines.append('\n')
+   lines.append('/* (first code point << 5) | category index; each run lasts until the next one starts */\n')
+   lines.append('NFAI_INTERNAL const uint32_t NFAI_UNICODE_CATEGORY_RUNS[NFAI_UNICODE_NCATEGORY_RUNS] = {\n')
+   for i in range(0, len(runs), 8):
+      lines.append('   ' + ' '.join('0x%07Xu,' % r for r in runs[i:i + 8]) + '\n')
+   lines.append('};\n')
+   lines.append('\n')
+   lines.append('/* simple case folding orbits: each code point in [first, last] maps to the next member of\n')
+   lines.append(' * its orbit by adding delta (or +1 and -1 alternately, if delta is NFAI_FOLD_ALTERNATE) */\n')
+   lines.append('NFAI_INTERNAL const struct NfaiFoldRange NFAI_UNICODE_FOLDS[NFAI_UNICODE_NFOLDS] = {\n')
+   for i in range(0, len(folds), 4):
+      cells = []
+      for first, last, delta in folds[i:i + 4]:
+         cells.append('{ 0x%05X, 0x%05X, %s },' % (first, last,
+               'NFAI_FOLD_ALTERNATE' if delta is None else '%d' % delta))
+      lines.append('   ' + ' '.join(cells) + '\n')
+   lines.append('};\n')
+   return ''.join(lines)
+
+def main():
+   path = sys.argv[1] if len(sys.argv) > 1 else 'nfa.c'
+   with open(path) as f:
+      source = f.read()
+   begin = source.index(BEGIN) + len(BEGIN)
+   end = source.index(END)
+   with open(path, 'w') as f:
+      f.write(source[:begin] + generate() + source[end:])
+
+if __name__ == '__main__':
+   main()
@@ -5,6 +5,18 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+
+/* the JIT emits x86-64 code for the System V calling convention, into pages from mmap */
+#if !defined(NFA_NO_JIT) && defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)) && !defined(__CYGWIN__)
+#  define NFAI_JIT_X86_64
+#  include <sys/mman.h>
+#  if !defined(MAP_ANONYMOUS) && !defined(MAP_ANON)
+      /* (strict ISO modes hide MAP_ANONYMOUS, so pages are mapped from /dev/zero instead) */
+#     include <fcntl.h>
+#     include <unistd.h>
+#  endif
+#endif
 
 #define NFAI_INTERNAL static
 
@@ -22,6 +34,13 @@ extern "C" {
 
 #define NFAI_UNUSED(x) ((void)sizeof(x))
 
+/* execution counters (see nfa_exec_stats) are only kept if NFA_EXEC_STATS is defined */
+#ifdef NFA_EXEC_STATS
+#  define NFAI_COUNT(data, counter, n) ((data)->stats.counter += (n))
+#else
+#  define NFAI_COUNT(data, counter, n) ((void)0)
+#endif
+
 #ifdef NFA_NDEBUG
 #  define NFAI_ASSERT(x) do{NFAI_UNUSED(!(x));}while(0)
 #else
@@ -33,25 +52,83 @@ enum {
 
    NFAI_OP_MATCH_ANY      = (  1u << 8), /* match any byte */
    NFAI_OP_MATCH_BYTE     = (  2u << 8), /* match one byte exactly */
-   NFAI_OP_MATCH_BYTE_CI  = (  3u << 8), /* match one byte, special-cased to do a case-insensitive match for ASCII */
    NFAI_OP_MATCH_CLASS    = (  4u << 8), /* match a character class stored as an ordered list of disjoint ranges) */
 
    NFAI_OP_ASSERT_CONTEXT = (  5u << 8), /* assert that a particular context flag is set */
+   NFAI_OP_ASSERT_LOOK    = (  6u << 8), /* assert something about the bytes either side of the position */
 
    NFAI_OP_SAVE_START     = (  7u << 8), /* save the input position (start of capture) */
    NFAI_OP_SAVE_END       = (  8u << 8), /* save the input position (end of capture) */
 
    NFAI_OP_JUMP           = (  9u << 8), /* jump to one or more places */
 
-   NFAI_OP_ACCEPT         = ( 10u << 8)
+   NFAI_OP_ACCEPT         = ( 10u << 8),
+
+   NFAI_OP_TOKEN          = ( 11u << 8), /* report a token match (the token id is stored in the following op) */
+
+   NFAI_OP_MATCH_STRING   = ( 12u << 8), /* match a run of bytes exactly (the bytes are stored two per op in the following ops) */
+
+   NFAI_OP_REPEAT         = ( 13u << 8)  /* match a single-character op a counted number of times
+                                            (followed by the minimum count, the maximum count and the op) */
+};
+
+/* flags for NFAI_OP_REPEAT (stored in the low byte) */
+enum {
+   NFAI_REPEAT_LAZY      = 1, /* prefer fewer iterations */
+   NFAI_REPEAT_UNBOUNDED = 2  /* the maximum count is the minimum count, but the last iteration can repeat */
+};
+
+/* assertions for NFAI_OP_ASSERT_LOOK (stored in the low byte) */
+enum {
+   NFAI_LOOK_WORD_BOUNDARY     = 0, /* a word byte on one side and not the other */
+   NFAI_LOOK_NOT_WORD_BOUNDARY = 1,
+   NFAI_LOOK_LINE_START        = 2, /* at the start of the input, or after a newline */
+   NFAI_LOOK_LINE_END          = 3, /* at the end of the input, or before a newline */
+   NFAI_LOOK_NKINDS            = 4
+};
+
+/* what is known about the bytes either side of a position (see nfai_look_passes) */
+enum {
+   NFAI_LOOK_BEHIND_WORD = 1,  /* the byte before is a word byte */
+   NFAI_LOOK_BEHIND_LINE = 2,  /* there is no byte before, or it's a newline */
+   NFAI_LOOK_AHEAD_KNOWN = 4,  /* the byte after (or the end of the input) is known */
+   NFAI_LOOK_AHEAD_WORD  = 8,
+   NFAI_LOOK_AHEAD_LINE  = 16,
+   NFAI_LOOK_BEHIND      = NFAI_LOOK_BEHIND_WORD | NFAI_LOOK_BEHIND_LINE,
+   NFAI_LOOK_ANY         = -1  /* (for analysis) every assertion passes */
+};
+
+/* An NFA is stored in one of two formats: narrow (16-bit words), which is used whenever
+ * the program fits, or wide (32-bit words) for larger programs. Both formats have the
+ * same layout; only the word size differs. The builder and the optimizer always work
+ * with 32-bit words. */
+enum {
+   NFAI_FORMAT_NARROW = 1,
+   NFAI_FORMAT_WIDE   = 2
 };
 
-/* note: these can't be increased without changing the internal NFA representation */
+/* An Nfa starts with a header so that a stored blob can be checked before it's used
+ * (see nfa_validate). The magic number is stored in native byte order, so reading it
+ * byte-swapped means the blob came from a machine with the other byte order. The
+ * version changes whenever the instruction encoding does. */
+#define NFAI_MAGIC          0x1A41464Eu /* "NFA\x1A" when stored little-endian */
+#define NFAI_MAGIC_SWAPPED  0x4E46411Au
+enum { NFAI_VERSION = 4 };
+
+/* the wide limits keep every size and state count well clear of int overflow */
 enum {
-   NFAI_MAX_OPS  = UINT16_MAX - 1,
-   NFAI_MAX_JUMP = INT16_MAX - 1
+   NFAI_MAX_OPS    = (1 << 26) - 1,
+   NFAI_MAX_JUMP   = (1 << 26) - 1,
+   NFAI_MAX_STATES = (1 << 26) - 1,
+
+   NFAI_NARROW_MAX_OPS  = UINT16_MAX - 1,
+   NFAI_NARROW_MAX_JUMP = INT16_MAX - 1,
+   NFAI_NARROW_MAX_ARG  = UINT16_MAX /* largest token id or repeat count */
 };
 
+/* counted repetition of a single character is unrolled up to this count; above it, an NFAI_OP_REPEAT is used */
+enum { NFAI_REPEAT_UNROLL_LIMIT = 8 };
+
 #define NFAI_HI_BYTE(x) (uint8_t)((x) >> 8)
 #define NFAI_LO_BYTE(x) (uint8_t)((x) & 0xFFu)
 
@@ -211,17 +288,233 @@ NFAI_INTERNAL void nfai_free_pool(NfaPoolAllocator *pool) {
    }
 }
 
-typedef uint16_t NfaOpcode;
+typedef uint32_t NfaOpcode;
 
 struct Nfa {
-   int nops;
-   NfaOpcode ops[1];
+   uint32_t magic;    /* NFAI_MAGIC */
+   uint16_t version;  /* NFAI_VERSION */
+   uint16_t format;   /* NFAI_FORMAT_NARROW or NFAI_FORMAT_WIDE */
+   int32_t nops;
+   uint32_t checksum; /* of the ops and the prefilter (see nfai_checksum) */
+   /* the prefilter lets nfa_match reject some inputs without running a machine (see nfai_prefilter) */
+   uint32_t min_length; /* every match is at least this long */
+   uint32_t max_length; /* every match is at most this long and ends at the end of the input (UINT32_MAX if not) */
+   uint8_t nrequired;   /* number of bytes in required */
+   uint8_t required[3]; /* bytes that every match contains */
+   uint32_t folded;     /* bit i set: required[i] is a lower-case letter, which may appear in either case */
+   uint32_t anchored;   /* (bool) every match starts at the start of the input (so a search needn't go on) */
+   union {
+      uint16_t narrow[1];
+      uint32_t wide[1];
+   } ops;
 };
 
+NFAI_INTERNAL size_t nfai_nfa_size(int nops, int format) {
+   const size_t sz = offsetof(struct Nfa, ops)
+      + nops*(format == NFAI_FORMAT_WIDE ? sizeof(uint32_t) : sizeof(uint16_t));
+   return (sz < sizeof(struct Nfa) ? sizeof(struct Nfa) : sz);
+}
+
+NFAI_INTERNAL NfaOpcode nfai_word(const Nfa *nfa, int i) {
+   NFAI_ASSERT(i >= 0 && i < nfa->nops);
+   return (nfa->format == NFAI_FORMAT_WIDE ? nfa->ops.wide[i] : nfa->ops.narrow[i]);
+}
+
+/* jump offsets are signed */
+NFAI_INTERNAL int nfai_jump_offset(const Nfa *nfa, int i) {
+   NFAI_ASSERT(i >= 0 && i < nfa->nops);
+   return (nfa->format == NFAI_FORMAT_WIDE ? (int32_t)nfa->ops.wide[i] : (int16_t)nfa->ops.narrow[i]);
+}
+
+/* write 32-bit words into the NFA (negative jump offsets truncate correctly to 16 bits) */
+NFAI_INTERNAL void nfai_store_ops(Nfa *nfa, int at, const NfaOpcode *ops, int n) {
+   int i;
+   NFAI_ASSERT(at >= 0 && at + n <= nfa->nops);
+   if (nfa->format == NFAI_FORMAT_WIDE) {
+      memcpy(nfa->ops.wide + at, ops, n*sizeof(uint32_t));
+   } else {
+      for (i = 0; i < n; ++i) {
+         nfa->ops.narrow[at + i] = (uint16_t)ops[i];
+      }
+   }
+}
+
+/* number of words used by an instruction (opcode plus operands), given its first word
+ * and, for an NFAI_OP_REPEAT, the first word of its body */
+NFAI_INTERNAL int nfai_instr_length(NfaOpcode op, NfaOpcode body) {
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_CLASS:
+      case NFAI_OP_JUMP:
+         return 1 + NFAI_LO_BYTE(op);
+      case NFAI_OP_TOKEN:
+         return 2;
+      case NFAI_OP_MATCH_STRING:
+         return 1 + (NFAI_LO_BYTE(op) + 1) / 2;
+      case NFAI_OP_REPEAT:
+         return 3 + nfai_instr_length(body, 0);
+      default:
+         return 1;
+   }
+}
+
+/* number of words used by the instruction at ops[0] */
+NFAI_INTERNAL int nfai_op_length(const NfaOpcode *ops) {
+   const int repeat = ((ops[0] & NFAI_OPCODE_MASK) == NFAI_OP_REPEAT);
+   return nfai_instr_length(ops[0], (repeat ? ops[3] : 0));
+}
+
+/* number of words used by the instruction at nfa->ops[pc] */
+NFAI_INTERNAL int nfai_nfa_op_length(const Nfa *nfa, int pc) {
+   const NfaOpcode op = nfai_word(nfa, pc);
+   const int repeat = ((op & NFAI_OPCODE_MASK) == NFAI_OP_REPEAT);
+   return nfai_instr_length(op, (repeat ? nfai_word(nfa, pc + 3) : 0));
+}
+
+/* read the NFA's program as 32-bit words */
+NFAI_INTERNAL void nfai_load_ops(const Nfa *nfa, NfaOpcode *to) {
+   int pc, i, len;
+   for (pc = 0; pc < nfa->nops; pc += len) {
+      len = nfai_nfa_op_length(nfa, pc);
+      to[pc] = nfai_word(nfa, pc);
+      for (i = 1; i < len; ++i) {
+         if ((to[pc] & NFAI_OPCODE_MASK) == NFAI_OP_JUMP) {
+            to[pc + i] = (NfaOpcode)nfai_jump_offset(nfa, pc + i);
+         } else {
+            to[pc + i] = nfai_word(nfa, pc + i);
+         }
+      }
+   }
+}
+
+/* whether a sequence of instructions can be stored in the narrow format */
+NFAI_INTERNAL int nfai_ops_fit_narrow(const NfaOpcode *ops, int nops) {
+   int pc, i;
+   for (pc = 0; pc < nops; pc += nfai_op_length(ops + pc)) {
+      switch (ops[pc] & NFAI_OPCODE_MASK) {
+         case NFAI_OP_JUMP:
+            for (i = 1; i <= NFAI_LO_BYTE(ops[pc]); ++i) {
+               const int offset = (int32_t)ops[pc + i];
+               if (offset > NFAI_NARROW_MAX_JUMP || offset < -NFAI_NARROW_MAX_JUMP) { return 0; }
+            }
+            break;
+         case NFAI_OP_TOKEN:
+            if (ops[pc + 1] > NFAI_NARROW_MAX_ARG) { return 0; }
+            break;
+         case NFAI_OP_REPEAT:
+            /* the minimum count is never more than the maximum */
+            if (ops[pc + 2] > NFAI_NARROW_MAX_ARG) { return 0; }
+            break;
+      }
+   }
+   return 1;
+}
+
+NFAI_INTERNAL int nfai_ops_format(const NfaOpcode *ops, int nops) {
+   if (nops <= NFAI_NARROW_MAX_OPS && nfai_ops_fit_narrow(ops, nops)) {
+      return NFAI_FORMAT_NARROW;
+   } else {
+      return NFAI_FORMAT_WIDE;
+   }
+}
+
+NFAI_INTERNAL int nfai_format_max_jump(int format) {
+   return (format == NFAI_FORMAT_WIDE ? NFAI_MAX_JUMP : NFAI_NARROW_MAX_JUMP);
+}
+
+/* byte 'i' of the NFAI_OP_MATCH_STRING instruction at nfa->ops[pc] (high byte of each word first) */
+NFAI_INTERNAL uint8_t nfai_string_byte(const Nfa *nfa, int pc, int i) {
+   const NfaOpcode pair = nfai_word(nfa, pc + 1 + i/2);
+   return ((i & 1) ? NFAI_LO_BYTE(pair) : NFAI_HI_BYTE(pair));
+}
+
+/* bytes must be stored in order (storing an even-numbered byte clears the one after it) */
+NFAI_INTERNAL void nfai_set_string_byte(NfaOpcode *ops, int i, uint8_t c) {
+   if (i & 1) {
+      ops[1 + i/2] |= c;
+   } else {
+      ops[1 + i/2] = (NfaOpcode)(c << 8);
+   }
+}
+
+/* A thread part-way through a string match needs a distinct state for each byte offset,
+ * so an NFAI_OP_MATCH_STRING of n bytes has n-1 extra 'virtual' states, which are
+ * numbered after all the real ones. Similarly, an NFAI_OP_REPEAT with a maximum count
+ * of n has a virtual state for each count, both before and after matching the body. */
+NFAI_INTERNAL int nfai_virtual_states(const Nfa *nfa, int pc) {
+   const NfaOpcode op = nfai_word(nfa, pc);
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_STRING:
+         return NFAI_LO_BYTE(op) - 1;
+      case NFAI_OP_REPEAT:
+         NFAI_ASSERT(nfai_word(nfa, pc + 2) <= NFAI_MAX_STATES);
+         return 2 * (int)nfai_word(nfa, pc + 2);
+      default:
+         return 0;
+   }
+}
+
+/* number of states (real and virtual) of the instruction at nfa->ops[pc] which consume a byte */
+NFAI_INTERNAL int nfai_consuming_states(const Nfa *nfa, int pc) {
+   const NfaOpcode op = nfai_word(nfa, pc);
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_ANY:
+      case NFAI_OP_MATCH_BYTE:
+      case NFAI_OP_MATCH_CLASS:
+         return 1;
+      case NFAI_OP_MATCH_STRING:
+         return NFAI_LO_BYTE(op);
+      case NFAI_OP_REPEAT:
+         return (int)nfai_word(nfa, pc + 2);
+      default:
+         return 0;
+   }
+}
+
+/* (the count stops just past NFAI_MAX_STATES, so it can't overflow) */
+NFAI_INTERNAL int nfai_count_states(const Nfa *nfa) {
+   int pc, nstates = nfa->nops;
+   for (pc = 0; pc < nfa->nops && nstates <= NFAI_MAX_STATES; pc += nfai_nfa_op_length(nfa, pc)) {
+      nstates += nfai_virtual_states(nfa, pc);
+   }
+   return nstates;
+}
+
+NFAI_INTERNAL uint32_t nfai_hash_word(uint32_t h, uint32_t word) {
+   int j;
+   for (j = 0; j < 32; j += 8) {
+      h = (h ^ ((word >> j) & 0xFFu)) * 16777619u;
+   }
+   return h;
+}
+
+/* FNV-1a over the op values (so it doesn't depend on the format), then the prefilter */
+NFAI_INTERNAL uint32_t nfai_checksum(const Nfa *nfa) {
+   uint32_t h = 2166136261u;
+   int i;
+   for (i = 0; i < nfa->nops; ++i) {
+      h = nfai_hash_word(h, nfai_word(nfa, i));
+   }
+   h = nfai_hash_word(h, nfa->min_length);
+   h = nfai_hash_word(h, nfa->max_length);
+   h = nfai_hash_word(h, nfa->nrequired | ((uint32_t)nfa->required[0] << 8) |
+         ((uint32_t)nfa->required[1] << 16) | ((uint32_t)nfa->required[2] << 24));
+   h = nfai_hash_word(h, nfa->folded);
+   h = nfai_hash_word(h, nfa->anchored);
+   return h;
+}
+
+/* fill in the header once the ops have been stored */
+NFAI_INTERNAL void nfai_seal(Nfa *nfa) {
+   nfa->magic = NFAI_MAGIC;
+   nfa->version = NFAI_VERSION;
+   nfa->checksum = nfai_checksum(nfa);
+}
+
 struct NfaiBuilderData {
-   struct NfaiFragment *stack[NFA_BUILDER_MAX_STACK];
-   int frag_size[NFA_BUILDER_MAX_STACK];
+   struct NfaiFragment **stack;
+   int *frag_size;
    int nstack;
+   int capacity; /* starts at NFA_BUILDER_MAX_STACK, and doubles when the stack is full */
 };
 
 struct NfaiFragment {
@@ -264,6 +557,28 @@ NFAI_INTERNAL struct NfaiFragment *nfai_new_fragment(NfaBuilder *builder, int no
    }
 }
 
+/* the old arrays can't be freed (they're in the builder's pool), but doubling keeps
+ * the total size down to twice the final size */
+NFAI_INTERNAL int nfai_grow_stack(NfaBuilder *builder, struct NfaiBuilderData *data) {
+   struct NfaiFragment **stack;
+   int *frag_size;
+   int capacity;
+
+   if (data->capacity > NFAI_MAX_OPS / 2) { return (builder->error = NFA_ERROR_STACK_OVERFLOW); }
+   capacity = (data->capacity ? 2*data->capacity : NFA_BUILDER_MAX_STACK);
+   stack = (struct NfaiFragment**)nfai_alloc(&builder->alloc, capacity*sizeof(struct NfaiFragment*));
+   frag_size = (int*)nfai_alloc(&builder->alloc, capacity*sizeof(int));
+   if (!stack || !frag_size) { return (builder->error = NFA_ERROR_OUT_OF_MEMORY); }
+   if (data->nstack) {
+      memcpy(stack, data->stack, data->nstack*sizeof(struct NfaiFragment*));
+      memcpy(frag_size, data->frag_size, data->nstack*sizeof(int));
+   }
+   data->stack = stack;
+   data->frag_size = frag_size;
+   data->capacity = capacity;
+   return 0;
+}
+
 NFAI_INTERNAL struct NfaiFragment *nfai_push_new_fragment(NfaBuilder *builder, int nops) {
    struct NfaiFragment *frag;
    struct NfaiBuilderData *data;
@@ -275,10 +590,7 @@ NFAI_INTERNAL struct NfaiFragment *nfai_push_new_fragment(NfaBuilder *builder, i
    NFAI_ASSERT(builder->data);
    data = (struct NfaiBuilderData*)builder->data;
 
-   if (data->nstack >= NFA_BUILDER_MAX_STACK) {
-      builder->error = NFA_ERROR_STACK_OVERFLOW;
-      return NULL;
-   }
+   if (data->nstack >= data->capacity && nfai_grow_stack(builder, data)) { return NULL; }
 
    frag = nfai_new_fragment(builder, nops);
    if (!frag) { return NULL; }
@@ -289,7 +601,7 @@ NFAI_INTERNAL struct NfaiFragment *nfai_push_new_fragment(NfaBuilder *builder, i
    return frag;
 }
 
-NFAI_INTERNAL int nfai_push_single_op(NfaBuilder *builder, uint16_t op) {
+NFAI_INTERNAL int nfai_push_single_op(NfaBuilder *builder, NfaOpcode op) {
    struct NfaiFragment *frag = nfai_push_new_fragment(builder, 1);
    if (frag) { frag->ops[0] = op; }
    return builder->error;
@@ -308,6 +620,44 @@ NFAI_INTERNAL struct NfaiFragment *nfai_link_fragments(struct NfaiFragment *a, s
    return a;
 }
 
+/* push a copy of an expression (the copy is a single fragment) */
+NFAI_INTERNAL int nfai_push_copy(NfaBuilder *builder, struct NfaiFragment *frag, int frag_size) {
+   struct NfaiFragment *copy, *at;
+   int to = 0;
+   copy = nfai_push_new_fragment(builder, frag_size);
+   if (!copy || frag_size == 0) { return builder->error; }
+   at = frag;
+   do {
+      memcpy(copy->ops + to, at->ops, at->nops * sizeof(NfaOpcode));
+      to += at->nops;
+      at = at->next;
+   } while (at != frag);
+   NFAI_ASSERT(to == frag_size);
+   return 0;
+}
+
+/* copy the ops of an expression into a single array */
+NFAI_INTERNAL void nfai_flatten_fragments(const struct NfaiFragment *first, NfaOpcode *to) {
+   const struct NfaiFragment *frag = first;
+   do {
+      memcpy(to, frag->ops, frag->nops * sizeof(NfaOpcode));
+      to += frag->nops;
+      frag = frag->next;
+   } while (frag != first);
+}
+
+/* the format for the output NFA: narrow, unless the expression doesn't fit */
+NFAI_INTERNAL int nfai_builder_format(const struct NfaiBuilderData *data) {
+   const struct NfaiFragment *frag = data->stack[0];
+   NFAI_ASSERT(data->nstack == 1);
+   if (data->frag_size[0] + 1 > NFAI_NARROW_MAX_OPS) { return NFAI_FORMAT_WIDE; }
+   do {
+      if (!nfai_ops_fit_narrow(frag->ops, frag->nops)) { return NFAI_FORMAT_WIDE; }
+      frag = frag->next;
+   } while (frag != data->stack[0]);
+   return NFAI_FORMAT_NARROW;
+}
+
 /* ASCII 'A' = 65; ASCII 'Z' = 90; ASCII 'a' = 97; ASCII 'z' = 122 */
 NFAI_INTERNAL int nfai_is_ascii_alpha_upper(int x) { NFAI_ASSERT(x >= 0 && x <= 255); return (x >= 65 && x <= 90); }
 NFAI_INTERNAL int nfai_is_ascii_alpha_lower(int x) { NFAI_ASSERT(x >= 0 && x <= 255); return (x >= 97 && x <= 122); }
@@ -321,16 +671,55 @@ NFAI_INTERNAL int nfai_ascii_tolower(int x) {
    return (nfai_is_ascii_alpha_upper(x) ? (x += (97 - 65)) : x);
 }
 
-NFAI_INTERNAL NfaOpcode nfai_byte_match_op(char c, int flags) {
-   uint16_t op = NFAI_OP_MATCH_BYTE;
-   uint8_t arg = c;
-   /* only alpha characters can be matched case-insensitively */
-   if ((flags & NFA_MATCH_CASE_INSENSITIVE) && nfai_is_ascii_alpha(arg)) {
-      op = NFAI_OP_MATCH_BYTE_CI;
-      /* always store the lowercase version */
-      arg = nfai_ascii_tolower(arg);
+/* word bytes are ASCII letters, digits and underscore */
+NFAI_INTERNAL int nfai_is_word_byte(int x) {
+   return (nfai_is_ascii_alpha(x) || (x >= 48 && x <= 57) || x == 95);
+}
+
+/* look bits for the position after byte c (c < 0 for the start of the input) */
+NFAI_INTERNAL int nfai_look_behind(int c) {
+   if (c < 0 || c == 10) { return NFAI_LOOK_BEHIND_LINE; }
+   return (nfai_is_word_byte(c) ? NFAI_LOOK_BEHIND_WORD : 0);
+}
+
+/* look bits for the position before byte c (c < 0 for the end of the input) */
+NFAI_INTERNAL int nfai_look_ahead(int c) {
+   if (c < 0 || c == 10) { return NFAI_LOOK_AHEAD_KNOWN | NFAI_LOOK_AHEAD_LINE; }
+   return NFAI_LOOK_AHEAD_KNOWN | (nfai_is_word_byte(c) ? NFAI_LOOK_AHEAD_WORD : 0);
+}
+
+/* whether a look assertion passes: 1 or 0, or -1 if that depends on the byte after the
+ * position and it isn't known yet */
+NFAI_INTERNAL int nfai_look_passes(int kind, int look) {
+   if (look == NFAI_LOOK_ANY) { return 1; }
+   if (kind == NFAI_LOOK_LINE_START) { return ((look & NFAI_LOOK_BEHIND_LINE) != 0); }
+   if (!(look & NFAI_LOOK_AHEAD_KNOWN)) { return -1; }
+   switch (kind) {
+      case NFAI_LOOK_LINE_END:
+         return ((look & NFAI_LOOK_AHEAD_LINE) != 0);
+      case NFAI_LOOK_WORD_BOUNDARY:
+         return (!(look & NFAI_LOOK_BEHIND_WORD) != !(look & NFAI_LOOK_AHEAD_WORD));
+      default:
+         NFAI_ASSERT(kind == NFAI_LOOK_NOT_WORD_BOUNDARY);
+         return (!(look & NFAI_LOOK_BEHIND_WORD) == !(look & NFAI_LOOK_AHEAD_WORD));
+   }
+}
+
+/* write the code to match the byte c into ops (if it isn't NULL); returns its length.
+ * Case is folded here, so the machine never has to: with NFA_MATCH_CASE_INSENSITIVE,
+ * an ASCII letter is matched by a class of its upper- and lower-case forms */
+NFAI_INTERNAL int nfai_emit_byte_match(NfaOpcode *ops, uint8_t c, int flags) {
+   if ((flags & NFA_MATCH_CASE_INSENSITIVE) && nfai_is_ascii_alpha(c)) {
+      const uint8_t lower = (uint8_t)nfai_ascii_tolower(c), upper = lower - (97 - 65);
+      if (ops) {
+         ops[0] = NFAI_OP_MATCH_CLASS | 2u;
+         ops[1] = (upper << 8) | upper;
+         ops[2] = (lower << 8) | lower;
+      }
+      return 3;
    }
-   return op | arg;
+   if (ops) { ops[0] = NFAI_OP_MATCH_BYTE | c; }
+   return 1;
 }
 
 /* a character-class fragment is one which consists of a single action
@@ -343,7 +732,6 @@ NFAI_INTERNAL int nfai_is_frag_charclass(struct NfaiFragment *frag) {
    switch (frag->ops[0] & NFAI_OPCODE_MASK) {
       case NFAI_OP_MATCH_ANY:
       case NFAI_OP_MATCH_BYTE:
-      case NFAI_OP_MATCH_BYTE_CI:
          return (frag->nops == 1);
       case NFAI_OP_MATCH_CLASS:
          return (frag->nops == 1 + (int)NFAI_LO_BYTE(frag->ops[0]));
@@ -370,13 +758,6 @@ NFAI_INTERNAL int nfai_char_class_to_ranges(struct NfaiFragment *frag, NfaOpcode
          buf[0] = (arg << 8) | arg;
          *ranges = buf;
          return 1;
-      case NFAI_OP_MATCH_BYTE_CI:
-         NFAI_ASSERT(nfai_is_ascii_alpha_lower(arg));
-         buf[1] = (arg << 8) | arg;
-         arg -= (97 - 65); /* convert to upper case */
-         buf[0] = (arg << 8) | arg;
-         *ranges = buf;
-         return 2;
       case NFAI_OP_MATCH_CLASS:
          *ranges = frag->ops + 1;
          return arg;
@@ -427,7 +808,7 @@ NFAI_INTERNAL int nfai_merge_char_classes(NfaBuilder *builder,
       struct NfaiFragment *a, struct NfaiFragment *b,
       struct NfaiFragment **out_frag, int *out_size) {
    struct NfaiFragment *frag;
-   NfaOpcode buf1[2], buf2[2]; /* need max. 2 ranges for an NFAI_OP_MATCH_BYTE_CI op */
+   NfaOpcode buf1[1], buf2[1];
    int an, bn, nranges;
    NfaOpcode *aranges, *branges;
 
@@ -520,113 +901,1550 @@ NFAI_INTERNAL int nfai_make_alt(
    return 0;
 }
 
-NFAI_INTERNAL int nfai_builder_init_internal(NfaBuilder *builder) {
+/* alternation of n expressions (in priority order) with a single fork, or a balanced tree
+ * of forks if there are more than 255; the frags and sizes arrays are overwritten */
+NFAI_INTERNAL int nfai_make_alt_n(NfaBuilder *builder, struct NfaiFragment **frags, int *sizes, int n,
+      struct NfaiFragment **out_frag, int *out_size) {
+   struct NfaiFragment *fork, *jump, *frag;
+   int i, j, m, at, last, total;
+
    NFAI_ASSERT(builder);
-   if (builder->error) { return builder->error; }
-   builder->data = nfai_alloc(&builder->alloc, sizeof(struct NfaiBuilderData));
-   if (!builder->data) { return (builder->error = NFA_ERROR_OUT_OF_MEMORY); }
-   memset(builder->data, 0, sizeof(struct NfaiBuilderData));
+   NFAI_ASSERT(frags);
+   NFAI_ASSERT(sizes);
+   NFAI_ASSERT(n >= 1);
+   NFAI_ASSERT(out_frag);
+   NFAI_ASSERT(out_size);
+
+   /* adjacent character matches are merged into a single class */
+   for (i = m = 0; i < n; ++i) {
+      if (m > 0 && nfai_is_frag_charclass(frags[m - 1]) && nfai_is_frag_charclass(frags[i])) {
+         if (nfai_merge_char_classes(builder, frags[m - 1], frags[i], &frags[m - 1], &sizes[m - 1])) {
+            return builder->error;
+         }
+      } else {
+         frags[m] = frags[i];
+         sizes[m] = sizes[i];
+         ++m;
+      }
+   }
+   n = m;
+
+   if (n == 1) {
+      *out_frag = frags[0];
+      *out_size = sizes[0];
+      return 0;
+   }
+
+   if (n > UINT8_MAX) {
+      /* alternate between (at most 255) groups of alternatives */
+      const int group = (n + UINT8_MAX - 1) / UINT8_MAX;
+      for (i = j = 0; i < n; i += group, ++j) {
+         m = (n - i < group ? n - i : group);
+         if (nfai_make_alt_n(builder, frags + i, sizes + i, m, &frag, &at)) { return builder->error; }
+         frags[j] = frag;
+         sizes[j] = at;
+      }
+      return nfai_make_alt_n(builder, frags, sizes, j, out_frag, out_size);
+   }
+
+   /* each expression except the last jumps to the end; empty expressions are skipped
+    * (the fork goes straight to the end instead) */
+   last = -1;
+   total = 0;
+   for (i = 0; i < n; ++i) {
+      if (sizes[i]) {
+         if (last >= 0) { total += 2; }
+         if (total + sizes[i] > NFAI_MAX_JUMP) { return (builder->error = NFA_ERROR_NFA_TOO_LARGE); }
+         total += sizes[i];
+         last = i;
+      }
+   }
+   if (last < 0) {
+      *out_frag = (struct NfaiFragment*)&NFAI_EMPTY_FRAGMENT;
+      *out_size = 0;
+      return 0;
+   }
+
+   fork = nfai_new_fragment(builder, 1 + n);
+   if (!fork) { return builder->error; }
+   fork->ops[0] = NFAI_OP_JUMP | (uint8_t)n;
+   frag = fork;
+   at = 0;
+   for (i = 0; i < n; ++i) {
+      if (!sizes[i]) {
+         fork->ops[1 + i] = total;
+         continue;
+      }
+      fork->ops[1 + i] = at;
+      frag = nfai_link_fragments(frag, frags[i]);
+      at += sizes[i];
+      if (i != last) {
+         jump = nfai_new_fragment(builder, 2);
+         if (!jump) { return builder->error; }
+         jump->ops[0] = NFAI_OP_JUMP | (uint8_t)1;
+         jump->ops[1] = total - (at + 2);
+         frag = nfai_link_fragments(frag, jump);
+         at += jump->nops;
+      }
+   }
+   NFAI_ASSERT(at == total);
+
+   *out_frag = frag;
+   *out_size = fork->nops + total;
    return 0;
 }
 
-NFAI_INTERNAL const char * const NFAI_ERROR_DESC[] = {
-   /* NFA_NO_ERROR                      */ "no error",
+/* A literal set is compiled from a trie. Each node's code is a fork over its children (in
+ * byte order) followed by a jump to the end of the set if a string ends at the node, so
+ * the number of threads after each byte is bounded by the fan-out, not the number of
+ * strings. Runs of nodes with a single child are matched with a single string op. */
+struct NfaiTrieNode {
+   struct NfaiTrieNode *child;   /* first child (children are kept in byte order) */
+   struct NfaiTrieNode *sibling; /* next child of the same parent */
+   struct NfaiTrieNode *prev;    /* node created before this one (children are created after their parents) */
+   struct NfaiTrieNode *end;     /* last node of the single-child run that starts at this node */
+   int nchildren;
+   int run;      /* number of bytes matched on the way from the parent to 'end' */
+   int nletters; /* number of those bytes which are ASCII letters */
+   int size;     /* size of the code for this node */
+   uint8_t byte; /* byte on the edge from the parent */
+   uint8_t terminal; /* (bool) a string ends at this node */
+};
 
-   /* NFA_ERROR_OUT_OF_MEMORY           */ "out of memory",
-   /* NFA_ERROR_NFA_TOO_LARGE           */ "NFA too large",
-   /* NFA_ERROR_STACK_OVERFLOW          */ "stack overflow",
-   /* NFA_ERROR_STACK_UNDERFLOW         */ "stack underflow",
-   /* NFA_ERROR_COMPLEMENT_OF_NON_CHAR  */ "complement of non-character pattern",
-   /* NFA_ERROR_UNCLOSED                */ "finish running when the stack contains multiple items",
-   /* NFA_ERROR_BUFFER_TOO_SMALL        */ "output buffer is too small",
+/* a node in the middle of a run has exactly one child and no string ends there */
+NFAI_INTERNAL int nfai_trie_is_run(const struct NfaiTrieNode *node) {
+   return (node->nchildren == 1 && !node->terminal);
+}
 
-   /* NFA_ERROR_REGEX_UNCLOSED_GROUP    */ "unclosed group",
-   /* NFA_ERROR_REGEX_UNEXPECTED_RPAREN */ "unexpected ')'",
-   /* NFA_ERROR_REGEX_REPEATED_EMPTY    */ "repetition of empty expression",
-   /* NFA_ERROR_REGEX_NESTING_OVERFLOW  */ "groups nested too deep",
-   /* NFA_ERROR_REGEX_EMPTY_CHARCLASS   */ "empty character class",
-   /* NFA_ERROR_REGEX_UNCLOSED_CLASS    */ "unclosed character class",
-   /* NFA_ERROR_REGEX_RANGE_BACKWARDS   */ "character range is backwards (first character must be <= last character)",
-   /* NFA_ERROR_REGEX_TRAILING_SLASH    */ "trailing slash (unfinished escape code)",
-   /* ... anything else ...             */ "unknown error"
-};
+/* number of ops needed to match the run of bytes starting at node (a case-insensitive
+ * letter needs a class of three ops, see nfai_emit_byte_match) */
+NFAI_INTERNAL int nfai_trie_run_size(const struct NfaiTrieNode *node, int flags) {
+   int n = node->run, size = 0;
+   if (flags & NFA_MATCH_CASE_INSENSITIVE) { return n + 2*node->nletters; }
+   for (; n > 0; n -= UINT8_MAX) {
+      size += (n == 1 ? 1 : 1 + ((n < UINT8_MAX ? n : UINT8_MAX) + 1)/2);
+   }
+   return size;
+}
 
-#ifndef NFA_NO_STDIO
-NFAI_INTERNAL const char NFAI_HEX_DIGITS[] = "0123456789ABCDEF";
-NFAI_INTERNAL const char *nfai_quoted_char(int c, char *buf, size_t bufsize) {
-   NFAI_ASSERT(c >= 0 && c <= UINT8_MAX);
-   /* max length is for "'\xFF'", which is 7 bytes (including null terminator)
-    * this is an assert because nfai_quoted_char is internal, ie, if bufsize is < 7
-    * then that's a bug in the code in this file somewhere */
-   NFAI_ASSERT(bufsize >= 7);
-   if (c >= 32 && c < 127) {
-      buf[0] = '\'';
-      buf[1] = (char)c;
-      buf[2] = '\'';
-      buf[3] = '\0';
-   } else {
-      switch (c) {
-         case 0x00: return "'\\0'";
-         case 0x07: return "'\\a'";
-         case 0x08: return "'\\b'";
-         case 0x09: return "'\\t'";
-         case 0x0A: return "'\\n'";
-         case 0x0B: return "'\\v'";
-         case 0x0C: return "'\\f'";
-         case 0x0D: return "'\\r'";
-         case 0x1B: return "'\\e'";
-         default:
-            buf[0] = '\'';
-            buf[1] = '\\';
-            buf[2] = 'x';
-            buf[3] = NFAI_HEX_DIGITS[((uint8_t)c >> 4) & 15];
-            buf[4] = NFAI_HEX_DIGITS[((uint8_t)c) & 15];
-            buf[5] = '\'';
-            buf[6] = '\0';
-            break;
+/* size of a fork with n targets (more than 255 targets need a fork of two forks) */
+NFAI_INTERNAL int nfai_trie_fork_size(int n) {
+   if (n <= 1) { return 0; }
+   return (n <= UINT8_MAX ? 1 + n : 3 + (1 + n/2) + (1 + (n - n/2)));
+}
+
+NFAI_INTERNAL struct NfaiTrieNode *nfai_trie_new_node(NfaBuilder *builder, struct NfaiTrieNode **last, uint8_t byte) {
+   struct NfaiTrieNode *node = (struct NfaiTrieNode*)nfai_zalloc(&builder->alloc, sizeof(struct NfaiTrieNode));
+   if (!node) {
+      builder->error = NFA_ERROR_OUT_OF_MEMORY;
+      return NULL;
+   }
+   node->byte = byte;
+   node->prev = *last;
+   *last = node;
+   return node;
+}
+
+NFAI_INTERNAL int nfai_trie_insert(NfaBuilder *builder, struct NfaiTrieNode *root, struct NfaiTrieNode **last,
+      const char *bytes, size_t length, int flags) {
+   struct NfaiTrieNode *node = root, **link, *child;
+   size_t i;
+   for (i = 0; i < length; ++i) {
+      uint8_t c = (uint8_t)bytes[i];
+      if (flags & NFA_MATCH_CASE_INSENSITIVE) { c = nfai_ascii_tolower(c); }
+      link = &node->child;
+      while (*link && (*link)->byte < c) { link = &(*link)->sibling; }
+      if (!*link || (*link)->byte != c) {
+         child = nfai_trie_new_node(builder, last, c);
+         if (!child) { return builder->error; }
+         child->sibling = *link;
+         *link = child;
+         ++node->nchildren;
       }
+      node = *link;
    }
-   return buf;
+   node->terminal = 1;
+   return 0;
 }
 
-NFAI_INTERNAL int nfai_print_opcode(const Nfa *nfa, int state, FILE *to) {
-   char buf1[8], buf2[8];
-   NfaOpcode op;
-   int i;
+/* work out the runs and code sizes, children first; returns the number of nodes */
+NFAI_INTERNAL int nfai_trie_layout(struct NfaiTrieNode *last, int flags) {
+   int nnodes = 0;
+   struct NfaiTrieNode *node, *child;
+   for (node = last; node; node = node->prev) {
+      if (nfai_trie_is_run(node)) {
+         node->run = 1 + node->child->run;
+         node->nletters = nfai_is_ascii_alpha(node->byte) + node->child->nletters;
+         node->end = node->child->end;
+         node->size = nfai_trie_run_size(node->child, flags) + node->child->end->size;
+      } else {
+         node->run = 1;
+         node->nletters = nfai_is_ascii_alpha(node->byte);
+         node->end = node;
+         node->size = nfai_trie_fork_size(node->nchildren + node->terminal) + (node->terminal ? 2 : 0);
+         for (child = node->child; child; child = child->sibling) {
+            node->size += nfai_trie_run_size(child, flags) + child->end->size;
+         }
+      }
+      /* (sizes are clamped, so they can't overflow) */
+      if (node->size > NFAI_MAX_OPS) { node->size = NFAI_MAX_OPS + 1; }
+      ++nnodes;
+   }
+   return nnodes;
+}
 
-   NFAI_ASSERT(nfa);
-   NFAI_ASSERT(to);
-   NFAI_ASSERT(state >= 0 && state < nfa->nops);
+/* emit the bytes of the run starting at 'node' (ending at node->end); returns the new position */
+NFAI_INTERNAL int nfai_trie_emit_run(NfaOpcode *ops, int at, const struct NfaiTrieNode *node, int flags) {
+   int n = 0;
+   for (;;) {
+      if (flags & NFA_MATCH_CASE_INSENSITIVE) {
+         at += nfai_emit_byte_match(ops + at, node->byte, flags);
+      } else if (n == 0 && node->run == 1) {
+         /* (node->run counts the bytes left in the run, including this one) */
+         at += nfai_emit_byte_match(ops + at, node->byte, 0);
+      } else {
+         if (n == 0) { ops[at] = NFAI_OP_MATCH_STRING | (uint8_t)(node->run < UINT8_MAX ? node->run : UINT8_MAX); }
+         nfai_set_string_byte(ops + at, n, node->byte);
+         if (++n == (int)NFAI_LO_BYTE(ops[at])) {
+            at += nfai_op_length(ops + at);
+            n = 0;
+         }
+      }
+      if (node == node->end) { break; }
+      node = node->child;
+   }
+   NFAI_ASSERT(n == 0);
+   return at;
+}
 
-   i = state;
-   op = nfa->ops[i];
-   fprintf(to, "  %4d: ", i);
-   switch (op & NFAI_OPCODE_MASK) {
+/* emit the code for the trie, using an explicit stack of (node, position) pairs */
+NFAI_INTERNAL int nfai_trie_emit(NfaBuilder *builder, struct NfaiTrieNode *root, int nnodes, NfaOpcode *ops, int flags) {
+   struct NfaiTrieNode **stack_node, *node, *child;
+   int *stack_at, nstack = 0, at, i, n, fork, targets[UINT8_MAX + 2];
+   const int end = root->size;
+
+   stack_node = (struct NfaiTrieNode**)nfai_alloc(&builder->alloc, nnodes*sizeof(struct NfaiTrieNode*));
+   stack_at = (int*)nfai_alloc(&builder->alloc, nnodes*sizeof(int));
+   if (!stack_node || !stack_at) { return (builder->error = NFA_ERROR_OUT_OF_MEMORY); }
+
+   stack_node[nstack] = root;
+   stack_at[nstack++] = 0;
+   while (nstack) {
+      node = stack_node[--nstack];
+      at = stack_at[nstack];
+      if (nfai_trie_is_run(node)) {
+         /* only the root gets here: other runs are emitted as part of their parent's branch */
+         at = nfai_trie_emit_run(ops, at, node->child, flags);
+         NFAI_ASSERT(nstack < nnodes);
+         stack_node[nstack] = node->child->end;
+         stack_at[nstack++] = at;
+         continue;
+      }
+
+      /* find the start of each branch */
+      n = node->nchildren + node->terminal;
+      fork = at;
+      at += nfai_trie_fork_size(n);
+      i = 0;
+      for (child = node->child; child; child = child->sibling) {
+         targets[i++] = at;
+         at += nfai_trie_run_size(child, flags) + child->end->size;
+      }
+      if (node->terminal) { targets[i++] = at; }
+      NFAI_ASSERT(i == n);
+
+      /* emit the fork */
+      if (n > UINT8_MAX) {
+         const int n0 = n/2;
+         ops[fork] = NFAI_OP_JUMP | 2u;
+         ops[fork + 1] = 0;
+         ops[fork + 2] = 1 + n0;
+         ops[fork + 3] = NFAI_OP_JUMP | (uint8_t)n0;
+         for (i = 0; i < n0; ++i) { ops[fork + 4 + i] = (NfaOpcode)(targets[i] - (fork + 4 + n0)); }
+         fork += 4 + n0;
+         ops[fork] = NFAI_OP_JUMP | (uint8_t)(n - n0);
+         for (i = n0; i < n; ++i) { ops[fork + 1 + (i - n0)] = (NfaOpcode)(targets[i] - (fork + 1 + (n - n0))); }
+      } else if (n > 1) {
+         ops[fork] = NFAI_OP_JUMP | (uint8_t)n;
+         for (i = 0; i < n; ++i) { ops[fork + 1 + i] = (NfaOpcode)(targets[i] - (fork + 1 + n)); }
+      }
+
+      /* emit each branch's run and queue the node it leads to */
+      i = 0;
+      for (child = node->child; child; child = child->sibling) {
+         NFAI_ASSERT(nstack < nnodes);
+         stack_node[nstack] = child->end;
+         stack_at[nstack++] = nfai_trie_emit_run(ops, targets[i++], child, flags);
+      }
+      if (node->terminal) {
+         ops[targets[i]] = NFAI_OP_JUMP | 1u;
+         ops[targets[i] + 1] = (NfaOpcode)(end - (targets[i] + 2));
+      }
+   }
+   return 0;
+}
+
+/* ----- UNICODE ----- */
+
+/* Code point classes (see nfa_build_match_codepoints, and NFA_REGEX_UTF8) are sets of code
+ * point ranges. They are compiled into an automaton over the bytes of their UTF-8 encodings,
+ * so the input never needs to be decoded, and code points which can't be encoded (the
+ * surrogates) are never matched, nor is any invalid UTF-8. */
+
+enum {
+   NFAI_MAX_CODEPOINT = 0x10FFFF,
+   NFAI_FOLD_ALTERNATE = 0x7FFFFFFF
+};
+
+struct NfaiFoldRange {
+   uint32_t first;
+   uint32_t last;
+   int32_t delta;
+};
+
+/* BEGIN GENERATED UNICODE TABLES */
+/* generated by gen_unicode_tables.py from the Unicode Character Database (version 14.0.0) */
+
+enum {
+   NFAI_UNICODE_NCATEGORIES = 30,
+   NFAI_UNICODE_NCATEGORY_RUNS = 3968,
+   NFAI_UNICODE_NFOLDS = 366
+};
+
+/* two-letter general category names, in the order of their indexes */
+NFAI_INTERNAL const char NFAI_UNICODE_CATEGORY_NAMES[] =
+   "CnLuLlLtLmLoMnMcMeNdNlNoPcPdPsPePiPfPoSmScSkSoZsZlZpCcCfCsCo";
+
+/* (first code point << 5) | category index; each run lasts until the next one starts */
+NFAI_INTERNAL const uint32_t NFAI_UNICODE_CATEGORY_RUNS[NFAI_UNICODE_NCATEGORY_RUNS] = {
+   0x000001Au, 0x0000417u, 0x0000432u, 0x0000494u, 0x00004B2u, 0x000050Eu, 0x000052Fu, 0x0000552u,
+   0x0000573u, 0x0000592u, 0x00005ADu, 0x00005D2u, 0x0000609u, 0x0000752u, 0x0000793u, 0x00007F2u,
+   0x0000821u, 0x0000B6Eu, 0x0000B92u, 0x0000BAFu, 0x0000BD5u, 0x0000BECu, 0x0000C15u, 0x0000C22u,
+   0x0000F6Eu, 0x0000F93u, 0x0000FAFu, 0x0000FD3u, 0x0000FFAu, 0x0001417u, 0x0001432u, 0x0001454u,
+   0x00014D6u, 0x00014F2u, 0x0001515u, 0x0001536u, 0x0001545u, 0x0001570u, 0x0001593u, 0x00015BBu,
+   0x00015D6u, 0x00015F5u, 0x0001616u, 0x0001633u, 0x000164Bu, 0x0001695u, 0x00016A2u, 0x00016D2u,
+   0x0001715u, 0x000172Bu, 0x0001745u, 0x0001771u, 0x000178Bu, 0x00017F2u, 0x0001801u, 0x0001AF3u,
+   0x0001B01u, 0x0001BE2u, 0x0001EF3u, 0x0001F02u, 0x0002001u, 0x0002022u, 0x0002041u, 0x0002062u,
+   0x0002081u, 0x00020A2u, 0x00020C1u, 0x00020E2u, 0x0002101u, 0x0002122u, 0x0002141u, 0x0002162u,
+   0x0002181u, 0x00021A2u, 0x00021C1u, 0x00021E2u, 0x0002201u, 0x0002222u, 0x0002241u, 0x0002262u,
+   0x0002281u, 0x00022A2u, 0x00022C1u, 0x00022E2u, 0x0002301u, 0x0002322u, 0x0002341u, 0x0002362u,
+   0x0002381u, 0x00023A2u, 0x00023C1u, 0x00023E2u, 0x0002401u, 0x0002422u, 0x0002441u, 0x0002462u,
+   0x0002481u, 0x00024A2u, 0x00024C1u, 0x00024E2u, 0x0002501u, 0x0002522u, 0x0002541u, 0x0002562u,
+   0x0002581u, 0x00025A2u, 0x00025C1u, 0x00025E2u, 0x0002601u, 0x0002622u, 0x0002641u, 0x0002662u,
+   0x0002681u, 0x00026A2u, 0x00026C1u, 0x00026E2u, 0x0002721u, 0x0002742u, 0x0002761u, 0x0002782u,
+   0x00027A1u, 0x00027C2u, 0x00027E1u, 0x0002802u, 0x0002821u, 0x0002842u, 0x0002861u, 0x0002882u,
+   0x00028A1u, 0x00028C2u, 0x00028E1u, 0x0002902u, 0x0002941u, 0x0002962u, 0x0002981u, 0x00029A2u,
+   0x00029C1u, 0x00029E2u, 0x0002A01u, 0x0002A22u, 0x0002A41u, 0x0002A62u, 0x0002A81u, 0x0002AA2u,
+   0x0002AC1u, 0x0002AE2u, 0x0002B01u, 0x0002B22u, 0x0002B41u, 0x0002B62u, 0x0002B81u, 0x0002BA2u,
+   0x0002BC1u, 0x0002BE2u, 0x0002C01u, 0x0002C22u, 0x0002C41u, 0x0002C62u, 0x0002C81u, 0x0002CA2u,
+   0x0002CC1u, 0x0002CE2u, 0x0002D01u, 0x0002D22u, 0x0002D41u, 0x0002D62u, 0x0002D81u, 0x0002DA2u,
+   0x0002DC1u, 0x0002DE2u, 0x0002E01u, 0x0002E22u, 0x0002E41u, 0x0002E62u, 0x0002E81u, 0x0002EA2u,
+   0x0002EC1u, 0x0002EE2u, 0x0002F01u, 0x0002F42u, 0x0002F61u, 0x0002F82u, 0x0002FA1u, 0x0002FC2u,
+   0x0003021u, 0x0003062u, 0x0003081u, 0x00030A2u, 0x00030C1u, 0x0003102u, 0x0003121u, 0x0003182u,
+   0x00031C1u, 0x0003242u, 0x0003261u, 0x00032A2u, 0x00032C1u, 0x0003322u, 0x0003381u, 0x00033C2u,
+   0x00033E1u, 0x0003422u, 0x0003441u, 0x0003462u, 0x0003481u, 0x00034A2u, 0x00034C1u, 0x0003502u,
+   0x0003521u, 0x0003542u, 0x0003581u, 0x00035A2u, 0x00035C1u, 0x0003602u, 0x0003621u, 0x0003682u,
+   0x00036A1u, 0x00036C2u, 0x00036E1u, 0x0003722u, 0x0003765u, 0x0003781u, 0x00037A2u, 0x0003805u,
+   0x0003881u, 0x00038A3u, 0x00038C2u, 0x00038E1u, 0x0003903u, 0x0003922u, 0x0003941u, 0x0003963u,
+   0x0003982u, 0x00039A1u, 0x00039C2u, 0x00039E1u, 0x0003A02u, 0x0003A21u, 0x0003A42u, 0x0003A61u,
+   0x0003A82u, 0x0003AA1u, 0x0003AC2u, 0x0003AE1u, 0x0003B02u, 0x0003B21u, 0x0003B42u, 0x0003B61u,
+   0x0003B82u, 0x0003BC1u, 0x0003BE2u, 0x0003C01u, 0x0003C22u, 0x0003C41u, 0x0003C62u, 0x0003C81u,
+   0x0003CA2u, 0x0003CC1u, 0x0003CE2u, 0x0003D01u, 0x0003D22u, 0x0003D41u, 0x0003D62u, 0x0003D81u,
+   0x0003DA2u, 0x0003DC1u, 0x0003DE2u, 0x0003E21u, 0x0003E43u, 0x0003E62u, 0x0003E81u, 0x0003EA2u,
+   0x0003EC1u, 0x0003F22u, 0x0003F41u, 0x0003F62u, 0x0003F81u, 0x0003FA2u, 0x0003FC1u, 0x0003FE2u,
+   0x0004001u, 0x0004022u, 0x0004041u, 0x0004062u, 0x0004081u, 0x00040A2u, 0x00040C1u, 0x00040E2u,
+   0x0004101u, 0x0004122u, 0x0004141u, 0x0004162u, 0x0004181u, 0x00041A2u, 0x00041C1u, 0x00041E2u,
+   0x0004201u, 0x0004222u, 0x0004241u, 0x0004262u, 0x0004281u, 0x00042A2u, 0x00042C1u, 0x00042E2u,
+   0x0004301u, 0x0004322u, 0x0004341u, 0x0004362u, 0x0004381u, 0x00043A2u, 0x00043C1u, 0x00043E2u,
+   0x0004401u, 0x0004422u, 0x0004441u, 0x0004462u, 0x0004481u, 0x00044A2u, 0x00044C1u, 0x00044E2u,
+   0x0004501u, 0x0004522u, 0x0004541u, 0x0004562u, 0x0004581u, 0x00045A2u, 0x00045C1u, 0x00045E2u,
+   0x0004601u, 0x0004622u, 0x0004641u, 0x0004662u, 0x0004741u, 0x0004782u, 0x00047A1u, 0x00047E2u,
+   0x0004821u, 0x0004842u, 0x0004861u, 0x00048E2u, 0x0004901u, 0x0004922u, 0x0004941u, 0x0004962u,
+   0x0004981u, 0x00049A2u, 0x00049C1u, 0x00049E2u, 0x0005285u, 0x00052A2u, 0x0005604u, 0x0005855u,
+   0x00058C4u, 0x0005A55u, 0x0005C04u, 0x0005CB5u, 0x0005D84u, 0x0005DB5u, 0x0005DC4u, 0x0005DF5u,
+   0x0006006u, 0x0006E01u, 0x0006E22u, 0x0006E41u, 0x0006E62u, 0x0006E84u, 0x0006EB5u, 0x0006EC1u,
+   0x0006EE2u, 0x0006F00u, 0x0006F44u, 0x0006F62u, 0x0006FD2u, 0x0006FE1u, 0x0007000u, 0x0007095u,
+   0x00070C1u, 0x00070F2u, 0x0007101u, 0x0007160u, 0x0007181u, 0x00071A0u, 0x00071C1u, 0x0007202u,
+   0x0007221u, 0x0007440u, 0x0007461u, 0x0007582u, 0x00079E1u, 0x0007A02u, 0x0007A41u, 0x0007AA2u,
+   0x0007B01u, 0x0007B22u, 0x0007B41u, 0x0007B62u, 0x0007B81u, 0x0007BA2u, 0x0007BC1u, 0x0007BE2u,
+   0x0007C01u, 0x0007C22u, 0x0007C41u, 0x0007C62u, 0x0007C81u, 0x0007CA2u, 0x0007CC1u, 0x0007CE2u,
+   0x0007D01u, 0x0007D22u, 0x0007D41u, 0x0007D62u, 0x0007D81u, 0x0007DA2u, 0x0007DC1u, 0x0007DE2u,
+   0x0007E81u, 0x0007EA2u, 0x0007ED3u, 0x0007EE1u, 0x0007F02u, 0x0007F21u, 0x0007F62u, 0x0007FA1u,
+   0x0008602u, 0x0008C01u, 0x0008C22u, 0x0008C41u, 0x0008C62u, 0x0008C81u, 0x0008CA2u, 0x0008CC1u,
+   0x0008CE2u, 0x0008D01u, 0x0008D22u, 0x0008D41u, 0x0008D62u, 0x0008D81u, 0x0008DA2u, 0x0008DC1u,
+   0x0008DE2u, 0x0008E01u, 0x0008E22u, 0x0008E41u, 0x0008E62u, 0x0008E81u, 0x0008EA2u, 0x0008EC1u,
+   0x0008EE2u, 0x0008F01u, 0x0008F22u, 0x0008F41u, 0x0008F62u, 0x0008F81u, 0x0008FA2u, 0x0008FC1u,
+   0x0008FE2u, 0x0009001u, 0x0009022u, 0x0009056u, 0x0009066u, 0x0009108u, 0x0009141u, 0x0009162u,
+   0x0009181u, 0x00091A2u, 0x00091C1u, 0x00091E2u, 0x0009201u, 0x0009222u, 0x0009241u, 0x0009262u,
+   0x0009281u, 0x00092A2u, 0x00092C1u, 0x00092E2u, 0x0009301u, 0x0009322u, 0x0009341u, 0x0009362u,
+   0x0009381u, 0x00093A2u, 0x00093C1u, 0x00093E2u, 0x0009401u, 0x0009422u, 0x0009441u, 0x0009462u,
+   0x0009481u, 0x00094A2u, 0x00094C1u, 0x00094E2u, 0x0009501u, 0x0009522u, 0x0009541u, 0x0009562u,
+   0x0009581u, 0x00095A2u, 0x00095C1u, 0x00095E2u, 0x0009601u, 0x0009622u, 0x0009641u, 0x0009662u,
+   0x0009681u, 0x00096A2u, 0x00096C1u, 0x00096E2u, 0x0009701u, 0x0009722u, 0x0009741u, 0x0009762u,
+   0x0009781u, 0x00097A2u, 0x00097C1u, 0x00097E2u, 0x0009801u, 0x0009842u, 0x0009861u, 0x0009882u,
+   0x00098A1u, 0x00098C2u, 0x00098E1u, 0x0009902u, 0x0009921u, 0x0009942u, 0x0009961u, 0x0009982u,
+   0x00099A1u, 0x00099C2u, 0x0009A01u, 0x0009A22u, 0x0009A41u, 0x0009A62u, 0x0009A81u, 0x0009AA2u,
+   0x0009AC1u, 0x0009AE2u, 0x0009B01u, 0x0009B22u, 0x0009B41u, 0x0009B62u, 0x0009B81u, 0x0009BA2u,
+   0x0009BC1u, 0x0009BE2u, 0x0009C01u, 0x0009C22u, 0x0009C41u, 0x0009C62u, 0x0009C81u, 0x0009CA2u,
+   0x0009CC1u, 0x0009CE2u, 0x0009D01u, 0x0009D22u, 0x0009D41u, 0x0009D62u, 0x0009D81u, 0x0009DA2u,
+   0x0009DC1u, 0x0009DE2u, 0x0009E01u, 0x0009E22u, 0x0009E41u, 0x0009E62u, 0x0009E81u, 0x0009EA2u,
+   0x0009EC1u, 0x0009EE2u, 0x0009F01u, 0x0009F22u, 0x0009F41u, 0x0009F62u, 0x0009F81u, 0x0009FA2u,
+   0x0009FC1u, 0x0009FE2u, 0x000A001u, 0x000A022u, 0x000A041u, 0x000A062u, 0x000A081u, 0x000A0A2u,
+   0x000A0C1u, 0x000A0E2u, 0x000A101u, 0x000A122u, 0x000A141u, 0x000A162u, 0x000A181u, 0x000A1A2u,
+   0x000A1C1u, 0x000A1E2u, 0x000A201u, 0x000A222u, 0x000A241u, 0x000A262u, 0x000A281u, 0x000A2A2u,
+   0x000A2C1u, 0x000A2E2u, 0x000A301u, 0x000A322u, 0x000A341u, 0x000A362u, 0x000A381u, 0x000A3A2u,
+   0x000A3C1u, 0x000A3E2u, 0x000A401u, 0x000A422u, 0x000A441u, 0x000A462u, 0x000A481u, 0x000A4A2u,
+   0x000A4C1u, 0x000A4E2u, 0x000A501u, 0x000A522u, 0x000A541u, 0x000A562u, 0x000A581u, 0x000A5A2u,
+   0x000A5C1u, 0x000A5E2u, 0x000A600u, 0x000A621u, 0x000AAE0u, 0x000AB24u, 0x000AB52u, 0x000AC02u,
+   0x000B132u, 0x000B14Du, 0x000B160u, 0x000B1B6u, 0x000B1F4u, 0x000B200u, 0x000B226u, 0x000B7CDu,
+   0x000B7E6u, 0x000B812u, 0x000B826u, 0x000B872u, 0x000B886u, 0x000B8D2u, 0x000B8E6u, 0x000B900u,
+   0x000BA05u, 0x000BD60u, 0x000BDE5u, 0x000BE72u, 0x000BEA0u, 0x000C01Bu, 0x000C0D3u, 0x000C132u,
+   0x000C174u, 0x000C192u, 0x000C1D6u, 0x000C206u, 0x000C372u, 0x000C39Bu, 0x000C3B2u, 0x000C405u,
+   0x000C804u, 0x000C825u, 0x000C966u, 0x000CC09u, 0x000CD52u, 0x000CDC5u, 0x000CE06u, 0x000CE25u,
+   0x000DA92u, 0x000DAA5u, 0x000DAC6u, 0x000DBBBu, 0x000DBD6u, 0x000DBE6u, 0x000DCA4u, 0x000DCE6u,
+   0x000DD36u, 0x000DD46u, 0x000DDC5u, 0x000DE09u, 0x000DF45u, 0x000DFB6u, 0x000DFE5u, 0x000E012u,
+   0x000E1C0u, 0x000E1FBu, 0x000E205u, 0x000E226u, 0x000E245u, 0x000E606u, 0x000E960u, 0x000E9A5u,
+   0x000F4C6u, 0x000F625u, 0x000F640u, 0x000F809u, 0x000F945u, 0x000FD66u, 0x000FE84u, 0x000FED6u,
+   0x000FEF2u, 0x000FF44u, 0x000FF60u, 0x000FFA6u, 0x000FFD4u, 0x0010005u, 0x00102C6u, 0x0010344u,
+   0x0010366u, 0x0010484u, 0x00104A6u, 0x0010504u, 0x0010526u, 0x00105C0u, 0x0010612u, 0x00107E0u,
+   0x0010805u, 0x0010B26u, 0x0010B80u, 0x0010BD2u, 0x0010BE0u, 0x0010C05u, 0x0010D60u, 0x0010E05u,
+   0x0011115u, 0x0011125u, 0x00111E0u, 0x001121Bu, 0x0011240u, 0x0011306u, 0x0011405u, 0x0011924u,
+   0x0011946u, 0x0011C5Bu, 0x0011C66u, 0x0012067u, 0x0012085u, 0x0012746u, 0x0012767u, 0x0012786u,
+   0x00127A5u, 0x00127C7u, 0x0012826u, 0x0012927u, 0x00129A6u, 0x00129C7u, 0x0012A05u, 0x0012A26u,
+   0x0012B05u, 0x0012C46u, 0x0012C92u, 0x0012CC9u, 0x0012E12u, 0x0012E24u, 0x0012E45u, 0x0013026u,
+   0x0013047u, 0x0013080u, 0x00130A5u, 0x00131A0u, 0x00131E5u, 0x0013220u, 0x0013265u, 0x0013520u,
+   0x0013545u, 0x0013620u, 0x0013645u, 0x0013660u, 0x00136C5u, 0x0013740u, 0x0013786u, 0x00137A5u,
+   0x00137C7u, 0x0013826u, 0x00138A0u, 0x00138E7u, 0x0013920u, 0x0013967u, 0x00139A6u, 0x00139C5u,
+   0x00139E0u, 0x0013AE7u, 0x0013B00u, 0x0013B85u, 0x0013BC0u, 0x0013BE5u, 0x0013C46u, 0x0013C80u,
+   0x0013CC9u, 0x0013E05u, 0x0013E54u, 0x0013E8Bu, 0x0013F56u, 0x0013F74u, 0x0013F85u, 0x0013FB2u,
+   0x0013FC6u, 0x0013FE0u, 0x0014026u, 0x0014067u, 0x0014080u, 0x00140A5u, 0x0014160u, 0x00141E5u,
+   0x0014220u, 0x0014265u, 0x0014520u, 0x0014545u, 0x0014620u, 0x0014645u, 0x0014680u, 0x00146A5u,
+   0x00146E0u, 0x0014705u, 0x0014740u, 0x0014786u, 0x00147A0u, 0x00147C7u, 0x0014826u, 0x0014860u,
+   0x00148E6u, 0x0014920u, 0x0014966u, 0x00149C0u, 0x0014A26u, 0x0014A40u, 0x0014B25u, 0x0014BA0u,
+   0x0014BC5u, 0x0014BE0u, 0x0014CC9u, 0x0014E06u, 0x0014E45u, 0x0014EA6u, 0x0014ED2u, 0x0014EE0u,
+   0x0015026u, 0x0015067u, 0x0015080u, 0x00150A5u, 0x00151C0u, 0x00151E5u, 0x0015240u, 0x0015265u,
+   0x0015520u, 0x0015545u, 0x0015620u, 0x0015645u, 0x0015680u, 0x00156A5u, 0x0015740u, 0x0015786u,
+   0x00157A5u, 0x00157C7u, 0x0015826u, 0x00158C0u, 0x00158E6u, 0x0015927u, 0x0015940u, 0x0015967u,
+   0x00159A6u, 0x00159C0u, 0x0015A05u, 0x0015A20u, 0x0015C05u, 0x0015C46u, 0x0015C80u, 0x0015CC9u,
+   0x0015E12u, 0x0015E34u, 0x0015E40u, 0x0015F25u, 0x0015F46u, 0x0016000u, 0x0016026u, 0x0016047u,
+   0x0016080u, 0x00160A5u, 0x00161A0u, 0x00161E5u, 0x0016220u, 0x0016265u, 0x0016520u, 0x0016545u,
+   0x0016620u, 0x0016645u, 0x0016680u, 0x00166A5u, 0x0016740u, 0x0016786u, 0x00167A5u, 0x00167C7u,
+   0x00167E6u, 0x0016807u, 0x0016826u, 0x00168A0u, 0x00168E7u, 0x0016920u, 0x0016967u, 0x00169A6u,
+   0x00169C0u, 0x0016AA6u, 0x0016AE7u, 0x0016B00u, 0x0016B85u, 0x0016BC0u, 0x0016BE5u, 0x0016C46u,
+   0x0016C80u, 0x0016CC9u, 0x0016E16u, 0x0016E25u, 0x0016E4Bu, 0x0016F00u, 0x0017046u, 0x0017065u,
+   0x0017080u, 0x00170A5u, 0x0017160u, 0x00171C5u, 0x0017220u, 0x0017245u, 0x00172C0u, 0x0017325u,
+   0x0017360u, 0x0017385u, 0x00173A0u, 0x00173C5u, 0x0017400u, 0x0017465u, 0x00174A0u, 0x0017505u,
+   0x0017560u, 0x00175C5u, 0x0017740u, 0x00177C7u, 0x0017806u, 0x0017827u, 0x0017860u, 0x00178C7u,
+   0x0017920u, 0x0017947u, 0x00179A6u, 0x00179C0u, 0x0017A05u, 0x0017A20u, 0x0017AE7u, 0x0017B00u,
+   0x0017CC9u, 0x0017E0Bu, 0x0017E76u, 0x0017F34u, 0x0017F56u, 0x0017F60u, 0x0018006u, 0x0018027u,
+   0x0018086u, 0x00180A5u, 0x00181A0u, 0x00181C5u, 0x0018220u, 0x0018245u, 0x0018520u, 0x0018545u,
+   0x0018740u, 0x0018786u, 0x00187A5u, 0x00187C6u, 0x0018827u, 0x00188A0u, 0x00188C6u, 0x0018920u,
+   0x0018946u, 0x00189C0u, 0x0018AA6u, 0x0018AE0u, 0x0018B05u, 0x0018B60u, 0x0018BA5u, 0x0018BC0u,
+   0x0018C05u, 0x0018C46u, 0x0018C80u, 0x0018CC9u, 0x0018E00u, 0x0018EF2u, 0x0018F0Bu, 0x0018FF6u,
+   0x0019005u, 0x0019026u, 0x0019047u, 0x0019092u, 0x00190A5u, 0x00191A0u, 0x00191C5u, 0x0019220u,
+   0x0019245u, 0x0019520u, 0x0019545u, 0x0019680u, 0x00196A5u, 0x0019740u, 0x0019786u, 0x00197A5u,
+   0x00197C7u, 0x00197E6u, 0x0019807u, 0x00198A0u, 0x00198C6u, 0x00198E7u, 0x0019920u, 0x0019947u,
+   0x0019986u, 0x00199C0u, 0x0019AA7u, 0x0019AE0u, 0x0019BA5u, 0x0019BE0u, 0x0019C05u, 0x0019C46u,
+   0x0019C80u, 0x0019CC9u, 0x0019E00u, 0x0019E25u, 0x0019E60u, 0x001A006u, 0x001A047u, 0x001A085u,
+   0x001A1A0u, 0x001A1C5u, 0x001A220u, 0x001A245u, 0x001A766u, 0x001A7A5u, 0x001A7C7u, 0x001A826u,
+   0x001A8A0u, 0x001A8C7u, 0x001A920u, 0x001A947u, 0x001A9A6u, 0x001A9C5u, 0x001A9F6u, 0x001AA00u,
+   0x001AA85u, 0x001AAE7u, 0x001AB0Bu, 0x001ABE5u, 0x001AC46u, 0x001AC80u, 0x001ACC9u, 0x001AE0Bu,
+   0x001AF36u, 0x001AF45u, 0x001B000u, 0x001B026u, 0x001B047u, 0x001B080u, 0x001B0A5u, 0x001B2E0u,
+   0x001B345u, 0x001B640u, 0x001B665u, 0x001B780u, 0x001B7A5u, 0x001B7C0u, 0x001B805u, 0x001B8E0u,
+   0x001B946u, 0x001B960u, 0x001B9E7u, 0x001BA46u, 0x001BAA0u, 0x001BAC6u, 0x001BAE0u, 0x001BB07u,
+   0x001BC00u, 0x001BCC9u, 0x001BE00u, 0x001BE47u, 0x001BE92u, 0x001BEA0u, 0x001C025u, 0x001C626u,
+   0x001C645u, 0x001C686u, 0x001C760u, 0x001C7F4u, 0x001C805u, 0x001C8C4u, 0x001C8E6u, 0x001C9F2u,
+   0x001CA09u, 0x001CB52u, 0x001CB80u, 0x001D025u, 0x001D060u, 0x001D085u, 0x001D0A0u, 0x001D0C5u,
+   0x001D160u, 0x001D185u, 0x001D480u, 0x001D4A5u, 0x001D4C0u, 0x001D4E5u, 0x001D626u, 0x001D645u,
+   0x001D686u, 0x001D7A5u, 0x001D7C0u, 0x001D805u, 0x001D8A0u, 0x001D8C4u, 0x001D8E0u, 0x001D906u,
+   0x001D9C0u, 0x001DA09u, 0x001DB40u, 0x001DB85u, 0x001DC00u, 0x001E005u, 0x001E036u, 0x001E092u,
+   0x001E276u, 0x001E292u, 0x001E2B6u, 0x001E306u, 0x001E356u, 0x001E409u, 0x001E54Bu, 0x001E696u,
+   0x001E6A6u, 0x001E6D6u, 0x001E6E6u, 0x001E716u, 0x001E726u, 0x001E74Eu, 0x001E76Fu, 0x001E78Eu,
+   0x001E7AFu, 0x001E7C7u, 0x001E805u, 0x001E900u, 0x001E925u, 0x001EDA0u, 0x001EE26u, 0x001EFE7u,
+   0x001F006u, 0x001F0B2u, 0x001F0C6u, 0x001F105u, 0x001F1A6u, 0x001F300u, 0x001F326u, 0x001F7A0u,
+   0x001F7D6u, 0x001F8C6u, 0x001F8F6u, 0x001F9A0u, 0x001F9D6u, 0x001FA12u, 0x001FAB6u, 0x001FB32u,
+   0x001FB60u, 0x0020005u, 0x0020567u, 0x00205A6u, 0x0020627u, 0x0020646u, 0x0020707u, 0x0020726u,
+   0x0020767u, 0x00207A6u, 0x00207E5u, 0x0020809u, 0x0020952u, 0x0020A05u, 0x0020AC7u, 0x0020B06u,
+   0x0020B45u, 0x0020BC6u, 0x0020C25u, 0x0020C47u, 0x0020CA5u, 0x0020CE7u, 0x0020DC5u, 0x0020E26u,
+   0x0020EA5u, 0x0021046u, 0x0021067u, 0x00210A6u, 0x00210E7u, 0x00211A6u, 0x00211C5u, 0x00211E7u,
+   0x0021209u, 0x0021347u, 0x00213A6u, 0x00213D6u, 0x0021401u, 0x00218C0u, 0x00218E1u, 0x0021900u,
+   0x00219A1u, 0x00219C0u, 0x0021A02u, 0x0021F72u, 0x0021F84u, 0x0021FA2u, 0x0022005u, 0x0024920u,
+   0x0024945u, 0x00249C0u, 0x0024A05u, 0x0024AE0u, 0x0024B05u, 0x0024B20u, 0x0024B45u, 0x0024BC0u,
+   0x0024C05u, 0x0025120u, 0x0025145u, 0x00251C0u, 0x0025205u, 0x0025620u, 0x0025645u, 0x00256C0u,
+   0x0025705u, 0x00257E0u, 0x0025805u, 0x0025820u, 0x0025845u, 0x00258C0u, 0x0025905u, 0x0025AE0u,
+   0x0025B05u, 0x0026220u, 0x0026245u, 0x00262C0u, 0x0026305u, 0x0026B60u, 0x0026BA6u, 0x0026C12u,
+   0x0026D2Bu, 0x0026FA0u, 0x0027005u, 0x0027216u, 0x0027340u, 0x0027401u, 0x0027EC0u, 0x0027F02u,
+   0x0027FC0u, 0x002800Du, 0x0028025u, 0x002CDB6u, 0x002CDD2u, 0x002CDE5u, 0x002D017u, 0x002D025u,
+   0x002D36Eu, 0x002D38Fu, 0x002D3A0u, 0x002D405u, 0x002DD72u, 0x002DDCAu, 0x002DE25u, 0x002DF20u,
+   0x002E005u, 0x002E246u, 0x002E2A7u, 0x002E2C0u, 0x002E3E5u, 0x002E646u, 0x002E687u, 0x002E6B2u,
+   0x002E6E0u, 0x002E805u, 0x002EA46u, 0x002EA80u, 0x002EC05u, 0x002EDA0u, 0x002EDC5u, 0x002EE20u,
+   0x002EE46u, 0x002EE80u, 0x002F005u, 0x002F686u, 0x002F6C7u, 0x002F6E6u, 0x002F7C7u, 0x002F8C6u,
+   0x002F8E7u, 0x002F926u, 0x002FA92u, 0x002FAE4u, 0x002FB12u, 0x002FB74u, 0x002FB85u, 0x002FBA6u,
+   0x002FBC0u, 0x002FC09u, 0x002FD40u, 0x002FE0Bu, 0x002FF40u, 0x0030012u, 0x00300CDu, 0x00300F2u,
+   0x0030166u, 0x00301DBu, 0x00301E6u, 0x0030209u, 0x0030340u, 0x0030405u, 0x0030864u, 0x0030885u,
+   0x0030F20u, 0x0031005u, 0x00310A6u, 0x00310E5u, 0x0031526u, 0x0031545u, 0x0031560u, 0x0031605u,
+   0x0031EC0u, 0x0032005u, 0x00323E0u, 0x0032406u, 0x0032467u, 0x00324E6u, 0x0032527u, 0x0032580u,
+   0x0032607u, 0x0032646u, 0x0032667u, 0x0032726u, 0x0032780u, 0x0032816u, 0x0032820u, 0x0032892u,
+   0x00328C9u, 0x0032A05u, 0x0032DC0u, 0x0032E05u, 0x0032EA0u, 0x0033005u, 0x0033580u, 0x0033605u,
+   0x0033940u, 0x0033A09u, 0x0033B4Bu, 0x0033B60u, 0x0033BD6u, 0x0034005u, 0x00342E6u, 0x0034327u,
+   0x0034366u, 0x0034380u, 0x00343D2u, 0x0034405u, 0x0034AA7u, 0x0034AC6u, 0x0034AE7u, 0x0034B06u,
+   0x0034BE0u, 0x0034C06u, 0x0034C27u, 0x0034C46u, 0x0034C67u, 0x0034CA6u, 0x0034DA7u, 0x0034E66u,
+   0x0034FA0u, 0x0034FE6u, 0x0035009u, 0x0035140u, 0x0035209u, 0x0035340u, 0x0035412u, 0x00354E4u,
+   0x0035512u, 0x00355C0u, 0x0035606u, 0x00357C8u, 0x00357E6u, 0x00359E0u, 0x0036006u, 0x0036087u,
+   0x00360A5u, 0x0036686u, 0x00366A7u, 0x00366C6u, 0x0036767u, 0x0036786u, 0x00367A7u, 0x0036846u,
+   0x0036867u, 0x00368A5u, 0x00369A0u, 0x0036A09u, 0x0036B52u, 0x0036C36u, 0x0036D66u, 0x0036E96u,
+   0x0036FB2u, 0x0036FE0u, 0x0037006u, 0x0037047u, 0x0037065u, 0x0037427u, 0x0037446u, 0x00374C7u,
+   0x0037506u, 0x0037547u, 0x0037566u, 0x00375C5u, 0x0037609u, 0x0037745u, 0x0037CC6u, 0x0037CE7u,
+   0x0037D06u, 0x0037D47u, 0x0037DA6u, 0x0037DC7u, 0x0037DE6u, 0x0037E47u, 0x0037E80u, 0x0037F92u,
+   0x0038005u, 0x0038487u, 0x0038586u, 0x0038687u, 0x00386C6u, 0x0038700u, 0x0038772u, 0x0038809u,
+   0x0038940u, 0x00389A5u, 0x0038A09u, 0x0038B45u, 0x0038F04u, 0x0038FD2u, 0x0039002u, 0x0039120u,
+   0x0039201u, 0x0039760u, 0x00397A1u, 0x0039812u, 0x0039900u, 0x0039A06u, 0x0039A72u, 0x0039A86u,
+   0x0039C27u, 0x0039C46u, 0x0039D25u, 0x0039DA6u, 0x0039DC5u, 0x0039E86u, 0x0039EA5u, 0x0039EE7u,
+   0x0039F06u, 0x0039F45u, 0x0039F60u, 0x003A002u, 0x003A584u, 0x003AD62u, 0x003AF04u, 0x003AF22u,
+   0x003B364u, 0x003B806u, 0x003C001u, 0x003C022u, 0x003C041u, 0x003C062u, 0x003C081u, 0x003C0A2u,
+   0x003C0C1u, 0x003C0E2u, 0x003C101u, 0x003C122u, 0x003C141u, 0x003C162u, 0x003C181u, 0x003C1A2u,
+   0x003C1C1u, 0x003C1E2u, 0x003C201u, 0x003C222u, 0x003C241u, 0x003C262u, 0x003C281u, 0x003C2A2u,
+   0x003C2C1u, 0x003C2E2u, 0x003C301u, 0x003C322u, 0x003C341u, 0x003C362u, 0x003C381u, 0x003C3A2u,
+   0x003C3C1u, 0x003C3E2u, 0x003C401u, 0x003C422u, 0x003C441u, 0x003C462u, 0x003C481u, 0x003C4A2u,
+   0x003C4C1u, 0x003C4E2u, 0x003C501u, 0x003C522u, 0x003C541u, 0x003C562u, 0x003C581u, 0x003C5A2u,
+   0x003C5C1u, 0x003C5E2u, 0x003C601u, 0x003C622u, 0x003C641u, 0x003C662u, 0x003C681u, 0x003C6A2u,
+   0x003C6C1u, 0x003C6E2u, 0x003C701u, 0x003C722u, 0x003C741u, 0x003C762u, 0x003C781u, 0x003C7A2u,
+   0x003C7C1u, 0x003C7E2u, 0x003C801u, 0x003C822u, 0x003C841u, 0x003C862u, 0x003C881u, 0x003C8A2u,
+   0x003C8C1u, 0x003C8E2u, 0x003C901u, 0x003C922u, 0x003C941u, 0x003C962u, 0x003C981u, 0x003C9A2u,
+   0x003C9C1u, 0x003C9E2u, 0x003CA01u, 0x003CA22u, 0x003CA41u, 0x003CA62u, 0x003CA81u, 0x003CAA2u,
+   0x003CAC1u, 0x003CAE2u, 0x003CB01u, 0x003CB22u, 0x003CB41u, 0x003CB62u, 0x003CB81u, 0x003CBA2u,
+   0x003CBC1u, 0x003CBE2u, 0x003CC01u, 0x003CC22u, 0x003CC41u, 0x003CC62u, 0x003CC81u, 0x003CCA2u,
+   0x003CCC1u, 0x003CCE2u, 0x003CD01u, 0x003CD22u, 0x003CD41u, 0x003CD62u, 0x003CD81u, 0x003CDA2u,
+   0x003CDC1u, 0x003CDE2u, 0x003CE01u, 0x003CE22u, 0x003CE41u, 0x003CE62u, 0x003CE81u, 0x003CEA2u,
+   0x003CEC1u, 0x003CEE2u, 0x003CF01u, 0x003CF22u, 0x003CF41u, 0x003CF62u, 0x003CF81u, 0x003CFA2u,
+   0x003CFC1u, 0x003CFE2u, 0x003D001u, 0x003D022u, 0x003D041u, 0x003D062u, 0x003D081u, 0x003D0A2u,
+   0x003D0C1u, 0x003D0E2u, 0x003D101u, 0x003D122u, 0x003D141u, 0x003D162u, 0x003D181u, 0x003D1A2u,
+   0x003D1C1u, 0x003D1E2u, 0x003D201u, 0x003D222u, 0x003D241u, 0x003D262u, 0x003D281u, 0x003D2A2u,
+   0x003D3C1u, 0x003D3E2u, 0x003D401u, 0x003D422u, 0x003D441u, 0x003D462u, 0x003D481u, 0x003D4A2u,
+   0x003D4C1u, 0x003D4E2u, 0x003D501u, 0x003D522u, 0x003D541u, 0x003D562u, 0x003D581u, 0x003D5A2u,
+   0x003D5C1u, 0x003D5E2u, 0x003D601u, 0x003D622u, 0x003D641u, 0x003D662u, 0x003D681u, 0x003D6A2u,
+   0x003D6C1u, 0x003D6E2u, 0x003D701u, 0x003D722u, 0x003D741u, 0x003D762u, 0x003D781u, 0x003D7A2u,
+   0x003D7C1u, 0x003D7E2u, 0x003D801u, 0x003D822u, 0x003D841u, 0x003D862u, 0x003D881u, 0x003D8A2u,
+   0x003D8C1u, 0x003D8E2u, 0x003D901u, 0x003D922u, 0x003D941u, 0x003D962u, 0x003D981u, 0x003D9A2u,
+   0x003D9C1u, 0x003D9E2u, 0x003DA01u, 0x003DA22u, 0x003DA41u, 0x003DA62u, 0x003DA81u, 0x003DAA2u,
+   0x003DAC1u, 0x003DAE2u, 0x003DB01u, 0x003DB22u, 0x003DB41u, 0x003DB62u, 0x003DB81u, 0x003DBA2u,
+   0x003DBC1u, 0x003DBE2u, 0x003DC01u, 0x003DC22u, 0x003DC41u, 0x003DC62u, 0x003DC81u, 0x003DCA2u,
+   0x003DCC1u, 0x003DCE2u, 0x003DD01u, 0x003DD22u, 0x003DD41u, 0x003DD62u, 0x003DD81u, 0x003DDA2u,
+   0x003DDC1u, 0x003DDE2u, 0x003DE01u, 0x003DE22u, 0x003DE41u, 0x003DE62u, 0x003DE81u, 0x003DEA2u,
+   0x003DEC1u, 0x003DEE2u, 0x003DF01u, 0x003DF22u, 0x003DF41u, 0x003DF62u, 0x003DF81u, 0x003DFA2u,
+   0x003DFC1u, 0x003DFE2u, 0x003E101u, 0x003E202u, 0x003E2C0u, 0x003E301u, 0x003E3C0u, 0x003E402u,
+   0x003E501u, 0x003E602u, 0x003E701u, 0x003E802u, 0x003E8C0u, 0x003E901u, 0x003E9C0u, 0x003EA02u,
+   0x003EB00u, 0x003EB21u, 0x003EB40u, 0x003EB61u, 0x003EB80u, 0x003EBA1u, 0x003EBC0u, 0x003EBE1u,
+   0x003EC02u, 0x003ED01u, 0x003EE02u, 0x003EFC0u, 0x003F002u, 0x003F103u, 0x003F202u, 0x003F303u,
+   0x003F402u, 0x003F503u, 0x003F602u, 0x003F6A0u, 0x003F6C2u, 0x003F701u, 0x003F783u, 0x003F7B5u,
+   0x003F7C2u, 0x003F7F5u, 0x003F842u, 0x003F8A0u, 0x003F8C2u, 0x003F901u, 0x003F983u, 0x003F9B5u,
+   0x003FA02u, 0x003FA80u, 0x003FAC2u, 0x003FB01u, 0x003FB80u, 0x003FBB5u, 0x003FC02u, 0x003FD01u,
+   0x003FDB5u, 0x003FE00u, 0x003FE42u, 0x003FEA0u, 0x003FEC2u, 0x003FF01u, 0x003FF83u, 0x003FFB5u,
+   0x003FFE0u, 0x0040017u, 0x004017Bu, 0x004020Du, 0x00402D2u, 0x0040310u, 0x0040331u, 0x004034Eu,
+   0x0040370u, 0x00403B1u, 0x00403CEu, 0x00403F0u, 0x0040412u, 0x0040518u, 0x0040539u, 0x004055Bu,
+   0x00405F7u, 0x0040612u, 0x0040730u, 0x0040751u, 0x0040772u, 0x00407ECu, 0x0040832u, 0x0040893u,
+   0x00408AEu, 0x00408CFu, 0x00408F2u, 0x0040A53u, 0x0040A72u, 0x0040A8Cu, 0x0040AB2u, 0x0040BF7u,
+   0x0040C1Bu, 0x0040CA0u, 0x0040CDBu, 0x0040E0Bu, 0x0040E24u, 0x0040E40u, 0x0040E8Bu, 0x0040F53u,
+   0x0040FAEu, 0x0040FCFu, 0x0040FE4u, 0x004100Bu, 0x0041153u, 0x00411AEu, 0x00411CFu, 0x00411E0u,
+   0x0041204u, 0x00413A0u, 0x0041414u, 0x0041820u, 0x0041A06u, 0x0041BA8u, 0x0041C26u, 0x0041C48u,
+   0x0041CA6u, 0x0041E20u, 0x0042016u, 0x0042041u, 0x0042076u, 0x00420E1u, 0x0042116u, 0x0042142u,
+   0x0042161u, 0x00421C2u, 0x0042201u, 0x0042262u, 0x0042296u, 0x00422A1u, 0x00422D6u, 0x0042313u,
+   0x0042321u, 0x00423D6u, 0x0042481u, 0x00424B6u, 0x00424C1u, 0x00424F6u, 0x0042501u, 0x0042536u,
+   0x0042541u, 0x00425D6u, 0x00425E2u, 0x0042601u, 0x0042682u, 0x00426A5u, 0x0042722u, 0x0042756u,
+   0x0042782u, 0x00427C1u, 0x0042813u, 0x00428A1u, 0x00428C2u, 0x0042956u, 0x0042973u, 0x0042996u,
+   0x00429C2u, 0x00429F6u, 0x0042A0Bu, 0x0042C0Au, 0x0043061u, 0x0043082u, 0x00430AAu, 0x004312Bu,
+   0x0043156u, 0x0043180u, 0x0043213u, 0x00432B6u, 0x0043353u, 0x0043396u, 0x0043413u, 0x0043436u,
+   0x0043473u, 0x0043496u, 0x00434D3u, 0x00434F6u, 0x00435D3u, 0x00435F6u, 0x00439D3u, 0x0043A16u,
+   0x0043A53u, 0x0043A76u, 0x0043A93u, 0x0043AB6u, 0x0043E93u, 0x0046016u, 0x004610Eu, 0x004612Fu,
+   0x004614Eu, 0x004616Fu, 0x0046196u, 0x0046413u, 0x0046456u, 0x004652Eu, 0x004654Fu, 0x0046576u,
+   0x0046F93u, 0x0046FB6u, 0x0047373u, 0x0047696u, 0x0047B93u, 0x0047C56u, 0x00484E0u, 0x0048816u,
+   0x0048960u, 0x0048C0Bu, 0x0049396u, 0x0049D4Bu, 0x004A016u, 0x004B6F3u, 0x004B716u, 0x004B833u,
+   0x004B856u, 0x004BF13u, 0x004C016u, 0x004CDF3u, 0x004CE16u, 0x004ED0Eu, 0x004ED2Fu, 0x004ED4Eu,
+   0x004ED6Fu, 0x004ED8Eu, 0x004EDAFu, 0x004EDCEu, 0x004EDEFu, 0x004EE0Eu, 0x004EE2Fu, 0x004EE4Eu,
+   0x004EE6Fu, 0x004EE8Eu, 0x004EEAFu, 0x004EECBu, 0x004F296u, 0x004F813u, 0x004F8AEu, 0x004F8CFu,
+   0x004F8F3u, 0x004FCCEu, 0x004FCEFu, 0x004FD0Eu, 0x004FD2Fu, 0x004FD4Eu, 0x004FD6Fu, 0x004FD8Eu,
+   0x004FDAFu, 0x004FDCEu, 0x004FDEFu, 0x004FE13u, 0x0050016u, 0x0052013u, 0x005306Eu, 0x005308Fu,
+   0x00530AEu, 0x00530CFu, 0x00530EEu, 0x005310Fu, 0x005312Eu, 0x005314Fu, 0x005316Eu, 0x005318Fu,
+   0x00531AEu, 0x00531CFu, 0x00531EEu, 0x005320Fu, 0x005322Eu, 0x005324Fu, 0x005326Eu, 0x005328Fu,
+   0x00532AEu, 0x00532CFu, 0x00532EEu, 0x005330Fu, 0x0053333u, 0x0053B0Eu, 0x0053B2Fu, 0x0053B4Eu,
+   0x0053B6Fu, 0x0053B93u, 0x0053F8Eu, 0x0053FAFu, 0x0053FD3u, 0x0056016u, 0x0056613u, 0x00568B6u,
+   0x00568F3u, 0x00569B6u, 0x0056E80u, 0x0056ED6u, 0x00572C0u, 0x00572F6u, 0x0058001u, 0x0058602u,
+   0x0058C01u, 0x0058C22u, 0x0058C41u, 0x0058CA2u, 0x0058CE1u, 0x0058D02u, 0x0058D21u, 0x0058D42u,
+   0x0058D61u, 0x0058D82u, 0x0058DA1u, 0x0058E22u, 0x0058E41u, 0x0058E62u, 0x0058EA1u, 0x0058EC2u,
+   0x0058F84u, 0x0058FC1u, 0x0059022u, 0x0059041u, 0x0059062u, 0x0059081u, 0x00590A2u, 0x00590C1u,
+   0x00590E2u, 0x0059101u, 0x0059122u, 0x0059141u, 0x0059162u, 0x0059181u, 0x00591A2u, 0x00591C1u,
+   0x00591E2u, 0x0059201u, 0x0059222u, 0x0059241u, 0x0059262u, 0x0059281u, 0x00592A2u, 0x00592C1u,
+   0x00592E2u, 0x0059301u, 0x0059322u, 0x0059341u, 0x0059362u, 0x0059381u, 0x00593A2u, 0x00593C1u,
+   0x00593E2u, 0x0059401u, 0x0059422u, 0x0059441u, 0x0059462u, 0x0059481u, 0x00594A2u, 0x00594C1u,
+   0x00594E2u, 0x0059501u, 0x0059522u, 0x0059541u, 0x0059562u, 0x0059581u, 0x00595A2u, 0x00595C1u,
+   0x00595E2u, 0x0059601u, 0x0059622u, 0x0059641u, 0x0059662u, 0x0059681u, 0x00596A2u, 0x00596C1u,
+   0x00596E2u, 0x0059701u, 0x0059722u, 0x0059741u, 0x0059762u, 0x0059781u, 0x00597A2u, 0x00597C1u,
+   0x00597E2u, 0x0059801u, 0x0059822u, 0x0059841u, 0x0059862u, 0x0059881u, 0x00598A2u, 0x00598C1u,
+   0x00598E2u, 0x0059901u, 0x0059922u, 0x0059941u, 0x0059962u, 0x0059981u, 0x00599A2u, 0x00599C1u,
+   0x00599E2u, 0x0059A01u, 0x0059A22u, 0x0059A41u, 0x0059A62u, 0x0059A81u, 0x0059AA2u, 0x0059AC1u,
+   0x0059AE2u, 0x0059B01u, 0x0059B22u, 0x0059B41u, 0x0059B62u, 0x0059B81u, 0x0059BA2u, 0x0059BC1u,
+   0x0059BE2u, 0x0059C01u, 0x0059C22u, 0x0059C41u, 0x0059C62u, 0x0059CB6u, 0x0059D61u, 0x0059D82u,
+   0x0059DA1u, 0x0059DC2u, 0x0059DE6u, 0x0059E41u, 0x0059E62u, 0x0059E80u, 0x0059F32u, 0x0059FABu,
+   0x0059FD2u, 0x005A002u, 0x005A4C0u, 0x005A4E2u, 0x005A500u, 0x005A5A2u, 0x005A5C0u, 0x005A605u,
+   0x005AD00u, 0x005ADE4u, 0x005AE12u, 0x005AE20u, 0x005AFE6u, 0x005B005u, 0x005B2E0u, 0x005B405u,
+   0x005B4E0u, 0x005B505u, 0x005B5E0u, 0x005B605u, 0x005B6E0u, 0x005B705u, 0x005B7E0u, 0x005B805u,
+   0x005B8E0u, 0x005B905u, 0x005B9E0u, 0x005BA05u, 0x005BAE0u, 0x005BB05u, 0x005BBE0u, 0x005BC06u,
+   0x005C012u, 0x005C050u, 0x005C071u, 0x005C090u, 0x005C0B1u, 0x005C0D2u, 0x005C130u, 0x005C151u,
+   0x005C172u, 0x005C190u, 0x005C1B1u, 0x005C1D2u, 0x005C2EDu, 0x005C312u, 0x005C34Du, 0x005C372u,
+   0x005C390u, 0x005C3B1u, 0x005C3D2u, 0x005C410u, 0x005C431u, 0x005C44Eu, 0x005C46Fu, 0x005C48Eu,
+   0x005C4AFu, 0x005C4CEu, 0x005C4EFu, 0x005C50Eu, 0x005C52Fu, 0x005C552u, 0x005C5E4u, 0x005C612u,
+   0x005C74Du, 0x005C792u, 0x005C80Du, 0x005C832u, 0x005C84Eu, 0x005C872u, 0x005CA16u, 0x005CA52u,
+   0x005CAAEu, 0x005CACFu, 0x005CAEEu, 0x005CB0Fu, 0x005CB2Eu, 0x005CB4Fu, 0x005CB6Eu, 0x005CB8Fu,
+   0x005CBADu, 0x005CBC0u, 0x005D016u, 0x005D340u, 0x005D376u, 0x005DE80u, 0x005E016u, 0x005FAC0u,
+   0x005FE16u, 0x005FF80u, 0x0060017u, 0x0060032u, 0x0060096u, 0x00600A4u, 0x00600C5u, 0x00600EAu,
+   0x006010Eu, 0x006012Fu, 0x006014Eu, 0x006016Fu, 0x006018Eu, 0x00601AFu, 0x00601CEu, 0x00601EFu,
+   0x006020Eu, 0x006022Fu, 0x0060256u, 0x006028Eu, 0x00602AFu, 0x00602CEu, 0x00602EFu, 0x006030Eu,
+   0x006032Fu, 0x006034Eu, 0x006036Fu, 0x006038Du, 0x00603AEu, 0x00603CFu, 0x0060416u, 0x006042Au,
+   0x0060546u, 0x00605C7u, 0x006060Du, 0x0060624u, 0x00606D6u, 0x006070Au, 0x0060764u, 0x0060785u,
+   0x00607B2u, 0x00607D6u, 0x0060800u, 0x0060825u, 0x00612E0u, 0x0061326u, 0x0061375u, 0x00613A4u,
+   0x00613E5u, 0x006140Du, 0x0061425u, 0x0061F72u, 0x0061F84u, 0x0061FE5u, 0x0062000u, 0x00620A5u,
+   0x0062600u, 0x0062625u, 0x00631E0u, 0x0063216u, 0x006324Bu, 0x00632D6u, 0x0063405u, 0x0063816u,
+   0x0063C80u, 0x0063E05u, 0x0064016u, 0x00643E0u, 0x006440Bu, 0x0064556u, 0x006490Bu, 0x0064A16u,
+   0x0064A2Bu, 0x0064C16u, 0x006500Bu, 0x0065156u, 0x006562Bu, 0x0065816u, 0x0068005u, 0x009B816u,
+   0x009C005u, 0x01402A4u, 0x01402C5u, 0x01491A0u, 0x0149216u, 0x01498E0u, 0x0149A05u, 0x0149F04u,
+   0x0149FD2u, 0x014A005u, 0x014C184u, 0x014C1B2u, 0x014C205u, 0x014C409u, 0x014C545u, 0x014C580u,
+   0x014C801u, 0x014C822u, 0x014C841u, 0x014C862u, 0x014C881u, 0x014C8A2u, 0x014C8C1u, 0x014C8E2u,
+   0x014C901u, 0x014C922u, 0x014C941u, 0x014C962u, 0x014C981u, 0x014C9A2u, 0x014C9C1u, 0x014C9E2u,
+   0x014CA01u, 0x014CA22u, 0x014CA41u, 0x014CA62u, 0x014CA81u, 0x014CAA2u, 0x014CAC1u, 0x014CAE2u,
+   0x014CB01u, 0x014CB22u, 0x014CB41u, 0x014CB62u, 0x014CB81u, 0x014CBA2u, 0x014CBC1u, 0x014CBE2u,
+   0x014CC01u, 0x014CC22u, 0x014CC41u, 0x014CC62u, 0x014CC81u, 0x014CCA2u, 0x014CCC1u, 0x014CCE2u,
+   0x014CD01u, 0x014CD22u, 0x014CD41u, 0x014CD62u, 0x014CD81u, 0x014CDA2u, 0x014CDC5u, 0x014CDE6u,
+   0x014CE08u, 0x014CE72u, 0x014CE86u, 0x014CFD2u, 0x014CFE4u, 0x014D001u, 0x014D022u, 0x014D041u,
+   0x014D062u, 0x014D081u, 0x014D0A2u, 0x014D0C1u, 0x014D0E2u, 0x014D101u, 0x014D122u, 0x014D141u,
+   0x014D162u, 0x014D181u, 0x014D1A2u, 0x014D1C1u, 0x014D1E2u, 0x014D201u, 0x014D222u, 0x014D241u,
+   0x014D262u, 0x014D281u, 0x014D2A2u, 0x014D2C1u, 0x014D2E2u, 0x014D301u, 0x014D322u, 0x014D341u,
+   0x014D362u, 0x014D384u, 0x014D3C6u, 0x014D405u, 0x014DCCAu, 0x014DE06u, 0x014DE52u, 0x014DF00u,
+   0x014E015u, 0x014E2E4u, 0x014E415u, 0x014E441u, 0x014E462u, 0x014E481u, 0x014E4A2u, 0x014E4C1u,
+   0x014E4E2u, 0x014E501u, 0x014E522u, 0x014E541u, 0x014E562u, 0x014E581u, 0x014E5A2u, 0x014E5C1u,
+   0x014E5E2u, 0x014E641u, 0x014E662u, 0x014E681u, 0x014E6A2u, 0x014E6C1u, 0x014E6E2u, 0x014E701u,
+   0x014E722u, 0x014E741u, 0x014E762u, 0x014E781u, 0x014E7A2u, 0x014E7C1u, 0x014E7E2u, 0x014E801u,
+   0x014E822u, 0x014E841u, 0x014E862u, 0x014E881u, 0x014E8A2u, 0x014E8C1u, 0x014E8E2u, 0x014E901u,
+   0x014E922u, 0x014E941u, 0x014E962u, 0x014E981u, 0x014E9A2u, 0x014E9C1u, 0x014E9E2u, 0x014EA01u,
+   0x014EA22u, 0x014EA41u, 0x014EA62u, 0x014EA81u, 0x014EAA2u, 0x014EAC1u, 0x014EAE2u, 0x014EB01u,
+   0x014EB22u, 0x014EB41u, 0x014EB62u, 0x014EB81u, 0x014EBA2u, 0x014EBC1u, 0x014EBE2u, 0x014EC01u,
+   0x014EC22u, 0x014EC41u, 0x014EC62u, 0x014EC81u, 0x014ECA2u, 0x014ECC1u, 0x014ECE2u, 0x014ED01u,
+   0x014ED22u, 0x014ED41u, 0x014ED62u, 0x014ED81u, 0x014EDA2u, 0x014EDC1u, 0x014EDE2u, 0x014EE04u,
+   0x014EE22u, 0x014EF21u, 0x014EF42u, 0x014EF61u, 0x014EF82u, 0x014EFA1u, 0x014EFE2u, 0x014F001u,
+   0x014F022u, 0x014F041u, 0x014F062u, 0x014F081u, 0x014F0A2u, 0x014F0C1u, 0x014F0E2u, 0x014F104u,
+   0x014F135u, 0x014F161u, 0x014F182u, 0x014F1A1u, 0x014F1C2u, 0x014F1E5u, 0x014F201u, 0x014F222u,
+   0x014F241u, 0x014F262u, 0x014F2C1u, 0x014F2E2u, 0x014F301u, 0x014F322u, 0x014F341u, 0x014F362u,
+   0x014F381u, 0x014F3A2u, 0x014F3C1u, 0x014F3E2u, 0x014F401u, 0x014F422u, 0x014F441u, 0x014F462u,
+   0x014F481u, 0x014F4A2u, 0x014F4C1u, 0x014F4E2u, 0x014F501u, 0x014F522u, 0x014F541u, 0x014F5E2u,
+   0x014F601u, 0x014F6A2u, 0x014F6C1u, 0x014F6E2u, 0x014F701u, 0x014F722u, 0x014F741u, 0x014F762u,
+   0x014F781u, 0x014F7A2u, 0x014F7C1u, 0x014F7E2u, 0x014F801u, 0x014F822u, 0x014F841u, 0x014F862u,
+   0x014F881u, 0x014F902u, 0x014F921u, 0x014F942u, 0x014F960u, 0x014FA01u, 0x014FA22u, 0x014FA40u,
+   0x014FA62u, 0x014FA80u, 0x014FAA2u, 0x014FAC1u, 0x014FAE2u, 0x014FB01u, 0x014FB22u, 0x014FB40u,
+   0x014FE44u, 0x014FEA1u, 0x014FEC2u, 0x014FEE5u, 0x014FF04u, 0x014FF42u, 0x014FF65u, 0x0150046u,
+   0x0150065u, 0x01500C6u, 0x01500E5u, 0x0150166u, 0x0150185u, 0x0150467u, 0x01504A6u, 0x01504E7u,
+   0x0150516u, 0x0150586u, 0x01505A0u, 0x015060Bu, 0x01506D6u, 0x0150714u, 0x0150736u, 0x0150740u,
+   0x0150805u, 0x0150E92u, 0x0150F00u, 0x0151007u, 0x0151045u, 0x0151687u, 0x0151886u, 0x01518C0u,
+   0x01519D2u, 0x0151A09u, 0x0151B40u, 0x0151C06u, 0x0151E45u, 0x0151F12u, 0x0151F65u, 0x0151F92u,
+   0x0151FA5u, 0x0151FE6u, 0x0152009u, 0x0152145u, 0x01524C6u, 0x01525D2u, 0x0152605u, 0x01528E6u,
+   0x0152A47u, 0x0152A80u, 0x0152BF2u, 0x0152C05u, 0x0152FA0u, 0x0153006u, 0x0153067u, 0x0153085u,
+   0x0153666u, 0x0153687u, 0x01536C6u, 0x0153747u, 0x0153786u, 0x01537C7u, 0x0153832u, 0x01539C0u,
+   0x01539E4u, 0x0153A09u, 0x0153B40u, 0x0153BD2u, 0x0153C05u, 0x0153CA6u, 0x0153CC4u, 0x0153CE5u,
+   0x0153E09u, 0x0153F45u, 0x0153FE0u, 0x0154005u, 0x0154526u, 0x01545E7u, 0x0154626u, 0x0154667u,
+   0x01546A6u, 0x01546E0u, 0x0154805u, 0x0154866u, 0x0154885u, 0x0154986u, 0x01549A7u, 0x01549C0u,
+   0x0154A09u, 0x0154B40u, 0x0154B92u, 0x0154C05u, 0x0154E04u, 0x0154E25u, 0x0154EF6u, 0x0154F45u,
+   0x0154F67u, 0x0154F86u, 0x0154FA7u, 0x0154FC5u, 0x0155606u, 0x0155625u, 0x0155646u, 0x01556A5u,
+   0x01556E6u, 0x0155725u, 0x01557C6u, 0x0155805u, 0x0155826u, 0x0155845u, 0x0155860u, 0x0155B65u,
+   0x0155BA4u, 0x0155BD2u, 0x0155C05u, 0x0155D67u, 0x0155D86u, 0x0155DC7u, 0x0155E12u, 0x0155E45u,
+   0x0155E64u, 0x0155EA7u, 0x0155EC6u, 0x0155EE0u, 0x0156025u, 0x01560E0u, 0x0156125u, 0x01561E0u,
+   0x0156225u, 0x01562E0u, 0x0156405u, 0x01564E0u, 0x0156505u, 0x01565E0u, 0x0156602u, 0x0156B75u,
+   0x0156B84u, 0x0156C02u, 0x0156D24u, 0x0156D55u, 0x0156D80u, 0x0156E02u, 0x0157805u, 0x0157C67u,
+   0x0157CA6u, 0x0157CC7u, 0x0157D06u, 0x0157D27u, 0x0157D72u, 0x0157D87u, 0x0157DA6u, 0x0157DC0u,
+   0x0157E09u, 0x0157F40u, 0x0158005u, 0x01AF480u, 0x01AF605u, 0x01AF8E0u, 0x01AF965u, 0x01AFF80u,
+   0x01B001Cu, 0x01C001Du, 0x01F2005u, 0x01F4DC0u, 0x01F4E05u, 0x01F5B40u, 0x01F6002u, 0x01F60E0u,
+   0x01F6262u, 0x01F6300u, 0x01F63A5u, 0x01F63C6u, 0x01F63E5u, 0x01F6533u, 0x01F6545u, 0x01F66E0u,
+   0x01F6705u, 0x01F67A0u, 0x01F67C5u, 0x01F67E0u, 0x01F6805u, 0x01F6840u, 0x01F6865u, 0x01F68A0u,
+   0x01F68C5u, 0x01F7655u, 0x01F7860u, 0x01F7A65u, 0x01FA7CFu, 0x01FA7EEu, 0x01FA816u, 0x01FAA05u,
+   0x01FB200u, 0x01FB245u, 0x01FB900u, 0x01FB9F6u, 0x01FBA00u, 0x01FBE05u, 0x01FBF94u, 0x01FBFB6u,
+   0x01FC006u, 0x01FC212u, 0x01FC2EEu, 0x01FC30Fu, 0x01FC332u, 0x01FC340u, 0x01FC406u, 0x01FC612u,
+   0x01FC62Du, 0x01FC66Cu, 0x01FC6AEu, 0x01FC6CFu, 0x01FC6EEu, 0x01FC70Fu, 0x01FC72Eu, 0x01FC74Fu,
+   0x01FC76Eu, 0x01FC78Fu, 0x01FC7AEu, 0x01FC7CFu, 0x01FC7EEu, 0x01FC80Fu, 0x01FC82Eu, 0x01FC84Fu,
+   0x01FC86Eu, 0x01FC88Fu, 0x01FC8B2u, 0x01FC8EEu, 0x01FC90Fu, 0x01FC932u, 0x01FC9ACu, 0x01FCA12u,
+   0x01FCA60u, 0x01FCA92u, 0x01FCB0Du, 0x01FCB2Eu, 0x01FCB4Fu, 0x01FCB6Eu, 0x01FCB8Fu, 0x01FCBAEu,
+   0x01FCBCFu, 0x01FCBF2u, 0x01FCC53u, 0x01FCC6Du, 0x01FCC93u, 0x01FCCE0u, 0x01FCD12u, 0x01FCD34u,
+   0x01FCD52u, 0x01FCD80u, 0x01FCE05u, 0x01FCEA0u, 0x01FCEC5u, 0x01FDFA0u, 0x01FDFFBu, 0x01FE000u,
+   0x01FE032u, 0x01FE094u, 0x01FE0B2u, 0x01FE10Eu, 0x01FE12Fu, 0x01FE152u, 0x01FE173u, 0x01FE192u,
+   0x01FE1ADu, 0x01FE1D2u, 0x01FE209u, 0x01FE352u, 0x01FE393u, 0x01FE3F2u, 0x01FE421u, 0x01FE76Eu,
+   0x01FE792u, 0x01FE7AFu, 0x01FE7D5u, 0x01FE7ECu, 0x01FE815u, 0x01FE822u, 0x01FEB6Eu, 0x01FEB93u,
+   0x01FEBAFu, 0x01FEBD3u, 0x01FEBEEu, 0x01FEC0Fu, 0x01FEC32u, 0x01FEC4Eu, 0x01FEC6Fu, 0x01FEC92u,
+   0x01FECC5u, 0x01FEE04u, 0x01FEE25u, 0x01FF3C4u, 0x01FF405u, 0x01FF7E0u, 0x01FF845u, 0x01FF900u,
+   0x01FF945u, 0x01FFA00u, 0x01FFA45u, 0x01FFB00u, 0x01FFB45u, 0x01FFBA0u, 0x01FFC14u, 0x01FFC53u,
+   0x01FFC75u, 0x01FFC96u, 0x01FFCB4u, 0x01FFCE0u, 0x01FFD16u, 0x01FFD33u, 0x01FFDB6u, 0x01FFDE0u,
+   0x01FFF3Bu, 0x01FFF96u, 0x01FFFC0u, 0x0200005u, 0x0200180u, 0x02001A5u, 0x02004E0u, 0x0200505u,
+   0x0200760u, 0x0200785u, 0x02007C0u, 0x02007E5u, 0x02009C0u, 0x0200A05u, 0x0200BC0u, 0x0201005u,
+   0x0201F60u, 0x0202012u, 0x0202060u, 0x02020EBu, 0x0202680u, 0x02026F6u, 0x020280Au, 0x0202EABu,
+   0x0202F36u, 0x020314Bu, 0x0203196u, 0x02031E0u, 0x0203216u, 0x02033A0u, 0x0203416u, 0x0203420u,
+   0x0203A16u, 0x0203FA6u, 0x0203FC0u, 0x0205005u, 0x02053A0u, 0x0205405u, 0x0205A20u, 0x0205C06u,
+   0x0205C2Bu, 0x0205F80u, 0x0206005u, 0x020640Bu, 0x0206480u, 0x02065A5u, 0x020682Au, 0x0206845u,
+   0x020694Au, 0x0206960u, 0x0206A05u, 0x0206EC6u, 0x0206F60u, 0x0207005u, 0x02073C0u, 0x02073F2u,
+   0x0207405u, 0x0207880u, 0x0207905u, 0x0207A12u, 0x0207A2Au, 0x0207AC0u, 0x0208001u, 0x0208502u,
+   0x0208A05u, 0x02093C0u, 0x0209409u, 0x0209540u, 0x0209601u, 0x0209A80u, 0x0209B02u, 0x0209F80u,
+   0x020A005u, 0x020A500u, 0x020A605u, 0x020AC80u, 0x020ADF2u, 0x020AE01u, 0x020AF60u, 0x020AF81u,
+   0x020B160u, 0x020B181u, 0x020B260u, 0x020B281u, 0x020B2C0u, 0x020B2E2u, 0x020B440u, 0x020B462u,
+   0x020B640u, 0x020B662u, 0x020B740u, 0x020B762u, 0x020B7A0u, 0x020C005u, 0x020E6E0u, 0x020E805u,
+   0x020EAC0u, 0x020EC05u, 0x020ED00u, 0x020F004u, 0x020F0C0u, 0x020F0E4u, 0x020F620u, 0x020F644u,
+   0x020F760u, 0x0210005u, 0x02100C0u, 0x0210105u, 0x0210120u, 0x0210145u, 0x02106C0u, 0x02106E5u,
+   0x0210720u, 0x0210785u, 0x02107A0u, 0x02107E5u, 0x0210AC0u, 0x0210AF2u, 0x0210B0Bu, 0x0210C05u,
+   0x0210EF6u, 0x0210F2Bu, 0x0211005u, 0x02113E0u, 0x02114EBu, 0x0211600u, 0x0211C05u, 0x0211E60u,
+   0x0211E85u, 0x0211EC0u, 0x0211F6Bu, 0x0212005u, 0x02122CBu, 0x0212380u, 0x02123F2u, 0x0212405u,
+   0x0212740u, 0x02127F2u, 0x0212800u, 0x0213005u, 0x0213700u, 0x021378Bu, 0x02137C5u, 0x021380Bu,
+   0x0213A00u, 0x0213A4Bu, 0x0214005u, 0x0214026u, 0x0214080u, 0x02140A6u, 0x02140E0u, 0x0214186u,
+   0x0214205u, 0x0214280u, 0x02142A5u, 0x0214300u, 0x0214325u, 0x02146C0u, 0x0214706u, 0x0214760u,
+   0x02147E6u, 0x021480Bu, 0x0214920u, 0x0214A12u, 0x0214B20u, 0x0214C05u, 0x0214FABu, 0x0214FF2u,
+   0x0215005u, 0x02153ABu, 0x0215400u, 0x0215805u, 0x0215916u, 0x0215925u, 0x0215CA6u, 0x0215CE0u,
+   0x0215D6Bu, 0x0215E12u, 0x0215EE0u, 0x0216005u, 0x02166C0u, 0x0216732u, 0x0216805u, 0x0216AC0u,
+   0x0216B0Bu, 0x0216C05u, 0x0216E60u, 0x0216F0Bu, 0x0217005u, 0x0217240u, 0x0217332u, 0x02173A0u,
+   0x021752Bu, 0x0217600u, 0x0218005u, 0x0218920u, 0x0219001u, 0x0219660u, 0x0219802u, 0x0219E60u,
+   0x0219F4Bu, 0x021A005u, 0x021A486u, 0x021A500u, 0x021A609u, 0x021A740u, 0x021CC0Bu, 0x021CFE0u,
+   0x021D005u, 0x021D540u, 0x021D566u, 0x021D5ADu, 0x021D5C0u, 0x021D605u, 0x021D640u, 0x021E005u,
+   0x021E3ABu, 0x021E4E5u, 0x021E500u, 0x021E605u, 0x021E8C6u, 0x021EA2Bu, 0x021EAB2u, 0x021EB40u,
+   0x021EE05u, 0x021F046u, 0x021F0D2u, 0x021F140u, 0x021F605u, 0x021F8ABu, 0x021F980u, 0x021FC05u,
+   0x021FEE0u, 0x0220007u, 0x0220026u, 0x0220047u, 0x0220065u, 0x0220706u, 0x02208F2u, 0x02209C0u,
+   0x0220A4Bu, 0x0220CC9u, 0x0220E06u, 0x0220E25u, 0x0220E66u, 0x0220EA5u, 0x0220EC0u, 0x0220FE6u,
+   0x0221047u, 0x0221065u, 0x0221607u, 0x0221666u, 0x02216E7u, 0x0221726u, 0x0221772u, 0x02217BBu,
+   0x02217D2u, 0x0221846u, 0x0221860u, 0x02219BBu, 0x02219C0u, 0x0221A05u, 0x0221D20u, 0x0221E09u,
+   0x0221F40u, 0x0222006u, 0x0222065u, 0x02224E6u, 0x0222587u, 0x02225A6u, 0x02226A0u, 0x02226C9u,
+   0x0222812u, 0x0222885u, 0x02228A7u, 0x02228E5u, 0x0222900u, 0x0222A05u, 0x0222E66u, 0x0222E92u,
+   0x0222EC5u, 0x0222EE0u, 0x0223006u, 0x0223047u, 0x0223065u, 0x0223667u, 0x02236C6u, 0x02237E7u,
+   0x0223825u, 0x02238B2u, 0x0223926u, 0x02239B2u, 0x02239C7u, 0x02239E6u, 0x0223A09u, 0x0223B45u,
+   0x0223B72u, 0x0223B85u, 0x0223BB2u, 0x0223C00u, 0x0223C2Bu, 0x0223EA0u, 0x0224005u, 0x0224240u,
+   0x0224265u, 0x0224587u, 0x02245E6u, 0x0224647u, 0x0224686u, 0x02246A7u, 0x02246C6u, 0x0224712u,
+   0x02247C6u, 0x02247E0u, 0x0225005u, 0x02250E0u, 0x0225105u, 0x0225120u, 0x0225145u, 0x02251C0u,
+   0x02251E5u, 0x02253C0u, 0x02253E5u, 0x0225532u, 0x0225540u, 0x0225605u, 0x0225BE6u, 0x0225C07u,
+   0x0225C66u, 0x0225D60u, 0x0225E09u, 0x0225F40u, 0x0226006u, 0x0226047u, 0x0226080u, 0x02260A5u,
+   0x02261A0u, 0x02261E5u, 0x0226220u, 0x0226265u, 0x0226520u, 0x0226545u, 0x0226620u, 0x0226645u,
+   0x0226680u, 0x02266A5u, 0x0226740u, 0x0226766u, 0x02267A5u, 0x02267C7u, 0x0226806u, 0x0226827u,
+   0x02268A0u, 0x02268E7u, 0x0226920u, 0x0226967u, 0x02269C0u, 0x0226A05u, 0x0226A20u, 0x0226AE7u,
+   0x0226B00u, 0x0226BA5u, 0x0226C47u, 0x0226C80u, 0x0226CC6u, 0x0226DA0u, 0x0226E06u, 0x0226EA0u,
+   0x0228005u, 0x02286A7u, 0x0228706u, 0x0228807u, 0x0228846u, 0x02288A7u, 0x02288C6u, 0x02288E5u,
+   0x0228972u, 0x0228A09u, 0x0228B52u, 0x0228B80u, 0x0228BB2u, 0x0228BC6u, 0x0228BE5u, 0x0228C40u,
+   0x0229005u, 0x0229607u, 0x0229666u, 0x0229727u, 0x0229746u, 0x0229767u, 0x02297E6u, 0x0229827u,
+   0x0229846u, 0x0229885u, 0x02298D2u, 0x02298E5u, 0x0229900u, 0x0229A09u, 0x0229B40u, 0x022B005u,
+   0x022B5E7u, 0x022B646u, 0x022B6C0u, 0x022B707u, 0x022B786u, 0x022B7C7u, 0x022B7E6u, 0x022B832u,
+   0x022BB05u, 0x022BB86u, 0x022BBC0u, 0x022C005u, 0x022C607u, 0x022C666u, 0x022C767u, 0x022C7A6u,
+   0x022C7C7u, 0x022C7E6u, 0x022C832u, 0x022C885u, 0x022C8A0u, 0x022CA09u, 0x022CB40u, 0x022CC12u,
+   0x022CDA0u, 0x022D005u, 0x022D566u, 0x022D587u, 0x022D5A6u, 0x022D5C7u, 0x022D606u, 0x022D6C7u,
+   0x022D6E6u, 0x022D705u, 0x022D732u, 0x022D740u, 0x022D809u, 0x022D940u, 0x022E005u, 0x022E360u,
+   0x022E3A6u, 0x022E407u, 0x022E446u, 0x022E4C7u, 0x022E4E6u, 0x022E580u, 0x022E609u, 0x022E74Bu,
+   0x022E792u, 0x022E7F6u, 0x022E805u, 0x022E8E0u, 0x0230005u, 0x0230587u, 0x02305E6u, 0x0230707u,
+   0x0230726u, 0x0230772u, 0x0230780u, 0x0231401u, 0x0231802u, 0x0231C09u, 0x0231D4Bu, 0x0231E60u,
+   0x0231FE5u, 0x02320E0u, 0x0232125u, 0x0232140u, 0x0232185u, 0x0232280u, 0x02322A5u, 0x02322E0u,
+   0x0232305u, 0x0232607u, 0x02326C0u, 0x02326E7u, 0x0232720u, 0x0232766u, 0x02327A7u, 0x02327C6u,
+   0x02327E5u, 0x0232807u, 0x0232825u, 0x0232847u, 0x0232866u, 0x0232892u, 0x02328E0u, 0x0232A09u,
+   0x0232B40u, 0x0233405u, 0x0233500u, 0x0233545u, 0x0233A27u, 0x0233A86u, 0x0233B00u, 0x0233B46u,
+   0x0233B87u, 0x0233C06u, 0x0233C25u, 0x0233C52u, 0x0233C65u, 0x0233C87u, 0x0233CA0u, 0x0234005u,
+   0x0234026u, 0x0234165u, 0x0234666u, 0x0234727u, 0x0234745u, 0x0234766u, 0x02347F2u, 0x02348E6u,
+   0x0234900u, 0x0234A05u, 0x0234A26u, 0x0234AE7u, 0x0234B26u, 0x0234B85u, 0x0235146u, 0x02352E7u,
+   0x0235306u, 0x0235352u, 0x02353A5u, 0x02353D2u, 0x0235460u, 0x0235605u, 0x0235F20u, 0x0238005u,
+   0x0238120u, 0x0238145u, 0x02385E7u, 0x0238606u, 0x02386E0u, 0x0238706u, 0x02387C7u, 0x02387E6u,
+   0x0238805u, 0x0238832u, 0x02388C0u, 0x0238A09u, 0x0238B4Bu, 0x0238DA0u, 0x0238E12u, 0x0238E45u,
+   0x0239200u, 0x0239246u, 0x0239500u, 0x0239527u, 0x0239546u, 0x0239627u, 0x0239646u, 0x0239687u,
+   0x02396A6u, 0x02396E0u, 0x023A005u, 0x023A0E0u, 0x023A105u, 0x023A140u, 0x023A165u, 0x023A626u,
+   0x023A6E0u, 0x023A746u, 0x023A760u, 0x023A786u, 0x023A7C0u, 0x023A7E6u, 0x023A8C5u, 0x023A8E6u,
+   0x023A900u, 0x023AA09u, 0x023AB40u, 0x023AC05u, 0x023ACC0u, 0x023ACE5u, 0x023AD20u, 0x023AD45u,
+   0x023B147u, 0x023B1E0u, 0x023B206u, 0x023B240u, 0x023B267u, 0x023B2A6u, 0x023B2C7u, 0x023B2E6u,
+   0x023B305u, 0x023B320u, 0x023B409u, 0x023B540u, 0x023DC05u, 0x023DE66u, 0x023DEA7u, 0x023DEF2u,
+   0x023DF20u, 0x023F605u, 0x023F620u, 0x023F80Bu, 0x023FAB6u, 0x023FBB4u, 0x023FC36u, 0x023FE40u,
+   0x023FFF2u, 0x0240005u, 0x0247340u, 0x024800Au, 0x0248DE0u, 0x0248E12u, 0x0248EA0u, 0x0249005u,
+   0x024A880u, 0x025F205u, 0x025FE32u, 0x025FE60u, 0x0260005u, 0x02685E0u, 0x026861Bu, 0x0268720u,
+   0x0288005u, 0x028C8E0u, 0x02D0005u, 0x02D4720u, 0x02D4805u, 0x02D4BE0u, 0x02D4C09u, 0x02D4D40u,
+   0x02D4DD2u, 0x02D4E05u, 0x02D57E0u, 0x02D5809u, 0x02D5940u, 0x02D5A05u, 0x02D5DC0u, 0x02D5E06u,
+   0x02D5EB2u, 0x02D5EC0u, 0x02D6005u, 0x02D6606u, 0x02D66F2u, 0x02D6796u, 0x02D6804u, 0x02D6892u,
+   0x02D68B6u, 0x02D68C0u, 0x02D6A09u, 0x02D6B40u, 0x02D6B6Bu, 0x02D6C40u, 0x02D6C65u, 0x02D6F00u,
+   0x02D6FA5u, 0x02D7200u, 0x02DC801u, 0x02DCC02u, 0x02DD00Bu, 0x02DD2F2u, 0x02DD360u, 0x02DE005u,
+   0x02DE960u, 0x02DE9E6u, 0x02DEA05u, 0x02DEA27u, 0x02DF100u, 0x02DF1E6u, 0x02DF264u, 0x02DF400u,
+   0x02DFC04u, 0x02DFC52u, 0x02DFC64u, 0x02DFC86u, 0x02DFCA0u, 0x02DFE07u, 0x02DFE40u, 0x02E0005u,
+   0x030FF00u, 0x0310005u, 0x0319AC0u, 0x031A005u, 0x031A120u, 0x035FE04u, 0x035FE80u, 0x035FEA4u,
+   0x035FF80u, 0x035FFA4u, 0x035FFE0u, 0x0360005u, 0x0362460u, 0x0362A05u, 0x0362A60u, 0x0362C85u,
+   0x0362D00u, 0x0362E05u, 0x0365F80u, 0x0378005u, 0x0378D60u, 0x0378E05u, 0x0378FA0u, 0x0379005u,
+   0x0379120u, 0x0379205u, 0x0379340u, 0x0379396u, 0x03793A6u, 0x03793F2u, 0x037941Bu, 0x0379480u,
+   0x039E006u, 0x039E5C0u, 0x039E606u, 0x039E8E0u, 0x039EA16u, 0x039F880u, 0x03A0016u, 0x03A1EC0u,
+   0x03A2016u, 0x03A24E0u, 0x03A2536u, 0x03A2CA7u, 0x03A2CE6u, 0x03A2D56u, 0x03A2DA7u, 0x03A2E7Bu,
+   0x03A2F66u, 0x03A3076u, 0x03A30A6u, 0x03A3196u, 0x03A3546u, 0x03A35D6u, 0x03A3D60u, 0x03A4016u,
+   0x03A4846u, 0x03A48B6u, 0x03A48C0u, 0x03A5C0Bu, 0x03A5E80u, 0x03A6016u, 0x03A6AE0u, 0x03A6C0Bu,
+   0x03A6F20u, 0x03A8001u, 0x03A8342u, 0x03A8681u, 0x03A89C2u, 0x03A8AA0u, 0x03A8AC2u, 0x03A8D01u,
+   0x03A9042u, 0x03A9381u, 0x03A93A0u, 0x03A93C1u, 0x03A9400u, 0x03A9441u, 0x03A9460u, 0x03A94A1u,
+   0x03A94E0u, 0x03A9521u, 0x03A95A0u, 0x03A95C1u, 0x03A96C2u, 0x03A9740u, 0x03A9762u, 0x03A9780u,
+   0x03A97A2u, 0x03A9880u, 0x03A98A2u, 0x03A9A01u, 0x03A9D42u, 0x03AA081u, 0x03AA0C0u, 0x03AA0E1u,
+   0x03AA160u, 0x03AA1A1u, 0x03AA2A0u, 0x03AA2C1u, 0x03AA3A0u, 0x03AA3C2u, 0x03AA701u, 0x03AA740u,
+   0x03AA761u, 0x03AA7E0u, 0x03AA801u, 0x03AA8A0u, 0x03AA8C1u, 0x03AA8E0u, 0x03AA941u, 0x03AAA20u,
+   0x03AAA42u, 0x03AAD81u, 0x03AB0C2u, 0x03AB401u, 0x03AB742u, 0x03ABA81u, 0x03ABDC2u, 0x03AC101u,
+   0x03AC442u, 0x03AC781u, 0x03ACAC2u, 0x03ACE01u, 0x03AD142u, 0x03AD4C0u, 0x03AD501u, 0x03AD833u,
+   0x03AD842u, 0x03ADB73u, 0x03ADB82u, 0x03ADC41u, 0x03ADF73u, 0x03ADF82u, 0x03AE2B3u, 0x03AE2C2u,
+   0x03AE381u, 0x03AE6B3u, 0x03AE6C2u, 0x03AE9F3u, 0x03AEA02u, 0x03AEAC1u, 0x03AEDF3u, 0x03AEE02u,
+   0x03AF133u, 0x03AF142u, 0x03AF201u, 0x03AF533u, 0x03AF542u, 0x03AF873u, 0x03AF882u, 0x03AF941u,
+   0x03AF962u, 0x03AF980u, 0x03AF9C9u, 0x03B0016u, 0x03B4006u, 0x03B46F6u, 0x03B4766u, 0x03B4DB6u,
+   0x03B4EA6u, 0x03B4ED6u, 0x03B5086u, 0x03B50B6u, 0x03B50F2u, 0x03B5180u, 0x03B5366u, 0x03B5400u,
+   0x03B5426u, 0x03B5600u, 0x03BE002u, 0x03BE145u, 0x03BE162u, 0x03BE3E0u, 0x03C0006u, 0x03C00E0u,
+   0x03C0106u, 0x03C0320u, 0x03C0366u, 0x03C0440u, 0x03C0466u, 0x03C04A0u, 0x03C04C6u, 0x03C0560u,
+   0x03C2005u, 0x03C25A0u, 0x03C2606u, 0x03C26E4u, 0x03C27C0u, 0x03C2809u, 0x03C2940u, 0x03C29C5u,
+   0x03C29F6u, 0x03C2A00u, 0x03C5205u, 0x03C55C6u, 0x03C55E0u, 0x03C5805u, 0x03C5D86u, 0x03C5E09u,
+   0x03C5F40u, 0x03C5FF4u, 0x03C6000u, 0x03CFC05u, 0x03CFCE0u, 0x03CFD05u, 0x03CFD80u, 0x03CFDA5u,
+   0x03CFDE0u, 0x03CFE05u, 0x03CFFE0u, 0x03D0005u, 0x03D18A0u, 0x03D18EBu, 0x03D1A06u, 0x03D1AE0u,
+   0x03D2001u, 0x03D2442u, 0x03D2886u, 0x03D2964u, 0x03D2980u, 0x03D2A09u, 0x03D2B40u, 0x03D2BD2u,
+   0x03D2C00u, 0x03D8E2Bu, 0x03D9596u, 0x03D95ABu, 0x03D9614u, 0x03D962Bu, 0x03D96A0u, 0x03DA02Bu,
+   0x03DA5D6u, 0x03DA5EBu, 0x03DA7C0u, 0x03DC005u, 0x03DC080u, 0x03DC0A5u, 0x03DC400u, 0x03DC425u,
+   0x03DC460u, 0x03DC485u, 0x03DC4A0u, 0x03DC4E5u, 0x03DC500u, 0x03DC525u, 0x03DC660u, 0x03DC685u,
+   0x03DC700u, 0x03DC725u, 0x03DC740u, 0x03DC765u, 0x03DC780u, 0x03DC845u, 0x03DC860u, 0x03DC8E5u,
+   0x03DC900u, 0x03DC925u, 0x03DC940u, 0x03DC965u, 0x03DC980u, 0x03DC9A5u, 0x03DCA00u, 0x03DCA25u,
+   0x03DCA60u, 0x03DCA85u, 0x03DCAA0u, 0x03DCAE5u, 0x03DCB00u, 0x03DCB25u, 0x03DCB40u, 0x03DCB65u,
+   0x03DCB80u, 0x03DCBA5u, 0x03DCBC0u, 0x03DCBE5u, 0x03DCC00u, 0x03DCC25u, 0x03DCC60u, 0x03DCC85u,
+   0x03DCCA0u, 0x03DCCE5u, 0x03DCD60u, 0x03DCD85u, 0x03DCE60u, 0x03DCE85u, 0x03DCF00u, 0x03DCF25u,
+   0x03DCFA0u, 0x03DCFC5u, 0x03DCFE0u, 0x03DD005u, 0x03DD140u, 0x03DD165u, 0x03DD380u, 0x03DD425u,
+   0x03DD480u, 0x03DD4A5u, 0x03DD540u, 0x03DD565u, 0x03DD780u, 0x03DDE13u, 0x03DDE40u, 0x03E0016u,
+   0x03E0580u, 0x03E0616u, 0x03E1280u, 0x03E1416u, 0x03E15E0u, 0x03E1636u, 0x03E1800u, 0x03E1836u,
+   0x03E1A00u, 0x03E1A36u, 0x03E1EC0u, 0x03E200Bu, 0x03E21B6u, 0x03E35C0u, 0x03E3CD6u, 0x03E4060u,
+   0x03E4216u, 0x03E4780u, 0x03E4816u, 0x03E4920u, 0x03E4A16u, 0x03E4A40u, 0x03E4C16u, 0x03E4CC0u,
+   0x03E6016u, 0x03E7F75u, 0x03E8016u, 0x03EDB00u, 0x03EDBB6u, 0x03EDDA0u, 0x03EDE16u, 0x03EDFA0u,
+   0x03EE016u, 0x03EEE80u, 0x03EF016u, 0x03EFB20u, 0x03EFC16u, 0x03EFD80u, 0x03EFE16u, 0x03EFE20u,
+   0x03F0016u, 0x03F0180u, 0x03F0216u, 0x03F0900u, 0x03F0A16u, 0x03F0B40u, 0x03F0C16u, 0x03F1100u,
+   0x03F1216u, 0x03F15C0u, 0x03F1616u, 0x03F1640u, 0x03F2016u, 0x03F4A80u, 0x03F4C16u, 0x03F4DC0u,
+   0x03F4E16u, 0x03F4EA0u, 0x03F4F16u, 0x03F4FA0u, 0x03F5016u, 0x03F50E0u, 0x03F5216u, 0x03F55A0u,
+   0x03F5616u, 0x03F5760u, 0x03F5816u, 0x03F58C0u, 0x03F5A16u, 0x03F5B40u, 0x03F5C16u, 0x03F5D00u,
+   0x03F5E16u, 0x03F5EE0u, 0x03F6016u, 0x03F7260u, 0x03F7296u, 0x03F7960u, 0x03F7E09u, 0x03F7F40u,
+   0x0400005u, 0x054DC00u, 0x054E005u, 0x056E720u, 0x056E805u, 0x05703C0u, 0x0570405u, 0x059D440u,
+   0x059D605u, 0x05D7C20u, 0x05F0005u, 0x05F43C0u, 0x0600005u, 0x0626960u, 0x1C0003Bu, 0x1C00040u,
+   0x1C0041Bu, 0x1C01000u, 0x1C02006u, 0x1C03E00u, 0x1E0001Du, 0x1FFFFC0u, 0x200001Du, 0x21FFFC0u,
+};
+
+/* simple case folding orbits: each code point in [first, last] maps to the next member of
+ * its orbit by adding delta (or +1 and -1 alternately, if delta is NFAI_FOLD_ALTERNATE) */
+NFAI_INTERNAL const struct NfaiFoldRange NFAI_UNICODE_FOLDS[NFAI_UNICODE_NFOLDS] = {
+   { 0x00041, 0x0005A, 32 }, { 0x00061, 0x0006A, -32 }, { 0x0006B, 0x0006B, 8383 }, { 0x0006C, 0x00072, -32 },
+   { 0x00073, 0x00073, 268 }, { 0x00074, 0x0007A, -32 }, { 0x000B5, 0x000B5, 743 }, { 0x000C0, 0x000D6, 32 },
+   { 0x000D8, 0x000DE, 32 }, { 0x000DF, 0x000DF, 7615 }, { 0x000E0, 0x000E4, -32 }, { 0x000E5, 0x000E5, 8262 },
+   { 0x000E6, 0x000F6, -32 }, { 0x000F8, 0x000FE, -32 }, { 0x000FF, 0x000FF, 121 }, { 0x00100, 0x0012F, NFAI_FOLD_ALTERNATE },
+   { 0x00132, 0x00137, NFAI_FOLD_ALTERNATE }, { 0x00139, 0x00148, NFAI_FOLD_ALTERNATE }, { 0x0014A, 0x00177, NFAI_FOLD_ALTERNATE }, { 0x00178, 0x00178, -121 },
+   { 0x00179, 0x0017E, NFAI_FOLD_ALTERNATE }, { 0x0017F, 0x0017F, -300 }, { 0x00180, 0x00180, 195 }, { 0x00181, 0x00181, 210 },
+   { 0x00182, 0x00185, NFAI_FOLD_ALTERNATE }, { 0x00186, 0x00186, 206 }, { 0x00187, 0x00188, NFAI_FOLD_ALTERNATE }, { 0x00189, 0x0018A, 205 },
+   { 0x0018B, 0x0018C, NFAI_FOLD_ALTERNATE }, { 0x0018E, 0x0018E, 79 }, { 0x0018F, 0x0018F, 202 }, { 0x00190, 0x00190, 203 },
+   { 0x00191, 0x00192, NFAI_FOLD_ALTERNATE }, { 0x00193, 0x00193, 205 }, { 0x00194, 0x00194, 207 }, { 0x00195, 0x00195, 97 },
+   { 0x00196, 0x00196, 211 }, { 0x00197, 0x00197, 209 }, { 0x00198, 0x00199, NFAI_FOLD_ALTERNATE }, { 0x0019A, 0x0019A, 163 },
+   { 0x0019C, 0x0019C, 211 }, { 0x0019D, 0x0019D, 213 }, { 0x0019E, 0x0019E, 130 }, { 0x0019F, 0x0019F, 214 },
+   { 0x001A0, 0x001A5, NFAI_FOLD_ALTERNATE }, { 0x001A6, 0x001A6, 218 }, { 0x001A7, 0x001A8, NFAI_FOLD_ALTERNATE }, { 0x001A9, 0x001A9, 218 },
+   { 0x001AC, 0x001AD, NFAI_FOLD_ALTERNATE }, { 0x001AE, 0x001AE, 218 }, { 0x001AF, 0x001B0, NFAI_FOLD_ALTERNATE }, { 0x001B1, 0x001B2, 217 },
+   { 0x001B3, 0x001B6, NFAI_FOLD_ALTERNATE }, { 0x001B7, 0x001B7, 219 }, { 0x001B8, 0x001B9, NFAI_FOLD_ALTERNATE }, { 0x001BC, 0x001BD, NFAI_FOLD_ALTERNATE },
+   { 0x001BF, 0x001BF, 56 }, { 0x001C4, 0x001C5, 1 }, { 0x001C6, 0x001C6, -2 }, { 0x001C7, 0x001C8, 1 },
+   { 0x001C9, 0x001C9, -2 }, { 0x001CA, 0x001CB, 1 }, { 0x001CC, 0x001CC, -2 }, { 0x001CD, 0x001DC, NFAI_FOLD_ALTERNATE },
+   { 0x001DD, 0x001DD, -79 }, { 0x001DE, 0x001EF, NFAI_FOLD_ALTERNATE }, { 0x001F1, 0x001F2, 1 }, { 0x001F3, 0x001F3, -2 },
+   { 0x001F4, 0x001F5, NFAI_FOLD_ALTERNATE }, { 0x001F6, 0x001F6, -97 }, { 0x001F7, 0x001F7, -56 }, { 0x001F8, 0x0021F, NFAI_FOLD_ALTERNATE },
+   { 0x00220, 0x00220, -130 }, { 0x00222, 0x00233, NFAI_FOLD_ALTERNATE }, { 0x0023A, 0x0023A, 10795 }, { 0x0023B, 0x0023C, NFAI_FOLD_ALTERNATE },
+   { 0x0023D, 0x0023D, -163 }, { 0x0023E, 0x0023E, 10792 }, { 0x0023F, 0x00240, 10815 }, { 0x00241, 0x00242, NFAI_FOLD_ALTERNATE },
+   { 0x00243, 0x00243, -195 }, { 0x00244, 0x00244, 69 }, { 0x00245, 0x00245, 71 }, { 0x00246, 0x0024F, NFAI_FOLD_ALTERNATE },
+   { 0x00250, 0x00250, 10783 }, { 0x00251, 0x00251, 10780 }, { 0x00252, 0x00252, 10782 }, { 0x00253, 0x00253, -210 },
+   { 0x00254, 0x00254, -206 }, { 0x00256, 0x00257, -205 }, { 0x00259, 0x00259, -202 }, { 0x0025B, 0x0025B, -203 },
+   { 0x0025C, 0x0025C, 42319 }, { 0x00260, 0x00260, -205 }, { 0x00261, 0x00261, 42315 }, { 0x00263, 0x00263, -207 },
+   { 0x00265, 0x00265, 42280 }, { 0x00266, 0x00266, 42308 }, { 0x00268, 0x00268, -209 }, { 0x00269, 0x00269, -211 },
+   { 0x0026A, 0x0026A, 42308 }, { 0x0026B, 0x0026B, 10743 }, { 0x0026C, 0x0026C, 42305 }, { 0x0026F, 0x0026F, -211 },
+   { 0x00271, 0x00271, 10749 }, { 0x00272, 0x00272, -213 }, { 0x00275, 0x00275, -214 }, { 0x0027D, 0x0027D, 10727 },
+   { 0x00280, 0x00280, -218 }, { 0x00282, 0x00282, 42307 }, { 0x00283, 0x00283, -218 }, { 0x00287, 0x00287, 42282 },
+   { 0x00288, 0x00288, -218 }, { 0x00289, 0x00289, -69 }, { 0x0028A, 0x0028B, -217 }, { 0x0028C, 0x0028C, -71 },
+   { 0x00292, 0x00292, -219 }, { 0x0029D, 0x0029D, 42261 }, { 0x0029E, 0x0029E, 42258 }, { 0x00345, 0x00345, 84 },
+   { 0x00370, 0x00373, NFAI_FOLD_ALTERNATE }, { 0x00376, 0x00377, NFAI_FOLD_ALTERNATE }, { 0x0037B, 0x0037D, 130 }, { 0x0037F, 0x0037F, 116 },
+   { 0x00386, 0x00386, 38 }, { 0x00388, 0x0038A, 37 }, { 0x0038C, 0x0038C, 64 }, { 0x0038E, 0x0038F, 63 },
+   { 0x00391, 0x003A1, 32 }, { 0x003A3, 0x003A3, 31 }, { 0x003A4, 0x003AB, 32 }, { 0x003AC, 0x003AC, -38 },
+   { 0x003AD, 0x003AF, -37 }, { 0x003B1, 0x003B1, -32 }, { 0x003B2, 0x003B2, 30 }, { 0x003B3, 0x003B4, -32 },
+   { 0x003B5, 0x003B5, 64 }, { 0x003B6, 0x003B7, -32 }, { 0x003B8, 0x003B8, 25 }, { 0x003B9, 0x003B9, 7173 },
+   { 0x003BA, 0x003BA, 54 }, { 0x003BB, 0x003BB, -32 }, { 0x003BC, 0x003BC, -775 }, { 0x003BD, 0x003BF, -32 },
+   { 0x003C0, 0x003C0, 22 }, { 0x003C1, 0x003C1, 48 }, { 0x003C2, 0x003C2, 1 }, { 0x003C3, 0x003C5, -32 },
+   { 0x003C6, 0x003C6, 15 }, { 0x003C7, 0x003C8, -32 }, { 0x003C9, 0x003C9, 7517 }, { 0x003CA, 0x003CB, -32 },
+   { 0x003CC, 0x003CC, -64 }, { 0x003CD, 0x003CE, -63 }, { 0x003CF, 0x003CF, 8 }, { 0x003D0, 0x003D0, -62 },
+   { 0x003D1, 0x003D1, 35 }, { 0x003D5, 0x003D5, -47 }, { 0x003D6, 0x003D6, -54 }, { 0x003D7, 0x003D7, -8 },
+   { 0x003D8, 0x003EF, NFAI_FOLD_ALTERNATE }, { 0x003F0, 0x003F0, -86 }, { 0x003F1, 0x003F1, -80 }, { 0x003F2, 0x003F2, 7 },
+   { 0x003F3, 0x003F3, -116 }, { 0x003F4, 0x003F4, -92 }, { 0x003F5, 0x003F5, -96 }, { 0x003F7, 0x003F8, NFAI_FOLD_ALTERNATE },
+   { 0x003F9, 0x003F9, -7 }, { 0x003FA, 0x003FB, NFAI_FOLD_ALTERNATE }, { 0x003FD, 0x003FF, -130 }, { 0x00400, 0x0040F, 80 },
+   { 0x00410, 0x0042F, 32 }, { 0x00430, 0x00431, -32 }, { 0x00432, 0x00432, 6222 }, { 0x00433, 0x00433, -32 },
+   { 0x00434, 0x00434, 6221 }, { 0x00435, 0x0043D, -32 }, { 0x0043E, 0x0043E, 6212 }, { 0x0043F, 0x00440, -32 },
+   { 0x00441, 0x00442, 6210 }, { 0x00443, 0x00449, -32 }, { 0x0044A, 0x0044A, 6204 }, { 0x0044B, 0x0044F, -32 },
+   { 0x00450, 0x0045F, -80 }, { 0x00460, 0x00461, NFAI_FOLD_ALTERNATE }, { 0x00462, 0x00462, 1 }, { 0x00463, 0x00463, 6180 },
+   { 0x00464, 0x00481, NFAI_FOLD_ALTERNATE }, { 0x0048A, 0x004BF, NFAI_FOLD_ALTERNATE }, { 0x004C0, 0x004C0, 15 }, { 0x004C1, 0x004CE, NFAI_FOLD_ALTERNATE },
+   { 0x004CF, 0x004CF, -15 }, { 0x004D0, 0x0052F, NFAI_FOLD_ALTERNATE }, { 0x00531, 0x00556, 48 }, { 0x00561, 0x00586, -48 },
+   { 0x010A0, 0x010C5, 7264 }, { 0x010C7, 0x010C7, 7264 }, { 0x010CD, 0x010CD, 7264 }, { 0x010D0, 0x010FA, 3008 },
+   { 0x010FD, 0x010FF, 3008 }, { 0x013A0, 0x013EF, 38864 }, { 0x013F0, 0x013F5, 8 }, { 0x013F8, 0x013FD, -8 },
+   { 0x01C80, 0x01C80, -6254 }, { 0x01C81, 0x01C81, -6253 }, { 0x01C82, 0x01C82, -6244 }, { 0x01C83, 0x01C83, -6242 },
+   { 0x01C84, 0x01C84, 1 }, { 0x01C85, 0x01C85, -6243 }, { 0x01C86, 0x01C86, -6236 }, { 0x01C87, 0x01C87, -6181 },
+   { 0x01C88, 0x01C88, 35266 }, { 0x01C90, 0x01CBA, -3008 }, { 0x01CBD, 0x01CBF, -3008 }, { 0x01D79, 0x01D79, 35332 },
+   { 0x01D7D, 0x01D7D, 3814 }, { 0x01D8E, 0x01D8E, 35384 }, { 0x01E00, 0x01E5F, NFAI_FOLD_ALTERNATE }, { 0x01E60, 0x01E60, 1 },
+   { 0x01E61, 0x01E61, 58 }, { 0x01E62, 0x01E95, NFAI_FOLD_ALTERNATE }, { 0x01E9B, 0x01E9B, -59 }, { 0x01E9E, 0x01E9E, -7615 },
+   { 0x01EA0, 0x01EFF, NFAI_FOLD_ALTERNATE }, { 0x01F00, 0x01F07, 8 }, { 0x01F08, 0x01F0F, -8 }, { 0x01F10, 0x01F15, 8 },
+   { 0x01F18, 0x01F1D, -8 }, { 0x01F20, 0x01F27, 8 }, { 0x01F28, 0x01F2F, -8 }, { 0x01F30, 0x01F37, 8 },
+   { 0x01F38, 0x01F3F, -8 }, { 0x01F40, 0x01F45, 8 }, { 0x01F48, 0x01F4D, -8 }, { 0x01F51, 0x01F51, 8 },
+   { 0x01F53, 0x01F53, 8 }, { 0x01F55, 0x01F55, 8 }, { 0x01F57, 0x01F57, 8 }, { 0x01F59, 0x01F59, -8 },
+   { 0x01F5B, 0x01F5B, -8 }, { 0x01F5D, 0x01F5D, -8 }, { 0x01F5F, 0x01F5F, -8 }, { 0x01F60, 0x01F67, 8 },
+   { 0x01F68, 0x01F6F, -8 }, { 0x01F70, 0x01F71, 74 }, { 0x01F72, 0x01F75, 86 }, { 0x01F76, 0x01F77, 100 },
+   { 0x01F78, 0x01F79, 128 }, { 0x01F7A, 0x01F7B, 112 }, { 0x01F7C, 0x01F7D, 126 }, { 0x01F80, 0x01F87, 8 },
+   { 0x01F88, 0x01F8F, -8 }, { 0x01F90, 0x01F97, 8 }, { 0x01F98, 0x01F9F, -8 }, { 0x01FA0, 0x01FA7, 8 },
+   { 0x01FA8, 0x01FAF, -8 }, { 0x01FB0, 0x01FB1, 8 }, { 0x01FB3, 0x01FB3, 9 }, { 0x01FB8, 0x01FB9, -8 },
+   { 0x01FBA, 0x01FBB, -74 }, { 0x01FBC, 0x01FBC, -9 }, { 0x01FBE, 0x01FBE, -7289 }, { 0x01FC3, 0x01FC3, 9 },
+   { 0x01FC8, 0x01FCB, -86 }, { 0x01FCC, 0x01FCC, -9 }, { 0x01FD0, 0x01FD1, 8 }, { 0x01FD8, 0x01FD9, -8 },
+   { 0x01FDA, 0x01FDB, -100 }, { 0x01FE0, 0x01FE1, 8 }, { 0x01FE5, 0x01FE5, 7 }, { 0x01FE8, 0x01FE9, -8 },
+   { 0x01FEA, 0x01FEB, -112 }, { 0x01FEC, 0x01FEC, -7 }, { 0x01FF3, 0x01FF3, 9 }, { 0x01FF8, 0x01FF9, -128 },
+   { 0x01FFA, 0x01FFB, -126 }, { 0x01FFC, 0x01FFC, -9 }, { 0x02126, 0x02126, -7549 }, { 0x0212A, 0x0212A, -8415 },
+   { 0x0212B, 0x0212B, -8294 }, { 0x02132, 0x02132, 28 }, { 0x0214E, 0x0214E, -28 }, { 0x02160, 0x0216F, 16 },
+   { 0x02170, 0x0217F, -16 }, { 0x02183, 0x02184, NFAI_FOLD_ALTERNATE }, { 0x024B6, 0x024CF, 26 }, { 0x024D0, 0x024E9, -26 },
+   { 0x02C00, 0x02C2F, 48 }, { 0x02C30, 0x02C5F, -48 }, { 0x02C60, 0x02C61, NFAI_FOLD_ALTERNATE }, { 0x02C62, 0x02C62, -10743 },
+   { 0x02C63, 0x02C63, -3814 }, { 0x02C64, 0x02C64, -10727 }, { 0x02C65, 0x02C65, -10795 }, { 0x02C66, 0x02C66, -10792 },
+   { 0x02C67, 0x02C6C, NFAI_FOLD_ALTERNATE }, { 0x02C6D, 0x02C6D, -10780 }, { 0x02C6E, 0x02C6E, -10749 }, { 0x02C6F, 0x02C6F, -10783 },
+   { 0x02C70, 0x02C70, -10782 }, { 0x02C72, 0x02C73, NFAI_FOLD_ALTERNATE }, { 0x02C75, 0x02C76, NFAI_FOLD_ALTERNATE }, { 0x02C7E, 0x02C7F, -10815 },
+   { 0x02C80, 0x02CE3, NFAI_FOLD_ALTERNATE }, { 0x02CEB, 0x02CEE, NFAI_FOLD_ALTERNATE }, { 0x02CF2, 0x02CF3, NFAI_FOLD_ALTERNATE }, { 0x02D00, 0x02D25, -7264 },
+   { 0x02D27, 0x02D27, -7264 }, { 0x02D2D, 0x02D2D, -7264 }, { 0x0A640, 0x0A649, NFAI_FOLD_ALTERNATE }, { 0x0A64A, 0x0A64A, 1 },
+   { 0x0A64B, 0x0A64B, -35267 }, { 0x0A64C, 0x0A66D, NFAI_FOLD_ALTERNATE }, { 0x0A680, 0x0A69B, NFAI_FOLD_ALTERNATE }, { 0x0A722, 0x0A72F, NFAI_FOLD_ALTERNATE },
+   { 0x0A732, 0x0A76F, NFAI_FOLD_ALTERNATE }, { 0x0A779, 0x0A77C, NFAI_FOLD_ALTERNATE }, { 0x0A77D, 0x0A77D, -35332 }, { 0x0A77E, 0x0A787, NFAI_FOLD_ALTERNATE },
+   { 0x0A78B, 0x0A78C, NFAI_FOLD_ALTERNATE }, { 0x0A78D, 0x0A78D, -42280 }, { 0x0A790, 0x0A793, NFAI_FOLD_ALTERNATE }, { 0x0A794, 0x0A794, 48 },
+   { 0x0A796, 0x0A7A9, NFAI_FOLD_ALTERNATE }, { 0x0A7AA, 0x0A7AA, -42308 }, { 0x0A7AB, 0x0A7AB, -42319 }, { 0x0A7AC, 0x0A7AC, -42315 },
+   { 0x0A7AD, 0x0A7AD, -42305 }, { 0x0A7AE, 0x0A7AE, -42308 }, { 0x0A7B0, 0x0A7B0, -42258 }, { 0x0A7B1, 0x0A7B1, -42282 },
+   { 0x0A7B2, 0x0A7B2, -42261 }, { 0x0A7B3, 0x0A7B3, 928 }, { 0x0A7B4, 0x0A7C3, NFAI_FOLD_ALTERNATE }, { 0x0A7C4, 0x0A7C4, -48 },
+   { 0x0A7C5, 0x0A7C5, -42307 }, { 0x0A7C6, 0x0A7C6, -35384 }, { 0x0A7C7, 0x0A7CA, NFAI_FOLD_ALTERNATE }, { 0x0A7D0, 0x0A7D1, NFAI_FOLD_ALTERNATE },
+   { 0x0A7D6, 0x0A7D9, NFAI_FOLD_ALTERNATE }, { 0x0A7F5, 0x0A7F6, NFAI_FOLD_ALTERNATE }, { 0x0AB53, 0x0AB53, -928 }, { 0x0AB70, 0x0ABBF, -38864 },
+   { 0x0FF21, 0x0FF3A, 32 }, { 0x0FF41, 0x0FF5A, -32 }, { 0x10400, 0x10427, 40 }, { 0x10428, 0x1044F, -40 },
+   { 0x104B0, 0x104D3, 40 }, { 0x104D8, 0x104FB, -40 }, { 0x10570, 0x1057A, 39 }, { 0x1057C, 0x1058A, 39 },
+   { 0x1058C, 0x10592, 39 }, { 0x10594, 0x10595, 39 }, { 0x10597, 0x105A1, -39 }, { 0x105A3, 0x105B1, -39 },
+   { 0x105B3, 0x105B9, -39 }, { 0x105BB, 0x105BC, -39 }, { 0x10C80, 0x10CB2, 64 }, { 0x10CC0, 0x10CF2, -64 },
+   { 0x118A0, 0x118BF, 32 }, { 0x118C0, 0x118DF, -32 }, { 0x16E40, 0x16E5F, 32 }, { 0x16E60, 0x16E7F, -32 },
+   { 0x1E900, 0x1E921, 34 }, { 0x1E922, 0x1E943, -34 },
+};
+/* END GENERATED UNICODE TABLES */
+
+NFAI_INTERNAL const uint32_t NFAI_ALL_CODEPOINTS[2] = { 0, NFAI_MAX_CODEPOINT };
+
+/* the next member of the code point's simple case folding orbit (or the code point itself) */
+NFAI_INTERNAL uint32_t nfai_fold_next(uint32_t cp) {
+   int lo = 0, hi = NFAI_UNICODE_NFOLDS;
+   while (lo < hi) {
+      const int mid = lo + (hi - lo)/2;
+      const struct NfaiFoldRange *fold = NFAI_UNICODE_FOLDS + mid;
+      if (cp < fold->first) {
+         hi = mid;
+      } else if (cp > fold->last) {
+         lo = mid + 1;
+      } else if (fold->delta == NFAI_FOLD_ALTERNATE) {
+         return (((cp - fold->first) & 1u) ? cp - 1 : cp + 1);
+      } else {
+         return cp + (uint32_t)fold->delta;
+      }
+   }
+   return cp;
+}
+
+/* the categories named by a \p{...} name: a general category ("Lu"), a major class ("L"),
+ * or "LC" (Lu, Ll and Lt); returns a mask of category indexes, or 0 if the name is unknown */
+NFAI_INTERNAL uint32_t nfai_category_mask(const char *name, size_t length) {
+   uint32_t mask = 0;
+   int i;
+   if (length < 1 || length > 2) { return 0; }
+   if (length == 2 && name[0] == 'L' && name[1] == 'C') {
+      return nfai_category_mask("Lu", 2) | nfai_category_mask("Ll", 2) | nfai_category_mask("Lt", 2);
+   }
+   for (i = 0; i < NFAI_UNICODE_NCATEGORIES; ++i) {
+      const char *cat = NFAI_UNICODE_CATEGORY_NAMES + 2*i;
+      if (name[0] == cat[0] && (length == 1 || name[1] == cat[1])) { mask |= (1u << i); }
+   }
+   return mask;
+}
+
+/* a set of code point ranges (each is a first, last pair), allocated in the builder's pool */
+struct NfaiCodepointSet {
+   uint32_t *ranges;
+   int n;
+   int capacity;
+};
+
+NFAI_INTERNAL int nfai_cpset_add(NfaBuilder *builder, struct NfaiCodepointSet *set, uint32_t first, uint32_t last) {
+   NFAI_ASSERT(first <= last);
+   NFAI_ASSERT(last <= NFAI_MAX_CODEPOINT);
+   if (builder->error) { return builder->error; }
+   if (set->n == set->capacity) {
+      /* the old array can't be freed (it's in the builder's pool), but doubling keeps
+       * the total size down to twice the final size */
+      uint32_t *ranges;
+      const int capacity = (set->capacity ? 2*set->capacity : 16);
+      if (capacity > NFAI_MAX_OPS) { return (builder->error = NFA_ERROR_NFA_TOO_LARGE); }
+      ranges = (uint32_t*)nfai_alloc(&builder->alloc, 2*capacity*sizeof(uint32_t));
+      if (!ranges) { return (builder->error = NFA_ERROR_OUT_OF_MEMORY); }
+      if (set->n) { memcpy(ranges, set->ranges, 2*set->n*sizeof(uint32_t)); }
+      set->ranges = ranges;
+      set->capacity = capacity;
+   }
+   /* (ranges are usually added in order, so merge with the last one if possible) */
+   if (set->n && set->ranges[2*set->n - 1] + 1 >= first && set->ranges[2*set->n - 2] <= first) {
+      if (last > set->ranges[2*set->n - 1]) { set->ranges[2*set->n - 1] = last; }
+      return 0;
+   }
+   set->ranges[2*set->n] = first;
+   set->ranges[2*set->n + 1] = last;
+   ++set->n;
+   return 0;
+}
+
+NFAI_INTERNAL void nfai_cpset_sift(uint32_t *ranges, int root, int n) {
+   for (;;) {
+      uint32_t first, last;
+      int child = 2*root + 1;
+      if (child >= n) { break; }
+      if (child + 1 < n && ranges[2*(child + 1)] > ranges[2*child]) { ++child; }
+      if (ranges[2*root] >= ranges[2*child]) { break; }
+      first = ranges[2*root];
+      last = ranges[2*root + 1];
+      ranges[2*root] = ranges[2*child];
+      ranges[2*root + 1] = ranges[2*child + 1];
+      ranges[2*child] = first;
+      ranges[2*child + 1] = last;
+      root = child;
+   }
+}
+
+/* sort the ranges (with a heap sort) and merge those which overlap or touch */
+NFAI_INTERNAL void nfai_cpset_normalize(struct NfaiCodepointSet *set) {
+   uint32_t *ranges = set->ranges;
+   int i, n = 0;
+   for (i = set->n/2 - 1; i >= 0; --i) { nfai_cpset_sift(ranges, i, set->n); }
+   for (i = set->n - 1; i > 0; --i) {
+      uint32_t first = ranges[0], last = ranges[1];
+      ranges[0] = ranges[2*i];
+      ranges[1] = ranges[2*i + 1];
+      ranges[2*i] = first;
+      ranges[2*i + 1] = last;
+      nfai_cpset_sift(ranges, 0, i);
+   }
+   for (i = 0; i < set->n; ++i) {
+      if (n > 0 && ranges[2*i] <= ranges[2*n - 1] + 1) {
+         if (ranges[2*i + 1] > ranges[2*n - 1]) { ranges[2*n - 1] = ranges[2*i + 1]; }
+      } else {
+         ranges[2*n] = ranges[2*i];
+         ranges[2*n + 1] = ranges[2*i + 1];
+         ++n;
+      }
+   }
+   set->n = n;
+}
+
+/* replace a normalized set with its complement (in a new array) */
+NFAI_INTERNAL int nfai_cpset_complement(NfaBuilder *builder, struct NfaiCodepointSet *set) {
+   struct NfaiCodepointSet comp;
+   uint32_t next = 0;
+   int i;
+   memset(&comp, 0, sizeof(comp));
+   for (i = 0; i < set->n; ++i) {
+      if (set->ranges[2*i] > next) { nfai_cpset_add(builder, &comp, next, set->ranges[2*i] - 1); }
+      next = set->ranges[2*i + 1] + 1;
+   }
+   if (next <= NFAI_MAX_CODEPOINT) { nfai_cpset_add(builder, &comp, next, NFAI_MAX_CODEPOINT); }
+   if (builder->error) { return builder->error; }
+   *set = comp;
+   return 0;
+}
+
+/* add every code point that's equal to one in the set under simple case folding
+ * (orbits have at most four members, so three rounds of mapping each code point to the
+ * next member of its orbit reach all of them) */
+NFAI_INTERNAL int nfai_cpset_fold(NfaBuilder *builder, struct NfaiCodepointSet *set) {
+   int round, i, j, n;
+   for (round = 0; round < 3; ++round) {
+      n = set->n;
+      for (i = 0; i < n; ++i) {
+         const uint32_t first = set->ranges[2*i], last = set->ranges[2*i + 1];
+         for (j = 0; j < NFAI_UNICODE_NFOLDS; ++j) {
+            const struct NfaiFoldRange *fold = NFAI_UNICODE_FOLDS + j;
+            uint32_t a, b;
+            if (fold->last < first) { continue; }
+            if (fold->first > last) { break; }
+            a = (first > fold->first ? first : fold->first);
+            b = (last < fold->last ? last : fold->last);
+            if (fold->delta == NFAI_FOLD_ALTERNATE) {
+               /* (widen [a, b] to whole pairs) */
+               a -= ((a - fold->first) & 1u);
+               b += (((b - fold->first) & 1u) ^ 1u);
+            } else {
+               a += (uint32_t)fold->delta;
+               b += (uint32_t)fold->delta;
+            }
+            if (nfai_cpset_add(builder, set, a, b)) { return builder->error; }
+         }
+      }
+      nfai_cpset_normalize(set);
+   }
+   return 0;
+}
+
+/* add the code points in the categories in 'mask' (see nfai_category_mask) */
+NFAI_INTERNAL int nfai_cpset_add_categories(NfaBuilder *builder, struct NfaiCodepointSet *set, uint32_t mask) {
+   int i;
+   for (i = 0; i < NFAI_UNICODE_NCATEGORY_RUNS; ++i) {
+      const uint32_t run = NFAI_UNICODE_CATEGORY_RUNS[i];
+      if (mask & (1u << (run & 31u))) {
+         uint32_t last = NFAI_MAX_CODEPOINT;
+         if (i + 1 < NFAI_UNICODE_NCATEGORY_RUNS) { last = (NFAI_UNICODE_CATEGORY_RUNS[i + 1] >> 5) - 1; }
+         if (nfai_cpset_add(builder, set, run >> 5, last)) { return builder->error; }
+      }
+   }
+   return 0;
+}
+
+NFAI_INTERNAL int nfai_utf8_encode(uint32_t cp, uint8_t *bytes) {
+   NFAI_ASSERT(cp <= NFAI_MAX_CODEPOINT);
+   if (cp < 0x80u) {
+      bytes[0] = (uint8_t)cp;
+      return 1;
+   } else if (cp < 0x800u) {
+      bytes[0] = (uint8_t)(0xC0u | (cp >> 6));
+      bytes[1] = (uint8_t)(0x80u | (cp & 0x3Fu));
+      return 2;
+   } else if (cp < 0x10000u) {
+      bytes[0] = (uint8_t)(0xE0u | (cp >> 12));
+      bytes[1] = (uint8_t)(0x80u | ((cp >> 6) & 0x3Fu));
+      bytes[2] = (uint8_t)(0x80u | (cp & 0x3Fu));
+      return 3;
+   } else {
+      bytes[0] = (uint8_t)(0xF0u | (cp >> 18));
+      bytes[1] = (uint8_t)(0x80u | ((cp >> 12) & 0x3Fu));
+      bytes[2] = (uint8_t)(0x80u | ((cp >> 6) & 0x3Fu));
+      bytes[3] = (uint8_t)(0x80u | (cp & 0x3Fu));
+      return 4;
+   }
+}
+
+/* The automaton is built from the byte sequences of the ranges in order, sharing suffixes
+ * as it goes (the ranges' sequences are sorted, so once a sequence diverges from the one
+ * before, the nodes below the divergence are finished and can be replaced by an identical
+ * node if one has already been made). This is the approach of the utf8-ranges and
+ * regex-automata Rust crates (and of RE2, which shares suffixes with a cache). */
+
+enum {
+   NFAI_UTF8_HASH_SIZE = 256,
+   NFAI_UTF8_MAX_TRANS = 128 /* per node: at most 64 ASCII ranges and 51 lead bytes */
+};
+
+struct NfaiUtf8Trans {
+   uint8_t first;
+   uint8_t last;
+   int target; /* a finished node (0 is the final node) */
+};
+
+struct NfaiUtf8Node {
+   struct NfaiUtf8Trans *trans;
+   int ntrans;
+   int next; /* next node in the same hash chain (or -1) */
+   int at;   /* position of the node's code */
+   int size; /* size of the node's code */
+};
+
+struct NfaiUtf8Compiler {
+   NfaBuilder *builder;
+   struct NfaiUtf8Node *nodes; /* finished nodes */
+   int nnodes;
+   int capacity;
+   int buckets[NFAI_UTF8_HASH_SIZE];
+   /* unfinished nodes, along the path of the latest sequence */
+   struct NfaiUtf8Trans *pending[4]; /* transitions whose targets are finished */
+   int npending[4];
+   uint8_t last_first[4], last_last[4]; /* the transition to the next unfinished node */
+   int depth; /* number of unfinished nodes (the root is always unfinished) */
+   int started; /* (bool) whether any sequences have been added */
+};
+
+NFAI_INTERNAL int nfai_utf8_init(NfaBuilder *builder, struct NfaiUtf8Compiler *c) {
+   int i;
+   memset(c, 0, sizeof(*c));
+   c->builder = builder;
+   for (i = 0; i < NFAI_UTF8_HASH_SIZE; ++i) { c->buckets[i] = -1; }
+   for (i = 0; i < 4; ++i) {
+      c->pending[i] = (struct NfaiUtf8Trans*)nfai_alloc(&builder->alloc, NFAI_UTF8_MAX_TRANS*sizeof(struct NfaiUtf8Trans));
+      if (!c->pending[i]) { return (builder->error = NFA_ERROR_OUT_OF_MEMORY); }
+   }
+   c->capacity = 16;
+   c->nodes = (struct NfaiUtf8Node*)nfai_zalloc(&builder->alloc, c->capacity*sizeof(struct NfaiUtf8Node));
+   if (!c->nodes) { return (builder->error = NFA_ERROR_OUT_OF_MEMORY); }
+   c->nnodes = 1; /* the final node, which has no transitions */
+   c->depth = 1;
+   return 0;
+}
+
+/* find or make a finished node with the given transitions; returns its index, or -1 */
+NFAI_INTERNAL int nfai_utf8_finish_node(struct NfaiUtf8Compiler *c, const struct NfaiUtf8Trans *trans, int ntrans) {
+   struct NfaiUtf8Node *node;
+   uint32_t h = 2166136261u;
+   int i, k;
+
+   NFAI_ASSERT(ntrans > 0);
+   for (i = 0; i < ntrans; ++i) {
+      h = nfai_hash_word(h, ((uint32_t)trans[i].first << 8) | trans[i].last);
+      h = nfai_hash_word(h, (uint32_t)trans[i].target);
+   }
+   h %= NFAI_UTF8_HASH_SIZE;
+   for (k = c->buckets[h]; k >= 0; k = c->nodes[k].next) {
+      node = c->nodes + k;
+      if (node->ntrans != ntrans) { continue; }
+      for (i = 0; i < ntrans; ++i) {
+         if (node->trans[i].first != trans[i].first || node->trans[i].last != trans[i].last ||
+               node->trans[i].target != trans[i].target) { break; }
+      }
+      if (i == ntrans) { return k; }
+   }
+
+   if (c->nnodes == c->capacity) {
+      struct NfaiUtf8Node *nodes;
+      if (c->capacity > NFAI_MAX_OPS / 2) { c->builder->error = NFA_ERROR_NFA_TOO_LARGE; return -1; }
+      nodes = (struct NfaiUtf8Node*)nfai_alloc(&c->builder->alloc, 2*c->capacity*sizeof(struct NfaiUtf8Node));
+      if (!nodes) { c->builder->error = NFA_ERROR_OUT_OF_MEMORY; return -1; }
+      memcpy(nodes, c->nodes, c->nnodes*sizeof(struct NfaiUtf8Node));
+      c->nodes = nodes;
+      c->capacity *= 2;
+   }
+   node = c->nodes + c->nnodes;
+   node->trans = (struct NfaiUtf8Trans*)nfai_alloc(&c->builder->alloc, ntrans*sizeof(struct NfaiUtf8Trans));
+   if (!node->trans) { c->builder->error = NFA_ERROR_OUT_OF_MEMORY; return -1; }
+   memcpy(node->trans, trans, ntrans*sizeof(struct NfaiUtf8Trans));
+   node->ntrans = ntrans;
+   node->next = c->buckets[h];
+   c->buckets[h] = c->nnodes;
+   return c->nnodes++;
+}
+
+NFAI_INTERNAL void nfai_utf8_add_trans(struct NfaiUtf8Compiler *c, int level, int target) {
+   struct NfaiUtf8Trans *trans = c->pending[level];
+   const int n = c->npending[level];
+   if (n && trans[n - 1].target == target && trans[n - 1].last + 1 == c->last_first[level]) {
+      trans[n - 1].last = c->last_last[level];
+   } else {
+      NFAI_ASSERT(n < NFAI_UTF8_MAX_TRANS);
+      trans[n].first = c->last_first[level];
+      trans[n].last = c->last_last[level];
+      trans[n].target = target;
+      ++c->npending[level];
+   }
+}
+
+/* finish the unfinished nodes below 'level' */
+NFAI_INTERNAL int nfai_utf8_finish_from(struct NfaiUtf8Compiler *c, int level) {
+   int target = 0;
+   while (c->depth > level + 1) {
+      const int at = --c->depth;
+      nfai_utf8_add_trans(c, at, target);
+      target = nfai_utf8_finish_node(c, c->pending[at], c->npending[at]);
+      if (target < 0) { return c->builder->error; }
+      c->npending[at] = 0;
+   }
+   nfai_utf8_add_trans(c, level, target);
+   return 0;
+}
+
+NFAI_INTERNAL int nfai_utf8_add_sequence(struct NfaiUtf8Compiler *c, const uint8_t *first, const uint8_t *last, int length) {
+   int prefix = 0, i;
+   /* (the root has no transition to an unfinished node before the first sequence) */
+   if (c->started) {
+      while (prefix < c->depth && prefix < length &&
+            c->last_first[prefix] == first[prefix] && c->last_last[prefix] == last[prefix]) { ++prefix; }
+      NFAI_ASSERT(prefix < length);
+      if (nfai_utf8_finish_from(c, prefix)) { return c->builder->error; }
+   }
+   c->last_first[prefix] = first[prefix];
+   c->last_last[prefix] = last[prefix];
+   for (i = prefix + 1; i < length; ++i) {
+      c->npending[i] = 0;
+      c->last_first[i] = first[i];
+      c->last_last[i] = last[i];
+   }
+   c->depth = length;
+   c->started = 1;
+   return 0;
+}
+
+/* split [first, last] into ranges whose encodings are the same length and are each a
+ * sequence of byte ranges, and add them (leaving out the surrogates) */
+NFAI_INTERNAL int nfai_utf8_add_range(struct NfaiUtf8Compiler *c, uint32_t first, uint32_t last) {
+   static const uint32_t MAX_FOR_LENGTH[3] = { 0x7Fu, 0x7FFu, 0xFFFFu };
+   uint32_t stack[16];
+   uint8_t a[4], b[4];
+   int nstack = 0, i, n;
+
+   stack[nstack++] = first;
+   stack[nstack++] = last;
+   while (nstack) {
+      last = stack[--nstack];
+      first = stack[--nstack];
+   split:
+      if (first <= 0xDFFFu && last >= 0xD800u) {
+         if (last > 0xDFFFu) {
+            stack[nstack++] = 0xE000u;
+            stack[nstack++] = last;
+         }
+         if (first >= 0xD800u) { continue; }
+         last = 0xD7FFu;
+      }
+      for (i = 0; i < 3; ++i) {
+         if (first <= MAX_FOR_LENGTH[i] && last > MAX_FOR_LENGTH[i]) {
+            stack[nstack++] = MAX_FOR_LENGTH[i] + 1;
+            stack[nstack++] = last;
+            last = MAX_FOR_LENGTH[i];
+            goto split;
+         }
+      }
+      if (last >= 0x80u) {
+         for (i = 1; i < 4; ++i) {
+            const uint32_t m = (1u << (6*i)) - 1;
+            if ((first & ~m) != (last & ~m)) {
+               if ((first & m) != 0) {
+                  stack[nstack++] = (first | m) + 1;
+                  stack[nstack++] = last;
+                  last = first | m;
+                  goto split;
+               }
+               if ((last & m) != m) {
+                  stack[nstack++] = last & ~m;
+                  stack[nstack++] = last;
+                  last = (last & ~m) - 1;
+                  goto split;
+               }
+            }
+         }
+      }
+      NFAI_ASSERT(nstack <= 14);
+      n = nfai_utf8_encode(first, a);
+      nfai_utf8_encode(last, b);
+      if (nfai_utf8_add_sequence(c, a, b, n)) { return c->builder->error; }
+   }
+   return 0;
+}
+
+/* The code for a node is a fork with a branch for each distinct target, each of which
+ * matches the bytes that lead there and jumps to the target's code. Nodes are laid out
+ * from the root down (targets are always finished before the nodes that refer to them,
+ * so all the jumps are forward), and the branch to the node laid out next goes last,
+ * so that it can fall through to it without a jump. Writes the code at node->at
+ * (if 'ops' is not NULL); returns the size. */
+NFAI_INTERNAL int nfai_utf8_node_code(const struct NfaiUtf8Compiler *c, int k, NfaOpcode *ops, int end) {
+   const struct NfaiUtf8Node *node = c->nodes + k;
+   int targets[NFAI_UTF8_MAX_TRANS], ntargets = 0, i, j, n, one, single, at, branch;
+
+   for (i = 0; i < node->ntrans; ++i) {
+      for (j = 0; j < ntargets && targets[j] != node->trans[i].target; ++j) {}
+      if (j == ntargets) { targets[ntargets++] = node->trans[i].target; }
+   }
+   for (j = 0; j < ntargets - 1; ++j) {
+      if (targets[j] == k - 1) {
+         targets[j] = targets[ntargets - 1];
+         targets[ntargets - 1] = k - 1;
+      }
+   }
+
+   at = (ops ? node->at : 0);
+   branch = at;
+   if (ntargets > 1) { at += 1 + ntargets; }
+   for (j = 0; j < ntargets; ++j) {
+      const int target = targets[j];
+      for (i = n = one = 0; i < node->ntrans; ++i) {
+         if (node->trans[i].target == target) { one = i; ++n; }
+      }
+      single = (n == 1 && node->trans[one].first == node->trans[one].last);
+      if (ops) {
+         if (ntargets > 1) { ops[branch + 1 + j] = (NfaOpcode)(at - (branch + 1 + ntargets)); }
+         if (single) {
+            ops[at] = NFAI_OP_MATCH_BYTE | node->trans[one].first;
+         } else {
+            ops[at] = NFAI_OP_MATCH_CLASS | (uint8_t)n;
+            for (i = n = 0; i < node->ntrans; ++i) {
+               if (node->trans[i].target == target) {
+                  ops[at + 1 + n++] = ((NfaOpcode)node->trans[i].first << 8) | node->trans[i].last;
+               }
+            }
+         }
+      }
+      at += (single ? 1 : 1 + n);
+      if (j < ntargets - 1 || target != k - 1) {
+         if (ops) {
+            ops[at] = NFAI_OP_JUMP | 1u;
+            ops[at + 1] = (NfaOpcode)((target ? c->nodes[target].at : end) - (at + 2));
+         }
+         at += 2;
+      }
+   }
+   if (ops) {
+      if (ntargets > 1) { ops[branch] = NFAI_OP_JUMP | (uint8_t)ntargets; }
+      return at - node->at;
+   }
+   return at;
+}
+
+/* push a matcher for a normalized set of code points */
+NFAI_INTERNAL int nfai_build_codepoint_set(NfaBuilder *builder, const struct NfaiCodepointSet *set) {
+   struct NfaiUtf8Compiler c;
+   struct NfaiFragment *frag;
+   int i, k, root, size;
+
+   if (builder->error) { return builder->error; }
+   if (set->n == 0) { return nfai_push_single_op(builder, NFAI_OP_MATCH_CLASS | 0u); }
+
+   if (nfai_utf8_init(builder, &c)) { return builder->error; }
+   for (i = 0; i < set->n; ++i) {
+      if (nfai_utf8_add_range(&c, set->ranges[2*i], set->ranges[2*i + 1])) { return builder->error; }
+   }
+   if (!c.started) {
+      /* (only surrogates) */
+      return nfai_push_single_op(builder, NFAI_OP_MATCH_CLASS | 0u);
+   }
+   if (nfai_utf8_finish_from(&c, 0)) { return builder->error; }
+   root = nfai_utf8_finish_node(&c, c.pending[0], c.npending[0]);
+   if (root < 0) { return builder->error; }
+   NFAI_ASSERT(root == c.nnodes - 1);
+
+   size = 0;
+   for (k = root; k > 0; --k) {
+      c.nodes[k].at = size;
+      size += nfai_utf8_node_code(&c, k, NULL, 0);
+      if (size > NFAI_MAX_JUMP) { return (builder->error = NFA_ERROR_NFA_TOO_LARGE); }
+   }
+   frag = nfai_push_new_fragment(builder, size);
+   if (!frag) { return builder->error; }
+   for (k = root; k > 0; --k) {
+      nfai_utf8_node_code(&c, k, frag->ops, size);
+   }
+   return 0;
+}
+
+/* push a matcher for a set of code points (which is normalized, and may be replaced) */
+NFAI_INTERNAL int nfai_build_codepoints(NfaBuilder *builder, struct NfaiCodepointSet *set, int flags) {
+   nfai_cpset_normalize(set);
+   if (flags & NFA_MATCH_CASE_INSENSITIVE) {
+      if (nfai_cpset_fold(builder, set)) { return builder->error; }
+   }
+   if (flags & NFA_MATCH_COMPLEMENT) {
+      if (nfai_cpset_complement(builder, set)) { return builder->error; }
+   }
+   return nfai_build_codepoint_set(builder, set);
+}
+
+/* push a matcher for a single code point */
+NFAI_INTERNAL int nfai_build_codepoint(NfaBuilder *builder, struct NfaiCodepointSet *scratch, uint32_t cp, int flags) {
+   uint8_t bytes[4];
+   if ((flags & NFA_MATCH_CASE_INSENSITIVE) && nfai_fold_next(cp) != cp) {
+      scratch->n = 0;
+      if (nfai_cpset_add(builder, scratch, cp, cp)) { return builder->error; }
+      return nfai_build_codepoints(builder, scratch, NFA_MATCH_CASE_INSENSITIVE);
+   }
+   return nfa_build_match_string(builder, (const char*)bytes, nfai_utf8_encode(cp, bytes), 0);
+}
+
+NFAI_INTERNAL int nfai_builder_init_internal(NfaBuilder *builder) {
+   NFAI_ASSERT(builder);
+   if (builder->error) { return builder->error; }
+   builder->data = nfai_alloc(&builder->alloc, sizeof(struct NfaiBuilderData));
+   if (!builder->data) { return (builder->error = NFA_ERROR_OUT_OF_MEMORY); }
+   memset(builder->data, 0, sizeof(struct NfaiBuilderData));
+   return nfai_grow_stack(builder, (struct NfaiBuilderData*)builder->data);
+}
+
+NFAI_INTERNAL const char * const NFAI_ERROR_DESC[] = {
+   /* NFA_NO_ERROR                      */ "no error",
+
+   /* NFA_ERROR_OUT_OF_MEMORY           */ "out of memory",
+   /* NFA_ERROR_NFA_TOO_LARGE           */ "NFA too large",
+   /* NFA_ERROR_STACK_OVERFLOW          */ "stack overflow",
+   /* NFA_ERROR_STACK_UNDERFLOW         */ "stack underflow",
+   /* NFA_ERROR_COMPLEMENT_OF_NON_CHAR  */ "complement of non-character pattern",
+   /* NFA_ERROR_UNCLOSED                */ "finish running when the stack contains multiple items",
+   /* NFA_ERROR_BUFFER_TOO_SMALL        */ "output buffer is too small",
+
+   /* NFA_ERROR_REGEX_UNCLOSED_GROUP    */ "unclosed group",
+   /* NFA_ERROR_REGEX_UNEXPECTED_RPAREN */ "unexpected ')'",
+   /* NFA_ERROR_REGEX_REPEATED_EMPTY    */ "repetition of empty expression",
+   /* NFA_ERROR_REGEX_NESTING_OVERFLOW  */ "groups nested too deep",
+   /* NFA_ERROR_REGEX_EMPTY_CHARCLASS   */ "empty character class",
+   /* NFA_ERROR_REGEX_UNCLOSED_CLASS    */ "unclosed character class",
+   /* NFA_ERROR_REGEX_RANGE_BACKWARDS   */ "character range is backwards (first character must be <= last character)",
+   /* NFA_ERROR_REGEX_TRAILING_SLASH    */ "trailing slash (unfinished escape code)",
+   /* NFA_ERROR_REGEX_BAD_REPEAT        */ "invalid repetition count (must be {n}, {n,} or {n,m} with n <= m)",
+   /* NFA_ERROR_NFA_INVALID             */ "NFA data is corrupt or invalid",
+   /* NFA_ERROR_NFA_VERSION             */ "NFA data is from an incompatible version of libnfa (or a machine with different byte order)",
+   /* NFA_ERROR_REGEX_BAD_UTF8          */ "invalid UTF-8 in pattern",
+   /* NFA_ERROR_REGEX_BAD_ESCAPE        */ "invalid escape sequence (\\x{..} must be a Unicode scalar value; \\p{..} must be a name)",
+   /* NFA_ERROR_UNKNOWN_CATEGORY        */ "unknown Unicode general category",
+   /* NFA_ERROR_BAD_TEMPLATE            */ "invalid replacement template ('$' must be followed by '$', a digit, or {n} with n <= 255)",
+   /* ... anything else ...             */ "unknown error"
+};
+
+#ifndef NFA_NO_STDIO
+NFAI_INTERNAL const char NFAI_HEX_DIGITS[] = "0123456789ABCDEF";
+NFAI_INTERNAL const char *nfai_quoted_char(int c, char *buf, size_t bufsize) {
+   NFAI_ASSERT(c >= 0 && c <= UINT8_MAX);
+   /* max length is for "'\xFF'", which is 7 bytes (including null terminator)
+    * this is an assert because nfai_quoted_char is internal, ie, if bufsize is < 7
+    * then that's a bug in the code in this file somewhere */
+   NFAI_ASSERT(bufsize >= 7);
+   if (c >= 32 && c < 127) {
+      buf[0] = '\'';
+      buf[1] = (char)c;
+      buf[2] = '\'';
+      buf[3] = '\0';
+   } else {
+      switch (c) {
+         case 0x00: return "'\\0'";
+         case 0x07: return "'\\a'";
+         case 0x08: return "'\\b'";
+         case 0x09: return "'\\t'";
+         case 0x0A: return "'\\n'";
+         case 0x0B: return "'\\v'";
+         case 0x0C: return "'\\f'";
+         case 0x0D: return "'\\r'";
+         case 0x1B: return "'\\e'";
+         default:
+            buf[0] = '\'';
+            buf[1] = '\\';
+            buf[2] = 'x';
+            buf[3] = NFAI_HEX_DIGITS[((uint8_t)c >> 4) & 15];
+            buf[4] = NFAI_HEX_DIGITS[((uint8_t)c) & 15];
+            buf[5] = '\'';
+            buf[6] = '\0';
+            break;
+      }
+   }
+   return buf;
+}
+
+NFAI_INTERNAL int nfai_print_opcode(const Nfa *nfa, int state, FILE *to) {
+   char buf1[8], buf2[8];
+   NfaOpcode op;
+   int i;
+
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(to);
+   NFAI_ASSERT(state >= 0 && state < nfa->nops);
+
+   i = state;
+   op = nfai_word(nfa, i);
+   fprintf(to, "  %4d: ", i);
+   switch (op & NFAI_OPCODE_MASK) {
       case NFAI_OP_MATCH_ANY:
          fprintf(to, "match any\n");
          break;
       case NFAI_OP_MATCH_BYTE:
-      case NFAI_OP_MATCH_BYTE_CI:
-         fprintf(to, "match byte %s%s\n", nfai_quoted_char(NFAI_LO_BYTE(op), buf1, sizeof(buf1)),
-               ((op & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_BYTE_CI) ? " (case insensitive)" : "");
+         fprintf(to, "match byte %s\n", nfai_quoted_char(NFAI_LO_BYTE(op), buf1, sizeof(buf1)));
          break;
       case NFAI_OP_MATCH_CLASS:
          {
-            int n = NFAI_LO_BYTE(nfa->ops[i]);
+            int n = NFAI_LO_BYTE(op);
             if (n == 1) {
-               ++i;
+               const NfaOpcode range = nfai_word(nfa, ++i);
                fprintf(to, "match range %s--%s (%d--%d)\n",
-                     nfai_quoted_char(NFAI_HI_BYTE(nfa->ops[i]), buf1, sizeof(buf1)),
-                     nfai_quoted_char(NFAI_LO_BYTE(nfa->ops[i]), buf2, sizeof(buf2)),
-                     NFAI_HI_BYTE(nfa->ops[i]), NFAI_LO_BYTE(nfa->ops[i]));
+                     nfai_quoted_char(NFAI_HI_BYTE(range), buf1, sizeof(buf1)),
+                     nfai_quoted_char(NFAI_LO_BYTE(range), buf2, sizeof(buf2)),
+                     NFAI_HI_BYTE(range), NFAI_LO_BYTE(range));
             } else {
                fprintf(to, "match ranges:\n");
                while (n) {
-                  --n; ++i;
+                  const NfaOpcode range = nfai_word(nfa, ++i);
+                  --n;
                   fprintf(to, "            %s--%s (%d--%d)\n",
-                     nfai_quoted_char(NFAI_HI_BYTE(nfa->ops[i]), buf1, sizeof(buf1)),
-                     nfai_quoted_char(NFAI_LO_BYTE(nfa->ops[i]), buf2, sizeof(buf2)),
-                     NFAI_HI_BYTE(nfa->ops[i]), NFAI_LO_BYTE(nfa->ops[i]));
+                     nfai_quoted_char(NFAI_HI_BYTE(range), buf1, sizeof(buf1)),
+                     nfai_quoted_char(NFAI_LO_BYTE(range), buf2, sizeof(buf2)),
+                     NFAI_HI_BYTE(range), NFAI_LO_BYTE(range));
                }
             }
          }
@@ -635,25 +2453,32 @@ NFAI_INTERNAL int nfai_print_opcode(const Nfa *nfa, int state, FILE *to) {
          NFAI_ASSERT(NFAI_LO_BYTE(op) < 32);
          fprintf(to, "assert context (flag 0x%X)\n", (1u << NFAI_LO_BYTE(op)));
          break;
+      case NFAI_OP_ASSERT_LOOK:
+         {
+            static const char *names[NFAI_LOOK_NKINDS] = { "word boundary", "not word boundary", "line start", "line end" };
+            NFAI_ASSERT(NFAI_LO_BYTE(op) < NFAI_LOOK_NKINDS);
+            fprintf(to, "assert %s\n", names[NFAI_LO_BYTE(op)]);
+         }
+         break;
       case NFAI_OP_SAVE_START:
-         fprintf(to, "save start @%d\n", NFAI_LO_BYTE(nfa->ops[i]));
+         fprintf(to, "save start @%d\n", NFAI_LO_BYTE(op));
          break;
       case NFAI_OP_SAVE_END:
-         fprintf(to, "save end @%d\n", NFAI_LO_BYTE(nfa->ops[i]));
+         fprintf(to, "save end @%d\n", NFAI_LO_BYTE(op));
          break;
       case NFAI_OP_JUMP:
          {
-            int base, n = NFAI_LO_BYTE(nfa->ops[i]);
+            int base, n = NFAI_LO_BYTE(op);
             ++i;
             base = i + n;
             if (n == 1) {
-               fprintf(to, "jump %+d (-> %d)\n", (int16_t)nfa->ops[i], base+(int16_t)nfa->ops[i]);
+               fprintf(to, "jump %+d (-> %d)\n", nfai_jump_offset(nfa, i), base + nfai_jump_offset(nfa, i));
             } else {
                int j;
                fprintf(to, "fork\n");
                for (j = 0; j < n; ++j, ++i) {
                   fprintf(to, "           %+d (-> %d)\n",
-                        (int16_t)nfa->ops[i], base+(int16_t)nfa->ops[i]);
+                        nfai_jump_offset(nfa, i), base + nfai_jump_offset(nfa, i));
                }
                --i;
             }
@@ -662,6 +2487,29 @@ NFAI_INTERNAL int nfai_print_opcode(const Nfa *nfa, int state, FILE *to) {
       case NFAI_OP_ACCEPT:
          fprintf(to, "accept\n");
          break;
+      case NFAI_OP_TOKEN:
+         ++i;
+         fprintf(to, "token %d\n", (int)nfai_word(nfa, i));
+         break;
+      case NFAI_OP_MATCH_STRING:
+         {
+            int j, n = NFAI_LO_BYTE(op);
+            fprintf(to, "match string (%d bytes)", n);
+            for (j = 0; j < n; ++j) {
+               fprintf(to, " %s", nfai_quoted_char(nfai_string_byte(nfa, i, j), buf1, sizeof(buf1)));
+            }
+            fprintf(to, "\n");
+            i += nfai_nfa_op_length(nfa, i) - 1;
+         }
+         break;
+      case NFAI_OP_REPEAT:
+         if (NFAI_LO_BYTE(op) & NFAI_REPEAT_UNBOUNDED) {
+            fprintf(to, "repeat {%d,}", (int)nfai_word(nfa, i+1));
+         } else {
+            fprintf(to, "repeat {%d,%d}", (int)nfai_word(nfa, i+1), (int)nfai_word(nfa, i+2));
+         }
+         fprintf(to, "%s:\n", (NFAI_LO_BYTE(op) & NFAI_REPEAT_LAZY) ? " (non-greedy)" : "");
+         return nfai_print_opcode(nfa, i + 3, to);
    }
 
    ++i;
@@ -691,9 +2539,13 @@ struct NfaiRegexParser {
    int ncaptures; /* number of captures so far */
    int capture_groups; /* (bool) whether to capture groups or not */
    int match_flags; /* flags to pass to the character match functions (ie, case-insensitivity) */
+   int utf8; /* (bool) whether characters are UTF-8 encoded code points (NFA_REGEX_UTF8) */
+   int multiline; /* (bool) whether '^' and '$' are line anchors (NFA_REGEX_MULTILINE) */
    int avail; /* characters available in buf */
+   struct NfaiCodepointSet cpset; /* (utf8) code points in the current class */
    uint8_t stack[NFA_BUILDER_MAX_STACK]; /* parser state stack */
    uint8_t captures[NFA_BUILDER_MAX_STACK]; /* capture ID stack */
+   int alts[NFA_BUILDER_MAX_STACK]; /* number of '|' seen in each group */
 };
 
 NFAI_INTERNAL void nfai_regex_parser_fill(struct NfaiRegexParser *parser, const char *begin, const char *end) {
@@ -721,6 +2573,8 @@ NFAI_INTERNAL void nfai_regex_parser_init(struct NfaiRegexParser *parser, const
    parser->ncaptures = 0;
    parser->capture_groups = ((flags & NFA_REGEX_NO_CAPTURES) == 0);
    parser->match_flags = ((flags & NFA_REGEX_CASE_INSENSITIVE) ? NFA_MATCH_CASE_INSENSITIVE : 0);
+   parser->utf8 = ((flags & NFA_REGEX_UTF8) != 0);
+   parser->multiline = ((flags & NFA_REGEX_MULTILINE) != 0);
    nfai_regex_parser_fill(parser, parser->pattern, parser->pattern_end);
 }
 
@@ -730,9 +2584,23 @@ NFAI_INTERNAL uint8_t nfai_regex_parser_nextchar(struct NfaiRegexParser *parser)
    return *parser->at++;
 }
 
-NFAI_INTERNAL char nfai_escaped_char(char c) {
-   switch (c) {
-      case 'r': return '\r';
+/* read the decimal count in a '{n,m}' repetition; returns -1 if there are no digits */
+NFAI_INTERNAL int nfai_regex_parser_count(struct NfaiRegexParser *parser) {
+   int n = -1;
+   for (;;) {
+      if (parser->at > (parser->buf + (NFAI_PARSER_BUF_SIZE - 6))) {
+         nfai_regex_parser_fill(parser, parser->buf_at + (parser->at - parser->buf), parser->pattern_end);
+      }
+      if (parser->avail <= 0 || *parser->at < '0' || *parser->at > '9') { return n; }
+      n = (n < 0 ? 0 : n*10) + (nfai_regex_parser_nextchar(parser) - '0');
+      /* clamp huge counts (they'll be rejected by the builder) */
+      if (n > NFAI_MAX_STATES) { n = NFAI_MAX_STATES + 1; }
+   }
+}
+
+NFAI_INTERNAL char nfai_escaped_char(char c) {
+   switch (c) {
+      case 'r': return '\r';
       case 'n': return '\n';
       case '0': return '\0';
       case 't': return '\t';
@@ -742,6 +2610,136 @@ NFAI_INTERNAL char nfai_escaped_char(char c) {
    }
 }
 
+/* make sure there are at least 6 characters to look ahead at in the buffer (if the pattern has them) */
+NFAI_INTERNAL void nfai_regex_parser_refill(struct NfaiRegexParser *parser) {
+   if (parser->at > (parser->buf + (NFAI_PARSER_BUF_SIZE - 6))) {
+      nfai_regex_parser_fill(parser, parser->buf_at + (parser->at - parser->buf), parser->pattern_end);
+   }
+}
+
+/* (utf8) decode the rest of the UTF-8 sequence which starts with 'c'; returns 0 if it's invalid */
+NFAI_INTERNAL int nfai_regex_parser_utf8(struct NfaiRegexParser *parser, uint8_t c, uint32_t *cp) {
+   static const uint32_t MIN_FOR_LENGTH[4] = { 0u, 0x80u, 0x800u, 0x10000u };
+   int n, i;
+   if (c >= 0xC2u && c <= 0xDFu) { n = 1; }
+   else if (c >= 0xE0u && c <= 0xEFu) { n = 2; }
+   else if (c >= 0xF0u && c <= 0xF4u) { n = 3; }
+   else { return 0; }
+   *cp = c & (0x3Fu >> n);
+   nfai_regex_parser_refill(parser);
+   for (i = 0; i < n; ++i) {
+      if (parser->avail <= 0 || ((uint8_t)*parser->at & 0xC0u) != 0x80u) { return 0; }
+      *cp = (*cp << 6) | (nfai_regex_parser_nextchar(parser) & 0x3Fu);
+   }
+   return (*cp >= MIN_FOR_LENGTH[n] && *cp <= NFAI_MAX_CODEPOINT && (*cp < 0xD800u || *cp > 0xDFFFu));
+}
+
+/* (utf8) read a character (after its first byte, 'c'), which is either a code point or a
+ * \p or \P category; for a category, sets *mask (see nfai_category_mask) and *negated */
+NFAI_INTERNAL int nfai_regex_parser_atom(struct NfaiRegexParser *parser, NfaBuilder *builder, uint8_t c,
+      uint32_t *cp, uint32_t *mask, int *negated) {
+   *mask = 0;
+   *negated = 0;
+   if (c == '\\') {
+      if (parser->avail <= 0) { return (builder->error = NFA_ERROR_REGEX_TRAILING_SLASH); }
+      c = nfai_regex_parser_nextchar(parser);
+      nfai_regex_parser_refill(parser);
+      if (c == 'p' || c == 'P') {
+         char name[2];
+         int n = 0;
+         *negated = (c == 'P');
+         if (parser->avail <= 0) { return (builder->error = NFA_ERROR_REGEX_BAD_ESCAPE); }
+         c = nfai_regex_parser_nextchar(parser);
+         if (c == '{') {
+            for (;;) {
+               nfai_regex_parser_refill(parser);
+               if (parser->avail <= 0) { return (builder->error = NFA_ERROR_REGEX_BAD_ESCAPE); }
+               c = nfai_regex_parser_nextchar(parser);
+               if (c == '}') { break; }
+               if (n < 2) { name[n] = (char)c; }
+               ++n;
+            }
+         } else {
+            name[n++] = (char)c;
+         }
+         *mask = (n <= 2 ? nfai_category_mask(name, n) : 0u);
+         return (*mask ? 0 : (builder->error = NFA_ERROR_UNKNOWN_CATEGORY));
+      } else if (c == 'x' && parser->avail > 0 && *parser->at == '{') {
+         int ndigits = 0;
+         ++parser->at; --parser->avail;
+         *cp = 0;
+         for (;;) {
+            nfai_regex_parser_refill(parser);
+            if (parser->avail <= 0) { return (builder->error = NFA_ERROR_REGEX_BAD_ESCAPE); }
+            c = nfai_regex_parser_nextchar(parser);
+            if (c == '}') { break; }
+            /* (large values stop growing once they're out of range) */
+            if (*cp <= NFAI_MAX_CODEPOINT) { *cp *= 16; }
+            if (c >= '0' && c <= '9') { *cp += c - '0'; }
+            else if (c >= 'a' && c <= 'f') { *cp += c - 'a' + 10; }
+            else if (c >= 'A' && c <= 'F') { *cp += c - 'A' + 10; }
+            else { return (builder->error = NFA_ERROR_REGEX_BAD_ESCAPE); }
+            ++ndigits;
+         }
+         if (!ndigits || *cp > NFAI_MAX_CODEPOINT || (*cp >= 0xD800u && *cp <= 0xDFFFu)) {
+            return (builder->error = NFA_ERROR_REGEX_BAD_ESCAPE);
+         }
+         return 0;
+      } else if (c < 0x80u) {
+         *cp = (uint8_t)nfai_escaped_char((char)c);
+         return 0;
+      }
+   } else if (c < 0x80u) {
+      *cp = c;
+      return 0;
+   }
+   /* (the first byte of a multi-byte character, escaped or not) */
+   return (nfai_regex_parser_utf8(parser, c, cp) ? 0 : (builder->error = NFA_ERROR_REGEX_BAD_UTF8));
+}
+
+/* (utf8) add a character, a range or a category in a class to parser->cpset */
+NFAI_INTERNAL int nfai_regex_parser_class_item(struct NfaiRegexParser *parser, NfaBuilder *builder, uint8_t c) {
+   uint32_t first, last, mask;
+   int negated, i;
+   if (nfai_regex_parser_atom(parser, builder, c, &first, &mask, &negated)) { return builder->error; }
+   if (mask && negated) {
+      struct NfaiCodepointSet cats;
+      memset(&cats, 0, sizeof(cats));
+      if (nfai_cpset_add_categories(builder, &cats, mask)) { return builder->error; }
+      if (nfai_cpset_complement(builder, &cats)) { return builder->error; }
+      for (i = 0; i < cats.n; ++i) {
+         if (nfai_cpset_add(builder, &parser->cpset, cats.ranges[2*i], cats.ranges[2*i + 1])) { return builder->error; }
+      }
+      return 0;
+   } else if (mask) {
+      return nfai_cpset_add_categories(builder, &parser->cpset, mask);
+   }
+   last = first;
+   nfai_regex_parser_refill(parser);
+   if (*parser->at == '-') {
+      ++parser->at; --parser->avail;
+      if (parser->avail <= 0) { return (builder->error = NFA_ERROR_REGEX_UNCLOSED_CLASS); }
+      c = nfai_regex_parser_nextchar(parser);
+      if (nfai_regex_parser_atom(parser, builder, c, &last, &mask, &negated)) { return builder->error; }
+      if (mask) { return (builder->error = NFA_ERROR_REGEX_BAD_ESCAPE); }
+      if (first > last) { return (builder->error = NFA_ERROR_REGEX_RANGE_BACKWARDS); }
+   }
+   return nfai_cpset_add(builder, &parser->cpset, first, last);
+}
+
+/* (utf8) push a matcher for a character (after its first byte, 'c') outside a class */
+NFAI_INTERNAL int nfai_regex_parser_term(struct NfaiRegexParser *parser, NfaBuilder *builder, uint8_t c) {
+   uint32_t cp, mask;
+   int negated;
+   if (nfai_regex_parser_atom(parser, builder, c, &cp, &mask, &negated)) { return builder->error; }
+   if (mask) {
+      parser->cpset.n = 0;
+      if (nfai_cpset_add_categories(builder, &parser->cpset, mask)) { return builder->error; }
+      return nfai_build_codepoints(builder, &parser->cpset, parser->match_flags | (negated ? NFA_MATCH_COMPLEMENT : 0));
+   }
+   return nfai_build_codepoint(builder, &parser->cpset, cp, parser->match_flags);
+}
+
 #define DEBUG_REGEX_PARSER 0
 #if DEBUG_REGEX_PARSER
 #  define NFAI_DEBUG_WRITE(msg) fprintf(stderr, "%s", msg)
@@ -778,8 +2776,18 @@ NFAI_INTERNAL void nfai_regex_parser_step(struct NfaiRegexParser *parser, NfaBui
       if (parser->avail < 0) { builder->error = NFA_ERROR_REGEX_UNCLOSED_CLASS; return; }
       if (c == ']') {
          if ((state & NFAI_REGEX_STATE_JOIN) == 0) { builder->error = NFA_ERROR_REGEX_EMPTY_CLASS; return; }
-         if (state & NFAI_REGEX_STATE_NEGCLASS) { NFAI_DEBUG_WRITE("push/pop: complement\n"); nfa_build_complement_char(builder); }
+         if (parser->utf8) {
+            NFAI_DEBUG_WRITE("push: code points\n");
+            nfai_build_codepoints(builder, &parser->cpset,
+                  parser->match_flags | ((state & NFAI_REGEX_STATE_NEGCLASS) ? NFA_MATCH_COMPLEMENT : 0));
+         } else if (state & NFAI_REGEX_STATE_NEGCLASS) {
+            NFAI_DEBUG_WRITE("push/pop: complement\n"); nfa_build_complement_char(builder);
+         }
          state &= ~(NFAI_REGEX_STATE_CHARCLASS | NFAI_REGEX_STATE_NEGCLASS);
+      } else if (parser->utf8) {
+         /* (the class is pushed as a whole, at the end) */
+         nfai_regex_parser_class_item(parser, builder, (uint8_t)c);
+         state |= NFAI_REGEX_STATE_JOIN;
       } else {
          uint8_t first, last;
          if (c == '\\') {
@@ -812,15 +2820,16 @@ NFAI_INTERNAL void nfai_regex_parser_step(struct NfaiRegexParser *parser, NfaBui
          if (parser->top > 1 && parser->avail < 0) { builder->error = NFA_ERROR_REGEX_UNCLOSED_GROUP; return; }
          if (parser->top <= 1 && c == ')') { builder->error = NFA_ERROR_REGEX_UNEXPECTED_RPAREN; return; }
          if (state & NFAI_REGEX_STATE_JOIN) { NFAI_DEBUG_WRITE("push/pop: join\n"); nfa_build_join(builder); }
-         if (state & NFAI_REGEX_STATE_ALT) { NFAI_DEBUG_WRITE("push/pop: alt\n"); nfa_build_alt(builder); }
+         if (state & NFAI_REGEX_STATE_ALT) { NFAI_DEBUG_WRITE("push/pop: alt\n"); nfa_build_alt_n(builder, parser->alts[parser->top] + 1); }
          if (state & NFAI_REGEX_STATE_CAPTURE) { NFAI_DEBUG_WRITE("push/pop: capture\n"); nfa_build_capture(builder, parser->captures[parser->top]); }
          parser->stack[parser->top] = 0;
+         parser->alts[parser->top] = 0;
          --parser->top;
          state = parser->stack[parser->top];
       } else if (c == '|') {
-         /* alternation */
+         /* alternation (the alternatives are collected on the stack until the end of the group) */
          if (state & NFAI_REGEX_STATE_JOIN) { NFAI_DEBUG_WRITE("push/pop: join\n"); nfa_build_join(builder); }
-         if (state & NFAI_REGEX_STATE_ALT) { NFAI_DEBUG_WRITE("push/pop: alt\n"); nfa_build_alt(builder); }
+         ++parser->alts[parser->top];
          NFAI_DEBUG_WRITE("push: empty\n"); nfa_build_match_empty(builder);
          state &= ~NFAI_REGEX_STATE_JOIN;
          state |= NFAI_REGEX_STATE_ALT;
@@ -832,6 +2841,22 @@ NFAI_INTERNAL void nfai_regex_parser_step(struct NfaiRegexParser *parser, NfaBui
          if (c == '?') { NFAI_DEBUG_WRITE("push/pop: zero-or-one\n"); nfa_build_zero_or_one(builder, flags); }
          else if (c == '*') { NFAI_DEBUG_WRITE("push/pop: zero-or-more\n"); nfa_build_zero_or_more(builder, flags); }
          else if (c == '+') { NFAI_DEBUG_WRITE("push/pop: one-or-more\n"); nfa_build_one_or_more(builder, flags); }
+      } else if (c == '{') {
+         /* counted repetition */
+         int flags = 0, min, max;
+         if ((state & NFAI_REGEX_STATE_JOIN) == 0) { builder->error = NFA_ERROR_REGEX_REPEATED_EMPTY; return; }
+         min = max = nfai_regex_parser_count(parser);
+         if (min >= 0 && parser->avail > 0 && *parser->at == ',') {
+            ++parser->at; --parser->avail;
+            max = nfai_regex_parser_count(parser);
+         }
+         if (min < 0 || parser->avail <= 0 || *parser->at != '}' || (max >= 0 && max < min)) {
+            builder->error = NFA_ERROR_REGEX_BAD_REPEAT;
+            return;
+         }
+         ++parser->at; --parser->avail;
+         if (*parser->at == '?') { ++parser->at; --parser->avail; flags = NFA_REPEAT_NON_GREEDY; }
+         NFAI_DEBUG_WRITE("push/pop: repeat\n"); nfa_build_repeat(builder, min, max, flags);
       } else { /* term */
          if (state & NFAI_REGEX_STATE_JOIN) { NFAI_DEBUG_WRITE("push/pop: join\n"); nfa_build_join(builder); }
          state |= NFAI_REGEX_STATE_JOIN;
@@ -850,16 +2875,32 @@ NFAI_INTERNAL void nfai_regex_parser_step(struct NfaiRegexParser *parser, NfaBui
             /* STATE_JOIN in char-class used to indicate that we've seen one character (range) already */
             state &= ~NFAI_REGEX_STATE_JOIN;
             state |= NFAI_REGEX_STATE_CHARCLASS;
+            parser->cpset.n = 0;
             if (*parser->at == '^') {
                ++parser->at; --parser->avail;
                state |= NFAI_REGEX_STATE_NEGCLASS;
             }
+         } else if (c == '.' && parser->utf8) {
+            NFAI_DEBUG_WRITE("push: any code point\n"); nfa_build_match_codepoints(builder, NFAI_ALL_CODEPOINTS, 1, 0);
          } else if (c == '.') {
             NFAI_DEBUG_WRITE("push: any\n"); nfa_build_match_any(builder);
+         } else if (c == '^' && parser->multiline) {
+            NFAI_DEBUG_WRITE("push: assert line start\n"); nfa_build_assert_line_start(builder);
+         } else if (c == '$' && parser->multiline) {
+            NFAI_DEBUG_WRITE("push: assert line end\n"); nfa_build_assert_line_end(builder);
          } else if (c == '^') {
             NFAI_DEBUG_WRITE("push: assert start\n"); nfa_build_assert_at_start(builder);
          } else if (c == '$') {
             NFAI_DEBUG_WRITE("push: assert end\n"); nfa_build_assert_at_end(builder);
+         } else if (c == '\\' && parser->avail > 0 && (*parser->at == 'b' || *parser->at == 'B')) {
+            /* (inside a class, '\b' is a backspace) */
+            if (nfai_regex_parser_nextchar(parser) == 'b') {
+               NFAI_DEBUG_WRITE("push: assert word boundary\n"); nfa_build_assert_word_boundary(builder);
+            } else {
+               NFAI_DEBUG_WRITE("push: assert not word boundary\n"); nfa_build_assert_not_word_boundary(builder);
+            }
+         } else if (parser->utf8) {
+            NFAI_DEBUG_WRITE("push: code point\n"); nfai_regex_parser_term(parser, builder, (uint8_t)c);
          } else if (c == '\\') {
             if (parser->avail <= 0) { builder->error = NFA_ERROR_REGEX_TRAILING_SLASH; return; }
             c = nfai_escaped_char(nfai_regex_parser_nextchar(parser));
@@ -899,10 +2940,507 @@ NFAI_INTERNAL void nfai_parse_regex(NfaBuilder *builder, const char *pattern, si
    }
 }
 
+/* ----- OPTIMIZER ----- */
+
+enum {
+   NFAI_OPT_START     = (1u << 0), /* op is the start of an instruction (not an operand) */
+   NFAI_OPT_REACHED   = (1u << 1), /* instruction is reachable from the entry point */
+   NFAI_OPT_KEPT      = (1u << 2), /* instruction is present in the optimized program */
+   NFAI_OPT_CYCLE     = (1u << 3), /* instruction is part of a cycle of non-consuming transitions */
+   NFAI_OPT_ONSTACK   = (1u << 4), /* used by the cycle search */
+   NFAI_OPT_TARGET    = (1u << 5), /* instruction is the entry point or a jump target in the optimized program */
+   NFAI_OPT_MERGED    = (1u << 6), /* byte match which has been merged into a string match with the ops before it */
+   NFAI_OPT_WIDE      = (1u << 7)  /* fork with too many targets to be flattened */
+};
+
+struct NfaiOptimizer {
+   const NfaOpcode *ops;
+   int nops;
+   uint8_t *flags;   /* NFAI_OPT_* flags for each op */
+   int *mark;        /* scratch marks used while flattening forks */
+   int *new_pc;      /* location of each kept instruction in the optimized program */
+   int *ntargets;    /* number of (flattened) targets for each jump instruction */
+   int **targets;    /* (flattened) targets for each jump instruction */
+   int *resolved;    /* the instruction that jumping to each instruction is equivalent to */
+   int *stack;       /* scratch stack used for the reachability and cycle searches */
+   int *run;         /* number of bytes in each merged string match (stored at its first op) */
+   int flatten;      /* (bool) whether nested forks should be flattened */
+   int max_jump;     /* largest jump offset that the NFA's format can store */
+};
+
+NFAI_INTERNAL int nfai_opt_is_jump(const struct NfaiOptimizer *opt, int pc, int njumps) {
+   const NfaOpcode op = opt->ops[pc];
+   if ((op & NFAI_OPCODE_MASK) != NFAI_OP_JUMP) { return 0; }
+   return (njumps ? (NFAI_LO_BYTE(op) == njumps) : (NFAI_LO_BYTE(op) > 1));
+}
+
+NFAI_INTERNAL int nfai_opt_jump_target(const struct NfaiOptimizer *opt, int pc, int i) {
+   const int njumps = NFAI_LO_BYTE(opt->ops[pc]);
+   NFAI_ASSERT(i >= 0 && i < njumps);
+   return pc + 1 + njumps + (int32_t)opt->ops[pc + 1 + i];
+}
+
+/* an assertion which repeats the (identical) assertion immediately before it never changes anything */
+NFAI_INTERNAL int nfai_opt_is_redundant(const struct NfaiOptimizer *opt, int pc) {
+   const NfaOpcode op = opt->ops[pc];
+   if ((op & NFAI_OPCODE_MASK) != NFAI_OP_ASSERT_CONTEXT && (op & NFAI_OPCODE_MASK) != NFAI_OP_ASSERT_LOOK) { return 0; }
+   return (pc > 0 && (opt->flags[pc - 1] & NFAI_OPT_START) && opt->ops[pc - 1] == op);
+}
+
+/* the instruction that jumping to 'pc' would skip to (-1 if it's not a single jump or a redundant assertion) */
+NFAI_INTERNAL int nfai_opt_skip(const struct NfaiOptimizer *opt, int pc) {
+   if (nfai_opt_is_jump(opt, pc, 1)) { return nfai_opt_jump_target(opt, pc, 0); }
+   if (nfai_opt_is_redundant(opt, pc)) { return pc - 1; }
+   return -1;
+}
+
+/* find the instruction that is equivalent to jumping to 'pc', skipping over single jumps
+ * and redundant assertions (without the table built by nfai_opt_find_resolved) */
+NFAI_INTERNAL int nfai_opt_resolve_slowly(const struct NfaiOptimizer *opt, int pc) {
+   int steps, next;
+   /* the step limit stops us going round in circles if there's a jump cycle */
+   for (steps = 0; steps < opt->nops; ++steps) {
+      next = nfai_opt_skip(opt, pc);
+      if (next < 0) { break; }
+      pc = next;
+   }
+   return pc;
+}
+
+/* Fill in opt->resolved. A long chain of alternatives ends each alternative with a jump to
+ * the next jump, so every instruction on a chain of skips is resolved at once. */
+NFAI_INTERNAL int nfai_opt_find_resolved(struct NfaiOptimizer *opt, NfaPoolAllocator *pool) {
+   int *chain;
+   int root, at, next, n, i, to;
+
+   opt->resolved = (int*)nfai_alloc(pool, opt->nops*sizeof(int));
+   chain = (int*)nfai_alloc(pool, opt->nops*sizeof(int));
+   if (!opt->resolved || !chain) { return NFA_ERROR_OUT_OF_MEMORY; }
+   for (at = 0; at < opt->nops; ++at) { opt->resolved[at] = -1; }
+
+   for (root = 0; root < opt->nops; root += nfai_op_length(opt->ops + root)) {
+      n = 0;
+      /* (-2 marks an instruction on the current chain) */
+      for (at = root; opt->resolved[at] == -1 && (next = nfai_opt_skip(opt, at)) >= 0; at = next) {
+         opt->resolved[at] = -2;
+         chain[n++] = at;
+      }
+      if (opt->resolved[at] == -2) {
+         /* a jump cycle */
+         for (i = 0; i < n; ++i) { opt->resolved[chain[i]] = nfai_opt_resolve_slowly(opt, chain[i]); }
+         continue;
+      }
+      if (opt->resolved[at] == -1) { opt->resolved[at] = at; }
+      to = opt->resolved[at];
+      for (i = 0; i < n; ++i) { opt->resolved[chain[i]] = to; }
+   }
+   return 0;
+}
+
+NFAI_INTERNAL int nfai_opt_resolve(const struct NfaiOptimizer *opt, int pc) {
+   NFAI_ASSERT(opt->resolved[pc] >= 0);
+   return opt->resolved[pc];
+}
+
+/* successors of an instruction which can be reached without consuming input (-1 when there are no more) */
+NFAI_INTERNAL int nfai_opt_epsilon_successor(const struct NfaiOptimizer *opt, int pc, int i) {
+   switch (opt->ops[pc] & NFAI_OPCODE_MASK) {
+      case NFAI_OP_JUMP:
+         return (i < NFAI_LO_BYTE(opt->ops[pc]) ? nfai_opt_jump_target(opt, pc, i) : -1);
+      case NFAI_OP_ASSERT_CONTEXT:
+      case NFAI_OP_ASSERT_LOOK:
+      case NFAI_OP_SAVE_START:
+      case NFAI_OP_SAVE_END:
+         return (i == 0 ? pc + 1 : -1);
+      case NFAI_OP_REPEAT:
+         /* with a minimum count of zero, the body can be skipped */
+         return (i == 0 && opt->ops[pc + 1] == 0 ? pc + nfai_op_length(opt->ops + pc) : -1);
+      default:
+         return -1;
+   }
+}
+
+/* Flattening a fork that lies on a cycle of non-consuming transitions would change the
+ * order in which the executor traces states (the executor stops at a fork which it's
+ * already in the middle of tracing), so those forks have to be found and left alone.
+ * This is Tarjan's strongly connected components algorithm, without recursion. */
+NFAI_INTERNAL int nfai_opt_find_cycles(struct NfaiOptimizer *opt, NfaPoolAllocator *pool) {
+   int *index, *lowlink, *frame_pc, *frame_i;
+   int counter = 0, nscc = 0, nframes, root;
+   const int n = opt->nops;
+
+   index = (int*)nfai_alloc(pool, n*sizeof(int));
+   lowlink = (int*)nfai_alloc(pool, n*sizeof(int));
+   frame_pc = (int*)nfai_alloc(pool, n*sizeof(int));
+   frame_i = (int*)nfai_alloc(pool, n*sizeof(int));
+   if (!index || !lowlink || !frame_pc || !frame_i) { return NFA_ERROR_OUT_OF_MEMORY; }
+   for (root = 0; root < n; ++root) { index[root] = -1; }
+
+   for (root = 0; root < n; root += nfai_op_length(opt->ops + root)) {
+      if (index[root] >= 0) { continue; }
+      nframes = 0;
+      frame_pc[nframes] = root;
+      frame_i[nframes++] = 0;
+      index[root] = lowlink[root] = counter++;
+      opt->stack[nscc++] = root;
+      opt->flags[root] |= NFAI_OPT_ONSTACK;
+      while (nframes) {
+         const int v = frame_pc[nframes - 1];
+         const int w = nfai_opt_epsilon_successor(opt, v, frame_i[nframes - 1]++);
+         if (w >= 0) {
+            if (w == v) { opt->flags[v] |= NFAI_OPT_CYCLE; }
+            if (index[w] < 0) {
+               index[w] = lowlink[w] = counter++;
+               opt->stack[nscc++] = w;
+               opt->flags[w] |= NFAI_OPT_ONSTACK;
+               frame_pc[nframes] = w;
+               frame_i[nframes++] = 0;
+            } else if (opt->flags[w] & NFAI_OPT_ONSTACK) {
+               if (index[w] < lowlink[v]) { lowlink[v] = index[w]; }
+            }
+         } else {
+            --nframes;
+            if (nframes && lowlink[v] < lowlink[frame_pc[nframes - 1]]) {
+               lowlink[frame_pc[nframes - 1]] = lowlink[v];
+            }
+            if (lowlink[v] == index[v]) {
+               /* v is the root of a component; pop it */
+               const int cycle = (opt->stack[nscc - 1] != v);
+               int x;
+               do {
+                  x = opt->stack[--nscc];
+                  opt->flags[x] &= ~NFAI_OPT_ONSTACK;
+                  if (cycle) { opt->flags[x] |= NFAI_OPT_CYCLE; }
+               } while (x != v);
+            }
+         }
+      }
+   }
+   return 0;
+}
+
+/* whether a jump target would be replaced by its own (flattened) targets */
+NFAI_INTERNAL int nfai_opt_flattens(const struct NfaiOptimizer *opt, int pc) {
+   return (opt->flatten && nfai_opt_is_jump(opt, pc, 0) && !(opt->flags[pc] & NFAI_OPT_CYCLE));
+}
+
+/* The targets of a jump, in the order that the executor would trace them. A target that's
+ * a fork is replaced by its own targets, which have already been found (so each fork is only
+ * expanded once). Returns -1 if there are too many targets. */
+NFAI_INTERNAL int nfai_opt_expand_fork(struct NfaiOptimizer *opt, int pc, int *to, int stamp) {
+   int i, j, n = 0, njumps;
+   NFAI_ASSERT(nfai_opt_is_jump(opt, pc, 0) || nfai_opt_is_jump(opt, pc, 1));
+   njumps = NFAI_LO_BYTE(opt->ops[pc]);
+   opt->mark[pc] = stamp;
+   for (i = 0; i < njumps; ++i) {
+      const int target = nfai_opt_resolve(opt, nfai_opt_jump_target(opt, pc, i));
+      /* a target that has already been traced would be ignored by the executor */
+      if (opt->mark[target] == stamp) { continue; }
+      opt->mark[target] = stamp;
+      if (nfai_opt_flattens(opt, target)) {
+         /* (if a fork below has too many targets, then so does this one) */
+         if (opt->flags[target] & NFAI_OPT_WIDE) { return -1; }
+         NFAI_ASSERT(opt->ntargets[target] > 0);
+         for (j = 0; j < opt->ntargets[target]; ++j) {
+            const int inner = opt->targets[target][j];
+            if (opt->mark[inner] == stamp) { continue; }
+            opt->mark[inner] = stamp;
+            if (n >= UINT8_MAX) { return -1; }
+            to[n++] = inner;
+         }
+      } else {
+         if (n >= UINT8_MAX) { return -1; }
+         to[n++] = target;
+      }
+   }
+   return n;
+}
+
+NFAI_INTERNAL int nfai_opt_fork_targets(struct NfaiOptimizer *opt, NfaPoolAllocator *pool, int pc) {
+   int buf[UINT8_MAX];
+   int n;
+   n = nfai_opt_expand_fork(opt, pc, buf, 2*pc + 1);
+   if (n < 0) {
+      /* too many targets to flatten; just resolve the direct targets */
+      const int flatten = opt->flatten;
+      opt->flags[pc] |= NFAI_OPT_WIDE;
+      opt->flatten = 0;
+      n = nfai_opt_expand_fork(opt, pc, buf, 2*pc + 2);
+      opt->flatten = flatten;
+   }
+   NFAI_ASSERT(n >= 0);
+   if (n == 0) {
+      /* every target leads straight back here (a dead end); keep the jump as it is */
+      int i;
+      n = NFAI_LO_BYTE(opt->ops[pc]);
+      for (i = 0; i < n; ++i) { buf[i] = nfai_opt_resolve(opt, nfai_opt_jump_target(opt, pc, i)); }
+   }
+   opt->targets[pc] = (int*)nfai_alloc(pool, n*sizeof(int));
+   if (!opt->targets[pc]) { return NFA_ERROR_OUT_OF_MEMORY; }
+   memcpy(opt->targets[pc], buf, n*sizeof(int));
+   opt->ntargets[pc] = n;
+   return 0;
+}
+
+/* Find the targets of every jump. A fork's targets are found after those of the forks that
+ * it flattens, which are found first by a depth-first search (without recursion, since a
+ * long chain of alternatives nests forks very deeply). Forks on a cycle aren't flattened,
+ * so the search can't come back round to a fork that's still in progress. */
+NFAI_INTERNAL int nfai_opt_build_targets(struct NfaiOptimizer *opt, NfaPoolAllocator *pool) {
+   int *frame_i, *frame_pc = opt->stack;
+   int root, nframes, error;
+
+   frame_i = (int*)nfai_alloc(pool, opt->nops*sizeof(int));
+   if (!frame_i) { return NFA_ERROR_OUT_OF_MEMORY; }
+   for (root = 0; root < opt->nops; root += nfai_op_length(opt->ops + root)) {
+      if ((opt->ops[root] & NFAI_OPCODE_MASK) != NFAI_OP_JUMP || opt->ntargets[root]) { continue; }
+      nframes = 0;
+      frame_pc[nframes] = root;
+      frame_i[nframes++] = 0;
+      while (nframes) {
+         const int pc = frame_pc[nframes - 1];
+         const int i = frame_i[nframes - 1]++;
+         if (i < NFAI_LO_BYTE(opt->ops[pc])) {
+            const int target = nfai_opt_resolve(opt, nfai_opt_jump_target(opt, pc, i));
+            if (nfai_opt_flattens(opt, target) && !opt->ntargets[target]) {
+               NFAI_ASSERT(nframes < opt->nops);
+               frame_pc[nframes] = target;
+               frame_i[nframes++] = 0;
+            }
+         } else {
+            --nframes;
+            error = nfai_opt_fork_targets(opt, pool, pc);
+            if (error) { return error; }
+         }
+      }
+   }
+   return 0;
+}
+
+NFAI_INTERNAL void nfai_opt_push_reachable(struct NfaiOptimizer *opt, int *nstack, int pc) {
+   NFAI_ASSERT(pc >= 0 && pc < opt->nops);
+   NFAI_ASSERT(opt->flags[pc] & NFAI_OPT_START);
+   /* each instruction is pushed at most once, so the stack can't overflow */
+   if (opt->flags[pc] & NFAI_OPT_REACHED) { return; }
+   opt->flags[pc] |= NFAI_OPT_REACHED;
+   NFAI_ASSERT(*nstack < opt->nops);
+   opt->stack[(*nstack)++] = pc;
+}
+
+NFAI_INTERNAL void nfai_opt_find_reachable(struct NfaiOptimizer *opt) {
+   int nstack = 0, i;
+   nfai_opt_push_reachable(opt, &nstack, 0);
+   while (nstack) {
+      const int pc = opt->stack[--nstack];
+      const NfaOpcode op = opt->ops[pc] & NFAI_OPCODE_MASK;
+      if (!nfai_opt_is_redundant(opt, pc)) { opt->flags[pc] |= NFAI_OPT_KEPT; }
+      if (op == NFAI_OP_JUMP) {
+         for (i = 0; i < opt->ntargets[pc]; ++i) {
+            nfai_opt_push_reachable(opt, &nstack, opt->targets[pc][i]);
+         }
+      } else if (op != NFAI_OP_ACCEPT && op != NFAI_OP_TOKEN) {
+         nfai_opt_push_reachable(opt, &nstack, pc + nfai_op_length(opt->ops + pc));
+      }
+   }
+   /* the accept op must always be the last op, even if it can't be reached */
+   opt->flags[opt->nops - 1] |= NFAI_OPT_KEPT;
+}
+
+/* a single jump to the next instruction in the optimized program does nothing */
+NFAI_INTERNAL void nfai_opt_remove_null_jumps(struct NfaiOptimizer *opt) {
+   int changed, pc, next;
+   do {
+      changed = 0;
+      for (pc = 0; pc < opt->nops; pc += nfai_op_length(opt->ops + pc)) {
+         if (!(opt->flags[pc] & NFAI_OPT_KEPT)) { continue; }
+         if (!nfai_opt_is_jump(opt, pc, 1) || opt->ntargets[pc] != 1) { continue; }
+         for (next = pc + 2; next < opt->nops; next += nfai_op_length(opt->ops + next)) {
+            if (opt->flags[next] & NFAI_OPT_KEPT) { break; }
+         }
+         if (next < opt->nops && opt->targets[pc][0] == next) {
+            opt->flags[pc] &= ~NFAI_OPT_KEPT;
+            changed = 1;
+         }
+      }
+   } while (changed);
+}
+
+/* a run of byte matches which can only be entered at the first one becomes a string match */
+NFAI_INTERNAL void nfai_opt_merge_strings(struct NfaiOptimizer *opt) {
+   int pc, i, head = -1;
+   opt->flags[0] |= NFAI_OPT_TARGET;
+   for (pc = 0; pc < opt->nops; pc += nfai_op_length(opt->ops + pc)) {
+      if (!(opt->flags[pc] & NFAI_OPT_KEPT)) { continue; }
+      if ((opt->ops[pc] & NFAI_OPCODE_MASK) != NFAI_OP_JUMP) { continue; }
+      for (i = 0; i < opt->ntargets[pc]; ++i) {
+         opt->flags[opt->targets[pc][i]] |= NFAI_OPT_TARGET;
+      }
+   }
+   for (pc = 0; pc < opt->nops; pc += nfai_op_length(opt->ops + pc)) {
+      opt->run[pc] = 0;
+      if (!(opt->flags[pc] & NFAI_OPT_KEPT) || (opt->ops[pc] & NFAI_OPCODE_MASK) != NFAI_OP_MATCH_BYTE) {
+         head = -1;
+      } else if (head >= 0 && !(opt->flags[pc] & NFAI_OPT_TARGET) && opt->run[head] < UINT8_MAX) {
+         ++opt->run[head];
+         opt->flags[pc] |= NFAI_OPT_MERGED;
+      } else {
+         head = pc;
+         opt->run[pc] = 1;
+      }
+   }
+}
+
+NFAI_INTERNAL int nfai_opt_layout(struct NfaiOptimizer *opt) {
+   int pc, at = 0;
+   for (pc = 0; pc < opt->nops; pc += nfai_op_length(opt->ops + pc)) {
+      opt->new_pc[pc] = -1;
+      if (!(opt->flags[pc] & NFAI_OPT_KEPT) || (opt->flags[pc] & NFAI_OPT_MERGED)) { continue; }
+      opt->new_pc[pc] = at;
+      if ((opt->ops[pc] & NFAI_OPCODE_MASK) == NFAI_OP_JUMP) {
+         at += 1 + opt->ntargets[pc];
+      } else if (opt->run[pc] > 1) {
+         at += 1 + (opt->run[pc] + 1)/2;
+      } else {
+         at += nfai_op_length(opt->ops + pc);
+      }
+   }
+   return at;
+}
+
+NFAI_INTERNAL int nfai_opt_emit(const struct NfaiOptimizer *opt, NfaOpcode *to) {
+   int pc, at = 0, i;
+   for (pc = 0; pc < opt->nops; pc += nfai_op_length(opt->ops + pc)) {
+      if (!(opt->flags[pc] & NFAI_OPT_KEPT) || (opt->flags[pc] & NFAI_OPT_MERGED)) { continue; }
+      NFAI_ASSERT(opt->new_pc[pc] == at);
+      if ((opt->ops[pc] & NFAI_OPCODE_MASK) == NFAI_OP_JUMP) {
+         const int n = opt->ntargets[pc];
+         const int base = at + 1 + n;
+         NFAI_ASSERT(n >= 1 && n <= UINT8_MAX);
+         to[at++] = NFAI_OP_JUMP | (uint8_t)n;
+         for (i = 0; i < n; ++i) {
+            const int target = opt->new_pc[opt->targets[pc][i]];
+            NFAI_ASSERT(target >= 0);
+            if (target - base > opt->max_jump || base - target > opt->max_jump) {
+               return NFA_ERROR_NFA_TOO_LARGE;
+            }
+            to[at++] = (NfaOpcode)(target - base);
+         }
+      } else if (opt->run[pc] > 1) {
+         const int n = opt->run[pc];
+         to[at] = NFAI_OP_MATCH_STRING | (uint8_t)n;
+         for (i = 0; i < n; ++i) {
+            NFAI_ASSERT((opt->ops[pc + i] & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_BYTE);
+            nfai_set_string_byte(to + at, i, NFAI_LO_BYTE(opt->ops[pc + i]));
+         }
+         at += nfai_op_length(to + at);
+      } else {
+         const int len = nfai_op_length(opt->ops + pc);
+         memcpy(to + at, opt->ops + pc, len*sizeof(NfaOpcode));
+         at += len;
+      }
+   }
+   return 0;
+}
+
+/* optimize a program in place; the result is never longer, and its jumps are no longer
+ * than 'max_jump', so it can always be stored in the same format as the original */
+NFAI_INTERNAL int nfai_optimize(NfaOpcode *ops, int *nops_inout, int max_jump, NfaPoolAllocator *pool) {
+   struct NfaiOptimizer opt;
+   NfaOpcode *out;
+   int n, pc, nops, error, attempt;
+
+   NFAI_ASSERT(ops);
+   NFAI_ASSERT(nops_inout);
+   NFAI_ASSERT(pool);
+   NFAI_ASSERT(*nops_inout > 0);
+   NFAI_ASSERT(ops[*nops_inout - 1] == NFAI_OP_ACCEPT);
+
+   n = *nops_inout;
+   memset(&opt, 0, sizeof(opt));
+   opt.ops = ops;
+   opt.nops = n;
+   opt.max_jump = max_jump;
+   opt.flags = (uint8_t*)nfai_alloc(pool, n*sizeof(uint8_t));
+   opt.mark = (int*)nfai_alloc(pool, n*sizeof(int));
+   opt.new_pc = (int*)nfai_alloc(pool, n*sizeof(int));
+   opt.ntargets = (int*)nfai_alloc(pool, n*sizeof(int));
+   opt.targets = (int**)nfai_alloc(pool, n*sizeof(int*));
+   opt.stack = (int*)nfai_alloc(pool, n*sizeof(int));
+   opt.run = (int*)nfai_alloc(pool, n*sizeof(int));
+   out = (NfaOpcode*)nfai_alloc(pool, n*sizeof(NfaOpcode));
+   if (!opt.flags || !opt.mark || !opt.new_pc || !opt.ntargets || !opt.targets || !opt.stack || !opt.run || !out) {
+      return NFA_ERROR_OUT_OF_MEMORY;
+   }
+
+   /* flattening forks can make the program larger (if an inner fork is still needed
+    * for some other reason), in which case we try again without flattening */
+   for (attempt = 0; attempt < 2; ++attempt) {
+      memset(opt.flags, 0, n*sizeof(uint8_t));
+      for (pc = 0; pc < n; ++pc) { opt.mark[pc] = -1; }
+      memset(opt.ntargets, 0, n*sizeof(int));
+      opt.flatten = (attempt == 0);
+
+      for (pc = 0; pc < n; pc += nfai_op_length(opt.ops + pc)) {
+         opt.flags[pc] |= NFAI_OPT_START;
+      }
+      NFAI_ASSERT(pc == n);
+
+      error = nfai_opt_find_cycles(&opt, pool);
+      if (error) { return error; }
+      error = nfai_opt_find_resolved(&opt, pool);
+      if (!error) { error = nfai_opt_build_targets(&opt, pool); }
+      if (error) { return error; }
+      nfai_opt_find_reachable(&opt);
+      nfai_opt_remove_null_jumps(&opt);
+      nfai_opt_merge_strings(&opt);
+      nops = nfai_opt_layout(&opt);
+      if (nops > n) { continue; }
+
+      error = nfai_opt_emit(&opt, out);
+      if (error == NFA_ERROR_NFA_TOO_LARGE) { continue; }
+      if (error) { return error; }
+
+      /* (merging strings doesn't change the number of states, so that can't grow) */
+      NFAI_ASSERT(out[nops - 1] == NFAI_OP_ACCEPT);
+      memcpy(ops, out, nops*sizeof(NfaOpcode));
+      *nops_inout = nops;
+      return 0;
+   }
+
+   /* couldn't improve the program; leave it unchanged */
+   return 0;
+}
+
+/* state ids are stored in 16 bits unless there are too many states for that */
+union NfaiStateIds {
+   uint16_t *narrow;
+   uint32_t *wide;
+};
+
 struct NfaiMachineData {
    struct NfaiStateSet *current;
    struct NfaiStateSet *next;
    union NfaiFreeCaptureSet *free_capture_sets;
+   int token; /* first (highest priority) token reached by the last start/step, or -1 */
+   int token_rank; /* number of states traced before that token (states after it have lower priority) */
+   int lookahead_token; /* token for the position before the last step's byte, once assertions waiting for that byte were resolved, or -1 */
+   int look; /* look bits (NFAI_LOOK_BEHIND_* etc) for the position being traced */
+   int accept_location; /* location at which the thread in the accept state reached it */
+   int accept_empty; /* (bool) that thread started at accept_location (its match is empty) */
+   int no_accept_at; /* location at which the accept state can't be reached (to skip an empty match), or -1 */
+   int start_rank; /* states in the current set that started before the current position */
+   int tracing_start; /* (bool) the states being traced started at the current position */
+   uint32_t context; /* context flags that the current state set was traced with */
+   int nstates; /* number of distinct states (including virtual states for string matches) */
+   int wide_ids; /* (bool) whether state ids are stored in 32 bits */
+   union NfaiStateIds virtual_base; /* first virtual state for each string or repeat op (indexed by op) */
+   union NfaiStateIds virtual_op; /* op that each virtual state belongs to (indexed by state - nops) */
+   int *trace_state; /* branches that nfai_trace_state has still to follow */
+   struct NfaiCaptureSet **trace_captures; /* the capture set for each of those branches (NULL without captures) */
+   int trace_size; /* room for branches (at most one for each jump target or repeat state) */
+#ifdef NFA_EXEC_STATS
+   NfaExecStats stats; /* (pages_allocated is counted by nfa_exec_stats) */
+#endif
 };
 
 struct NfaiCaptureSet {
@@ -917,27 +3455,54 @@ union NfaiFreeCaptureSet {
 
 struct NfaiStateSet {
    int nstates;
+   int size; /* number of distinct states (size of each array) */
+   int wide_ids; /* (bool) whether state ids are stored in 32 bits */
+   int deferred; /* (bool) some states are look assertions waiting for the next byte */
    struct NfaiCaptureSet **captures;
-   uint16_t *state;
-   uint16_t *position;
+   union NfaiStateIds state;
+   union NfaiStateIds position;
 };
 
-NFAI_INTERNAL struct NfaiStateSet *nfai_make_state_set(NfaPoolAllocator *pool, int nops, int ncaptures) {
+NFAI_INTERNAL int nfai_alloc_ids(NfaPoolAllocator *pool, union NfaiStateIds *ids, int n, int wide) {
+   if (wide) {
+      ids->wide = (uint32_t*)nfai_zalloc(pool, n*sizeof(uint32_t));
+      return (ids->wide != NULL);
+   } else {
+      ids->narrow = (uint16_t*)nfai_zalloc(pool, n*sizeof(uint16_t));
+      return (ids->narrow != NULL);
+   }
+}
+
+NFAI_INTERNAL int nfai_get_id(union NfaiStateIds ids, int wide, int i) {
+   return (wide ? (int)ids.wide[i] : (int)ids.narrow[i]);
+}
+
+NFAI_INTERNAL void nfai_set_id(union NfaiStateIds ids, int wide, int i, int id) {
+   NFAI_ASSERT(id >= 0 && (wide || id <= UINT16_MAX));
+   if (wide) {
+      ids.wide[i] = (uint32_t)id;
+   } else {
+      ids.narrow[i] = (uint16_t)id;
+   }
+}
+
+NFAI_INTERNAL struct NfaiStateSet *nfai_make_state_set(NfaPoolAllocator *pool, int nstates, int ncaptures) {
    struct NfaiStateSet *ss;
-   NFAI_ASSERT(nops > 0);
+   NFAI_ASSERT(nstates > 0);
    NFAI_ASSERT(ncaptures >= 0);
    ss = (struct NfaiStateSet*)nfai_alloc(pool, sizeof(*ss));
    if (!ss) { return NULL; }
    ss->nstates = 0;
+   ss->deferred = 0;
+   ss->size = nstates;
+   ss->wide_ids = (nstates > UINT16_MAX);
    ss->captures = NULL;
    if (ncaptures) {
-      ss->captures = (struct NfaiCaptureSet**)nfai_zalloc(pool, nops*sizeof(struct NfaiCaptureSet*));
+      ss->captures = (struct NfaiCaptureSet**)nfai_zalloc(pool, nstates*sizeof(struct NfaiCaptureSet*));
       if (!ss->captures) { return NULL; }
    }
-   ss->state = (uint16_t*)nfai_zalloc(pool, nops*sizeof(uint16_t));
-   if (!ss->state) { return NULL; }
-   ss->position = (uint16_t*)nfai_zalloc(pool, nops*sizeof(uint16_t));
-   if (!ss->position) { return NULL; }
+   if (!nfai_alloc_ids(pool, &ss->state, nstates, ss->wide_ids)) { return NULL; }
+   if (!nfai_alloc_ids(pool, &ss->position, nstates, ss->wide_ids)) { return NULL; }
    return ss;
 }
 
@@ -948,11 +3513,11 @@ NFAI_INTERNAL int nfai_is_state_marked(const Nfa *nfa, struct NfaiStateSet *stat
 
    NFAI_ASSERT(nfa);
    NFAI_ASSERT(states);
-   NFAI_ASSERT(states->nstates >= 0 && states->nstates <= nfa->nops);
-   NFAI_ASSERT(state >= 0 && state < nfa->nops);
+   NFAI_ASSERT(states->nstates >= 0 && states->nstates <= states->size);
+   NFAI_ASSERT(state >= 0 && state < states->size);
 
-   position = states->position[state];
-   return ((position < states->nstates) && (states->state[position] == state));
+   position = nfai_get_id(states->position, states->wide_ids, state);
+   return ((position < states->nstates) && (nfai_get_id(states->state, states->wide_ids, position) == state));
 }
 
 NFAI_INTERNAL void nfai_mark_state(const Nfa *nfa, struct NfaiStateSet *states, int state) {
@@ -962,13 +3527,13 @@ NFAI_INTERNAL void nfai_mark_state(const Nfa *nfa, struct NfaiStateSet *states,
 
    NFAI_ASSERT(nfa);
    NFAI_ASSERT(states);
-   NFAI_ASSERT(states->nstates >= 0 && states->nstates <= nfa->nops);
-   NFAI_ASSERT(state >= 0 && state < nfa->nops);
+   NFAI_ASSERT(states->nstates >= 0 && states->nstates <= states->size);
+   NFAI_ASSERT(state >= 0 && state < states->size);
    NFAI_ASSERT(!nfai_is_state_marked(nfa, states, state));
 
    position = states->nstates++;
-   states->position[state] = position;
-   states->state[position] = state;
+   nfai_set_id(states->position, states->wide_ids, state, position);
+   nfai_set_id(states->state, states->wide_ids, position, state);
 }
 
 NFAI_INTERNAL struct NfaiCaptureSet *nfai_make_capture_set(NfaMachine *vm) {
@@ -983,6 +3548,7 @@ NFAI_INTERNAL struct NfaiCaptureSet *nfai_make_capture_set(NfaMachine *vm) {
    set = (struct NfaiCaptureSet*)(data->free_capture_sets);
    if (set) {
       data->free_capture_sets = data->free_capture_sets->next;
+      NFAI_COUNT(data, freelist_hits, 1);
    } else {
       set = (struct NfaiCaptureSet*)nfai_zalloc(&vm->alloc,
             sizeof(struct NfaiCaptureSet) + sizeof(NfaCapture)*(vm->ncaptures - 1));
@@ -990,6 +3556,7 @@ NFAI_INTERNAL struct NfaiCaptureSet *nfai_make_capture_set(NfaMachine *vm) {
          vm->error = NFA_ERROR_OUT_OF_MEMORY;
          return NULL;
       }
+      NFAI_COUNT(data, capture_sets_allocated, 1);
    }
 
 #ifdef NFA_TRACE_MATCH
@@ -1034,6 +3601,7 @@ NFAI_INTERNAL struct NfaiCaptureSet *nfai_make_capture_set_unique(NfaMachine *vm
          return NULL;
       }
       memcpy(to->capture, from->capture, sizeof(NfaCapture)*(vm->ncaptures));
+      NFAI_COUNT((struct NfaiMachineData*)vm->data, capture_sets_copied, 1);
       return to;
    }
 
@@ -1041,15 +3609,15 @@ NFAI_INTERNAL struct NfaiCaptureSet *nfai_make_capture_set_unique(NfaMachine *vm
 }
 
 NFAI_INTERNAL void nfai_assert_no_captures(NfaMachine *vm, struct NfaiStateSet *set) {
+   NFAI_UNUSED(vm);
 #ifndef NFA_NDEBUG
    if (set->captures) {
       int i;
-      for (i = 0; i < vm->nfa->nops; ++i) {
+      for (i = 0; i < set->size; ++i) {
          NFAI_ASSERT(set->captures[i] == NULL);
       }
    }
 #else
-   NFAI_UNUSED(vm);
    NFAI_UNUSED(set);
 #endif
 }
@@ -1058,7 +3626,7 @@ NFAI_INTERNAL void nfai_clear_state_set_captures(NfaMachine *vm, struct NfaiStat
    int i;
    if (!states->captures) { return; }
    for (i = begin; i < states->nstates; ++i) {
-      int istate = states->state[i];
+      int istate = nfai_get_id(states->state, states->wide_ids, i);
       struct NfaiCaptureSet *set = states->captures[istate];
       if (set) {
          nfai_decref_capture_set(vm, set);
@@ -1067,11 +3635,62 @@ NFAI_INTERNAL void nfai_clear_state_set_captures(NfaMachine *vm, struct NfaiStat
    }
 }
 
+/* test a byte against the single-character op (any, byte, or class) at nfa->ops[pc] */
+NFAI_INTERNAL int nfai_match_char(const Nfa *nfa, int pc, uint8_t byte) {
+   const NfaOpcode op = nfai_word(nfa, pc);
+   const uint8_t arg = NFAI_LO_BYTE(op);
+   int j;
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_ANY:
+         return 1;
+      case NFAI_OP_MATCH_BYTE:
+         return (arg == byte);
+      case NFAI_OP_MATCH_CLASS:
+         for (j = 1; j <= arg; ++j) {
+            const NfaOpcode range = nfai_word(nfa, pc + j);
+            uint8_t first = NFAI_HI_BYTE(range);
+            uint8_t last = NFAI_LO_BYTE(range);
+            if (byte < first) { break; }
+            if (byte <= last) { return 1; }
+         }
+         return 0;
+      default:
+         NFAI_ASSERT(0 && "invalid operation");
+         return 0;
+   }
+}
+
+/* The states of an NFAI_OP_REPEAT with maximum count n are: the op itself (0 iterations
+ * done), virtual states base..base+n-1 (1..n iterations done), and virtual states
+ * base+n..base+2n-1 (matching the body for iteration 1..n). This returns the number of
+ * iterations done, and whether the state is one that matches the body. */
+NFAI_INTERNAL int nfai_repeat_count(const NfaMachine *vm, int pc, int state, int *in_body) {
+   const struct NfaiMachineData *data = (const struct NfaiMachineData*)vm->data;
+   const int max = nfai_word(vm->nfa, pc + 2);
+   const int k = (state == pc ? 0 : state - nfai_get_id(data->virtual_base, data->wide_ids, pc) + 1);
+   NFAI_ASSERT(k >= 0 && k <= 2*max);
+   *in_body = (k > max);
+   return (k > max ? k - max - 1 : k);
+}
+
+/* save a branch for nfai_trace_state to follow after the one it's on */
+NFAI_INTERNAL void nfai_trace_push(struct NfaiMachineData *data, int *top, int state, struct NfaiCaptureSet *captures) {
+   NFAI_ASSERT(*top < data->trace_size);
+   data->trace_state[*top] = state;
+   if (data->trace_captures) { data->trace_captures[*top] = captures; }
+   ++*top;
+}
+
+/* Follow the transitions that don't consume input from a state, adding the states that do
+ * (and the accept state) to the next set, in priority order. This is a depth-first search,
+ * with the branches still to be followed kept on a stack in the machine's pool (chains of
+ * non-consuming transitions can be far too long for the C stack). */
 NFAI_INTERNAL void nfai_trace_state(NfaMachine *vm, int location, int state, struct NfaiCaptureSet *captures, uint32_t flags) {
    struct NfaiMachineData *data;
    struct NfaiStateSet *states;
-   const NfaOpcode *ops;
-   uint16_t op;
+   const Nfa *nfa;
+   NfaOpcode word, op;
+   int pc, count, in_body, top = 0;
 
    NFAI_ASSERT(vm);
    if (vm->error) { return; }
@@ -1081,73 +3700,146 @@ NFAI_INTERNAL void nfai_trace_state(NfaMachine *vm, int location, int state, str
 
    data = (struct NfaiMachineData*)vm->data;
    states = data->next;
+   nfa = vm->nfa;
 
    NFAI_ASSERT(states);
-   NFAI_ASSERT(state >= 0 && state < vm->nfa->nops);
 
-   if (nfai_is_state_marked(vm->nfa, states, state)) {
-      if (captures) { nfai_decref_capture_set(vm, captures); }
-      return;
-   }
-   nfai_mark_state(vm->nfa, states, state);
+   for (;;) {
+      /* (state < 0 once a branch has ended) */
+      if (state < 0) {
+         if (top == 0) { return; }
+         --top;
+         state = data->trace_state[top];
+         captures = (data->trace_captures ? data->trace_captures[top] : NULL);
+      }
 
-#ifdef NFA_TRACE_MATCH
-   fprintf(stderr, "TRACE: ");
-   nfai_print_opcode(vm->nfa, state, stderr);
-#endif
+      NFAI_ASSERT(state >= 0 && state < states->size);
+      NFAI_COUNT(data, closure_expansions, 1);
+
+      /* virtual states are part-way through a string or repeat op */
+      pc = (state < nfa->nops ? state : nfai_get_id(data->virtual_op, data->wide_ids, state - nfa->nops));
+      word = nfai_word(nfa, pc);
+      op = (word & NFAI_OPCODE_MASK);
+      count = in_body = 0;
+      if (op == NFAI_OP_REPEAT) { count = nfai_repeat_count(vm, pc, state, &in_body); }
 
-   ops = (vm->nfa->ops + state);
-   op = (ops[0] & NFAI_OPCODE_MASK);
-   if (op == NFAI_OP_JUMP) {
-      int base, i, njumps;
-      njumps = NFAI_LO_BYTE(ops[0]);
-      NFAI_ASSERT(njumps >= 1);
-      base = state + 1 + njumps;
-      if (captures) { captures->refcount += njumps - 1; }
-      for (i = 1; i <= njumps; ++i) {
-         nfai_trace_state(vm, location, base + (int16_t)ops[i], captures, flags);
-      }
-   } else if (op == NFAI_OP_ASSERT_CONTEXT) {
-      uint32_t test;
-      int bitidx = NFAI_LO_BYTE(ops[0]);
-      NFAI_ASSERT(bitidx >= 0 && bitidx < 32);
-      test = ((uint32_t)1 << bitidx);
+      /* token states are never added to the state set: they just report the
+       * token and terminate the thread */
+      if (op == NFAI_OP_TOKEN) {
 #ifdef NFA_TRACE_MATCH
-      fprintf(stderr, "assert context & %u (%s)\n", test, ((flags & test) ? "passed" : "failed"));
+         fprintf(stderr, "TRACE: ");
+         nfai_print_opcode(vm->nfa, pc, stderr);
 #endif
-      if (flags & test) {
-         nfai_trace_state(vm, location, state + 1, captures, flags);
-      } else {
+         /* states are traced in priority order, so the first token wins */
+         if (data->token < 0) {
+            data->token = (int)nfai_word(nfa, pc + 1);
+            data->token_rank = states->nstates;
+         }
          if (captures) { nfai_decref_capture_set(vm, captures); }
+         state = -1;
+         continue;
       }
-   } else if (op == NFAI_OP_SAVE_START || op == NFAI_OP_SAVE_END) {
-      struct NfaiCaptureSet *set = captures;
-      if (captures) {
-         int idx = NFAI_LO_BYTE(ops[0]);
-         if (idx < vm->ncaptures) {
-            set = nfai_make_capture_set_unique(vm, captures);
-            if (!set) { NFAI_ASSERT(vm->error); return; }
-            if (op == NFAI_OP_SAVE_START) {
-               set->capture[idx].begin = location;
-            } else {
-               set->capture[idx].end = location;
-            }
-         }
+
+      if ((op == NFAI_OP_ACCEPT && data->no_accept_at >= 0 && location == data->no_accept_at) ||
+            nfai_is_state_marked(vm->nfa, states, state)) {
+         if (captures) { nfai_decref_capture_set(vm, captures); }
+         state = -1;
+         continue;
       }
-      nfai_trace_state(vm, location, state + 1, set, flags);
-   } else {
+      nfai_mark_state(vm->nfa, states, state);
+
 #ifdef NFA_TRACE_MATCH
-      fprintf(stderr, "copying capture %p to state %d\n", captures, state);
+      fprintf(stderr, "TRACE: ");
+      nfai_print_opcode(vm->nfa, pc, stderr);
 #endif
-      if (captures) {
-         NFAI_ASSERT(states->captures);
-         NFAI_ASSERT(captures->refcount > 0);
-         states->captures[state] = captures;
 
+      if (op == NFAI_OP_JUMP) {
+         int base, i, njumps;
+         njumps = NFAI_LO_BYTE(word);
+         NFAI_ASSERT(njumps >= 1);
+         base = state + 1 + njumps;
+         if (captures) { captures->refcount += njumps - 1; }
+         /* (pushed in reverse, so that they're followed in order) */
+         for (i = njumps; i > 1; --i) {
+            nfai_trace_push(data, &top, base + nfai_jump_offset(nfa, pc + i), captures);
+         }
+         state = base + nfai_jump_offset(nfa, pc + 1);
+      } else if (op == NFAI_OP_ASSERT_CONTEXT) {
+         uint32_t test;
+         int bitidx = NFAI_LO_BYTE(word);
+         NFAI_ASSERT(bitidx >= 0 && bitidx < 32);
+         test = ((uint32_t)1 << bitidx);
+#ifdef NFA_TRACE_MATCH
+         fprintf(stderr, "assert context & %u (%s)\n", test, ((flags & test) ? "passed" : "failed"));
+#endif
+         if (flags & test) {
+            state = state + 1;
+         } else {
+            if (captures) { nfai_decref_capture_set(vm, captures); }
+            state = -1;
+         }
+      } else if (op == NFAI_OP_ASSERT_LOOK && nfai_look_passes(NFAI_LO_BYTE(word), data->look) >= 0) {
+         if (nfai_look_passes(NFAI_LO_BYTE(word), data->look)) {
+            state = state + 1;
+         } else {
+            if (captures) { nfai_decref_capture_set(vm, captures); }
+            state = -1;
+         }
+      } else if (op == NFAI_OP_SAVE_START || op == NFAI_OP_SAVE_END) {
+         if (captures) {
+            int idx = NFAI_LO_BYTE(word);
+            if (idx < vm->ncaptures) {
+               struct NfaiCaptureSet *set = nfai_make_capture_set_unique(vm, captures);
+               if (!set) { NFAI_ASSERT(vm->error); return; }
+               if (op == NFAI_OP_SAVE_START) {
+                  set->capture[idx].begin = location;
+               } else {
+                  set->capture[idx].end = location;
+               }
+               captures = set;
+            }
+         }
+         state = state + 1;
+      } else if (op == NFAI_OP_REPEAT && !in_body) {
+         const int min = nfai_word(nfa, pc + 1), max = nfai_word(nfa, pc + 2);
+         const int base = (max ? nfai_get_id(data->virtual_base, data->wide_ids, pc) : 0);
+         const int exit = pc + nfai_nfa_op_length(nfa, pc);
+         int body = -1;
+         if (count < max) {
+            body = base + max + count;
+         } else if (NFAI_LO_BYTE(word) & NFAI_REPEAT_UNBOUNDED) {
+            /* go round the last iteration again */
+            body = base + 2*max - 1;
+         }
+         if (body >= 0 && count >= min) {
+            const int lazy = (NFAI_LO_BYTE(word) & NFAI_REPEAT_LAZY);
+            if (captures) { ++captures->refcount; }
+            nfai_trace_push(data, &top, (lazy ? body : exit), captures);
+            state = (lazy ? exit : body);
+         } else {
+            state = (body >= 0 ? body : exit);
+         }
+      } else {
+         /* (a look assertion that needs the next byte waits here, see nfai_resolve_lookahead) */
+         if (op == NFAI_OP_ASSERT_LOOK) { states->deferred = 1; }
          if (op == NFAI_OP_ACCEPT) {
-            /* store output captures */
-            vm->captures = captures->capture;
+            data->accept_location = location;
+            data->accept_empty = data->tracing_start;
+         }
+#ifdef NFA_TRACE_MATCH
+         fprintf(stderr, "copying capture %p to state %d\n", captures, state);
+#endif
+         if (captures) {
+            NFAI_ASSERT(states->captures);
+            NFAI_ASSERT(captures->refcount > 0);
+            states->captures[state] = captures;
+
+            if (op == NFAI_OP_ACCEPT) {
+               /* store output captures */
+               vm->captures = captures->capture;
+            }
          }
+         state = -1;
       }
    }
 }
@@ -1158,7 +3850,7 @@ NFAI_INTERNAL void nfai_print_captures(FILE *to, const NfaMachine *vm, const str
    NFAI_ASSERT(to);
    NFAI_ASSERT(vm);
 
-   for (i = 0; i < vm->nfa->nops; ++i) {
+   for (i = 0; i < ss->size; ++i) {
       struct NfaiCaptureSet *set = ss->captures[i];
       if (set) {
          fprintf(to, "(%p, rc %d) captures for state %2d:", set, set->refcount, i);
@@ -1206,11 +3898,20 @@ NFAI_INTERNAL void nfai_store_captures(const NfaMachine *vm, NfaCapture *capture
 
 NFAI_INTERNAL int nfai_exec_init_internal(NfaMachine *vm, const Nfa *nfa, int ncaptures) {
    struct NfaiMachineData *data;
+   int nstates;
    NFAI_ASSERT(vm);
    NFAI_ASSERT(nfa);
+   NFAI_ASSERT(nfa->magic == NFAI_MAGIC);
    NFAI_ASSERT(nfa->nops > 0);
    NFAI_ASSERT(ncaptures >= 0);
 
+   nstates = nfai_count_states(nfa);
+   if (nstates > NFAI_MAX_STATES) {
+      nfai_free_pool(&vm->alloc);
+      memset(vm, 0, sizeof(NfaMachine));
+      return (vm->error = NFA_ERROR_NFA_TOO_LARGE);
+   }
+
    data = (struct NfaiMachineData*)nfai_zalloc(&vm->alloc, sizeof(struct NfaiMachineData));
    if (!data) { goto mem_failure; }
    vm->data = data;
@@ -1219,11 +3920,37 @@ NFAI_INTERNAL int nfai_exec_init_internal(NfaMachine *vm, const Nfa *nfa, int nc
    vm->ncaptures = ncaptures;
    vm->captures = NULL;
 
-   data->current = nfai_make_state_set(&vm->alloc, nfa->nops, ncaptures);
+   data->nstates = nstates;
+   data->wide_ids = (nstates > UINT16_MAX);
+   if (nstates > nfa->nops) {
+      const int wide = data->wide_ids;
+      int pc, i, next = nfa->nops;
+      if (!nfai_alloc_ids(&vm->alloc, &data->virtual_base, nfa->nops, wide)) { goto mem_failure; }
+      if (!nfai_alloc_ids(&vm->alloc, &data->virtual_op, nstates - nfa->nops, wide)) { goto mem_failure; }
+      for (pc = 0; pc < nfa->nops; pc += nfai_nfa_op_length(nfa, pc)) {
+         const int nvirtual = nfai_virtual_states(nfa, pc);
+         nfai_set_id(data->virtual_base, wide, pc, next);
+         for (i = 0; i < nvirtual; ++i) {
+            nfai_set_id(data->virtual_op, wide, next++ - nfa->nops, pc);
+         }
+      }
+      NFAI_ASSERT(next == nstates);
+   }
+
+   data->trace_size = nfa->nops + nstates;
+   data->trace_state = (int*)nfai_alloc(&vm->alloc, data->trace_size*sizeof(int));
+   if (!data->trace_state) { goto mem_failure; }
+   if (ncaptures) {
+      data->trace_captures = (struct NfaiCaptureSet**)nfai_alloc(&vm->alloc, data->trace_size*sizeof(struct NfaiCaptureSet*));
+      if (!data->trace_captures) { goto mem_failure; }
+   }
+
+   data->current = nfai_make_state_set(&vm->alloc, nstates, ncaptures);
    if (!data->current) { goto mem_failure; }
-   data->next = nfai_make_state_set(&vm->alloc, nfa->nops, ncaptures);
+   data->next = nfai_make_state_set(&vm->alloc, nstates, ncaptures);
    if (!data->next) { goto mem_failure; }
    data->free_capture_sets = NULL;
+   data->token = -1;
    return 0;
 
 mem_failure:
@@ -1232,6 +3959,50 @@ mem_failure:
    return (vm->error = NFA_ERROR_OUT_OF_MEMORY);
 }
 
+/* The pool space used by a machine: what nfai_exec_init_internal allocates (this must make the
+ * same allocations; nfai_alloc doesn't pad, so the sizes just add up), plus the most capture
+ * sets that can be live at once. Every live capture set is held by a thread (a consuming or
+ * accept state) in the current or the next state set, or by nfai_trace_state while it follows
+ * transitions, where each save op on the path can have made a copy. Capture sets are reused
+ * before any more are allocated, so the pool never needs more than that. Returns 0 if the NFA
+ * has too many states for a machine (or the size doesn't fit in a size_t). */
+NFAI_INTERNAL size_t nfai_exec_pool_size(const Nfa *nfa, int ncaptures) {
+   const int nstates = nfai_count_states(nfa);
+   const size_t id_size = (nstates > UINT16_MAX ? sizeof(uint32_t) : sizeof(uint16_t));
+   size_t size, set_size, nsets = 1;
+   int pc;
+
+   if (nstates > NFAI_MAX_STATES) { return 0; }
+
+   size = NFAI_PAGE_HEAD_SIZE + sizeof(struct NfaiMachineData);
+   if (nstates > nfa->nops) { size += (size_t)nstates*id_size; } /* virtual_base and virtual_op */
+   size += ((size_t)nfa->nops + nstates)*sizeof(int); /* trace_state */
+   size += 2*(sizeof(struct NfaiStateSet) + 2*(size_t)nstates*id_size);
+   if (!ncaptures) { return size; }
+   size += ((size_t)nfa->nops + nstates)*sizeof(struct NfaiCaptureSet*); /* trace_captures */
+   size += 2*(size_t)nstates*sizeof(struct NfaiCaptureSet*);
+
+   for (pc = 0; pc < nfa->nops; pc += nfai_nfa_op_length(nfa, pc)) {
+      const NfaOpcode op = nfai_word(nfa, pc);
+      switch (op & NFAI_OPCODE_MASK) {
+         case NFAI_OP_ACCEPT:
+         case NFAI_OP_ASSERT_LOOK: /* (waiting for the next byte) */
+            nsets += 2;
+            break;
+         case NFAI_OP_SAVE_START:
+         case NFAI_OP_SAVE_END:
+            if (NFAI_LO_BYTE(op) < ncaptures) { ++nsets; }
+            break;
+         default:
+            nsets += 2*(size_t)nfai_consuming_states(nfa, pc);
+            break;
+      }
+   }
+   set_size = sizeof(struct NfaiCaptureSet) + sizeof(NfaCapture)*(ncaptures - 1);
+   if (nsets > ((size_t)-1 - size) / set_size) { return 0; }
+   return size + nsets*set_size;
+}
+
 /* ----- PUBLIC API ----- */
 
 NFA_API const char *nfa_error_string(int error) {
@@ -1263,6 +4034,13 @@ NFA_API int nfa_exec_init_custom(NfaMachine *vm, const Nfa *nfa, int ncaptures,
    return nfai_exec_init_internal(vm, nfa, ncaptures);
 }
 
+NFA_API size_t nfa_exec_required_pool_size(const Nfa *nfa, int ncaptures) {
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(nfa->magic == NFAI_MAGIC);
+   NFAI_ASSERT(ncaptures >= 0);
+   return nfai_exec_pool_size(nfa, ncaptures);
+}
+
 NFA_API void nfa_exec_free(NfaMachine *vm) {
    if (!vm) { return; }
    if (vm->alloc.allocf) { nfai_free_pool(&vm->alloc); }
@@ -1275,7 +4053,7 @@ NFA_API int nfa_exec_is_accepted(const NfaMachine *vm) {
    if (vm->error) { return 0; }
    NFAI_ASSERT(vm->data);
    data = (struct NfaiMachineData*)vm->data;
-   NFAI_ASSERT(vm->nfa->ops[vm->nfa->nops - 1] == NFAI_OP_ACCEPT);
+   NFAI_ASSERT(nfai_word(vm->nfa, vm->nfa->nops - 1) == NFAI_OP_ACCEPT);
    return nfai_is_state_marked(vm->nfa, data->current, vm->nfa->nops - 1);
 }
 
@@ -1293,12 +4071,104 @@ NFA_API int nfa_exec_is_finished(const NfaMachine *vm) {
    return (nfa_exec_is_rejected(vm) || nfa_exec_is_accepted(vm));
 }
 
-NFA_API int nfa_exec_start(NfaMachine *vm, int location, uint32_t context_flags) {
-   struct NfaiMachineData *data;
-   struct NfaiCaptureSet *set;
+#ifdef NFA_EXEC_STATS
+NFA_API int nfa_exec_stats(const NfaMachine *vm, NfaExecStats *stats) {
+   const struct NfaiMachineData *data;
+   const struct NfaiPage *page;
+   NFAI_ASSERT(vm);
+   NFAI_ASSERT(stats);
+   if (vm->error) {
+      memset(stats, 0, sizeof(*stats));
+      return vm->error;
+   }
+   NFAI_ASSERT(vm->data);
+   data = (const struct NfaiMachineData*)vm->data;
+   *stats = data->stats;
+   /* (a pool given to nfa_exec_init_pool counts as one page) */
+   for (page = (const struct NfaiPage*)vm->alloc.head; page; page = page->next) { ++stats->pages_allocated; }
+   return 0;
+}
+#endif
 
+/* the accept state is sticky: it's traced again, but keeps the location it was reached at
+ * (unless a higher priority thread has just reached it) */
+NFAI_INTERNAL void nfai_retrace_accept(NfaMachine *vm, int state, struct NfaiCaptureSet *captures, uint32_t flags) {
+   struct NfaiMachineData *data;
+   int reached, empty;
    NFAI_ASSERT(vm);
-   if (vm->error) { return vm->error; }
+   NFAI_ASSERT(vm->data);
+   data = (struct NfaiMachineData*)vm->data;
+   reached = nfai_is_state_marked(vm->nfa, data->next, state);
+   empty = data->accept_empty;
+   nfai_trace_state(vm, data->accept_location, state, captures, flags);
+   if (!reached) { data->accept_empty = empty; }
+}
+
+/* retrace the current states now that the byte after the current position is known (c < 0 at the
+ * end of the input): look assertions that were waiting on it pass or fail, other states are kept */
+NFAI_INTERNAL void nfai_resolve_lookahead(NfaMachine *vm, int c, int location) {
+   struct NfaiMachineData *data;
+   const Nfa *nfa;
+   int i, look, prior_token, prior_rank;
+   NFAI_ASSERT(vm);
+   NFAI_ASSERT(vm->data);
+   data = (struct NfaiMachineData*)vm->data;
+   nfa = vm->nfa;
+   NFAI_ASSERT(data->current->deferred);
+   NFAI_ASSERT(data->next->nstates == 0);
+
+   look = data->look;
+   data->look = (look & NFAI_LOOK_BEHIND) | nfai_look_ahead(c);
+   prior_token = data->token;
+   prior_rank = data->token_rank;
+   data->token = -1;
+   for (i = 0; i < data->current->nstates; ++i) {
+      struct NfaiCaptureSet *set;
+      int istate, pc, in_body = 0;
+      NfaOpcode op;
+
+      /* a token reached when these states were traced beats tokens reached from later states */
+      if (i == prior_rank && data->token < 0) { data->token = prior_token; }
+
+      istate = nfai_get_id(data->current->state, data->current->wide_ids, i);
+      pc = (istate < nfa->nops ? istate : nfai_get_id(data->virtual_op, data->wide_ids, istate - nfa->nops));
+      op = nfai_word(nfa, pc) & NFAI_OPCODE_MASK;
+      if (op == NFAI_OP_REPEAT) { nfai_repeat_count(vm, pc, istate, &in_body); }
+
+      /* transition states are reached again from whichever leaf state led to them */
+      if (op == NFAI_OP_JUMP ||
+            op == NFAI_OP_ASSERT_CONTEXT ||
+            (op == NFAI_OP_ASSERT_LOOK && nfai_look_passes(NFAI_LO_BYTE(nfai_word(nfa, pc)), look) >= 0) ||
+            op == NFAI_OP_SAVE_START ||
+            op == NFAI_OP_SAVE_END ||
+            (op == NFAI_OP_REPEAT && !in_body)) {
+         continue;
+      }
+
+      set = (data->current->captures ? data->current->captures[istate] : NULL);
+      if (data->current->captures) { data->current->captures[istate] = NULL; }
+      data->tracing_start = (i >= data->start_rank);
+      if (op == NFAI_OP_ACCEPT) {
+         nfai_retrace_accept(vm, istate, set, data->context);
+      } else {
+         nfai_trace_state(vm, location, istate, set, data->context);
+      }
+      if (vm->error) { return; }
+   }
+
+   if (data->token < 0) { data->token = prior_token; }
+
+   data->current->nstates = 0;
+   data->current->deferred = 0;
+   nfai_swap_state_sets(vm);
+}
+
+/* clear the machine, for a position after byte 'behind' (< 0 at the start of the input) */
+NFAI_INTERNAL void nfai_exec_reset(NfaMachine *vm, int behind, uint32_t context_flags) {
+   struct NfaiMachineData *data;
+
+   NFAI_ASSERT(vm);
+   NFAI_ASSERT(!vm->error);
    NFAI_ASSERT(vm->data);
    data = (struct NfaiMachineData*)vm->data;
 
@@ -1309,7 +4179,31 @@ NFA_API int nfa_exec_start(NfaMachine *vm, int location, uint32_t context_flags)
 
    /* unmark all states */
    data->current->nstates = 0;
+   data->current->deferred = 0;
    data->next->nstates = 0;
+   data->next->deferred = 0;
+   data->token = -1;
+   data->lookahead_token = -1;
+   data->accept_location = -1;
+   data->accept_empty = 0;
+   data->no_accept_at = -1;
+   data->start_rank = 0;
+
+   data->look = nfai_look_behind(behind) | ((context_flags & NFA_EXEC_AT_END) ? nfai_look_ahead(-1) : 0);
+   data->context = context_flags;
+}
+
+NFA_API int nfa_exec_start(NfaMachine *vm, int location, uint32_t context_flags) {
+   struct NfaiMachineData *data;
+   struct NfaiCaptureSet *set;
+
+   NFAI_ASSERT(vm);
+   if (vm->error) { return vm->error; }
+   NFAI_ASSERT(vm->data);
+   data = (struct NfaiMachineData*)vm->data;
+
+   /* there's no byte before the start position (nfa_exec_start can't know it) */
+   nfai_exec_reset(vm, -1, context_flags);
 
    /* create a new empty capture set */
    set = NULL;
@@ -1320,6 +4214,7 @@ NFA_API int nfa_exec_start(NfaMachine *vm, int location, uint32_t context_flags)
    }
 
    /* mark entry state(s) */
+   data->tracing_start = 1;
    nfai_trace_state(vm, location, 0, set, context_flags);
    nfai_swap_state_sets(vm);
 
@@ -1328,6 +4223,7 @@ NFA_API int nfa_exec_start(NfaMachine *vm, int location, uint32_t context_flags)
 
 NFA_API int nfa_exec_step(NfaMachine *vm, char byte, int location, uint32_t context_flags) {
    struct NfaiMachineData *data;
+   const Nfa *nfa;
 #ifdef NFA_TRACE_MATCH
    char buf[8];
 #endif
@@ -1336,67 +4232,89 @@ NFA_API int nfa_exec_step(NfaMachine *vm, char byte, int location, uint32_t cont
    if (vm->error) { return vm->error; }
    NFAI_ASSERT(vm->data);
    data = (struct NfaiMachineData*)vm->data;
+   nfa = vm->nfa;
 
 #ifdef NFA_TRACE_MATCH
    fprintf(stderr, "[%2d] %s\n", location, nfai_quoted_char((uint8_t)byte, buf, sizeof(buf)));
 #endif
 
+   data->lookahead_token = -1;
+   if (data->current->deferred) {
+      /* (the token for the position before this byte may change) */
+      nfai_resolve_lookahead(vm, (uint8_t)byte, location);
+      if (vm->error) { return vm->error; }
+      data->lookahead_token = data->token;
+   }
+   data->token = -1;
+   data->look = nfai_look_behind((uint8_t)byte) | ((context_flags & NFA_EXEC_AT_END) ? nfai_look_ahead(-1) : 0);
+   data->context = context_flags;
+   data->tracing_start = 0;
+
+   NFAI_COUNT(data, bytes_stepped, 1);
+   NFAI_COUNT(data, states_visited, (unsigned long)data->current->nstates);
+#ifdef NFA_EXEC_STATS
+   if (data->current->nstates > data->stats.peak_states) { data->stats.peak_states = data->current->nstates; }
+#endif
+
    for (i = 0; i < data->current->nstates; ++i) {
       struct NfaiCaptureSet *set;
-      int istate, inextstate, follow;
-      uint16_t op, arg;
+      int istate, pc, inextstate, follow, count = 0, in_body = 0;
+      NfaOpcode op, arg;
 
-      istate = data->current->state[i];
-      inextstate = istate + 1;
-      NFAI_ASSERT(istate >= 0 && istate < vm->nfa->nops);
+      istate = nfai_get_id(data->current->state, data->current->wide_ids, i);
+      NFAI_ASSERT(istate >= 0 && istate < data->nstates);
+      pc = (istate < nfa->nops ? istate : nfai_get_id(data->virtual_op, data->wide_ids, istate - nfa->nops));
+      inextstate = pc + 1;
 
       set = (data->current->captures ? data->current->captures[istate] : NULL);
-      op = vm->nfa->ops[istate] & NFAI_OPCODE_MASK;
-      arg = NFAI_LO_BYTE(vm->nfa->ops[istate]);
+      op = nfai_word(nfa, pc) & NFAI_OPCODE_MASK;
+      arg = NFAI_LO_BYTE(nfai_word(nfa, pc));
+      if (op == NFAI_OP_REPEAT) { count = nfai_repeat_count(vm, pc, istate, &in_body); }
 
       /* ignore transition ops */
       if (op == NFAI_OP_JUMP ||
             op == NFAI_OP_ASSERT_CONTEXT ||
+            op == NFAI_OP_ASSERT_LOOK ||
             op == NFAI_OP_SAVE_START ||
-            op == NFAI_OP_SAVE_END) {
+            op == NFAI_OP_SAVE_END ||
+            (op == NFAI_OP_REPEAT && !in_body)) {
          continue;
       }
 
 #ifdef NFA_TRACE_MATCH
-      nfai_print_opcode(vm->nfa, istate, stderr);
+      nfai_print_opcode(nfa, pc, stderr);
 #endif
 
       follow = 0;
 
       switch (op) {
          case NFAI_OP_MATCH_ANY:
-            follow = 1;
-            break;
          case NFAI_OP_MATCH_BYTE:
-            follow = (arg == (uint8_t)byte);
+         case NFAI_OP_MATCH_CLASS:
+            follow = nfai_match_char(nfa, pc, (uint8_t)byte);
+            inextstate = pc + nfai_nfa_op_length(nfa, pc);
             break;
-         case NFAI_OP_MATCH_BYTE_CI:
-            NFAI_ASSERT(nfai_is_ascii_alpha_lower(arg));
-            follow = (arg == nfai_ascii_tolower((uint8_t)byte));
+         case NFAI_OP_REPEAT:
+            /* a body state for iteration count+1; the next state is after that iteration */
+            follow = nfai_match_char(nfa, pc + 3, (uint8_t)byte);
+            inextstate = nfai_get_id(data->virtual_base, data->wide_ids, pc) + count;
             break;
-         case NFAI_OP_MATCH_CLASS:
+         case NFAI_OP_MATCH_STRING:
             {
-               int j;
-               for (j = 1; j <= arg; ++j) {
-                  uint8_t first = NFAI_HI_BYTE(vm->nfa->ops[istate + j]);
-                  uint8_t last = NFAI_LO_BYTE(vm->nfa->ops[istate + j]);
-                  if ((uint8_t)byte < first) { break; }
-                  if ((uint8_t)byte <= last) {
-                     follow = 1;
-                     break;
-                  }
+               /* the state tells us how far through the string this thread has got */
+               const int base = nfai_get_id(data->virtual_base, data->wide_ids, pc);
+               const int offset = (istate == pc ? 0 : istate - base + 1);
+               NFAI_ASSERT(offset >= 0 && offset < (int)arg);
+               follow = ((uint8_t)byte == nfai_string_byte(nfa, pc, offset));
+               if (offset + 1 < (int)arg) {
+                  inextstate = base + offset;
+               } else {
+                  inextstate = pc + nfai_nfa_op_length(nfa, pc);
                }
-               inextstate = istate + 1 + arg;
             }
             break;
          case NFAI_OP_ACCEPT:
-            /* accept state is sticky */
-            nfai_trace_state(vm, location + 1, istate, set, context_flags);
+            nfai_retrace_accept(vm, istate, set, context_flags);
             if (vm->error) { return vm->error; }
             /* don't try any lower priority alternatives */
             ++i;
@@ -1423,7 +4341,9 @@ break_for:
    }
 
    data->current->nstates = 0;
+   data->current->deferred = 0;
    nfai_swap_state_sets(vm);
+   data->start_rank = data->current->nstates;
    NFAI_ASSERT(!vm->error);
    return 0;
 }
@@ -1435,98 +4355,2715 @@ NFA_API int nfa_exec_match_string(NfaMachine *vm, const char *text, size_t lengt
    uint32_t flags;
    const size_t NULL_LEN = (size_t)(-1);
 
-   NFAI_ASSERT(vm);
-   NFAI_ASSERT(text);
+   NFAI_ASSERT(vm);
+   NFAI_ASSERT(text);
+
+   if (vm->error) { return vm->error; }
+
+   flags = NFA_EXEC_AT_START;
+   if ((length == 0u) || (length == NULL_LEN && text[0] == '\0')) {
+      flags |= NFA_EXEC_AT_END;
+   }
+
+   nfa_exec_start(vm, 0, flags);
+   if (vm->error) { return vm->error; }
+
+#ifdef NFA_TRACE_MATCH
+   NFAI_ASSERT(vm->data);
+   data = (struct NfaiMachineData*)vm->data;
+#endif
+
+   if ((flags & NFA_EXEC_AT_END) == 0) {
+      int at_end;
+      size_t i = 0;
+      do {
+         char c = text[i];
+         ++i;
+         at_end = ((length == NULL_LEN) ? (text[i] == '\0') : (length == i));
+         nfa_exec_step(vm, c, i - 1, (at_end ? NFA_EXEC_AT_END : 0));
+         if (vm->error) { return vm->error; }
+#ifdef NFA_TRACE_MATCH
+         if (vm->ncaptures) { nfai_print_captures(stderr, vm, data->current); }
+#endif
+      } while (!at_end && !nfa_exec_is_rejected(vm));
+   }
+
+#ifdef NFA_TRACE_MATCH
+   if (vm->ncaptures) {
+      fprintf(stderr, "final captures (current):\n");
+      nfai_print_captures(stderr, vm, data->current);
+      fprintf(stderr, "final captures (next):\n");
+      nfai_print_captures(stderr, vm, data->next);
+   }
+#endif
+
+   if (vm->error) { return vm->error; }
+
+   return nfa_exec_is_accepted(vm);
+}
+
+/* whether the text contains the lower-case letter c in either case. Setting bit 5 of a byte
+ * maps both cases of c to c (and nothing else to c), so this can look at a word at a time:
+ * a word holds c if the word with bit 5 of every byte set, xor c in every byte, has a zero byte */
+NFAI_INTERNAL int nfai_contains_folded(const char *text, int c, size_t length) {
+   const size_t ones = ~(size_t)0 / 255, highs = ones << 7, case_bits = ones * 32u, pattern = ones * (size_t)c;
+   size_t i, w;
+   NFAI_ASSERT(nfai_is_ascii_alpha_lower(c));
+   for (i = 0; i + sizeof(size_t) <= length; i += sizeof(size_t)) {
+      memcpy(&w, text + i, sizeof(size_t));
+      w = (w | case_bits) ^ pattern;
+      if ((w - ones) & ~w & highs) { return 1; }
+   }
+   for (; i < length; ++i) {
+      if (((uint8_t)text[i] | 32u) == (unsigned)c) { return 1; }
+   }
+   return 0;
+}
+
+/* whether the text is missing one of the bytes every match contains (memchr is usually
+ * vectorized, so looking for a required byte is much faster than stepping a machine) */
+NFAI_INTERNAL int nfai_prefilter_lacks_required(const Nfa *nfa, const char *text, size_t length) {
+   int i;
+   for (i = 0; i < nfa->nrequired; ++i) {
+      if ((nfa->folded >> i) & 1u) {
+         if (!nfai_contains_folded(text, nfa->required[i], length)) { return 1; }
+      } else if (!memchr(text, nfa->required[i], length)) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/* whether the NFA's prefilter rules out a match */
+NFAI_INTERNAL int nfai_prefilter_rejects(const Nfa *nfa, const char *text, size_t length) {
+   if (length == (size_t)(-1)) { length = strlen(text); }
+   if (length < nfa->min_length || (nfa->max_length != UINT32_MAX && length > nfa->max_length)) { return 1; }
+   return nfai_prefilter_lacks_required(nfa, text, length);
+}
+
+NFA_API int nfa_match(const Nfa *nfa, NfaCapture *captures, int ncaptures, const char *text, size_t length) {
+   NfaMachine vm;
+   int accepted;
+
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(ncaptures >= 0);
+   NFAI_ASSERT(captures || !ncaptures);
+   NFAI_ASSERT(text);
+   NFAI_ASSERT(nfa->nops >= 1);
+
+   if (nfai_prefilter_rejects(nfa, text, length)) {
+      if (ncaptures) { memset(captures, 0, ncaptures * sizeof(NfaCapture)); }
+      return 0;
+   }
+
+   nfa_exec_init(&vm, nfa, ncaptures);
+
+   accepted = nfa_exec_match_string(&vm, text, length);
+
+   if (accepted >= 0) {
+      if (ncaptures) {
+         nfai_store_captures(&vm, captures, ncaptures);
+      }
+      NFAI_ASSERT(!vm.error);
+   }
+
+   nfa_exec_free(&vm);
+   return accepted;
+}
+
+/* add a thread starting at the current position, with the lowest priority (for unanchored
+ * search); if the machine has captures, the thread's capture begin_slot begins here */
+NFAI_INTERNAL void nfai_exec_add_start(NfaMachine *vm, int location, uint32_t context_flags, int begin_slot) {
+   struct NfaiMachineData *data;
+   struct NfaiCaptureSet *set = NULL;
+   NFAI_ASSERT(vm);
+   NFAI_ASSERT(begin_slot < vm->ncaptures);
+   if (vm->error) { return; }
+   NFAI_ASSERT(vm->data);
+   data = (struct NfaiMachineData*)vm->data;
+   if (vm->ncaptures) {
+      set = nfai_make_capture_set(vm);
+      if (!set) { NFAI_ASSERT(vm->error); return; }
+      memset(set->capture, 0, vm->ncaptures * sizeof(NfaCapture));
+      if (begin_slot >= 0) { set->capture[begin_slot].begin = location; }
+   }
+   data->start_rank = data->current->nstates;
+   data->tracing_start = 1;
+   /* (nfai_trace_state adds to the next set, which is empty between steps) */
+   nfai_swap_state_sets(vm);
+   nfai_trace_state(vm, location, 0, set, context_flags);
+   nfai_swap_state_sets(vm);
+}
+
+/* whether the NFA matches somewhere in the line (which doesn't include its newline) */
+NFAI_INTERNAL int nfai_scan_line(NfaMachine *vm, const char *line, size_t length, int search) {
+   size_t i;
+   uint32_t flags = NFA_EXEC_AT_START | (length == 0 ? NFA_EXEC_AT_END : 0);
+   nfa_exec_start(vm, 0, flags);
+   for (i = 0; i < length && !nfa_exec_is_finished(vm); ++i) {
+      flags = (i + 1 == length ? NFA_EXEC_AT_END : 0);
+      nfa_exec_step(vm, line[i], (int)i, flags);
+      if (search && !nfa_exec_is_accepted(vm)) { nfai_exec_add_start(vm, (int)i + 1, flags, -1); }
+   }
+   return nfa_exec_is_accepted(vm);
+}
+
+NFA_API int nfa_exec_scan_lines(NfaMachine *vm, const char *text, size_t length, NfaLineFn fn, void *userdata) {
+   const Nfa *nfa;
+   const char *newline;
+   size_t at, end;
+   int count = 0;
+
+   NFAI_ASSERT(vm);
+   NFAI_ASSERT(text);
+   if (vm->error) { return vm->error; }
+   nfa = vm->nfa;
+
+   if (length == (size_t)(-1)) { length = strlen(text); }
+
+   for (at = 0; at < length; at = end + 1) {
+      newline = (const char*)memchr(text + at, '\n', length - at);
+      end = (newline ? (size_t)(newline - text) : length);
+      if (end - at < nfa->min_length || nfai_prefilter_lacks_required(nfa, text + at, end - at)) { continue; }
+      /* (a pattern anchored with '^' can only match at the start of a line) */
+      if (nfai_scan_line(vm, text + at, end - at, !nfa->anchored)) {
+         ++count;
+         if (fn && fn(userdata, at, end - at)) { break; }
+      }
+      if (vm->error) { break; }
+   }
+   return (vm->error ? vm->error : count);
+}
+
+NFA_API int nfa_scan_lines(const Nfa *nfa, const char *text, size_t length, NfaLineFn fn, void *userdata) {
+   NfaMachine vm;
+   int ret;
+   NFAI_ASSERT(nfa);
+   nfa_exec_init(&vm, nfa, 0);
+   ret = nfa_exec_scan_lines(&vm, text, length, fn, userdata);
+   nfa_exec_free(&vm);
+   return ret;
+}
+
+NFAI_INTERNAL void nfai_lexer_update(NfaLexer *lexer) {
+   struct NfaiMachineData *data;
+   NFAI_ASSERT(lexer);
+   if (lexer->vm.error) { return; }
+   NFAI_ASSERT(lexer->vm.data);
+   data = (struct NfaiMachineData*)lexer->vm.data;
+   if (data->lookahead_token >= 0) {
+      lexer->token = data->lookahead_token;
+      lexer->token_length = lexer->length - 1;
+   }
+   if (data->token >= 0) {
+      lexer->token = data->token;
+      lexer->token_length = lexer->length;
+   }
+   /* once there are no threads left, no longer token can be found */
+   if (nfa_exec_is_rejected(&lexer->vm)) { lexer->finished = 1; }
+}
+
+NFAI_INTERNAL int nfai_lexer_step(NfaLexer *lexer, char byte, uint32_t context_flags) {
+   NFAI_ASSERT(lexer);
+   NFAI_ASSERT(!lexer->finished);
+   nfa_exec_step(&lexer->vm, byte, lexer->location + lexer->length, context_flags);
+   ++lexer->length;
+   nfai_lexer_update(lexer);
+   return lexer->vm.error;
+}
+
+NFAI_INTERNAL int nfai_lexer_init_internal(NfaLexer *lexer) {
+   NFAI_ASSERT(lexer);
+   lexer->token = -1;
+   lexer->token_length = 0;
+   lexer->location = 0;
+   lexer->length = 0;
+   lexer->finished = 1;
+   return lexer->vm.error;
+}
+
+NFA_API int nfa_lexer_init(NfaLexer *lexer, const Nfa *nfa) {
+   NFAI_ASSERT(lexer);
+   nfa_exec_init(&lexer->vm, nfa, 0);
+   return nfai_lexer_init_internal(lexer);
+}
+
+NFA_API int nfa_lexer_init_pool(NfaLexer *lexer, const Nfa *nfa, void *pool, size_t pool_size) {
+   NFAI_ASSERT(lexer);
+   nfa_exec_init_pool(&lexer->vm, nfa, 0, pool, pool_size);
+   return nfai_lexer_init_internal(lexer);
+}
+
+NFA_API int nfa_lexer_init_custom(NfaLexer *lexer, const Nfa *nfa, NfaPageAllocFn allocf, void *userdata) {
+   NFAI_ASSERT(lexer);
+   nfa_exec_init_custom(&lexer->vm, nfa, 0, allocf, userdata);
+   return nfai_lexer_init_internal(lexer);
+}
+
+NFA_API void nfa_lexer_free(NfaLexer *lexer) {
+   if (!lexer) { return; }
+   nfa_exec_free(&lexer->vm);
+   memset(lexer, 0, sizeof(NfaLexer));
+}
+
+NFA_API int nfa_lexer_start(NfaLexer *lexer, int location) {
+   NFAI_ASSERT(lexer);
+   NFAI_ASSERT(location >= 0);
+   if (lexer->vm.error) { return lexer->vm.error; }
+   lexer->token = -1;
+   lexer->token_length = 0;
+   lexer->location = location;
+   lexer->length = 0;
+   lexer->finished = 0;
+   nfa_exec_start(&lexer->vm, location, (location == 0 ? NFA_EXEC_AT_START : 0));
+   nfai_lexer_update(lexer);
+   return lexer->vm.error;
+}
+
+NFA_API int nfa_lexer_feed(NfaLexer *lexer, const char *bytes, size_t length) {
+   size_t i;
+   NFAI_ASSERT(lexer);
+   NFAI_ASSERT(bytes || !length);
+   if (lexer->vm.error) { return lexer->vm.error; }
+   for (i = 0; i < length && !lexer->finished; ++i) {
+      if (nfai_lexer_step(lexer, bytes[i], 0)) { return lexer->vm.error; }
+   }
+   return lexer->finished;
+}
+
+NFA_API int nfa_lexer_finish(NfaLexer *lexer) {
+   struct NfaiMachineData *data;
+   NFAI_ASSERT(lexer);
+   if (lexer->vm.error) { return lexer->vm.error; }
+   NFAI_ASSERT(lexer->vm.data);
+   data = (struct NfaiMachineData*)lexer->vm.data;
+   if (!lexer->finished && data->current->deferred) {
+      /* the input ended, so assertions still waiting for the next byte can be decided */
+      data->lookahead_token = -1;
+      nfai_resolve_lookahead(&lexer->vm, -1, lexer->location + lexer->length);
+      if (lexer->vm.error) { return lexer->vm.error; }
+      nfai_lexer_update(lexer);
+   }
+   lexer->finished = 1;
+   return (lexer->token >= 0 ? NFA_RESULT_MATCH : NFA_RESULT_NOMATCH);
+}
+
+NFA_API int nfa_lex(NfaLexer *lexer, const char *text, size_t length, int location) {
+   size_t i;
+   NFAI_ASSERT(lexer);
+   NFAI_ASSERT(text || !length);
+   if (nfa_lexer_start(lexer, location)) { return lexer->vm.error; }
+   for (i = 0; i < length && !lexer->finished; ++i) {
+      if (nfai_lexer_step(lexer, text[i], (i + 1 == length ? NFA_EXEC_AT_END : 0))) { return lexer->vm.error; }
+   }
+   return nfa_lexer_finish(lexer);
+}
+
+/* the input a search can read: bytes [held_at, chunk_at) are in 'held' and bytes
+ * [chunk_at, end) are in 'chunk' (nfa_find_* have no held bytes) */
+struct NfaiInput {
+   const char *held;
+   size_t held_at;
+   const char *chunk;
+   size_t chunk_at;
+   size_t end;
+   int at_end; /* (bool) the input ends at 'end' (otherwise more can be fed) */
+};
+
+enum {
+   NFAI_RESULT_NEED_INPUT = 2 /* nfai_iter_search got to the end of the input it has so far */
+};
+
+NFAI_INTERNAL int nfai_input_byte(const struct NfaiInput *in, size_t i) {
+   NFAI_ASSERT(i >= in->held_at && i < in->end);
+   return (uint8_t)(i < in->chunk_at ? in->held[i - in->held_at] : in->chunk[i - in->chunk_at]);
+}
+
+/* whether the machine's match is decided: no thread of higher priority than the accept is left
+ * that can consume a byte, or that is a look assertion waiting for the next byte (the states
+ * ranked before the accept may also include transition states that led to it) */
+NFAI_INTERNAL int nfai_accept_is_decided(const NfaMachine *vm) {
+   const struct NfaiMachineData *data;
+   const Nfa *nfa = vm->nfa;
+   int i, istate, pc, in_body;
+   NfaOpcode word, op;
+   if (!nfa_exec_is_accepted(vm)) { return 0; }
+   data = (const struct NfaiMachineData*)vm->data;
+   for (i = 0; i < data->current->nstates; ++i) {
+      istate = nfai_get_id(data->current->state, data->current->wide_ids, i);
+      pc = (istate < nfa->nops ? istate : nfai_get_id(data->virtual_op, data->wide_ids, istate - nfa->nops));
+      word = nfai_word(nfa, pc);
+      op = (word & NFAI_OPCODE_MASK);
+      in_body = 0;
+      if (op == NFAI_OP_REPEAT) { nfai_repeat_count(vm, pc, istate, &in_body); }
+      if (op == NFAI_OP_ACCEPT) { return 1; }
+      if (!(op == NFAI_OP_JUMP ||
+            op == NFAI_OP_ASSERT_CONTEXT ||
+            (op == NFAI_OP_ASSERT_LOOK && nfai_look_passes(NFAI_LO_BYTE(word), data->look) >= 0) ||
+            op == NFAI_OP_SAVE_START ||
+            op == NFAI_OP_SAVE_END ||
+            (op == NFAI_OP_REPEAT && !in_body))) {
+         return 0;
+      }
+   }
+   NFAI_ASSERT(0 && "accept state not found");
+   return 0;
+}
+
+/* continue the search for the leftmost match from iter->position (which mustn't be empty at
+ * that position if the last match was empty there). The machine's last capture is the match
+ * (just its begin is used), unless the iterator is count-only. A match is decided once no
+ * higher priority thread is left; a byte is only stepped once it's known whether it's the last */
+NFAI_INTERNAL int nfai_iter_search(NfaIter *iter, const struct NfaiInput *in) {
+   NfaMachine *vm = &iter->vm;
+   struct NfaiMachineData *data;
+   const int slot = vm->ncaptures - 1;
+   uint32_t flags;
+   size_t i;
+
+   NFAI_ASSERT(vm->data);
+   NFAI_ASSERT(!iter->done);
+   NFAI_ASSERT(iter->position <= in->end);
+   data = (struct NfaiMachineData*)vm->data;
+
+   if (!iter->searching) {
+      const size_t at = iter->position;
+      if (at == in->end && !in->at_end) { return NFAI_RESULT_NEED_INPUT; }
+      flags = (at == 0 ? NFA_EXEC_AT_START : 0) | (at == in->end ? NFA_EXEC_AT_END : 0);
+      nfai_exec_reset(vm, (at ? nfai_input_byte(in, at - 1) : -1), flags);
+      data->no_accept_at = (iter->empty ? (int)at : -1);
+      nfai_exec_add_start(vm, (int)at, flags, slot);
+      iter->searching = 1;
+   }
+
+   while (!vm->error) {
+      i = iter->position;
+      if (nfai_accept_is_decided(vm)) { break; }
+      if (iter->anchored && nfa_exec_is_rejected(vm)) { break; }
+      if (i + 1 >= in->end && !in->at_end) { return NFAI_RESULT_NEED_INPUT; }
+      if (i == in->end) { break; }
+      flags = (i + 1 == in->end ? NFA_EXEC_AT_END : 0);
+      nfa_exec_step(vm, (char)nfai_input_byte(in, i), (int)i, flags);
+      iter->position = i + 1;
+      if (!iter->anchored && !nfa_exec_is_accepted(vm)) { nfai_exec_add_start(vm, (int)i + 1, flags, slot); }
+   }
+   if (!vm->error && data->current->deferred && !nfai_accept_is_decided(vm)) {
+      /* the input ended, so assertions still waiting for the next byte can be decided (unless
+       * they're all ranked after a decided match) */
+      NFAI_ASSERT(iter->position == in->end && in->at_end);
+      nfai_resolve_lookahead(vm, -1, (int)iter->position);
+   }
+   if (vm->error) { return vm->error; }
+
+   iter->searching = 0;
+   if (!nfa_exec_is_accepted(vm)) {
+      iter->done = 1;
+      return NFA_RESULT_NOMATCH;
+   }
+   iter->end = data->accept_location;
+   if (slot >= 0) {
+      iter->begin = vm->captures[slot].begin;
+      iter->empty = (iter->begin == iter->end);
+   } else {
+      iter->begin = -1;
+      iter->empty = data->accept_empty;
+   }
+   nfai_store_captures(vm, iter->captures, iter->ncaptures);
+   /* the next match starts where this one ended */
+   iter->position = (size_t)iter->end;
+   return NFA_RESULT_MATCH;
+}
+
+/* the first location that a match can still start at: where the oldest thread started
+ * (threads are in priority order, and a thread that starts later has a lower priority) */
+NFAI_INTERNAL size_t nfai_iter_oldest_start(const NfaIter *iter) {
+   const struct NfaiMachineData *data;
+   const int slot = iter->vm.ncaptures - 1;
+   int i;
+   NFAI_ASSERT(slot >= 0);
+   NFAI_ASSERT(iter->vm.data);
+   if (!iter->searching) { return iter->position; }
+   data = (const struct NfaiMachineData*)iter->vm.data;
+   for (i = 0; i < data->current->nstates; ++i) {
+      const struct NfaiCaptureSet *set = data->current->captures[nfai_get_id(data->current->state, data->current->wide_ids, i)];
+      if (set) { return (size_t)set->capture[slot].begin; }
+   }
+   return iter->position;
+}
+
+NFAI_INTERNAL void nfai_iter_input(const NfaIter *iter, struct NfaiInput *in) {
+   in->held = NULL;
+   in->held_at = 0;
+   in->chunk = iter->text;
+   in->chunk_at = 0;
+   in->end = iter->length;
+   in->at_end = 1;
+}
+
+/* the number of captures the iterator's machine needs: the match is recorded in a capture
+ * after any the pattern saves */
+NFAI_INTERNAL int nfai_iter_machine_captures(const Nfa *nfa, int ncaptures, int flags) {
+   int pc, slot;
+   if (flags & NFA_ITER_COUNT_ONLY) { return 0; }
+   for (pc = 0; pc < nfa->nops; pc += nfai_nfa_op_length(nfa, pc)) {
+      const NfaOpcode op = nfai_word(nfa, pc);
+      if ((op & NFAI_OPCODE_MASK) == NFAI_OP_SAVE_START || (op & NFAI_OPCODE_MASK) == NFAI_OP_SAVE_END) {
+         slot = NFAI_LO_BYTE(op);
+         if (slot >= ncaptures) { ncaptures = slot + 1; }
+      }
+   }
+   return ncaptures + 1;
+}
+
+NFAI_INTERNAL int nfai_iter_init_internal(NfaIter *iter, NfaCapture *captures, int ncaptures, int flags) {
+   NFAI_ASSERT(iter);
+   NFAI_ASSERT(ncaptures >= 0);
+   NFAI_ASSERT(captures || !ncaptures);
+   NFAI_ASSERT(!(flags & NFA_ITER_COUNT_ONLY) || !ncaptures);
+   iter->captures = captures;
+   iter->ncaptures = ncaptures;
+   iter->flags = flags;
+   iter->text = NULL;
+   iter->length = 0;
+   iter->begin = -1;
+   iter->end = -1;
+   iter->empty = 0;
+   iter->anchored = (iter->vm.nfa ? (int)iter->vm.nfa->anchored : 0);
+   iter->done = 1;
+   iter->position = 0;
+   iter->searching = 0;
+   return iter->vm.error;
+}
+
+NFA_API int nfa_iter_init(NfaIter *iter, const Nfa *nfa, NfaCapture *captures, int ncaptures, int flags) {
+   NFAI_ASSERT(iter);
+   NFAI_ASSERT(nfa);
+   nfa_exec_init(&iter->vm, nfa, nfai_iter_machine_captures(nfa, ncaptures, flags));
+   return nfai_iter_init_internal(iter, captures, ncaptures, flags);
+}
+
+NFA_API int nfa_iter_init_pool(NfaIter *iter, const Nfa *nfa, NfaCapture *captures, int ncaptures, int flags, void *pool, size_t pool_size) {
+   NFAI_ASSERT(iter);
+   NFAI_ASSERT(nfa);
+   nfa_exec_init_pool(&iter->vm, nfa, nfai_iter_machine_captures(nfa, ncaptures, flags), pool, pool_size);
+   return nfai_iter_init_internal(iter, captures, ncaptures, flags);
+}
+
+NFA_API int nfa_iter_init_custom(NfaIter *iter, const Nfa *nfa, NfaCapture *captures, int ncaptures, int flags, NfaPageAllocFn allocf, void *userdata) {
+   NFAI_ASSERT(iter);
+   NFAI_ASSERT(nfa);
+   nfa_exec_init_custom(&iter->vm, nfa, nfai_iter_machine_captures(nfa, ncaptures, flags), allocf, userdata);
+   return nfai_iter_init_internal(iter, captures, ncaptures, flags);
+}
+
+NFA_API size_t nfa_iter_required_pool_size(const Nfa *nfa, int ncaptures, int flags) {
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(nfa->magic == NFAI_MAGIC);
+   NFAI_ASSERT(ncaptures >= 0);
+   return nfai_exec_pool_size(nfa, nfai_iter_machine_captures(nfa, ncaptures, flags));
+}
+
+NFA_API void nfa_iter_free(NfaIter *iter) {
+   if (!iter) { return; }
+   nfa_exec_free(&iter->vm);
+   memset(iter, 0, sizeof(NfaIter));
+}
+
+NFA_API int nfa_find_first(NfaIter *iter, const char *text, size_t length) {
+   struct NfaiInput in;
+   const Nfa *nfa;
+   NFAI_ASSERT(iter);
+   NFAI_ASSERT(text);
+   if (iter->vm.error) { return iter->vm.error; }
+   nfa = iter->vm.nfa;
+
+   if (length == (size_t)(-1)) { length = strlen(text); }
+   iter->text = text;
+   iter->length = length;
+   iter->begin = -1;
+   iter->end = -1;
+   iter->empty = 0;
+   iter->position = 0;
+   iter->searching = 0;
+   iter->done = 0;
+
+   /* (there's no match anywhere in the text if it's missing a byte that every match needs) */
+   if (length < nfa->min_length || nfai_prefilter_lacks_required(nfa, text, length)) {
+      iter->done = 1;
+      return NFA_RESULT_NOMATCH;
+   }
+   nfai_iter_input(iter, &in);
+   return nfai_iter_search(iter, &in);
+}
+
+NFA_API int nfa_find_next(NfaIter *iter) {
+   struct NfaiInput in;
+   NFAI_ASSERT(iter);
+   if (iter->vm.error) { return iter->vm.error; }
+   if (iter->done) { return NFA_RESULT_NOMATCH; }
+   nfai_iter_input(iter, &in);
+   return nfai_iter_search(iter, &in);
+}
+
+NFA_API int nfa_count_matches(const Nfa *nfa, const char *text, size_t length) {
+   NfaIter iter;
+   int ret, count = 0;
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(text);
+   nfa_iter_init(&iter, nfa, NULL, 0, NFA_ITER_COUNT_ONLY);
+   for (ret = nfa_find_first(&iter, text, length); ret == NFA_RESULT_MATCH; ret = nfa_find_next(&iter)) {
+      ++count;
+   }
+   nfa_iter_free(&iter);
+   return (ret < 0 ? ret : count);
+}
+
+/* parse a group reference after a '$' in a replacement template ('0' to '9', or '{n}'), and
+ * move *t past it; returns the group, or -1 if it isn't valid */
+NFAI_INTERNAL int nfai_template_group(const char **t) {
+   const char *p = *t;
+   int group = 0;
+   if (*p >= '0' && *p <= '9') {
+      *t = p + 1;
+      return (*p - '0');
+   }
+   if (*p != '{') { return -1; }
+   for (++p; *p >= '0' && *p <= '9'; ++p) {
+      group = 10*group + (*p - '0');
+      if (group > 255) { return -1; }
+   }
+   if (p == *t + 1 || *p != '}') { return -1; }
+   *t = p + 1;
+   return group;
+}
+
+NFAI_INTERNAL int nfai_template_validate(const char *t) {
+   while (*t) {
+      if (*t++ != '$') { continue; }
+      if (*t == '$') {
+         ++t;
+      } else if (nfai_template_group(&t) < 0) {
+         return NFA_ERROR_BAD_TEMPLATE;
+      }
+   }
+   return 0;
+}
+
+NFAI_INTERNAL int nfai_replacer_emit(NfaReplacer *replacer, const char *bytes, size_t length) {
+   int ret;
+   if (!length) { return 0; }
+   ret = replacer->fn(replacer->userdata, bytes, length);
+   if (ret < 0) { replacer->iter.vm.error = ret; }
+   return ret;
+}
+
+/* output input bytes [begin, end), as (up to) one span of held bytes and one span of the chunk */
+NFAI_INTERNAL int nfai_replacer_emit_input(NfaReplacer *replacer, const struct NfaiInput *in, size_t begin, size_t end) {
+   NFAI_ASSERT(begin >= in->held_at && end <= in->end);
+   if (begin >= end) { return 0; }
+   if (begin < in->chunk_at) {
+      const size_t held_end = (end < in->chunk_at ? end : in->chunk_at);
+      if (nfai_replacer_emit(replacer, in->held + (begin - in->held_at), held_end - begin)) { return replacer->iter.vm.error; }
+      begin = held_end;
+   }
+   if (begin < end) { return nfai_replacer_emit(replacer, in->chunk + (begin - in->chunk_at), end - begin); }
+   return 0;
+}
+
+/* output the template for the last match: literal text comes from the template, groups from the input */
+NFAI_INTERNAL int nfai_replacer_expand(NfaReplacer *replacer, const struct NfaiInput *in) {
+   const NfaMachine *vm = &replacer->iter.vm;
+   const char *t = replacer->replacement, *literal = t;
+   while (*t) {
+      int group, ret;
+      if (*t != '$') {
+         ++t;
+         continue;
+      }
+      if (nfai_replacer_emit(replacer, literal, (size_t)(t - literal))) { return vm->error; }
+      ++t;
+      if (*t == '$') {
+         /* (the '$' is output with the literal text after it) */
+         literal = t++;
+         continue;
+      }
+      group = nfai_template_group(&t);
+      NFAI_ASSERT(group >= 0);
+      literal = t;
+      if (group == 0) {
+         ret = nfai_replacer_emit_input(replacer, in, (size_t)replacer->iter.begin, (size_t)replacer->iter.end);
+      } else if (group < vm->ncaptures - 1 && vm->captures[group].begin < vm->captures[group].end) {
+         ret = nfai_replacer_emit_input(replacer, in, (size_t)vm->captures[group].begin, (size_t)vm->captures[group].end);
+      } else {
+         /* (a group that didn't take part in the match, or that the pattern doesn't have, is empty) */
+         ret = 0;
+      }
+      if (ret) { return ret; }
+   }
+   return nfai_replacer_emit(replacer, literal, (size_t)(t - literal));
+}
+
+/* replace the matches found in the input, and output the input before them; stops when the
+ * search needs more input, or (at the end of the input) once everything has been output */
+NFAI_INTERNAL int nfai_replacer_run(NfaReplacer *replacer, const struct NfaiInput *in) {
+   NfaIter *iter = &replacer->iter;
+   int ret = NFA_RESULT_NOMATCH;
+   while (!iter->done) {
+      ret = nfai_iter_search(iter, in);
+      if (ret != NFA_RESULT_MATCH) { break; }
+      if (nfai_replacer_emit_input(replacer, in, replacer->emitted, (size_t)iter->begin)) { return iter->vm.error; }
+      if (nfai_replacer_expand(replacer, in)) { return iter->vm.error; }
+      replacer->emitted = (size_t)iter->end;
+      ++replacer->count;
+   }
+   if (ret < 0) { return ret; }
+   if (iter->done) {
+      /* there are no more matches, so the rest of the input is unchanged */
+      if (nfai_replacer_emit_input(replacer, in, replacer->emitted, in->end)) { return iter->vm.error; }
+      replacer->emitted = in->end;
+   }
+   return 0;
+}
+
+NFAI_INTERNAL void nfai_replacer_input(const NfaReplacer *replacer, struct NfaiInput *in, const char *bytes, size_t length) {
+   in->held = replacer->held;
+   in->held_at = replacer->held_at;
+   in->chunk = bytes;
+   in->chunk_at = replacer->held_at + replacer->held_length;
+   in->end = in->chunk_at + length;
+   in->at_end = 0;
+}
+
+NFA_API int nfa_replacer_init(NfaReplacer *replacer, const Nfa *nfa, const char *replacement, NfaSpanFn fn, void *userdata) {
+   int error;
+   NFAI_ASSERT(replacer);
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(replacement);
+   NFAI_ASSERT(fn);
+
+   memset(replacer, 0, sizeof(NfaReplacer));
+   error = nfai_template_validate(replacement);
+   if (error) { return (replacer->iter.vm.error = error); }
+   if (nfa_iter_init(&replacer->iter, nfa, NULL, 0, 0)) { return replacer->iter.vm.error; }
+   replacer->replacement = replacement;
+   replacer->fn = fn;
+   replacer->userdata = userdata;
+   replacer->iter.done = 0;
+   return 0;
+}
+
+NFA_API void nfa_replacer_free(NfaReplacer *replacer) {
+   if (!replacer) { return; }
+   if (replacer->held) { replacer->iter.vm.alloc.allocf(replacer->iter.vm.alloc.userdata, replacer->held, NULL); }
+   nfa_iter_free(&replacer->iter);
+   memset(replacer, 0, sizeof(NfaReplacer));
+}
+
+NFA_API int nfa_replacer_feed(NfaReplacer *replacer, const char *bytes, size_t length) {
+   NfaPoolAllocator *alloc;
+   struct NfaiInput in;
+   size_t keep, start;
+
+   NFAI_ASSERT(replacer);
+   NFAI_ASSERT(bytes || !length);
+   if (replacer->iter.vm.error) { return replacer->iter.vm.error; }
+   nfai_replacer_input(replacer, &in, bytes, length);
+   if (nfai_replacer_run(replacer, &in)) { return replacer->iter.vm.error; }
+
+   /* no match can start before the oldest thread, so the input before that is unchanged; the
+    * rest is kept (with the byte before it, for look assertions) until the match is decided */
+   start = (replacer->iter.done ? in.end : nfai_iter_oldest_start(&replacer->iter));
+   NFAI_ASSERT(start >= replacer->emitted);
+   if (nfai_replacer_emit_input(replacer, &in, replacer->emitted, start)) { return replacer->iter.vm.error; }
+   replacer->emitted = start;
+   keep = (start > in.held_at ? start - 1 : start);
+
+   if (in.end - keep > replacer->held_size) {
+      /* (the held bytes are moved to a bigger buffer) */
+      size_t size = 2*(in.end - keep);
+      char *held;
+      alloc = &replacer->iter.vm.alloc;
+      held = (char*)alloc->allocf(alloc->userdata, NULL, &size);
+      if (!held || size < in.end - keep) {
+         if (held) { alloc->allocf(alloc->userdata, held, NULL); }
+         return (replacer->iter.vm.error = NFA_ERROR_OUT_OF_MEMORY);
+      }
+      if (keep < in.chunk_at) { memcpy(held, replacer->held + (keep - in.held_at), in.chunk_at - keep); }
+      if (replacer->held) { alloc->allocf(alloc->userdata, replacer->held, NULL); }
+      replacer->held = held;
+      replacer->held_size = size;
+   } else if (keep < in.chunk_at) {
+      memmove(replacer->held, replacer->held + (keep - in.held_at), in.chunk_at - keep);
+   }
+   if (keep < in.chunk_at) {
+      memcpy(replacer->held + (in.chunk_at - keep), bytes, length);
+   } else {
+      memcpy(replacer->held, bytes + (keep - in.chunk_at), in.end - keep);
+   }
+   replacer->held_at = keep;
+   replacer->held_length = in.end - keep;
+   return 0;
+}
+
+NFA_API int nfa_replacer_finish(NfaReplacer *replacer) {
+   struct NfaiInput in;
+   NFAI_ASSERT(replacer);
+   if (replacer->iter.vm.error) { return replacer->iter.vm.error; }
+   nfai_replacer_input(replacer, &in, NULL, 0);
+   in.at_end = 1;
+   if (nfai_replacer_run(replacer, &in)) { return replacer->iter.vm.error; }
+   replacer->held_at = in.end;
+   replacer->held_length = 0;
+   return replacer->count;
+}
+
+NFA_API int nfa_replace(const Nfa *nfa, const char *text, size_t length, const char *replacement, NfaSpanFn fn, void *userdata) {
+   NfaReplacer replacer;
+   struct NfaiInput in;
+   int ret;
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(text);
+
+   if (length == (size_t)(-1)) { length = strlen(text); }
+   if (nfa_replacer_init(&replacer, nfa, replacement, fn, userdata)) { return replacer.iter.vm.error; }
+   /* (the whole input is there, so nothing is held; the prefilter can rule out any match) */
+   nfai_replacer_input(&replacer, &in, text, length);
+   in.at_end = 1;
+   if (length < nfa->min_length || nfai_prefilter_lacks_required(nfa, text, length)) { replacer.iter.done = 1; }
+   ret = nfai_replacer_run(&replacer, &in);
+   if (!ret) { ret = replacer.count; }
+   nfa_replacer_free(&replacer);
+   return ret;
+}
+
+/* ----- DFA CONSTRUCTION (for nfa_emit_c and the JIT) ----- */
+
+/* DFA construction gives up (with NFA_ERROR_NFA_TOO_LARGE) beyond these limits */
+enum {
+   NFAI_DFA_MAX_OPS    = (1 << 16), /* ops after expanding strings and counted repetition */
+   NFAI_DFA_MAX_STATES = 4096       /* DFA states */
+};
+
+struct NfaiDfaState {
+   int *kernel;   /* the NFA states reached by the transition into this state (sorted) */
+   int nkernel;
+   int start;     /* (bool) at the start of the input */
+   int behind;    /* look bits for the byte before (NFAI_LOOK_BEHIND_*; 0 if the program has no look assertions) */
+   int accept;    /* (bool) the NFA has accepted (whatever comes next) */
+   int accept_end; /* (bool) the NFA accepts if the input ends here */
+   int *next;     /* target for each byte value, or -1 for no match */
+   int targeted;  /* (bool) something jumps to this state */
+   int single;    /* (bool) every byte value has the same target */
+};
+
+struct NfaiDfa {
+   NfaPoolAllocator pool;
+   NfaOpcode *ops;  /* the expanded program (only single-byte matches, with absolute jump targets) */
+   int nops;
+   int has_look;    /* (bool) the program has look assertions */
+   int *mark;       /* closure marks (compared with stamp) */
+   int stamp;
+   int *stack;
+   int *closure;
+   int *scratch;
+   struct NfaiDfaState *states;
+   int nstates;
+   int max_states;  /* (at most NFAI_DFA_MAX_STATES) */
+   int nranges;     /* byte ranges that every op (and look assertion) treats alike */
+   int range_start[257]; /* first byte of each range, then 256 */
+   int *table;      /* hash table of states (2*NFAI_DFA_MAX_STATES slots, -1 if empty) */
+};
+
+/* Expand the program so that every thread state is an op: a string match becomes a
+ * byte match per byte, and a counted repetition is unrolled. Jumps are converted to
+ * absolute targets. */
+NFAI_INTERNAL int nfai_dfa_expand(struct NfaiDfa *dfa, const Nfa *nfa) {
+   NfaOpcode *ops, *to;
+   int *new_pc;
+   double total = 0.0;
+   int pc, i, j, len;
+
+   ops = (NfaOpcode*)nfai_alloc(&dfa->pool, nfa->nops * sizeof(NfaOpcode));
+   new_pc = (int*)nfai_alloc(&dfa->pool, nfa->nops * sizeof(int));
+   if (!ops || !new_pc) { return NFA_ERROR_OUT_OF_MEMORY; }
+   nfai_load_ops(nfa, ops);
+
+   for (pc = 0; pc < nfa->nops; pc += nfai_op_length(ops + pc)) {
+      const NfaOpcode op = ops[pc];
+      new_pc[pc] = (int)total;
+      if ((op & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_STRING) {
+         total += NFAI_LO_BYTE(op);
+      } else if ((op & NFAI_OPCODE_MASK) == NFAI_OP_REPEAT) {
+         const double body = nfai_op_length(ops + pc + 3), min = ops[pc + 1], max = ops[pc + 2];
+         total += ((NFAI_LO_BYTE(op) & NFAI_REPEAT_UNBOUNDED) ? min*body + body + 5.0 : min*body + (max - min)*(body + 3.0));
+      } else {
+         total += nfai_op_length(ops + pc);
+      }
+      if (total > (double)NFAI_DFA_MAX_OPS) { return NFA_ERROR_NFA_TOO_LARGE; }
+   }
+
+   dfa->nops = (int)total;
+   dfa->ops = to = (NfaOpcode*)nfai_alloc(&dfa->pool, dfa->nops * sizeof(NfaOpcode));
+   if (!to) { return NFA_ERROR_OUT_OF_MEMORY; }
+   for (pc = 0; pc < nfa->nops; pc += len) {
+      const NfaOpcode op = ops[pc];
+      len = nfai_op_length(ops + pc);
+      NFAI_ASSERT(to == dfa->ops + new_pc[pc]);
+      switch (op & NFAI_OPCODE_MASK) {
+         case NFAI_OP_JUMP:
+            *to++ = op;
+            for (i = 1; i < len; ++i) { *to++ = (NfaOpcode)new_pc[pc + len + (int32_t)ops[pc + i]]; }
+            break;
+         case NFAI_OP_MATCH_STRING:
+            for (i = 0; i < NFAI_LO_BYTE(op); ++i) {
+               const NfaOpcode pair = ops[pc + 1 + i/2];
+               *to++ = NFAI_OP_MATCH_BYTE | ((i & 1) ? NFAI_LO_BYTE(pair) : NFAI_HI_BYTE(pair));
+            }
+            break;
+         case NFAI_OP_REPEAT:
+            {
+               const int body = len - 3, min = (int)ops[pc + 1], max = (int)ops[pc + 2];
+               const int unbounded = (NFAI_LO_BYTE(op) & NFAI_REPEAT_UNBOUNDED);
+               const int end = new_pc[pc] + (unbounded ? min*body + body + 5 : min*body + (max - min)*(body + 3));
+               for (i = 0; i < (unbounded ? min + 1 : max); ++i) {
+                  const int at = (int)(to - dfa->ops);
+                  if (i >= min) {
+                     /* an optional iteration (or, for an unbounded repeat, a loop); skipping
+                      * it skips the rest of the repeat, so that the later iterations aren't
+                      * all in every closure */
+                     *to++ = NFAI_OP_JUMP | 2u;
+                     *to++ = (NfaOpcode)(at + 3);
+                     *to++ = (NfaOpcode)end;
+                  }
+                  for (j = 0; j < body; ++j) { *to++ = ops[pc + 3 + j]; }
+                  if (i >= min && unbounded) {
+                     *to++ = NFAI_OP_JUMP | 1u;
+                     *to++ = (NfaOpcode)at;
+                  }
+               }
+               NFAI_ASSERT(to == dfa->ops + end);
+            }
+            break;
+         case NFAI_OP_ASSERT_LOOK:
+            dfa->has_look = 1;
+            *to++ = op;
+            break;
+         default:
+            for (i = 0; i < len; ++i) { *to++ = ops[pc + i]; }
+            break;
+      }
+   }
+   NFAI_ASSERT(to == dfa->ops + dfa->nops);
+   return 0;
+}
+
+NFAI_INTERNAL void nfai_dfa_push(struct NfaiDfa *dfa, int pc, int *top) {
+   if (dfa->mark[pc] != dfa->stamp) {
+      dfa->mark[pc] = dfa->stamp;
+      dfa->stack[(*top)++] = pc;
+   }
+}
+
+/* the thread states (byte matches, accepts and tokens) reachable from the kernel without consuming
+ * input, given the context flags and the look bits for the bytes either side */
+NFAI_INTERNAL int nfai_dfa_closure(struct NfaiDfa *dfa, const int *kernel, int nkernel, uint32_t flags, int look) {
+   int i, n = 0, top = 0;
+   ++dfa->stamp;
+   for (i = 0; i < nkernel; ++i) { nfai_dfa_push(dfa, kernel[i], &top); }
+   while (top) {
+      const int pc = dfa->stack[--top];
+      const NfaOpcode op = dfa->ops[pc];
+      switch (op & NFAI_OPCODE_MASK) {
+         case NFAI_OP_JUMP:
+            for (i = 1; i <= NFAI_LO_BYTE(op); ++i) { nfai_dfa_push(dfa, (int)dfa->ops[pc + i], &top); }
+            break;
+         case NFAI_OP_ASSERT_CONTEXT:
+            if (flags & ((uint32_t)1 << NFAI_LO_BYTE(op))) { nfai_dfa_push(dfa, pc + 1, &top); }
+            break;
+         case NFAI_OP_ASSERT_LOOK:
+            if (nfai_look_passes(NFAI_LO_BYTE(op), look) > 0) { nfai_dfa_push(dfa, pc + 1, &top); }
+            break;
+         case NFAI_OP_SAVE_START:
+         case NFAI_OP_SAVE_END:
+            nfai_dfa_push(dfa, pc + 1, &top);
+            break;
+         default:
+            dfa->closure[n++] = pc;
+            break;
+      }
+   }
+   return n;
+}
+
+NFAI_INTERNAL int nfai_dfa_match(const NfaOpcode *ops, int pc, int byte) {
+   const NfaOpcode op = ops[pc];
+   const int arg = NFAI_LO_BYTE(op);
+   int i;
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_ANY:
+         return 1;
+      case NFAI_OP_MATCH_BYTE:
+         return (arg == byte);
+      case NFAI_OP_MATCH_CLASS:
+         for (i = 1; i <= arg; ++i) {
+            if (byte >= NFAI_HI_BYTE(ops[pc + i]) && byte <= NFAI_LO_BYTE(ops[pc + i])) { return 1; }
+         }
+         return 0;
+      default:
+         return 0;
+   }
+}
+
+NFAI_INTERNAL int nfai_int_cmp(const void *a, const void *b) {
+   const int x = *(const int*)a, y = *(const int*)b;
+   return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* find or add the DFA state for a (sorted) kernel; returns the state index, or a negative error code */
+NFAI_INTERNAL int nfai_dfa_state(struct NfaiDfa *dfa, const int *kernel, int nkernel, int start, int behind) {
+   struct NfaiDfaState *state;
+   uint32_t h = 2166136261u ^ (uint32_t)(start | (behind << 1));
+   int i, slot;
+   for (i = 0; i < nkernel; ++i) { h = (h ^ (uint32_t)kernel[i]) * 16777619u; }
+   for (slot = (int)(h % (2*NFAI_DFA_MAX_STATES));; slot = (slot + 1) % (2*NFAI_DFA_MAX_STATES)) {
+      if (dfa->table[slot] < 0) { break; }
+      state = dfa->states + dfa->table[slot];
+      if (state->start == start && state->behind == behind && state->nkernel == nkernel && !memcmp(state->kernel, kernel, nkernel*sizeof(int))) {
+         return dfa->table[slot];
+      }
+   }
+   if (dfa->nstates >= dfa->max_states) { return NFA_ERROR_NFA_TOO_LARGE; }
+   state = dfa->states + dfa->nstates;
+   state->kernel = (int*)nfai_alloc(&dfa->pool, (nkernel ? nkernel : 1)*sizeof(int));
+   state->next = (int*)nfai_alloc(&dfa->pool, 256*sizeof(int));
+   if (!state->kernel || !state->next) { return NFA_ERROR_OUT_OF_MEMORY; }
+   memcpy(state->kernel, kernel, nkernel*sizeof(int));
+   state->nkernel = nkernel;
+   state->start = start;
+   state->behind = behind;
+   dfa->table[slot] = dfa->nstates;
+   return dfa->nstates++;
+}
+
+/* space for nfai_dfa_closure (and a scratch list of the same size) */
+NFAI_INTERNAL int nfai_dfa_alloc_closure(struct NfaiDfa *dfa) {
+   dfa->mark = (int*)nfai_zalloc(&dfa->pool, dfa->nops*sizeof(int));
+   dfa->stack = (int*)nfai_alloc(&dfa->pool, dfa->nops*sizeof(int));
+   dfa->closure = (int*)nfai_alloc(&dfa->pool, dfa->nops*sizeof(int));
+   dfa->scratch = (int*)nfai_alloc(&dfa->pool, dfa->nops*sizeof(int));
+   return (dfa->mark && dfa->stack && dfa->closure && dfa->scratch ? 0 : NFA_ERROR_OUT_OF_MEMORY);
+}
+
+/* the closure of a state for the ahead class of the byte c (or the end of the input, for c < 0) */
+NFAI_INTERNAL int nfai_dfa_state_closure(struct NfaiDfa *dfa, const struct NfaiDfaState *state, int c, int *accepts) {
+   const uint32_t flags = (state->start ? NFA_EXEC_AT_START : 0) | (c < 0 ? NFA_EXEC_AT_END : 0);
+   const int look = (dfa->has_look ? state->behind | nfai_look_ahead(c) : 0);
+   int j, nclosure;
+   nclosure = nfai_dfa_closure(dfa, state->kernel, state->nkernel, flags, look);
+   *accepts = 0;
+   for (j = 0; j < nclosure; ++j) {
+      if ((dfa->ops[dfa->closure[j]] & NFAI_OPCODE_MASK) == NFAI_OP_ACCEPT) { *accepts = 1; }
+   }
+   return nclosure;
+}
+
+/* split the byte values into ranges whose bytes are matched by the same ops, and (with look
+ * assertions) are the same kind of byte, so that they all go to the same DFA state */
+NFAI_INTERNAL void nfai_dfa_byte_ranges(struct NfaiDfa *dfa) {
+   uint8_t split[257];
+   int pc, i, b;
+   memset(split, 0, sizeof(split));
+   split[0] = 1;
+   for (pc = 0; pc < dfa->nops; pc += nfai_op_length(dfa->ops + pc)) {
+      const NfaOpcode op = dfa->ops[pc];
+      if ((op & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_BYTE) {
+         split[NFAI_LO_BYTE(op)] = split[NFAI_LO_BYTE(op) + 1] = 1;
+      } else if ((op & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_CLASS) {
+         for (i = 1; i <= NFAI_LO_BYTE(op); ++i) {
+            split[NFAI_HI_BYTE(dfa->ops[pc + i])] = split[NFAI_LO_BYTE(dfa->ops[pc + i]) + 1] = 1;
+         }
+      }
+   }
+   if (dfa->has_look) {
+      for (b = 1; b < 256; ++b) {
+         if (nfai_look_ahead(b) != nfai_look_ahead(b - 1) || nfai_look_behind(b) != nfai_look_behind(b - 1)) { split[b] = 1; }
+      }
+   }
+   dfa->nranges = 0;
+   for (b = 0; b < 256; ++b) {
+      if (split[b]) { dfa->range_start[dfa->nranges++] = b; }
+   }
+   dfa->range_start[dfa->nranges] = 256;
+}
+
+NFAI_INTERNAL void nfai_dfa_set_range(struct NfaiDfa *dfa, struct NfaiDfaState *state, int r, int target) {
+   int b;
+   for (b = dfa->range_start[r]; b < dfa->range_start[r + 1]; ++b) { state->next[b] = target; }
+}
+
+/* Subset construction (for a yes/no answer, so thread priorities don't matter). With look
+ * assertions, a state also records what the byte before it was, and its closure depends on
+ * the byte after it: there's one closure for each kind of byte (word, newline, other). */
+NFAI_INTERNAL int nfai_dfa_determinize(struct NfaiDfa *dfa) {
+   static const int ahead[3] = { 'a', '\n', ' ' }; /* a byte of each kind */
+   const int zero = 0, naheads = (dfa->has_look ? 3 : 1);
+   int i, j, k, r, b, n, nclosure, target, accepts[3], sink;
+
+   if (nfai_dfa_alloc_closure(dfa)) { return NFA_ERROR_OUT_OF_MEMORY; }
+   nfai_dfa_byte_ranges(dfa);
+   dfa->states = (struct NfaiDfaState*)nfai_zalloc(&dfa->pool, NFAI_DFA_MAX_STATES*sizeof(struct NfaiDfaState));
+   dfa->table = (int*)nfai_alloc(&dfa->pool, 2*NFAI_DFA_MAX_STATES*sizeof(int));
+   if (!dfa->states || !dfa->table) { return NFA_ERROR_OUT_OF_MEMORY; }
+   for (i = 0; i < 2*NFAI_DFA_MAX_STATES; ++i) { dfa->table[i] = -1; }
+
+   target = nfai_dfa_state(dfa, &zero, 1, 1, (dfa->has_look ? nfai_look_behind(-1) : 0));
+   if (target < 0) { return target; }
+   for (i = 0; i < dfa->nstates; ++i) {
+      struct NfaiDfaState *state = dfa->states + i;
+
+      /* acceptance at the end of the input */
+      nfai_dfa_state_closure(dfa, state, -1, &state->accept_end);
+
+      state->accept = 1;
+      for (k = 0; k < naheads; ++k) {
+         nfai_dfa_state_closure(dfa, state, ahead[k], &accepts[k]);
+         if (!accepts[k]) { state->accept = 0; }
+      }
+      if (state->accept) { continue; }
+
+      for (k = 0; k < naheads; ++k) {
+         const int look = nfai_look_ahead(ahead[k]);
+         sink = -1;
+         nclosure = nfai_dfa_state_closure(dfa, state, ahead[k], &accepts[k]);
+         for (r = 0; r < dfa->nranges; ++r) {
+            /* (the first byte of a range stands for all of it) */
+            b = dfa->range_start[r];
+            if (dfa->has_look && nfai_look_ahead(b) != look) { continue; }
+            if (accepts[k]) {
+               /* the NFA accepted before this byte (a state which just accepts) */
+               if (sink < 0) {
+                  const int accept_pc = dfa->nops - 1;
+                  NFAI_ASSERT((dfa->ops[accept_pc] & NFAI_OPCODE_MASK) == NFAI_OP_ACCEPT);
+                  sink = nfai_dfa_state(dfa, &accept_pc, 1, 0, 0);
+                  if (sink < 0) { return sink; }
+                  dfa->states[sink].targeted = 1;
+               }
+               nfai_dfa_set_range(dfa, state, r, sink);
+               continue;
+            }
+            n = 0;
+            ++dfa->stamp;
+            for (j = 0; j < nclosure; ++j) {
+               const int pc = dfa->closure[j];
+               if (nfai_dfa_match(dfa->ops, pc, b)) {
+                  const int next = pc + nfai_op_length(dfa->ops + pc);
+                  if (dfa->mark[next] != dfa->stamp) {
+                     dfa->mark[next] = dfa->stamp;
+                     dfa->scratch[n++] = next;
+                  }
+               }
+            }
+            if (n == 0) {
+               target = -1;
+            } else {
+               qsort(dfa->scratch, n, sizeof(int), &nfai_int_cmp);
+               target = nfai_dfa_state(dfa, dfa->scratch, n, 0, (dfa->has_look ? nfai_look_behind(b) : 0));
+               if (target < 0) { return target; }
+               dfa->states[target].targeted = 1;
+            }
+            /* (dfa->states isn't reallocated, so 'state' is still valid) */
+            nfai_dfa_set_range(dfa, state, r, target);
+         }
+      }
+   }
+   return 0;
+}
+
+NFAI_INTERNAL int nfai_dfa_single_target(const struct NfaiDfaState *state) {
+   int b;
+   for (b = 1; b < 256; ++b) {
+      if (state->next[b] != state->next[0]) { return 0; }
+   }
+   return 1;
+}
+
+/* the target that covers the most byte values */
+NFAI_INTERNAL int nfai_dfa_fallback(const struct NfaiDfaState *state) {
+   int best = state->next[0], best_count = 0, b, i, count;
+   for (b = 0; b < 256; ++b) {
+      if (b > 0 && state->next[b] == best) { continue; }
+      count = 0;
+      for (i = b; i < 256; ++i) {
+         if (state->next[i] == state->next[b]) { ++count; }
+      }
+      if (count > best_count) {
+         best = state->next[b];
+         best_count = count;
+      }
+   }
+   return best;
+}
+
+/* build the DFA for an NFA, with at most max_states states (on success, the caller must free dfa->pool) */
+NFAI_INTERNAL int nfai_dfa_build(struct NfaiDfa *dfa, const Nfa *nfa, int max_states) {
+   int error, i;
+   NFAI_ASSERT(max_states > 0 && max_states <= NFAI_DFA_MAX_STATES);
+   memset(dfa, 0, sizeof(*dfa));
+   nfai_alloc_init_default(&dfa->pool);
+   dfa->max_states = max_states;
+   error = nfai_dfa_expand(dfa, nfa);
+   if (!error) { error = nfai_dfa_determinize(dfa); }
+   if (error) {
+      nfai_free_pool(&dfa->pool);
+      return error;
+   }
+   for (i = 0; i < dfa->nstates; ++i) {
+      if (!dfa->states[i].accept) { dfa->states[i].single = nfai_dfa_single_target(dfa->states + i); }
+   }
+   return 0;
+}
+
+/* ----- JIT ----- */
+
+/* A JIT matcher is a DFA, either compiled to machine code or stored as a transition table
+ * (when machine code isn't supported for this platform, or the system won't make pages
+ * executable). */
+struct NfaiJit {
+   int (*fn)(const unsigned char *p, const unsigned char *end); /* the machine code, or NULL */
+   void *code;
+   size_t code_size;
+   int16_t *next;  /* transition table: target for each (state, byte), or -1 for no match */
+   uint8_t *flags; /* NfaiJitStateFlag values for each state */
+};
+
+enum NfaiJitStateFlag {
+   NFAI_JIT_ACCEPT     = 1,
+   NFAI_JIT_ACCEPT_END = 2
+};
+
+#ifdef NFAI_JIT_X86_64
+
+/* States with more than this many byte tests dispatch through a jump table instead */
+enum { NFAI_JIT_MAX_TESTS = 8 };
+
+/* Code is generated twice: first to find the size and the position of each label (with
+ * 'bytes' NULL), then for real. Every branch has a 32-bit offset, so the layout doesn't
+ * depend on the label positions. Registers: rdi is the input pointer, rsi is the end of
+ * the input, eax holds the current byte, and ecx, rdx are scratch. */
+struct NfaiJitCode {
+   uint8_t *bytes;
+   uint32_t size;
+   uint32_t *labels; /* the code offset of each state, then the two return labels */
+};
+
+NFAI_INTERNAL void nfai_jit_byte(struct NfaiJitCode *code, unsigned x) {
+   if (code->bytes) { code->bytes[code->size] = (uint8_t)x; }
+   ++code->size;
+}
+
+NFAI_INTERNAL void nfai_jit_u32(struct NfaiJitCode *code, uint32_t x) {
+   nfai_jit_byte(code, x & 0xFFu);
+   nfai_jit_byte(code, (x >> 8) & 0xFFu);
+   nfai_jit_byte(code, (x >> 16) & 0xFFu);
+   nfai_jit_byte(code, (x >> 24) & 0xFFu);
+}
+
+/* a jump or conditional jump (with 32-bit offset) to a label; cc is the condition code, or -1 for jmp */
+NFAI_INTERNAL void nfai_jit_branch(struct NfaiJitCode *code, int cc, int label) {
+   if (cc < 0) {
+      nfai_jit_byte(code, 0xE9);
+   } else {
+      nfai_jit_byte(code, 0x0F);
+      nfai_jit_byte(code, 0x80 | (unsigned)cc);
+   }
+   nfai_jit_u32(code, code->labels[label] - (code->size + 4u));
+}
+
+enum {
+   NFAI_X86_JB  = 0x2,
+   NFAI_X86_JAE = 0x3,
+   NFAI_X86_JE  = 0x4,
+   NFAI_X86_JBE = 0x6
+};
+
+NFAI_INTERNAL void nfai_jit_align(struct NfaiJitCode *code, uint32_t alignment) {
+   while (code->size % alignment) { nfai_jit_byte(code, 0xCC); } /* int3 (never executed) */
+}
+
+/* jump to 'label' if the byte in eax is in [first, last]; 'lo' is the lowest byte value that hasn't been ruled out */
+NFAI_INTERNAL void nfai_jit_test_range(struct NfaiJitCode *code, int first, int last, int lo, int label) {
+   if (first == last) {
+      nfai_jit_byte(code, 0x3D); /* cmp eax, imm32 */
+      nfai_jit_u32(code, (uint32_t)first);
+      nfai_jit_branch(code, NFAI_X86_JE, label);
+   } else if (first == lo) {
+      nfai_jit_byte(code, 0x3D);
+      nfai_jit_u32(code, (uint32_t)last);
+      nfai_jit_branch(code, NFAI_X86_JBE, label);
+   } else if (last == 255) {
+      nfai_jit_byte(code, 0x3D);
+      nfai_jit_u32(code, (uint32_t)first);
+      nfai_jit_branch(code, NFAI_X86_JAE, label);
+   } else {
+      nfai_jit_byte(code, 0x8D); /* lea ecx, [rax - first] */
+      nfai_jit_byte(code, 0x88);
+      nfai_jit_u32(code, (uint32_t)0 - (uint32_t)first);
+      nfai_jit_byte(code, 0x81); /* cmp ecx, imm32 */
+      nfai_jit_byte(code, 0xF9);
+      nfai_jit_u32(code, (uint32_t)(last - first));
+      nfai_jit_branch(code, NFAI_X86_JBE, label);
+   }
+}
+
+NFAI_INTERNAL void nfai_jit_state(struct NfaiJitCode *code, const struct NfaiDfa *dfa, int i) {
+   const struct NfaiDfaState *state = dfa->states + i;
+   const int ret0 = dfa->nstates, ret1 = dfa->nstates + 1;
+   const int end_label = (state->accept_end ? ret1 : ret0);
+   int b, last, lo, ntests, fallback, self_loop;
+   uint32_t table;
+
+   if (state->accept) {
+      code->labels[i] = code->size;
+      nfai_jit_byte(code, 0xB8); /* mov eax, 1; ret */
+      nfai_jit_u32(code, 1u);
+      nfai_jit_byte(code, 0xC3);
+      return;
+   }
+
+   if (state->single && state->next[0] == i) {
+      /* every byte loops back: skip to the end of the input */
+      code->labels[i] = code->size;
+      nfai_jit_byte(code, 0xB8); /* mov eax, accept_end; ret */
+      nfai_jit_u32(code, (uint32_t)state->accept_end);
+      nfai_jit_byte(code, 0xC3);
+      return;
+   }
+
+   fallback = (state->single ? state->next[0] : nfai_dfa_fallback(state));
+   ntests = 0;
+   self_loop = 0;
+   for (b = 0; b < 256; b = last + 1) {
+      for (last = b; last < 255 && state->next[last + 1] == state->next[b];) { ++last; }
+      if (state->next[b] != fallback) { ++ntests; }
+      if (state->next[b] == i) { self_loop = 1; }
+   }
+
+   /* a state that loops on itself gets an aligned loop head, and tests for the loop first */
+   if (self_loop) { nfai_jit_align(code, 16); }
+   code->labels[i] = code->size;
+
+   nfai_jit_byte(code, 0x48); /* cmp rdi, rsi */
+   nfai_jit_byte(code, 0x39);
+   nfai_jit_byte(code, 0xF7);
+   nfai_jit_branch(code, NFAI_X86_JE, end_label);
+   if (state->single) {
+      if (fallback >= 0) {
+         nfai_jit_byte(code, 0x48); /* add rdi, 1 */
+         nfai_jit_byte(code, 0x83);
+         nfai_jit_byte(code, 0xC7);
+         nfai_jit_byte(code, 0x01);
+      }
+      nfai_jit_branch(code, -1, (fallback < 0 ? ret0 : fallback));
+      return;
+   }
+   nfai_jit_byte(code, 0x0F); /* movzx eax, byte [rdi] */
+   nfai_jit_byte(code, 0xB6);
+   nfai_jit_byte(code, 0x07);
+   nfai_jit_byte(code, 0x48); /* add rdi, 1 */
+   nfai_jit_byte(code, 0x83);
+   nfai_jit_byte(code, 0xC7);
+   nfai_jit_byte(code, 0x01);
+
+   if (ntests > NFAI_JIT_MAX_TESTS) {
+      /* jump table of 32-bit offsets (relative to the table), after 16 bytes of dispatch code */
+      table = code->size + 16;
+      table += (4 - table % 4) % 4;
+      nfai_jit_byte(code, 0x48); /* lea rcx, [rip + table] */
+      nfai_jit_byte(code, 0x8D);
+      nfai_jit_byte(code, 0x0D);
+      nfai_jit_u32(code, table - (code->size + 4));
+      nfai_jit_byte(code, 0x48); /* movsxd rdx, dword [rcx + rax*4] */
+      nfai_jit_byte(code, 0x63);
+      nfai_jit_byte(code, 0x14);
+      nfai_jit_byte(code, 0x81);
+      nfai_jit_byte(code, 0x48); /* add rdx, rcx */
+      nfai_jit_byte(code, 0x01);
+      nfai_jit_byte(code, 0xCA);
+      nfai_jit_byte(code, 0xFF); /* jmp rdx */
+      nfai_jit_byte(code, 0xE2);
+      nfai_jit_align(code, 4);
+      NFAI_ASSERT(code->size == table);
+      for (b = 0; b < 256; ++b) {
+         nfai_jit_u32(code, code->labels[(state->next[b] < 0 ? ret0 : state->next[b])] - table);
+      }
+      return;
+   }
+
+   /* compare and branch: the runs of byte values with the same target are tested in order
+    * (after the self loop, if there is one), and the most common target is left for last */
+   if (fallback != i) {
+      for (b = 0, lo = 0; b < 256; b = last + 1) {
+         for (last = b; last < 255 && state->next[last + 1] == state->next[b];) { ++last; }
+         if (state->next[b] == i) {
+            nfai_jit_test_range(code, b, last, lo, i);
+            if (lo == b) { lo = last + 1; }
+         }
+      }
+   }
+   for (b = 0, lo = 0; b < 256; b = last + 1) {
+      for (last = b; last < 255 && state->next[last + 1] == state->next[b];) { ++last; }
+      if (state->next[b] != fallback) {
+         if (state->next[b] != i) {
+            nfai_jit_test_range(code, b, last, lo, (state->next[b] < 0 ? ret0 : state->next[b]));
+         }
+         if (lo == b) { lo = last + 1; }
+      }
+   }
+   nfai_jit_branch(code, -1, (fallback < 0 ? ret0 : fallback));
+}
+
+NFAI_INTERNAL void nfai_jit_generate(struct NfaiJitCode *code, const struct NfaiDfa *dfa) {
+   int i;
+   code->size = 0;
+   for (i = 0; i < dfa->nstates; ++i) { nfai_jit_state(code, dfa, i); }
+   code->labels[dfa->nstates] = code->size;
+   nfai_jit_byte(code, 0x31); /* xor eax, eax; ret */
+   nfai_jit_byte(code, 0xC0);
+   nfai_jit_byte(code, 0xC3);
+   code->labels[dfa->nstates + 1] = code->size;
+   nfai_jit_byte(code, 0xB8); /* mov eax, 1; ret */
+   nfai_jit_u32(code, 1u);
+   nfai_jit_byte(code, 0xC3);
+}
+
+NFAI_INTERNAL void *nfai_jit_map(size_t size) {
+#if defined(MAP_ANONYMOUS)
+   return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#elif defined(MAP_ANON)
+   return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+#else
+   void *pages;
+   const int fd = open("/dev/zero", O_RDWR);
+   if (fd < 0) { return MAP_FAILED; }
+   pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+   return pages;
+#endif
+}
+
+/* returns 0 if the code can't be made executable (so that the caller can use a table instead) */
+NFAI_INTERNAL int nfai_jit_compile(struct NfaiJit *jit, struct NfaiDfa *dfa) {
+   struct NfaiJitCode code;
+   void *pages;
+   size_t size;
+
+   code.bytes = NULL;
+   code.labels = (uint32_t*)nfai_zalloc(&dfa->pool, (dfa->nstates + 2)*sizeof(uint32_t));
+   if (!code.labels) { return 0; }
+   nfai_jit_generate(&code, dfa);
+   size = code.size;
+
+   /* the pages are never writable and executable at the same time */
+   pages = nfai_jit_map(size);
+   if (pages == MAP_FAILED) { return 0; }
+   code.bytes = (uint8_t*)pages;
+   nfai_jit_generate(&code, dfa);
+   NFAI_ASSERT(code.size == size);
+   if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(pages, size);
+      return 0;
+   }
+   jit->code = pages;
+   jit->code_size = size;
+   /* (ISO C has no conversion from an object pointer to a function pointer) */
+   memcpy(&jit->fn, &pages, sizeof(pages));
+   return 1;
+}
+#endif
+
+NFAI_INTERNAL int nfai_jit_init(NfaJit *jit, const Nfa *nfa, int allow_native) {
+   struct NfaiDfa dfa;
+   struct NfaiJit *data;
+   int error, i, b;
+
+   NFAI_ASSERT(jit);
+   NFAI_ASSERT(nfa);
+
+   jit->data = NULL;
+   jit->native = 0;
+   error = nfai_dfa_build(&dfa, nfa, NFAI_DFA_MAX_STATES);
+   if (error) { return error; }
+
+   data = (struct NfaiJit*)malloc(sizeof(struct NfaiJit));
+   if (!data) {
+      nfai_free_pool(&dfa.pool);
+      return NFA_ERROR_OUT_OF_MEMORY;
+   }
+   memset(data, 0, sizeof(*data));
+
+#ifdef NFAI_JIT_X86_64
+   if (allow_native) { jit->native = nfai_jit_compile(data, &dfa); }
+#else
+   NFAI_UNUSED(allow_native);
+#endif
+
+   if (!jit->native) {
+      data->next = (int16_t*)malloc((size_t)dfa.nstates * 256 * sizeof(int16_t));
+      data->flags = (uint8_t*)malloc((size_t)dfa.nstates);
+      if (!data->next || !data->flags) {
+         free(data->next);
+         free(data->flags);
+         free(data);
+         nfai_free_pool(&dfa.pool);
+         return NFA_ERROR_OUT_OF_MEMORY;
+      }
+      for (i = 0; i < dfa.nstates; ++i) {
+         const struct NfaiDfaState *state = dfa.states + i;
+         data->flags[i] = (uint8_t)((state->accept ? NFAI_JIT_ACCEPT : 0) | (state->accept_end ? NFAI_JIT_ACCEPT_END : 0));
+         for (b = 0; b < 256; ++b) {
+            data->next[i*256 + b] = (int16_t)(state->accept ? -1 : state->next[b]);
+         }
+      }
+   }
+
+   nfai_free_pool(&dfa.pool);
+   jit->data = data;
+   return NFA_NO_ERROR;
+}
+
+NFA_API int nfa_jit_init(NfaJit *jit, const Nfa *nfa) {
+   return nfai_jit_init(jit, nfa, 1);
+}
+
+NFA_API void nfa_jit_free(NfaJit *jit) {
+   struct NfaiJit *data;
+   NFAI_ASSERT(jit);
+   data = (struct NfaiJit*)jit->data;
+   if (data) {
+#ifdef NFAI_JIT_X86_64
+      if (data->code) { munmap(data->code, data->code_size); }
+#endif
+      free(data->next);
+      free(data->flags);
+      free(data);
+   }
+   jit->data = NULL;
+   jit->native = 0;
+}
+
+NFA_API int nfa_jit_match(const NfaJit *jit, const char *text, size_t length) {
+   const struct NfaiJit *data;
+   const unsigned char *p = (const unsigned char*)text, *end = p + length;
+   int state = 0;
+
+   NFAI_ASSERT(jit);
+   NFAI_ASSERT(jit->data);
+   NFAI_ASSERT(text || !length);
+
+   data = (const struct NfaiJit*)jit->data;
+   if (data->fn) { return data->fn(p, end); }
+
+   while (!(data->flags[state] & NFAI_JIT_ACCEPT)) {
+      if (p == end) { return ((data->flags[state] & NFAI_JIT_ACCEPT_END) ? 1 : 0); }
+      state = data->next[state*256 + *p++];
+      if (state < 0) { return 0; }
+   }
+   return 1;
+}
+
+/* ----- STREAMS ----- */
+
+/* A stream engine is either the transition table of a JIT matcher (and a stream's state is
+ * one more than its DFA state, so that 0 is no match), or, for patterns whose DFA is too big,
+ * a bit-parallel simulation of the expanded program. In that, each byte match is a position,
+ * and a stream's state is the set of positions that matched the last byte (position 0 is the
+ * start of the input), or NFAI_STREAM_MATCHED. */
+enum {
+   NFAI_STREAM_MAX_POSITIONS = 62 /* byte matches (bit 0 is the start, and bit 63 is NFAI_STREAM_MATCHED) */
+};
+
+#define NFAI_STREAM_MATCHED ((uint64_t)1 << 63)
+
+struct NfaiStreamBits {
+   int nchunks;             /* bytes of the state that can have positions in */
+   uint64_t accept;         /* positions that the NFA accepts after (whatever comes next) */
+   uint64_t accept_end;     /* positions that the NFA accepts after at the end of the input */
+   uint64_t match[256];     /* positions that match each byte value */
+   uint64_t follow[8][256]; /* follow[k][v]: positions that can come next after any of the positions (v << 8k) */
+};
+
+/* the positions in the closure of one kernel state (sets *accepts if the NFA accepts) */
+NFAI_INTERNAL uint64_t nfai_stream_closure(struct NfaiDfa *dfa, const int *position, int pc, uint32_t flags, int *accepts) {
+   uint64_t bits = 0;
+   int j, nclosure;
+   nclosure = nfai_dfa_closure(dfa, &pc, 1, flags, 0);
+   *accepts = 0;
+   for (j = 0; j < nclosure; ++j) {
+      const int at = dfa->closure[j];
+      if ((dfa->ops[at] & NFAI_OPCODE_MASK) == NFAI_OP_ACCEPT) { *accepts = 1; }
+      if (position[at] > 0) { bits |= (uint64_t)1 << position[at]; }
+   }
+   return bits;
+}
+
+NFAI_INTERNAL int nfai_stream_build_bits(struct NfaiStreamBits *bits, struct NfaiDfa *dfa) {
+   uint64_t follow[NFAI_STREAM_MAX_POSITIONS + 1];
+   int *position;
+   int npositions = 0, pc, p, b, k, v, accepts;
+
+   position = (int*)nfai_zalloc(&dfa->pool, dfa->nops*sizeof(int));
+   if (!position || nfai_dfa_alloc_closure(dfa)) { return NFA_ERROR_OUT_OF_MEMORY; }
+   if (dfa->has_look) { return NFA_ERROR_NFA_TOO_LARGE; }
+
+   memset(bits, 0, sizeof(*bits));
+   for (pc = 0; pc < dfa->nops; pc += nfai_op_length(dfa->ops + pc)) {
+      const NfaOpcode op = dfa->ops[pc] & NFAI_OPCODE_MASK;
+      if (op == NFAI_OP_MATCH_ANY || op == NFAI_OP_MATCH_BYTE || op == NFAI_OP_MATCH_CLASS) {
+         if (npositions == NFAI_STREAM_MAX_POSITIONS) { return NFA_ERROR_NFA_TOO_LARGE; }
+         position[pc] = ++npositions;
+         for (b = 0; b < 256; ++b) {
+            if (nfai_dfa_match(dfa->ops, pc, b)) { bits->match[b] |= (uint64_t)1 << npositions; }
+         }
+      }
+   }
+
+   /* what follows each position, and whether the NFA accepts there */
+   follow[0] = nfai_stream_closure(dfa, position, 0, NFA_EXEC_AT_START, &accepts);
+   if (accepts) { bits->accept |= 1u; }
+   nfai_stream_closure(dfa, position, 0, NFA_EXEC_AT_START | NFA_EXEC_AT_END, &accepts);
+   if (accepts) { bits->accept_end |= 1u; }
+   for (pc = 0; pc < dfa->nops; pc += nfai_op_length(dfa->ops + pc)) {
+      const int next = pc + nfai_op_length(dfa->ops + pc);
+      p = position[pc];
+      if (!p) { continue; }
+      follow[p] = nfai_stream_closure(dfa, position, next, 0, &accepts);
+      if (accepts) { bits->accept |= (uint64_t)1 << p; }
+      nfai_stream_closure(dfa, position, next, NFA_EXEC_AT_END, &accepts);
+      if (accepts) { bits->accept_end |= (uint64_t)1 << p; }
+   }
+
+   bits->nchunks = (npositions + 8) / 8;
+   for (k = 0; k < bits->nchunks; ++k) {
+      for (v = 0; v < 256; ++v) {
+         for (b = 0; b < 8; ++b) {
+            p = k*8 + b;
+            if ((v & (1 << b)) && p <= npositions) { bits->follow[k][v] |= follow[p]; }
+         }
+      }
+   }
+   return 0;
+}
+
+NFAI_INTERNAL int nfai_stream_init(NfaStreamEngine *engine, const Nfa *nfa, int allow_dfa) {
+   struct NfaiStreamBits *bits;
+   struct NfaiDfa dfa;
+   NfaJit jit;
+   int error;
+
+   NFAI_ASSERT(engine);
+   NFAI_ASSERT(nfa);
+
+   engine->data = NULL;
+   engine->bit_parallel = 0;
+   if (allow_dfa) {
+      error = nfai_jit_init(&jit, nfa, 0);
+      if (error != NFA_ERROR_NFA_TOO_LARGE) {
+         engine->data = jit.data;
+         return error;
+      }
+   }
+
+   memset(&dfa, 0, sizeof(dfa));
+   nfai_alloc_init_default(&dfa.pool);
+   bits = (struct NfaiStreamBits*)malloc(sizeof(struct NfaiStreamBits));
+   error = (bits ? nfai_dfa_expand(&dfa, nfa) : NFA_ERROR_OUT_OF_MEMORY);
+   if (!error) { error = nfai_stream_build_bits(bits, &dfa); }
+   nfai_free_pool(&dfa.pool);
+   if (error) {
+      free(bits);
+      return error;
+   }
+   engine->data = bits;
+   engine->bit_parallel = 1;
+   return NFA_NO_ERROR;
+}
+
+NFA_API int nfa_stream_init(NfaStreamEngine *engine, const Nfa *nfa) {
+   return nfai_stream_init(engine, nfa, 1);
+}
+
+NFA_API void nfa_stream_free(NfaStreamEngine *engine) {
+   NfaJit jit;
+   NFAI_ASSERT(engine);
+   if (engine->bit_parallel) {
+      free(engine->data);
+   } else {
+      jit.data = engine->data;
+      jit.native = 0;
+      nfa_jit_free(&jit);
+   }
+   engine->data = NULL;
+   engine->bit_parallel = 0;
+}
+
+NFA_API int nfa_stream_feed(const NfaStreamEngine *engine, NfaStreamState *state, const char *bytes, size_t length) {
+   const unsigned char *p = (const unsigned char*)bytes, *end = p + length;
+   NfaStreamState s;
+
+   NFAI_ASSERT(engine);
+   NFAI_ASSERT(engine->data);
+   NFAI_ASSERT(state);
+   NFAI_ASSERT(bytes || !length);
+
+   s = *state;
+   if (engine->bit_parallel) {
+      const struct NfaiStreamBits *bits = (const struct NfaiStreamBits*)engine->data;
+      int k;
+      if (s & bits->accept) { s = NFAI_STREAM_MATCHED; }
+      while (p != end && s && s != NFAI_STREAM_MATCHED) {
+         uint64_t follow = bits->follow[0][s & 0xFFu];
+         for (k = 1; k < bits->nchunks; ++k) { follow |= bits->follow[k][(s >> (8*k)) & 0xFFu]; }
+         s = follow & bits->match[*p++];
+         if (s & bits->accept) { s = NFAI_STREAM_MATCHED; }
+      }
+      *state = s;
+      return (!s || s == NFAI_STREAM_MATCHED);
+   } else {
+      const struct NfaiJit *data = (const struct NfaiJit*)engine->data;
+      int at = (int)s - 1;
+      while (at >= 0 && !(data->flags[at] & NFAI_JIT_ACCEPT) && p != end) {
+         at = data->next[at*256 + *p++];
+      }
+      *state = (NfaStreamState)(at + 1);
+      return (at < 0 || (data->flags[at] & NFAI_JIT_ACCEPT));
+   }
+}
+
+NFA_API int nfa_stream_finish(const NfaStreamEngine *engine, NfaStreamState state) {
+   NFAI_ASSERT(engine);
+   NFAI_ASSERT(engine->data);
+   if (engine->bit_parallel) {
+      const struct NfaiStreamBits *bits = (const struct NfaiStreamBits*)engine->data;
+      return ((state == NFAI_STREAM_MATCHED || (state & bits->accept_end)) ? NFA_RESULT_MATCH : NFA_RESULT_NOMATCH);
+   } else {
+      const struct NfaiJit *data = (const struct NfaiJit*)engine->data;
+      return ((state && (data->flags[state - 1] & (NFAI_JIT_ACCEPT | NFAI_JIT_ACCEPT_END))) ? NFA_RESULT_MATCH : NFA_RESULT_NOMATCH);
+   }
+}
+
+/* ----- ANALYSIS ----- */
+
+/* The analysis works on the program with absolute jump targets: either the NFA's own
+ * program (for the counts and lengths, which must cope with any size of repeat), or the
+ * expanded program used for DFA construction (for the literals and the one-pass test). */
+
+/* read the NFA's program as 32-bit words, with absolute jump targets */
+NFAI_INTERNAL void nfai_info_load(const Nfa *nfa, NfaOpcode *ops) {
+   int pc, i, len;
+   nfai_load_ops(nfa, ops);
+   for (pc = 0; pc < nfa->nops; pc += len) {
+      len = nfai_op_length(ops + pc);
+      if ((ops[pc] & NFAI_OPCODE_MASK) == NFAI_OP_JUMP) {
+         for (i = 1; i < len; ++i) { ops[pc + i] = (NfaOpcode)(pc + len + (int32_t)ops[pc + i]); }
+      }
+   }
+}
+
+/* 'i'th successor of the instruction at ops[pc] (with absolute jump targets), or -1 */
+NFAI_INTERNAL int nfai_info_successor(const NfaOpcode *ops, int pc, int i) {
+   const NfaOpcode op = ops[pc];
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_JUMP:
+         return (i < NFAI_LO_BYTE(op) ? (int)ops[pc + 1 + i] : -1);
+      case NFAI_OP_ACCEPT:
+      case NFAI_OP_TOKEN:
+         return -1;
+      default:
+         return (i == 0 ? pc + nfai_op_length(ops + pc) : -1);
+   }
+}
+
+/* a match can end at an accept or a token */
+NFAI_INTERNAL int nfai_info_is_end(const NfaOpcode *ops, int pc) {
+   const NfaOpcode op = (ops[pc] & NFAI_OPCODE_MASK);
+   return (op == NFAI_OP_ACCEPT || op == NFAI_OP_TOKEN);
+}
+
+/* bytes consumed by the instruction at ops[pc]: sets *min, and returns the maximum (INT_MAX for no limit) */
+NFAI_INTERNAL int nfai_info_width(const NfaOpcode *ops, int pc, int *min) {
+   const NfaOpcode op = ops[pc];
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_ANY:
+      case NFAI_OP_MATCH_BYTE:
+      case NFAI_OP_MATCH_CLASS:
+         *min = 1;
+         return 1;
+      case NFAI_OP_MATCH_STRING:
+         *min = NFAI_LO_BYTE(op);
+         return NFAI_LO_BYTE(op);
+      case NFAI_OP_REPEAT:
+         *min = (int)ops[pc + 1];
+         return ((NFAI_LO_BYTE(op) & NFAI_REPEAT_UNBOUNDED) ? INT_MAX : (int)ops[pc + 2]);
+      default:
+         *min = 0;
+         return 0;
+   }
+}
+
+NFAI_INTERNAL int nfai_info_add(int a, int b) {
+   NFAI_ASSERT(a >= 0 && b >= 0);
+   return (a > INT_MAX - b ? INT_MAX : a + b);
+}
+
+/* the byte matched by a single-byte instruction that matches exactly one byte value, or -1 */
+NFAI_INTERNAL int nfai_info_single_byte(const NfaOpcode *ops, int pc) {
+   const NfaOpcode op = ops[pc];
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_BYTE:
+         return NFAI_LO_BYTE(op);
+      case NFAI_OP_MATCH_CLASS:
+         if (NFAI_LO_BYTE(op) == 1 && NFAI_HI_BYTE(ops[pc + 1]) == NFAI_LO_BYTE(ops[pc + 1])) { return NFAI_LO_BYTE(ops[pc + 1]); }
+         return -1;
+      default:
+         return -1;
+   }
+}
+
+/* the lower-case letter matched by a single-byte instruction that matches only that letter
+ * and its upper-case form (or just one of them), or -1 */
+NFAI_INTERNAL int nfai_info_folded_letter(const NfaOpcode *ops, int pc) {
+   const NfaOpcode op = ops[pc];
+   int c;
+   if ((op & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_CLASS && NFAI_LO_BYTE(op) == 2) {
+      /* (the form nfai_emit_byte_match uses for a case-insensitive letter) */
+      c = NFAI_LO_BYTE(ops[pc + 2]);
+      if (!nfai_is_ascii_alpha_lower(c)) { return -1; }
+      if (ops[pc + 1] != (NfaOpcode)(((c - 32) << 8) | (c - 32)) || ops[pc + 2] != (NfaOpcode)((c << 8) | c)) { return -1; }
+      return c;
+   }
+   c = nfai_info_single_byte(ops, pc);
+   return ((c >= 0 && nfai_is_ascii_alpha(c)) ? nfai_ascii_tolower(c) : -1);
+}
+
+/* a required byte c (see nfai_prefilter) is a byte value, or a lower-case letter with
+ * NFAI_INFO_FOLDED set for the letter in either case */
+enum { NFAI_INFO_FOLDED = 256 };
+
+NFAI_INTERNAL int nfai_info_byte_is(int byte, int c) {
+   if (c & NFAI_INFO_FOLDED) { return (nfai_is_ascii_alpha(byte) && nfai_ascii_tolower(byte) == (c & 255)); }
+   return (byte == c);
+}
+
+/* whether the single-byte instruction at ops[pc] only matches c */
+NFAI_INTERNAL int nfai_info_char_is(const NfaOpcode *ops, int pc, int c) {
+   if (c & NFAI_INFO_FOLDED) { return (nfai_info_folded_letter(ops, pc) == (c & 255)); }
+   return (nfai_info_single_byte(ops, pc) == c);
+}
+
+/* whether the instruction at ops[pc] can only be passed by consuming the byte c (among others) */
+NFAI_INTERNAL int nfai_info_needs_byte(const NfaOpcode *ops, int pc, int c) {
+   const NfaOpcode op = ops[pc];
+   int i;
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_STRING:
+         for (i = 0; i < NFAI_LO_BYTE(op); ++i) {
+            const NfaOpcode pair = ops[pc + 1 + i/2];
+            if (nfai_info_byte_is((i & 1) ? NFAI_LO_BYTE(pair) : NFAI_HI_BYTE(pair), c)) { return 1; }
+         }
+         return 0;
+      case NFAI_OP_REPEAT:
+         return (ops[pc + 1] > 0 && nfai_info_char_is(ops, pc + 3, c));
+      default:
+         return nfai_info_char_is(ops, pc, c);
+   }
+}
+
+/* mark the instructions reachable from the start, without going past an assertion of
+ * context flag 'blocked_flag', or an instruction that needs the byte 'blocked_byte' (-1
+ * for neither); returns 1 if an accept or token was reached */
+NFAI_INTERNAL int nfai_info_reach(const NfaOpcode *ops, int nops, char *mark, int *stack, int blocked_flag, int blocked_byte) {
+   int top = 0, found = 0, i, pc, next;
+   memset(mark, 0, nops);
+   mark[0] = 1;
+   stack[top++] = 0;
+   while (top) {
+      pc = stack[--top];
+      if (nfai_info_is_end(ops, pc)) { found = 1; }
+      if ((ops[pc] & NFAI_OPCODE_MASK) == NFAI_OP_ASSERT_CONTEXT && (int)NFAI_LO_BYTE(ops[pc]) == blocked_flag) { continue; }
+      if (blocked_byte >= 0 && nfai_info_needs_byte(ops, pc, blocked_byte)) { continue; }
+      for (i = 0; (next = nfai_info_successor(ops, pc, i)) >= 0; ++i) {
+         if (!mark[next]) {
+            mark[next] = 1;
+            stack[top++] = next;
+         }
+      }
+   }
+   return found;
+}
+
+/* shortest path from the start to an accept or token (Dijkstra's algorithm, with a binary
+ * heap of (distance, pc) pairs; stale entries are skipped, so there's at most one entry per
+ * edge and heap needs 2*(nops + 1) elements) */
+NFAI_INTERNAL int nfai_info_min_length(const NfaOpcode *ops, int nops, int *dist, int *heap) {
+   int n = 0, i, j, pc, next, d, width;
+   for (i = 0; i < nops; ++i) { dist[i] = INT_MAX; }
+   dist[0] = 0;
+   heap[0] = 0;
+   heap[1] = 0;
+   n = 1;
+   while (n) {
+      d = heap[0];
+      pc = heap[1];
+      /* pop, and sift down */
+      for (i = 0, --n; 2*i + 1 < n; i = j) {
+         j = 2*i + 1;
+         if (j + 1 < n && heap[2*(j + 1)] < heap[2*j]) { ++j; }
+         if (heap[2*n] <= heap[2*j]) { break; }
+         heap[2*i] = heap[2*j];
+         heap[2*i + 1] = heap[2*j + 1];
+      }
+      heap[2*i] = heap[2*n];
+      heap[2*i + 1] = heap[2*n + 1];
+
+      if (d > dist[pc]) { continue; }
+      if (nfai_info_is_end(ops, pc)) { return d; }
+      nfai_info_width(ops, pc, &width);
+      d = nfai_info_add(d, width);
+      for (j = 0; (next = nfai_info_successor(ops, pc, j)) >= 0; ++j) {
+         if (d < dist[next]) {
+            dist[next] = d;
+            /* push, and sift up */
+            for (i = n++; i > 0 && heap[2*((i - 1)/2)] > d; i = (i - 1)/2) {
+               heap[2*i] = heap[2*((i - 1)/2)];
+               heap[2*i + 1] = heap[2*((i - 1)/2) + 1];
+            }
+            heap[2*i] = d;
+            heap[2*i + 1] = next;
+         }
+      }
+   }
+   return 0;
+}
+
+/* Longest path from the start to an accept or token (INT_MAX if there's no limit, or -1 if
+ * neither can be reached), stored in *length. Cycles with no input consumed are allowed, so this finds the
+ * strongly connected components (Tarjan's algorithm, without recursion), which come out
+ * after every component they lead to. A component with a byte match on one of its cycles
+ * has no limit, if it can reach the end at all. */
+NFAI_INTERNAL int nfai_info_max_length(const NfaOpcode *ops, int nops, NfaPoolAllocator *pool, int *length) {
+   int *index, *low, *iter, *calls, *comp, *longest;
+   char *onstack;
+   int ncalls = 0, ncomp = 0, counter = 0, pc, next, i, k, best, cycle, width, unused;
+
+   index = (int*)nfai_alloc(pool, nops*sizeof(int));
+   low = (int*)nfai_alloc(pool, nops*sizeof(int));
+   iter = (int*)nfai_alloc(pool, nops*sizeof(int));
+   calls = (int*)nfai_alloc(pool, nops*sizeof(int));
+   comp = (int*)nfai_alloc(pool, nops*sizeof(int));
+   longest = (int*)nfai_alloc(pool, nops*sizeof(int));
+   onstack = (char*)nfai_zalloc(pool, nops);
+   if (!index || !low || !iter || !calls || !comp || !longest || !onstack) { return NFA_ERROR_OUT_OF_MEMORY; }
+   for (i = 0; i < nops; ++i) { index[i] = -1; }
+
+   index[0] = low[0] = counter++;
+   iter[0] = 0;
+   onstack[0] = 1;
+   comp[ncomp++] = 0;
+   calls[ncalls++] = 0;
+   while (ncalls) {
+      pc = calls[ncalls - 1];
+      next = nfai_info_successor(ops, pc, iter[pc]++);
+      if (next >= 0) {
+         if (index[next] < 0) {
+            index[next] = low[next] = counter++;
+            iter[next] = 0;
+            onstack[next] = 1;
+            comp[ncomp++] = next;
+            calls[ncalls++] = next;
+         } else if (onstack[next] && index[next] < low[pc]) {
+            low[pc] = index[next];
+         }
+         continue;
+      }
+
+      /* finished with pc */
+      --ncalls;
+      if (ncalls && low[pc] < low[calls[ncalls - 1]]) { low[calls[ncalls - 1]] = low[pc]; }
+      if (low[pc] != index[pc]) { continue; }
+
+      /* pc is the root of a component: the instructions on the component stack down to pc */
+      best = -1;
+      cycle = 0;
+      for (k = ncomp - 1;; --k) {
+         const int at = comp[k];
+         if (nfai_info_is_end(ops, at)) { best = (best > 0 ? best : 0); }
+         width = nfai_info_width(ops, at, &unused);
+         for (i = 0; (next = nfai_info_successor(ops, at, i)) >= 0; ++i) {
+            if (onstack[next]) {
+               /* (anything still on the stack is in this component) */
+               if (width > 0) { cycle = 1; }
+            } else if (longest[next] >= 0 && nfai_info_add(longest[next], width) > best) {
+               best = nfai_info_add(longest[next], width);
+            }
+         }
+         if (at == pc) { break; }
+      }
+      if (best >= 0 && cycle) { best = INT_MAX; }
+      for (; ncomp > k; --ncomp) {
+         longest[comp[ncomp - 1]] = best;
+         onstack[comp[ncomp - 1]] = 0;
+      }
+   }
+   *length = longest[0];
+   return 0;
+}
+
+/* the byte matched by every instruction in the list, or -1 */
+NFAI_INTERNAL int nfai_info_common_byte(const NfaOpcode *ops, const int *list, int n) {
+   int i, c = -1;
+   for (i = 0; i < n; ++i) {
+      const int b = nfai_info_single_byte(ops, list[i]);
+      if (b < 0 || (i > 0 && b != c)) { return -1; }
+      c = b;
+   }
+   return c;
+}
+
+/* bytes that every match starts with: while every thread (in the expanded program) is
+ * waiting for the same byte, that byte is required */
+NFAI_INTERNAL int nfai_info_prefix(struct NfaiDfa *dfa, char *prefix) {
+   int *kernel = dfa->scratch;
+   int nkernel = 1, n = 0, nclosure, c, i;
+   kernel[0] = 0;
+   while (n < NFA_INFO_MAX_LITERAL) {
+      /* (a thread may pass any assertion except '^' after the first byte) */
+      nclosure = nfai_dfa_closure(dfa, kernel, nkernel, (n ? ~(uint32_t)NFA_EXEC_AT_START : ~(uint32_t)0), NFAI_LOOK_ANY);
+      c = nfai_info_common_byte(dfa->ops, dfa->closure, nclosure);
+      if (c < 0) { break; }
+      prefix[n++] = (char)c;
+      for (i = 0; i < nclosure; ++i) { kernel[i] = dfa->closure[i] + nfai_op_length(dfa->ops + dfa->closure[i]); }
+      nkernel = nclosure;
+   }
+   return n;
+}
+
+/* Bytes that every match ends with: the same thing backwards, from the accepts and tokens.
+ * Each step finds the byte matches which lead (without consuming input) to the current set,
+ * and stops if the start can lead there too. Assertions are assumed to pass. */
+NFAI_INTERNAL int nfai_info_suffix(struct NfaiDfa *dfa, char *suffix) {
+   int *first, *preds, *chosen, *set = dfa->scratch;
+   int nset = 0, n = 0, nchosen, top, pc, next, i, j, c, at_start;
+
+   first = (int*)nfai_zalloc(&dfa->pool, (dfa->nops + 1)*sizeof(int));
+   preds = (int*)nfai_alloc(&dfa->pool, dfa->nops*sizeof(int));
+   chosen = (int*)nfai_zalloc(&dfa->pool, dfa->nops*sizeof(int));
+   if (!first || !preds || !chosen) { return NFA_ERROR_OUT_OF_MEMORY; }
+
+   /* predecessor lists (the predecessors of pc are preds[first[pc]] to preds[first[pc + 1] - 1]),
+    * filled in using dfa->mark to count */
+   for (pc = 0; pc < dfa->nops; ++pc) { dfa->mark[pc] = 0; }
+   for (pc = 0; pc < dfa->nops; pc += nfai_op_length(dfa->ops + pc)) {
+      for (i = 0; (next = nfai_info_successor(dfa->ops, pc, i)) >= 0; ++i) { ++first[next + 1]; }
+      if (nfai_info_is_end(dfa->ops, pc)) { set[nset++] = pc; }
+   }
+   for (pc = 0; pc < dfa->nops; ++pc) { first[pc + 1] += first[pc]; }
+   for (pc = 0; pc < dfa->nops; pc += nfai_op_length(dfa->ops + pc)) {
+      for (i = 0; (next = nfai_info_successor(dfa->ops, pc, i)) >= 0; ++i) { preds[first[next] + dfa->mark[next]++] = pc; }
+   }
+   for (pc = 0; pc < dfa->nops; ++pc) { dfa->mark[pc] = 0; }
+   dfa->stamp = 0;
+
+   while (n < NFA_INFO_MAX_LITERAL) {
+      ++dfa->stamp;
+      top = 0;
+      nchosen = 0;
+      at_start = 0;
+      for (i = 0; i < nset; ++i) { nfai_dfa_push(dfa, set[i], &top); }
+      while (top) {
+         pc = dfa->stack[--top];
+         if (pc == 0) { at_start = 1; }
+         for (j = first[pc]; j < first[pc + 1]; ++j) {
+            const int from = preds[j];
+            int width;
+            nfai_info_width(dfa->ops, from, &width);
+            if (!width) {
+               nfai_dfa_push(dfa, from, &top);
+            } else if (chosen[from] != dfa->stamp) {
+               chosen[from] = dfa->stamp;
+               dfa->closure[nchosen++] = from;
+            }
+         }
+      }
+      c = (at_start ? -1 : nfai_info_common_byte(dfa->ops, dfa->closure, nchosen));
+      if (c < 0) { break; }
+      suffix[n++] = (char)c;
+      memcpy(set, dfa->closure, nchosen*sizeof(int));
+      nset = nchosen;
+   }
+
+   /* (found backwards) */
+   for (i = 0; i < n/2; ++i) {
+      c = suffix[i];
+      suffix[i] = suffix[n - 1 - i];
+      suffix[n - 1 - i] = (char)c;
+   }
+   return n;
+}
+
+/* An NFA is one-pass if, at each step, every byte value is matched by at most one thread;
+ * then a match only ever has one thread, so each kernel is a single instruction (and there
+ * are at most nops of them to check). */
+NFAI_INTERNAL int nfai_info_one_pass(struct NfaiDfa *dfa) {
+   uint8_t used[256];
+   int *pending = dfa->scratch;
+   char *seen;
+   int npending = 0, start = 1, kernel = 0, nclosure, i, b, width;
+
+   seen = (char*)nfai_zalloc(&dfa->pool, dfa->nops);
+   if (!seen) { return NFA_ERROR_OUT_OF_MEMORY; }
+   for (;;) {
+      nclosure = nfai_dfa_closure(dfa, &kernel, 1, (start ? NFA_EXEC_AT_START : 0), NFAI_LOOK_ANY);
+      memset(used, 0, sizeof(used));
+      for (i = 0; i < nclosure; ++i) {
+         const int pc = dfa->closure[i], next = pc + nfai_op_length(dfa->ops + pc);
+         if (!nfai_info_width(dfa->ops, pc, &width)) { continue; }
+         for (b = 0; b < 256; ++b) {
+            if (nfai_dfa_match(dfa->ops, pc, b)) {
+               if (used[b]) { return 0; }
+               used[b] = 1;
+            }
+         }
+         if (!seen[next]) {
+            seen[next] = 1;
+            pending[npending++] = next;
+         }
+      }
+      if (!npending) { return 1; }
+      kernel = pending[--npending];
+      start = 0;
+   }
+}
+
+/* the parts of nfa_analyze that need the expanded program */
+NFAI_INTERNAL int nfai_info_expanded(const Nfa *nfa, NfaInfo *info) {
+   struct NfaiDfa dfa;
+   int error, n;
+   memset(&dfa, 0, sizeof(dfa));
+   nfai_alloc_init_default(&dfa.pool);
+   error = nfai_dfa_expand(&dfa, nfa);
+   if (!error) { error = nfai_dfa_alloc_closure(&dfa); }
+   if (!error) {
+      info->prefix_length = nfai_info_prefix(&dfa, info->prefix);
+      n = nfai_info_suffix(&dfa, info->suffix);
+      if (n < 0) { error = n; } else { info->suffix_length = n; }
+   }
+   if (!error) {
+      n = nfai_info_one_pass(&dfa);
+      if (n < 0) { error = n; } else { info->one_pass = n; }
+   }
+   nfai_free_pool(&dfa.pool);
+   /* (if the program is too big to expand, these just aren't known) */
+   return (error == NFA_ERROR_NFA_TOO_LARGE ? 0 : error);
+}
+
+/* Work out the NFA's prefilter (see struct Nfa): its shortest match, its longest if every
+ * match ends with '$', whether every match starts with '^', and up to three bytes which
+ * every match contains (a byte is required if no match can avoid the instructions that need
+ * it; only the first few distinct bytes in the program are tried). A case-insensitive letter
+ * is required in either case. This is best-effort: without the memory for it, the prefilter
+ * rejects nothing (and searches go on past the start). */
+NFAI_INTERNAL void nfai_prefilter(Nfa *nfa, NfaPoolAllocator *pool) {
+   const int max_candidates = 16;
+   uint8_t tried[2*256];
+   NfaOpcode *ops;
+   char *mark;
+   int *stack, *heap;
+   int pc, i, c, length, ncandidates = 0;
+
+   nfa->min_length = 0;
+   nfa->max_length = UINT32_MAX;
+   nfa->nrequired = 0;
+   memset(nfa->required, 0, sizeof(nfa->required));
+   nfa->folded = 0;
+   nfa->anchored = 0;
+
+   ops = (NfaOpcode*)nfai_alloc(pool, nfa->nops*sizeof(NfaOpcode));
+   mark = (char*)nfai_alloc(pool, nfa->nops);
+   stack = (int*)nfai_alloc(pool, nfa->nops*sizeof(int));
+   heap = (int*)nfai_alloc(pool, 2*(nfa->nops + 1)*sizeof(int));
+   if (!ops || !mark || !stack || !heap) { return; }
+   nfai_info_load(nfa, ops);
+
+   nfa->anchored = !nfai_info_reach(ops, nfa->nops, mark, stack, 0, -1);
+   nfa->min_length = (uint32_t)nfai_info_min_length(ops, nfa->nops, stack, heap);
+   if (!nfai_info_reach(ops, nfa->nops, mark, stack, 1, -1) &&
+         !nfai_info_max_length(ops, nfa->nops, pool, &length) && length >= 0 && length < INT_MAX) {
+      nfa->max_length = (uint32_t)length;
+   }
+
+   memset(tried, 0, sizeof(tried));
+   for (pc = 0; pc < nfa->nops && ncandidates < max_candidates; pc += nfai_op_length(ops + pc)) {
+      const int n = ((ops[pc] & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_STRING ? NFAI_LO_BYTE(ops[pc]) : 1);
+      for (i = 0; i < n && ncandidates < max_candidates && nfa->nrequired < sizeof(nfa->required); ++i) {
+         if ((ops[pc] & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_STRING) {
+            const NfaOpcode pair = ops[pc + 1 + i/2];
+            c = ((i & 1) ? NFAI_LO_BYTE(pair) : NFAI_HI_BYTE(pair));
+         } else {
+            c = nfai_info_single_byte(ops, pc);
+            if (c < 0 && (c = nfai_info_folded_letter(ops, pc)) >= 0) { c |= NFAI_INFO_FOLDED; }
+         }
+         if (c < 0 || tried[c]) { continue; }
+         tried[c] = 1;
+         ++ncandidates;
+         if (!nfai_info_reach(ops, nfa->nops, mark, stack, -1, c)) {
+            if (c & NFAI_INFO_FOLDED) { nfa->folded |= (1u << nfa->nrequired); }
+            nfa->required[nfa->nrequired++] = (uint8_t)c;
+         }
+      }
+   }
+}
+
+NFA_API int nfa_analyze(const Nfa *nfa, NfaInfo *info, int max_dfa_states) {
+   NfaPoolAllocator pool;
+   NfaOpcode *ops;
+   char *mark;
+   int *stack, *heap;
+   int error, pc, i, length = 0;
+
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(info);
+
+   memset(info, 0, sizeof(*info));
+   info->one_pass = -1;
+   info->dfa_states = -1;
+
+   nfai_alloc_init_default(&pool);
+   ops = (NfaOpcode*)nfai_alloc(&pool, nfa->nops*sizeof(NfaOpcode));
+   mark = (char*)nfai_alloc(&pool, nfa->nops);
+   stack = (int*)nfai_alloc(&pool, nfa->nops*sizeof(int));
+   heap = (int*)nfai_alloc(&pool, 2*(nfa->nops + 1)*sizeof(int));
+   if (!ops || !mark || !stack || !heap) {
+      nfai_free_pool(&pool);
+      return NFA_ERROR_OUT_OF_MEMORY;
+   }
+
+   nfai_info_load(nfa, ops);
+
+   info->anchored_start = !nfai_info_reach(ops, nfa->nops, mark, stack, 0, -1);
+   info->anchored_end = !nfai_info_reach(ops, nfa->nops, mark, stack, 1, -1);
+
+   /* states, by the same numbering as the machine (see nfai_virtual_states) */
+   nfai_info_reach(ops, nfa->nops, mark, stack, -1, -1);
+   for (pc = 0; pc < nfa->nops; pc += nfai_op_length(ops + pc)) {
+      const NfaOpcode op = ops[pc];
+      if (!mark[pc]) { continue; }
+      info->consuming_states += nfai_consuming_states(nfa, pc);
+      /* (token states are never added to a state set) */
+      if ((op & NFAI_OPCODE_MASK) != NFAI_OP_TOKEN) { info->max_live_states += 1 + nfai_virtual_states(nfa, pc); }
+      if ((op & NFAI_OPCODE_MASK) == NFAI_OP_SAVE_START || (op & NFAI_OPCODE_MASK) == NFAI_OP_SAVE_END) {
+         i = NFAI_LO_BYTE(op);
+         info->captures_used[i / 32] |= ((uint32_t)1 << (i % 32));
+         if (i >= info->ncaptures) { info->ncaptures = i + 1; }
+      }
+   }
+
+   info->min_length = nfai_info_min_length(ops, nfa->nops, stack, heap);
+   error = nfai_info_max_length(ops, nfa->nops, &pool, &length);
+   info->max_length = (length == INT_MAX ? -1 : (length < 0 ? 0 : length));
+   nfai_free_pool(&pool);
+
+   if (!error) { error = nfai_info_expanded(nfa, info); }
+   if (!error && max_dfa_states > 0) {
+      struct NfaiDfa dfa;
+      error = nfai_dfa_build(&dfa, nfa, (max_dfa_states < NFAI_DFA_MAX_STATES ? max_dfa_states : NFAI_DFA_MAX_STATES));
+      if (!error) {
+         info->dfa_states = dfa.nstates;
+         nfai_free_pool(&dfa.pool);
+      } else if (error == NFA_ERROR_NFA_TOO_LARGE) {
+         error = 0;
+      }
+   }
+   return error;
+}
+
+#ifndef NFA_NO_STDIO
+NFA_API void nfa_print_machine(const Nfa *nfa, FILE *to) {
+   int i;
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(to);
+   fprintf(to, "NFA with %d opcodes:\n", nfa->nops);
+   for (i = 0; i < nfa->nops;) {
+      i = nfai_print_opcode(nfa, i, to);
+   }
+   fprintf(to, "------\n");
+}
+
+/* ----- C SOURCE EMITTER ----- */
+
+NFAI_INTERNAL void nfai_emit_action(FILE *to, int target) {
+   if (target < 0) {
+      fprintf(to, "return 0;");
+   } else {
+      fprintf(to, "goto s%d;", target);
+   }
+}
+
+NFA_API int nfa_emit_c(const Nfa *nfa, const char *name, FILE *to) {
+   struct NfaiDfa dfa;
+   int error, i, b, lo, fallback, any_transitions = 0, any_tests = 0;
+
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(name);
+   NFAI_ASSERT(to);
+
+   error = nfai_dfa_build(&dfa, nfa, NFAI_DFA_MAX_STATES);
+   if (error) { return error; }
+
+   for (i = 0; i < dfa.nstates; ++i) {
+      if (!dfa.states[i].accept) {
+         any_transitions = 1;
+         if (!dfa.states[i].single) { any_tests = 1; }
+      }
+   }
+
+   fprintf(to, "/* DFA with %d state%s (generated by nfa_emit_c) */\n", dfa.nstates, (dfa.nstates == 1 ? "" : "s"));
+   fprintf(to, "int %s(const char *text, size_t length) {\n", name);
+   if (any_transitions) {
+      fprintf(to, "   const unsigned char *p = (const unsigned char*)text;\n");
+      fprintf(to, "   const unsigned char *const end = p + length;\n");
+      if (any_tests) { fprintf(to, "   unsigned c;\n"); }
+   } else {
+      fprintf(to, "   (void)text;\n");
+      fprintf(to, "   (void)length;\n");
+   }
+   for (i = 0; i < dfa.nstates; ++i) {
+      const struct NfaiDfaState *state = dfa.states + i;
+      if (state->targeted) { fprintf(to, "s%d:\n", i); }
+      if (state->accept) {
+         fprintf(to, "   return 1;\n");
+         continue;
+      }
+      fprintf(to, "   if (p == end) { return %d; }\n", state->accept_end);
+      if (state->single) {
+         fprintf(to, (state->next[0] < 0 ? "   " : "   ++p;\n   "));
+         nfai_emit_action(to, state->next[0]);
+         fprintf(to, "\n");
+         continue;
+      }
+      fprintf(to, "   c = *p++;\n");
+      /* the byte values are split into runs with the same target; runs that go to the
+       * most common target are left to the final fallback */
+      fallback = nfai_dfa_fallback(state);
+      for (b = 0, lo = 0; b < 256;) {
+         const int target = state->next[b];
+         int last = b;
+         while (last < 255 && state->next[last + 1] == target) { ++last; }
+         if (target != fallback) {
+            if (b == last) {
+               fprintf(to, "   if (c == %du) { ", b);
+            } else if (lo == b) {
+               /* (the bytes below this run have been ruled out) */
+               fprintf(to, "   if (c <= %du) { ", last);
+            } else if (last == 255) {
+               fprintf(to, "   if (c >= %du) { ", b);
+            } else {
+               fprintf(to, "   if (c >= %du && c <= %du) { ", b, last);
+            }
+            nfai_emit_action(to, target);
+            fprintf(to, " }\n");
+            if (lo == b) { lo = last + 1; }
+         }
+         b = last + 1;
+      }
+      fprintf(to, "   ");
+      nfai_emit_action(to, fallback);
+      fprintf(to, "\n");
+   }
+   fprintf(to, "}\n");
+
+   nfai_free_pool(&dfa.pool);
+   return 0;
+}
+#endif
+
+NFA_API size_t nfa_size(const Nfa *nfa) {
+   return nfai_nfa_size(nfa->nops, nfa->format);
+}
+
+NFAI_INTERNAL int nfai_is_char_op(NfaOpcode op) {
+   switch (op & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_ANY:
+      case NFAI_OP_MATCH_BYTE:
+      case NFAI_OP_MATCH_CLASS:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+/* check the operands of the instruction at nfa->ops[pc], which is known to be in bounds
+ * (jump targets are checked separately, once all the instruction starts are known) */
+NFAI_INTERNAL int nfai_validate_instr(const Nfa *nfa, int pc) {
+   const NfaOpcode word = nfai_word(nfa, pc);
+   const int arg = NFAI_LO_BYTE(word);
+   int i, prev;
+
+   if (word > UINT16_MAX) { return 0; }
+   switch (word & NFAI_OPCODE_MASK) {
+      case NFAI_OP_MATCH_ANY:
+      case NFAI_OP_MATCH_BYTE:
+      case NFAI_OP_SAVE_START:
+      case NFAI_OP_SAVE_END:
+      case NFAI_OP_ACCEPT:
+         return 1;
+      case NFAI_OP_MATCH_CLASS:
+         /* ordered, disjoint ranges */
+         prev = -1;
+         for (i = 1; i <= arg; ++i) {
+            const NfaOpcode range = nfai_word(nfa, pc + i);
+            if (range > UINT16_MAX || NFAI_HI_BYTE(range) > NFAI_LO_BYTE(range) || (int)NFAI_HI_BYTE(range) <= prev) { return 0; }
+            prev = NFAI_LO_BYTE(range);
+         }
+         return (arg > 0);
+      case NFAI_OP_ASSERT_CONTEXT:
+         return (arg < 32);
+      case NFAI_OP_ASSERT_LOOK:
+         return (arg < NFAI_LOOK_NKINDS);
+      case NFAI_OP_JUMP:
+         return (arg > 0);
+      case NFAI_OP_TOKEN:
+         return (nfai_word(nfa, pc + 1) <= INT32_MAX);
+      case NFAI_OP_MATCH_STRING:
+         /* (the builder makes a single byte into a byte match, and the machine relies on that) */
+         return (arg >= 2);
+      case NFAI_OP_REPEAT:
+         if (arg & ~(NFAI_REPEAT_LAZY | NFAI_REPEAT_UNBOUNDED)) { return 0; }
+         if (nfai_word(nfa, pc + 2) < 1 || nfai_word(nfa, pc + 2) > NFAI_MAX_STATES) { return 0; }
+         if (nfai_word(nfa, pc + 1) > nfai_word(nfa, pc + 2)) { return 0; }
+         return (nfai_is_char_op(nfai_word(nfa, pc + 3)) && nfai_validate_instr(nfa, pc + 3));
+      default:
+         return 0;
+   }
+}
+
+NFA_API int nfa_validate(const void *blob, size_t size) {
+   const Nfa *nfa = (const Nfa*)blob;
+   NfaPoolAllocator pool;
+   uint8_t *starts;
+   NfaOpcode op = 0;
+   int pc, i, len, error;
+
+   NFAI_ASSERT(blob);
+
+   if (size < offsetof(struct Nfa, ops)) { return NFA_ERROR_NFA_INVALID; }
+   if (nfa->magic == NFAI_MAGIC_SWAPPED) { return NFA_ERROR_NFA_VERSION; }
+   if (nfa->magic != NFAI_MAGIC) { return NFA_ERROR_NFA_INVALID; }
+   if (nfa->version != NFAI_VERSION) { return NFA_ERROR_NFA_VERSION; }
+   if (nfa->format != NFAI_FORMAT_NARROW && nfa->format != NFAI_FORMAT_WIDE) { return NFA_ERROR_NFA_INVALID; }
+   if (nfa->nops < 1 || nfa->nops > (nfa->format == NFAI_FORMAT_WIDE ? NFAI_MAX_OPS : NFAI_NARROW_MAX_OPS)) {
+      return NFA_ERROR_NFA_INVALID;
+   }
+   if (size < nfai_nfa_size(nfa->nops, nfa->format)) { return NFA_ERROR_NFA_INVALID; }
+   if (nfa->checksum != nfai_checksum(nfa)) { return NFA_ERROR_NFA_INVALID; }
+   if (nfa->nrequired > sizeof(nfa->required) || nfa->anchored > 1) { return NFA_ERROR_NFA_INVALID; }
+   for (i = 0; i < 32; ++i) {
+      if (((nfa->folded >> i) & 1u) && (i >= nfa->nrequired || !nfai_is_ascii_alpha_lower(nfa->required[i]))) {
+         return NFA_ERROR_NFA_INVALID;
+      }
+   }
+
+   /* mark the start of each instruction, checking that it's well formed */
+   nfai_alloc_init_default(&pool);
+   starts = (uint8_t*)nfai_zalloc(&pool, nfa->nops);
+   if (!starts) { nfai_free_pool(&pool); return NFA_ERROR_OUT_OF_MEMORY; }
+   error = 0;
+   for (pc = 0; pc < nfa->nops && !error; pc += len) {
+      op = nfai_word(nfa, pc);
+      if ((op & NFAI_OPCODE_MASK) == NFAI_OP_REPEAT && pc + 3 >= nfa->nops) {
+         error = NFA_ERROR_NFA_INVALID;
+         break;
+      }
+      len = nfai_nfa_op_length(nfa, pc);
+      if (len > nfa->nops - pc || !nfai_validate_instr(nfa, pc)) {
+         error = NFA_ERROR_NFA_INVALID;
+      }
+      starts[pc] = 1;
+   }
+
+   /* the program ends with an accept, so a thread can't run off the end */
+   if (!error && op != NFAI_OP_ACCEPT) { error = NFA_ERROR_NFA_INVALID; }
+
+   /* every jump must land on an instruction */
+   for (pc = 0; pc < nfa->nops && !error; pc += len) {
+      op = nfai_word(nfa, pc);
+      len = nfai_nfa_op_length(nfa, pc);
+      if ((op & NFAI_OPCODE_MASK) == NFAI_OP_JUMP) {
+         for (i = 1; i < len; ++i) {
+            const int offset = nfai_jump_offset(nfa, pc + i);
+            if (offset < -(pc + len) || offset >= nfa->nops - (pc + len) || !starts[pc + len + offset]) {
+               error = NFA_ERROR_NFA_INVALID;
+               break;
+            }
+         }
+      }
+   }
+   nfai_free_pool(&pool);
+
+   if (!error && nfai_count_states(nfa) > NFAI_MAX_STATES) { error = NFA_ERROR_NFA_TOO_LARGE; }
+   return error;
+}
 
-   if (vm->error) { return vm->error; }
+/* A bundle is a single blob holding many NFAs and an index of their names:
+ *
+ *    header | entries[count] | by_name[count] | names | NFAs
+ *
+ * All fields are 32-bit words in native byte order. by_name lists the entry indices in
+ * name order (for binary search), names are nul-terminated, and each NFA starts on an
+ * 8 byte boundary. Offsets are from the start of the bundle. */
+#define NFAI_BUNDLE_MAGIC          0x1A424E4Eu /* "NNB\x1A" when stored little-endian */
+#define NFAI_BUNDLE_MAGIC_SWAPPED  0x4E4E421Au
+enum { NFAI_BUNDLE_VERSION = 1 };
+
+struct NfaiBundleHeader {
+   uint32_t magic;    /* NFAI_BUNDLE_MAGIC */
+   uint16_t version;  /* NFAI_BUNDLE_VERSION */
+   uint16_t reserved;
+   uint32_t count;
+   uint32_t size;     /* of the whole bundle */
+};
 
-   flags = NFA_EXEC_AT_START;
-   if ((length == 0u) || (length == NULL_LEN && text[0] == '\0')) {
-      flags |= NFA_EXEC_AT_END;
-   }
+struct NfaiBundleEntry {
+   uint32_t nfa_offset;
+   uint32_t nfa_size;
+   uint32_t name_offset;
+   uint32_t name_length;
+};
 
-   nfa_exec_start(vm, 0, flags);
-   if (vm->error) { return vm->error; }
+NFAI_INTERNAL size_t nfai_align8(size_t x) { return (x + 7u) & ~(size_t)7u; }
 
-#ifdef NFA_TRACE_MATCH
-   NFAI_ASSERT(vm->data);
-   data = (struct NfaiMachineData*)vm->data;
-#endif
+/* compare the names of two entries (ties are broken by index, so the order is total) */
+NFAI_INTERNAL int nfai_bundle_name_cmp(const char *base, const struct NfaiBundleEntry *entries, uint32_t a, uint32_t b) {
+   const uint32_t alen = entries[a].name_length, blen = entries[b].name_length;
+   int c = memcmp(base + entries[a].name_offset, base + entries[b].name_offset, (alen < blen ? alen : blen));
+   if (c) { return c; }
+   if (alen != blen) { return (alen < blen ? -1 : 1); }
+   return (a < b ? -1 : (a > b ? 1 : 0));
+}
 
-   if ((flags & NFA_EXEC_AT_END) == 0) {
-      int at_end;
-      size_t i = 0;
-      do {
-         char c = text[i];
-         ++i;
-         at_end = ((length == NULL_LEN) ? (text[i] == '\0') : (length == i));
-         nfa_exec_step(vm, c, i - 1, (at_end ? NFA_EXEC_AT_END : 0));
-         if (vm->error) { return vm->error; }
-#ifdef NFA_TRACE_MATCH
-         if (vm->ncaptures) { nfai_print_captures(stderr, vm, data->current); }
-#endif
-      } while (!at_end && !nfa_exec_is_rejected(vm));
+/* heap sort, because qsort has no way to pass the names to the comparison */
+NFAI_INTERNAL void nfai_bundle_sort(const char *base, const struct NfaiBundleEntry *entries, uint32_t *idx, int n) {
+   int start, end, root, child;
+   uint32_t tmp;
+   for (start = n/2 - 1, end = n; end > 1;) {
+      if (start >= 0) {
+         root = start--;
+      } else {
+         --end;
+         tmp = idx[0]; idx[0] = idx[end]; idx[end] = tmp;
+         root = 0;
+      }
+      /* sift down */
+      while ((child = 2*root + 1) < end) {
+         if (child + 1 < end && nfai_bundle_name_cmp(base, entries, idx[child], idx[child + 1]) < 0) { ++child; }
+         if (nfai_bundle_name_cmp(base, entries, idx[root], idx[child]) >= 0) { break; }
+         tmp = idx[root]; idx[root] = idx[child]; idx[child] = tmp;
+         root = child;
+      }
    }
+}
 
-#ifdef NFA_TRACE_MATCH
-   if (vm->ncaptures) {
-      fprintf(stderr, "final captures (current):\n");
-      nfai_print_captures(stderr, vm, data->current);
-      fprintf(stderr, "final captures (next):\n");
-      nfai_print_captures(stderr, vm, data->next);
+NFA_API size_t nfa_bundle_size(const Nfa * const *nfas, const char * const *names, int count) {
+   size_t sz;
+   int i;
+   NFAI_ASSERT(nfas || !count);
+   NFAI_ASSERT(count >= 0);
+   sz = sizeof(struct NfaiBundleHeader) + count*(sizeof(struct NfaiBundleEntry) + sizeof(uint32_t));
+   for (i = 0; i < count; ++i) {
+      sz += (names && names[i] ? strlen(names[i]) : 0) + 1;
    }
-#endif
-
-   if (vm->error) { return vm->error; }
-
-   return nfa_exec_is_accepted(vm);
+   for (i = 0; i < count; ++i) {
+      NFAI_ASSERT(nfas[i]);
+      sz = nfai_align8(sz) + nfa_size(nfas[i]);
+   }
+   return sz;
 }
 
-NFA_API int nfa_match(const Nfa *nfa, NfaCapture *captures, int ncaptures, const char *text, size_t length) {
-   NfaMachine vm;
-   int accepted;
+NFA_API int nfa_bundle_write(void *buffer, size_t size, const Nfa * const *nfas, const char * const *names, int count) {
+   struct NfaiBundleHeader *header = (struct NfaiBundleHeader*)buffer;
+   struct NfaiBundleEntry *entries;
+   uint32_t *by_name;
+   char *base = (char*)buffer;
+   size_t at, total;
+   int i;
 
-   NFAI_ASSERT(nfa);
-   NFAI_ASSERT(ncaptures >= 0);
-   NFAI_ASSERT(captures || !ncaptures);
-   NFAI_ASSERT(text);
-   NFAI_ASSERT(nfa->nops >= 1);
+   NFAI_ASSERT(buffer);
+   NFAI_ASSERT(nfas || !count);
+   NFAI_ASSERT(count >= 0);
+
+   total = nfa_bundle_size(nfas, names, count);
+   if (total > UINT32_MAX) { return NFA_ERROR_NFA_TOO_LARGE; }
+   if (size < total) { return NFA_ERROR_BUFFER_TOO_SMALL; }
+
+   memset(buffer, 0, total);
+   header->magic = NFAI_BUNDLE_MAGIC;
+   header->version = NFAI_BUNDLE_VERSION;
+   header->count = (uint32_t)count;
+   header->size = (uint32_t)total;
+
+   entries = (struct NfaiBundleEntry*)(header + 1);
+   by_name = (uint32_t*)(entries + count);
+   at = (size_t)((char*)(by_name + count) - base);
+   for (i = 0; i < count; ++i) {
+      const size_t len = (names && names[i] ? strlen(names[i]) : 0);
+      if (len) { memcpy(base + at, names[i], len); }
+      entries[i].name_offset = (uint32_t)at;
+      entries[i].name_length = (uint32_t)len;
+      by_name[i] = (uint32_t)i;
+      at += len + 1;
+   }
+   for (i = 0; i < count; ++i) {
+      const size_t sz = nfa_size(nfas[i]);
+      at = nfai_align8(at);
+      memcpy(base + at, nfas[i], sz);
+      entries[i].nfa_offset = (uint32_t)at;
+      entries[i].nfa_size = (uint32_t)sz;
+      at += sz;
+   }
+   NFAI_ASSERT(at == total);
 
-   nfa_exec_init(&vm, nfa, ncaptures);
+   nfai_bundle_sort(base, entries, by_name, count);
+   return 0;
+}
 
-   accepted = nfa_exec_match_string(&vm, text, length);
+NFA_API int nfa_bundle_open(NfaBundle *bundle, const void *blob, size_t size) {
+   const struct NfaiBundleHeader *header = (const struct NfaiBundleHeader*)blob;
+   const struct NfaiBundleEntry *entries;
+   const uint32_t *by_name;
+   const char *base = (const char*)blob;
+   size_t index_end;
+   uint32_t i;
+   int error;
+
+   NFAI_ASSERT(bundle);
+   NFAI_ASSERT(blob);
+   memset(bundle, 0, sizeof(NfaBundle));
+
+   if (size < sizeof(struct NfaiBundleHeader)) { return NFA_ERROR_NFA_INVALID; }
+   if (header->magic == NFAI_BUNDLE_MAGIC_SWAPPED) { return NFA_ERROR_NFA_VERSION; }
+   if (header->magic != NFAI_BUNDLE_MAGIC) { return NFA_ERROR_NFA_INVALID; }
+   if (header->version != NFAI_BUNDLE_VERSION) { return NFA_ERROR_NFA_VERSION; }
+   if (header->size > size || header->count > INT32_MAX) { return NFA_ERROR_NFA_INVALID; }
+   size = header->size;
+   if ((size - sizeof(struct NfaiBundleHeader)) / (sizeof(struct NfaiBundleEntry) + sizeof(uint32_t)) < header->count) {
+      return NFA_ERROR_NFA_INVALID;
+   }
 
-   if (accepted >= 0) {
-      if (ncaptures) {
-         nfai_store_captures(&vm, captures, ncaptures);
+   entries = (const struct NfaiBundleEntry*)(header + 1);
+   by_name = (const uint32_t*)(entries + header->count);
+   index_end = (size_t)((const char*)(by_name + header->count) - base);
+
+   for (i = 0; i < header->count; ++i) {
+      const struct NfaiBundleEntry *e = entries + i;
+      if (e->name_offset < index_end || e->name_offset >= size || e->name_length >= size - e->name_offset) {
+         return NFA_ERROR_NFA_INVALID;
       }
-      NFAI_ASSERT(!vm.error);
+      if (base[e->name_offset + e->name_length] != '\0') { return NFA_ERROR_NFA_INVALID; }
+      if (e->nfa_offset < index_end || (e->nfa_offset & 7u) || e->nfa_offset > size || e->nfa_size > size - e->nfa_offset) {
+         return NFA_ERROR_NFA_INVALID;
+      }
+      if (by_name[i] >= header->count) { return NFA_ERROR_NFA_INVALID; }
+      if (i > 0 && nfai_bundle_name_cmp(base, entries, by_name[i - 1], by_name[i]) >= 0) { return NFA_ERROR_NFA_INVALID; }
+   }
+   for (i = 0; i < header->count; ++i) {
+      error = nfa_validate(base + entries[i].nfa_offset, entries[i].nfa_size);
+      if (error) { return error; }
    }
 
-   nfa_exec_free(&vm);
-   return accepted;
+   bundle->data = blob;
+   bundle->count = (int)header->count;
+   return 0;
 }
 
-#ifndef NFA_NO_STDIO
-NFA_API void nfa_print_machine(const Nfa *nfa, FILE *to) {
-   int i;
-   NFAI_ASSERT(nfa);
-   NFAI_ASSERT(to);
-   fprintf(to, "NFA with %d opcodes:\n", nfa->nops);
-   for (i = 0; i < nfa->nops;) {
-      i = nfai_print_opcode(nfa, i, to);
+NFA_API const Nfa *nfa_bundle_get(const NfaBundle *bundle, int index) {
+   const struct NfaiBundleEntry *entries;
+   NFAI_ASSERT(bundle);
+   if (index < 0 || index >= bundle->count) { return NULL; }
+   entries = (const struct NfaiBundleEntry*)((const struct NfaiBundleHeader*)bundle->data + 1);
+   return (const Nfa*)((const char*)bundle->data + entries[index].nfa_offset);
+}
+
+NFA_API const char *nfa_bundle_name(const NfaBundle *bundle, int index) {
+   const struct NfaiBundleEntry *entries;
+   NFAI_ASSERT(bundle);
+   if (index < 0 || index >= bundle->count) { return NULL; }
+   entries = (const struct NfaiBundleEntry*)((const struct NfaiBundleHeader*)bundle->data + 1);
+   return (const char*)bundle->data + entries[index].name_offset;
+}
+
+NFA_API int nfa_bundle_find(const NfaBundle *bundle, const char *name) {
+   const struct NfaiBundleEntry *entries;
+   const uint32_t *by_name;
+   const char *base;
+   size_t len;
+   int lo, hi, c;
+
+   NFAI_ASSERT(bundle);
+   NFAI_ASSERT(name);
+   base = (const char*)bundle->data;
+   entries = (const struct NfaiBundleEntry*)((const struct NfaiBundleHeader*)bundle->data + 1);
+   by_name = (const uint32_t*)(entries + bundle->count);
+   len = strlen(name);
+
+   /* find the first entry with a name >= the key */
+   lo = 0;
+   hi = bundle->count;
+   while (lo < hi) {
+      const int mid = lo + (hi - lo) / 2;
+      const struct NfaiBundleEntry *e = entries + by_name[mid];
+      c = memcmp(base + e->name_offset, name, (e->name_length < len ? e->name_length : len));
+      if (c == 0 && e->name_length != len) { c = (e->name_length < len ? -1 : 1); }
+      if (c < 0) { lo = mid + 1; } else { hi = mid; }
    }
-   fprintf(to, "------\n");
+   if (lo < bundle->count) {
+      const struct NfaiBundleEntry *e = entries + by_name[lo];
+      if (e->name_length == len && memcmp(base + e->name_offset, name, len) == 0) { return (int)by_name[lo]; }
+   }
+   return -1;
 }
-#endif
 
-NFA_API size_t nfa_size(const Nfa *nfa) {
-   return (sizeof(struct Nfa) + (nfa->nops - 1)*sizeof(nfa->ops[0]));
+NFA_API int nfa_optimize(Nfa *nfa, int *nops_before, int *nops_after) {
+   NfaPoolAllocator pool;
+   NfaOpcode *ops;
+   int nops, error;
+
+   NFAI_ASSERT(nfa);
+   NFAI_ASSERT(nfa->nops > 0);
+
+   if (nops_before) { *nops_before = nfa->nops; }
+   nfai_alloc_init_default(&pool);
+   nops = nfa->nops;
+   ops = (NfaOpcode*)nfai_alloc(&pool, nops*sizeof(NfaOpcode));
+   error = (ops ? 0 : NFA_ERROR_OUT_OF_MEMORY);
+   if (!error) {
+      nfai_load_ops(nfa, ops);
+      error = nfai_optimize(ops, &nops, nfai_format_max_jump(nfa->format), &pool);
+   }
+   if (!error) {
+      /* the result is never larger, so it fits in place (and may now fit in the narrow format) */
+      if (nfa->format == NFAI_FORMAT_WIDE) { nfa->format = (uint16_t)nfai_ops_format(ops, nops); }
+      nfa->nops = nops;
+      nfai_store_ops(nfa, 0, ops, nops);
+      nfai_seal(nfa);
+   }
+   nfai_free_pool(&pool);
+   if (nops_after) { *nops_after = nfa->nops; }
+   return error;
 }
 
 NFA_API int nfa_builder_init(NfaBuilder *builder) {
    NFAI_ASSERT(builder);
    builder->data = NULL;
+   builder->flags = 0;
    builder->error = nfai_alloc_init_default(&builder->alloc);
    return nfai_builder_init_internal(builder);
 }
@@ -1534,6 +7071,7 @@ NFA_API int nfa_builder_init(NfaBuilder *builder) {
 NFA_API int nfa_builder_init_pool(NfaBuilder *builder, void *pool, size_t pool_size) {
    NFAI_ASSERT(builder);
    builder->data = NULL;
+   builder->flags = 0;
    builder->error = nfai_alloc_init_pool(&builder->alloc, pool, pool_size);
    return nfai_builder_init_internal(builder);
 }
@@ -1541,6 +7079,7 @@ NFA_API int nfa_builder_init_pool(NfaBuilder *builder, void *pool, size_t pool_s
 NFA_API int nfa_builder_init_custom(NfaBuilder *builder, NfaPageAllocFn allocf, void *userdata) {
    NFAI_ASSERT(builder);
    builder->data = NULL;
+   builder->flags = 0;
    builder->error = nfai_alloc_init_custom(&builder->alloc, allocf, userdata);
    return nfai_builder_init_internal(builder);
 }
@@ -1560,7 +7099,7 @@ NFA_API Nfa *nfa_builder_output(NfaBuilder *builder) {
    if (!sz) { NFAI_ASSERT(builder->error); return NULL; }
    nfa = (Nfa*)malloc(sz);
    if (!nfa) { builder->error = NFA_ERROR_OUT_OF_MEMORY; }
-   else { nfa_builder_output_to_buffer(builder, nfa, sz); }
+   else if (nfa_builder_output_to_buffer(builder, nfa, sz)) { free(nfa); nfa = NULL; }
    return nfa;
 }
 
@@ -1577,14 +7116,15 @@ NFA_API size_t nfa_builder_output_size(NfaBuilder *builder) {
    NFAI_ASSERT(data->stack[0]);
    NFAI_ASSERT(data->frag_size[0] >= 0);
    nops = data->frag_size[0] + 1; /* +1 for the NFAI_OP_ACCEPT at the end */
-   return (sizeof(Nfa) + (nops - 1)*sizeof(NfaOpcode));
+   return nfai_nfa_size(nops, nfai_builder_format(data));
 }
 
 NFA_API int nfa_builder_output_to_buffer(NfaBuilder *builder, Nfa *nfa, size_t size) {
+   const NfaOpcode accept = NFAI_OP_ACCEPT;
    struct NfaiBuilderData *data;
    struct NfaiFragment *frag, *first;
-   int to, nops;
-   size_t required_size;
+   NfaOpcode *ops = NULL;
+   int to, nops, format;
 
    NFAI_ASSERT(builder);
    if (builder->error) { return builder->error; }
@@ -1599,20 +7139,48 @@ NFA_API int nfa_builder_output_to_buffer(NfaBuilder *builder, Nfa *nfa, size_t s
    NFAI_ASSERT(data->frag_size[0] >= 0);
 
    nops = data->frag_size[0] + 1; /* +1 for the NFAI_OP_ACCEPT at the end */
-   required_size = (sizeof(Nfa) + (nops - 1)*sizeof(NfaOpcode));
-   if (size < required_size) { return (builder->error = NFA_ERROR_BUFFER_TOO_SMALL); }
+   format = nfai_builder_format(data);
+   if (size < nfai_nfa_size(nops, format)) { return (builder->error = NFA_ERROR_BUFFER_TOO_SMALL); }
+
+   if (builder->flags & NFA_BUILDER_OPTIMIZE) {
+      /* optimization is best-effort: if the scratch memory can't be
+       * allocated then the NFA is left as it is */
+      ops = (NfaOpcode*)nfai_alloc(&builder->alloc, nops*sizeof(NfaOpcode));
+      if (ops) {
+         nfai_flatten_fragments(data->stack[0], ops);
+         ops[nops - 1] = NFAI_OP_ACCEPT;
+         if (nfai_optimize(ops, &nops, nfai_format_max_jump(format), &builder->alloc)) {
+            ops = NULL;
+            nops = data->frag_size[0] + 1;
+         } else if (format == NFAI_FORMAT_WIDE) {
+            format = nfai_ops_format(ops, nops);
+         }
+      }
+   }
 
-   first = frag = data->stack[0];
-   to = 0;
-   do {
-      memcpy(nfa->ops + to, frag->ops, frag->nops * sizeof(NfaOpcode));
-      to += frag->nops;
-      frag = frag->next;
-   } while (frag != first);
-   nfa->ops[to++] = NFAI_OP_ACCEPT;
-   nfa->nops = to;
-   NFAI_ASSERT(nfa->nops == nops);
-   return 0;
+   nfa->nops = nops;
+   nfa->format = (uint16_t)format;
+   if (ops) {
+      nfai_store_ops(nfa, 0, ops, nops);
+   } else {
+      first = frag = data->stack[0];
+      to = 0;
+      do {
+         nfai_store_ops(nfa, to, frag->ops, frag->nops);
+         to += frag->nops;
+         frag = frag->next;
+      } while (frag != first);
+      nfai_store_ops(nfa, to++, &accept, 1);
+      NFAI_ASSERT(to == nops);
+   }
+   nfai_prefilter(nfa, &builder->alloc);
+   nfai_seal(nfa);
+
+   /* each state needs an id when the NFA is executed */
+   if (nfai_count_states(nfa) > NFAI_MAX_STATES) {
+      builder->error = NFA_ERROR_NFA_TOO_LARGE;
+   }
+   return builder->error;
 }
 
 NFA_API int nfa_build_match_empty(NfaBuilder *builder) {
@@ -1622,7 +7190,7 @@ NFA_API int nfa_build_match_empty(NfaBuilder *builder) {
 
 NFA_API int nfa_build_match_string(NfaBuilder *builder, const char *bytes, size_t length, int flags) {
    struct NfaiFragment *frag;
-   int i;
+   int i, j, n, nops, per_byte;
 
    NFAI_ASSERT(builder);
 
@@ -1630,17 +7198,86 @@ NFA_API int nfa_build_match_string(NfaBuilder *builder, const char *bytes, size_
    if (length == (size_t)(-1)) { length = strlen(bytes); }
    if (length > NFAI_MAX_OPS) { return (builder->error = NFA_ERROR_NFA_TOO_LARGE); }
 
-   frag = nfai_push_new_fragment(builder, length);
+   /* case-insensitive letters need a class each (so the string is matched byte by byte);
+    * anything else is matched with NFAI_OP_MATCH_STRING ops of up to 255 bytes */
+   per_byte = 0;
+   if (flags & NFA_MATCH_CASE_INSENSITIVE) {
+      for (i = 0; i < (int)length; ++i) {
+         if (nfai_is_ascii_alpha((uint8_t)bytes[i])) { per_byte = 1; break; }
+      }
+   }
+
+   if (per_byte) {
+      nops = 0;
+      for (i = 0; i < (int)length; ++i) {
+         nops += nfai_emit_byte_match(NULL, (uint8_t)bytes[i], flags);
+      }
+      if (nops > NFAI_MAX_OPS) { return (builder->error = NFA_ERROR_NFA_TOO_LARGE); }
+   } else {
+      nops = 0;
+      for (i = 0; i < (int)length; i += n) {
+         n = ((int)length - i < UINT8_MAX ? (int)length - i : UINT8_MAX);
+         nops += (n == 1 ? 1 : 1 + (n + 1)/2);
+      }
+   }
+
+   frag = nfai_push_new_fragment(builder, nops);
    if (!frag) { return builder->error; }
 
-   for (i = 0; i < (int)length; ++i) {
-      frag->ops[i] = nfai_byte_match_op(bytes[i], flags);
+   if (per_byte) {
+      for (i = 0, j = 0; i < (int)length; ++i) {
+         j += nfai_emit_byte_match(frag->ops + j, (uint8_t)bytes[i], flags);
+      }
+      NFAI_ASSERT(j == nops);
+   } else {
+      NfaOpcode *to = frag->ops;
+      for (i = 0; i < (int)length; i += n) {
+         n = ((int)length - i < UINT8_MAX ? (int)length - i : UINT8_MAX);
+         if (n == 1) {
+            nfai_emit_byte_match(to, (uint8_t)bytes[i], 0);
+         } else {
+            *to = NFAI_OP_MATCH_STRING | (uint8_t)n;
+            for (j = 0; j < n; ++j) { nfai_set_string_byte(to, j, (uint8_t)bytes[i + j]); }
+         }
+         to += nfai_op_length(to);
+      }
+      NFAI_ASSERT(to == frag->ops + nops);
    }
    return 0;
 }
 
+NFA_API int nfa_build_literal_set(NfaBuilder *builder, const char * const *strings, const size_t *lengths, int count, int flags) {
+   struct NfaiTrieNode *root, *last = NULL;
+   struct NfaiFragment *frag;
+   int i, nnodes, size;
+
+   NFAI_ASSERT(builder);
+   NFAI_ASSERT(strings);
+   NFAI_ASSERT(count > 0);
+
+   if (builder->error) { return builder->error; }
+
+   root = nfai_trie_new_node(builder, &last, 0);
+   if (!root) { return builder->error; }
+   for (i = 0; i < count; ++i) {
+      const size_t length = ((!lengths || lengths[i] == (size_t)(-1)) ? strlen(strings[i]) : lengths[i]);
+      if (length > NFAI_MAX_OPS) { return (builder->error = NFA_ERROR_NFA_TOO_LARGE); }
+      if (nfai_trie_insert(builder, root, &last, strings[i], length, flags)) { return builder->error; }
+   }
+
+   nnodes = nfai_trie_layout(last, flags);
+   size = root->size;
+   if (size > NFAI_MAX_JUMP) { return (builder->error = NFA_ERROR_NFA_TOO_LARGE); }
+
+   frag = nfai_push_new_fragment(builder, size);
+   if (!frag || !size) { return builder->error; }
+   return nfai_trie_emit(builder, root, nnodes, frag->ops, flags);
+}
+
 NFA_API int nfa_build_match_byte(NfaBuilder *builder, char c, int flags) {
-   return nfai_push_single_op(builder, nfai_byte_match_op(c, flags));
+   struct NfaiFragment *frag = nfai_push_new_fragment(builder, nfai_emit_byte_match(NULL, (uint8_t)c, flags));
+   if (frag) { nfai_emit_byte_match(frag->ops, (uint8_t)c, flags); }
+   return builder->error;
 }
 
 NFA_API int nfa_build_match_byte_range(NfaBuilder *builder, char first, char last, int flags) {
@@ -1723,6 +7360,41 @@ NFA_API int nfa_build_match_any(NfaBuilder *builder) {
    return nfai_push_single_op(builder, NFAI_OP_MATCH_ANY);
 }
 
+NFA_API int nfa_build_match_codepoints(NfaBuilder *builder, const uint32_t *ranges, int nranges, int flags) {
+   struct NfaiCodepointSet set;
+   int i;
+
+   NFAI_ASSERT(builder);
+   NFAI_ASSERT(ranges || !nranges);
+   NFAI_ASSERT(nranges >= 0);
+
+   if (builder->error) { return builder->error; }
+
+   memset(&set, 0, sizeof(set));
+   for (i = 0; i < nranges; ++i) {
+      NFAI_ASSERT(ranges[2*i] <= ranges[2*i + 1]);
+      NFAI_ASSERT(ranges[2*i + 1] <= NFAI_MAX_CODEPOINT);
+      if (nfai_cpset_add(builder, &set, ranges[2*i], ranges[2*i + 1])) { return builder->error; }
+   }
+   return nfai_build_codepoints(builder, &set, flags);
+}
+
+NFA_API int nfa_build_match_category(NfaBuilder *builder, const char *name, int flags) {
+   struct NfaiCodepointSet set;
+   uint32_t mask;
+
+   NFAI_ASSERT(builder);
+   NFAI_ASSERT(name);
+
+   if (builder->error) { return builder->error; }
+
+   mask = nfai_category_mask(name, strlen(name));
+   if (!mask) { return (builder->error = NFA_ERROR_UNKNOWN_CATEGORY); }
+   memset(&set, 0, sizeof(set));
+   if (nfai_cpset_add_categories(builder, &set, mask)) { return builder->error; }
+   return nfai_build_codepoints(builder, &set, flags);
+}
+
 NFA_API int nfa_build_join(NfaBuilder *builder) {
    struct NfaiBuilderData *data;
    int i;
@@ -1739,6 +7411,10 @@ NFA_API int nfa_build_join(NfaBuilder *builder) {
 
    i = data->nstack - 2;
 
+   if (data->frag_size[i] + data->frag_size[i+1] > NFAI_MAX_OPS) {
+      return (builder->error = NFA_ERROR_NFA_TOO_LARGE);
+   }
+
    /* link and put on stack */
    data->stack[i] = nfai_link_fragments(data->stack[i], data->stack[i+1]);
    data->frag_size[i] += data->frag_size[i+1];
@@ -1780,6 +7456,65 @@ NFA_API int nfa_build_alt(NfaBuilder *builder) {
    return 0;
 }
 
+NFA_API int nfa_build_join_n(NfaBuilder *builder, int n) {
+   struct NfaiBuilderData *data;
+   int i, j;
+
+   NFAI_ASSERT(builder);
+   NFAI_ASSERT(n >= 1);
+   if (builder->error) { return builder->error; }
+
+   NFAI_ASSERT(builder->data);
+   data = (struct NfaiBuilderData*)builder->data;
+
+   if (data->nstack < n) {
+      return (builder->error = NFA_ERROR_STACK_UNDERFLOW);
+   }
+
+   i = data->nstack - n;
+   for (j = i + 1; j < data->nstack; ++j) {
+      if (data->frag_size[i] + data->frag_size[j] > NFAI_MAX_OPS) {
+         return (builder->error = NFA_ERROR_NFA_TOO_LARGE);
+      }
+      data->stack[i] = nfai_link_fragments(data->stack[i], data->stack[j]);
+      data->frag_size[i] += data->frag_size[j];
+      data->stack[j] = NULL;
+      data->frag_size[j] = 0;
+   }
+   data->nstack = i + 1;
+   return 0;
+}
+
+NFA_API int nfa_build_alt_n(NfaBuilder *builder, int n) {
+   struct NfaiBuilderData *data;
+   struct NfaiFragment *frag = NULL;
+   int frag_size = 0, i, j;
+
+   NFAI_ASSERT(builder);
+   NFAI_ASSERT(n >= 1);
+   if (builder->error) { return builder->error; }
+
+   NFAI_ASSERT(builder->data);
+   data = (struct NfaiBuilderData*)builder->data;
+
+   if (data->nstack < n) {
+      return (builder->error = NFA_ERROR_STACK_UNDERFLOW);
+   }
+
+   i = data->nstack - n;
+   nfai_make_alt_n(builder, data->stack + i, data->frag_size + i, n, &frag, &frag_size);
+   if (builder->error) { return builder->error; }
+
+   data->stack[i] = frag;
+   data->frag_size[i] = frag_size;
+   for (j = i + 1; j < data->nstack; ++j) {
+      data->stack[j] = NULL;
+      data->frag_size[j] = 0;
+   }
+   data->nstack = i + 1;
+   return 0;
+}
+
 NFA_API int nfa_build_zero_or_one(NfaBuilder *builder, int flags) {
    struct NfaiBuilderData *data;
    struct NfaiFragment *frag = NULL;
@@ -1899,6 +7634,94 @@ NFA_API int nfa_build_one_or_more(NfaBuilder *builder, int flags) {
    return 0;
 }
 
+NFA_API int nfa_build_repeat(NfaBuilder *builder, int min, int max, int flags) {
+   struct NfaiBuilderData *data;
+   struct NfaiFragment *body, *frag;
+   int i, j, k, body_size, unbounded;
+
+   NFAI_ASSERT(builder);
+   NFAI_ASSERT(min >= 0);
+   NFAI_ASSERT(max < 0 || max >= min);
+   if (builder->error) { return builder->error; }
+
+   NFAI_ASSERT(builder->data);
+   data = (struct NfaiBuilderData*)builder->data;
+
+   if (data->nstack < 1) {
+      return (builder->error = NFA_ERROR_STACK_UNDERFLOW);
+   }
+
+   i = data->nstack - 1;
+   body = data->stack[i];
+   body_size = data->frag_size[i];
+   unbounded = (max < 0);
+
+   if (body == &NFAI_EMPTY_FRAGMENT) { return 0; }
+   if (min == 1 && max == 1) { return 0; }
+   if (unbounded && min == 0) { return nfa_build_zero_or_more(builder, flags); }
+   if (unbounded && min == 1) { return nfa_build_one_or_more(builder, flags); }
+   if (max == 0) {
+      data->stack[i] = (struct NfaiFragment*)&NFAI_EMPTY_FRAGMENT;
+      data->frag_size[i] = 0;
+      return 0;
+   }
+
+   if ((unbounded ? min : max) > NFAI_REPEAT_UNROLL_LIMIT && nfai_is_frag_charclass(body)) {
+      /* a counter, so the size of the program doesn't depend on the count. Only the encoding
+       * is compact: the machine still has two virtual states per count, so its memory grows
+       * with the count (checked when the NFA is output). A count can't be kept per thread
+       * instead, since threads at different counts of one repeat are live at once (as in an
+       * unanchored search), and a state set tells them apart by their states */
+      if ((unbounded ? min : max) > NFAI_MAX_STATES) { return (builder->error = NFA_ERROR_NFA_TOO_LARGE); }
+      frag = nfai_new_fragment(builder, 3 + body_size);
+      if (!frag) { return builder->error; }
+      frag->ops[0] = NFAI_OP_REPEAT
+         | ((flags & NFA_REPEAT_NON_GREEDY) ? NFAI_REPEAT_LAZY : 0)
+         | (unbounded ? NFAI_REPEAT_UNBOUNDED : 0);
+      frag->ops[1] = min;
+      frag->ops[2] = (unbounded ? min : max);
+      memcpy(frag->ops + 3, body->ops, body_size * sizeof(NfaOpcode));
+      data->stack[i] = frag;
+      data->frag_size[i] = frag->nops;
+      return 0;
+   }
+
+   /* otherwise unroll it: e{m,} is (m-1) copies followed by e+, and e{m,n}
+    * is m copies followed by (e(e(e)?)?)? with (n-m) levels of nesting */
+   if ((double)body_size * (unbounded ? min : max) + 3.0 * (unbounded ? 1 : max - min) > (double)NFAI_MAX_OPS) {
+      return (builder->error = NFA_ERROR_NFA_TOO_LARGE);
+   }
+   data->stack[i] = (struct NfaiFragment*)&NFAI_EMPTY_FRAGMENT;
+   data->frag_size[i] = 0;
+   for (k = 0; k < (unbounded ? min - 1 : min); ++k) {
+      nfai_push_copy(builder, body, body_size);
+      nfa_build_join(builder);
+   }
+   if (unbounded) {
+      nfai_push_copy(builder, body, body_size);
+      nfa_build_one_or_more(builder, flags);
+      nfa_build_join(builder);
+   } else if (max > min) {
+      nfai_push_copy(builder, body, body_size);
+      nfa_build_zero_or_one(builder, flags);
+      for (k = min + 1; k < max && !builder->error; ++k) {
+         /* wrap the optional tail so far: (e tail)? */
+         nfai_push_copy(builder, body, body_size);
+         if (builder->error) { break; }
+         j = data->nstack - 1;
+         frag = data->stack[j];
+         data->stack[j] = data->stack[j - 1];
+         data->stack[j - 1] = frag;
+         data->frag_size[j] = data->frag_size[j - 1];
+         data->frag_size[j - 1] = body_size;
+         nfa_build_join(builder);
+         nfa_build_zero_or_one(builder, flags);
+      }
+      nfa_build_join(builder);
+   }
+   return builder->error;
+}
+
 NFA_API int nfa_build_complement_char(NfaBuilder *builder) {
    struct NfaiBuilderData *data;
    struct NfaiFragment *orig, *comp;
@@ -1989,6 +7812,35 @@ NFA_API int nfa_build_capture(NfaBuilder *builder, int id) {
    return 0;
 }
 
+NFA_API int nfa_build_token(NfaBuilder *builder, int id) {
+   struct NfaiBuilderData *data;
+   struct NfaiFragment *frag;
+   int i;
+
+   NFAI_ASSERT(builder);
+   NFAI_ASSERT(id >= 0);
+   if (builder->error) { return builder->error; }
+
+   NFAI_ASSERT(builder->data);
+   data = (struct NfaiBuilderData*)builder->data;
+
+   if (data->nstack < 1) {
+      return (builder->error = NFA_ERROR_STACK_UNDERFLOW);
+   }
+
+   i = data->nstack - 1;
+
+   frag = nfai_new_fragment(builder, 2);
+   if (!frag) { return builder->error; }
+
+   frag->ops[0] = NFAI_OP_TOKEN;
+   frag->ops[1] = (NfaOpcode)id;
+
+   data->stack[i] = nfai_link_fragments(data->stack[i], frag);
+   data->frag_size[i] += frag->nops;
+   return 0;
+}
+
 NFA_API int nfa_build_assert_at_start(NfaBuilder *builder) {
    return nfa_build_assert_context(builder, NFA_EXEC_AT_START);
 }
@@ -2008,6 +7860,22 @@ NFA_API int nfa_build_assert_context(NfaBuilder *builder, uint32_t flag) {
    return nfai_push_single_op(builder, NFAI_OP_ASSERT_CONTEXT | (uint8_t)i);
 }
 
+NFA_API int nfa_build_assert_word_boundary(NfaBuilder *builder) {
+   return nfai_push_single_op(builder, NFAI_OP_ASSERT_LOOK | (uint8_t)NFAI_LOOK_WORD_BOUNDARY);
+}
+
+NFA_API int nfa_build_assert_not_word_boundary(NfaBuilder *builder) {
+   return nfai_push_single_op(builder, NFAI_OP_ASSERT_LOOK | (uint8_t)NFAI_LOOK_NOT_WORD_BOUNDARY);
+}
+
+NFA_API int nfa_build_assert_line_start(NfaBuilder *builder) {
+   return nfai_push_single_op(builder, NFAI_OP_ASSERT_LOOK | (uint8_t)NFAI_LOOK_LINE_START);
+}
+
+NFA_API int nfa_build_assert_line_end(NfaBuilder *builder) {
+   return nfai_push_single_op(builder, NFAI_OP_ASSERT_LOOK | (uint8_t)NFAI_LOOK_LINE_END);
+}
+
 NFA_API int nfa_build_regex(NfaBuilder *builder, const char *pattern, size_t length, int flags) {
    NFAI_ASSERT(builder);
    NFAI_ASSERT(pattern);
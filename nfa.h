@@ -44,6 +44,7 @@ extern "C" {
 #endif
 
 #ifndef NFA_BUILDER_MAX_STACK
+/* initial size of the builder stack (it grows when needed), and the regex group nesting limit */
 #  define NFA_BUILDER_MAX_STACK  48
 #endif
 
@@ -71,6 +72,7 @@ typedef struct NfaBuilder {
    void *data; /* private data */
    NfaPoolAllocator alloc;
    int error;
+   int flags; /* NfaBuilderFlag values; reset to 0 by nfa_builder_init* */
 } NfaBuilder;
 
 enum NfaReturnCode {
@@ -94,19 +96,36 @@ enum NfaReturnCode {
    NFA_ERROR_REGEX_EMPTY_CLASS       = -12,
    NFA_ERROR_REGEX_UNCLOSED_CLASS    = -13,
    NFA_ERROR_REGEX_RANGE_BACKWARDS   = -14,
-   NFA_ERROR_REGEX_TRAILING_SLASH    = -15
+   NFA_ERROR_REGEX_TRAILING_SLASH    = -15,
+   NFA_ERROR_REGEX_BAD_REPEAT        = -16,
+
+   NFA_ERROR_NFA_INVALID             = -17,
+   NFA_ERROR_NFA_VERSION             = -18,
+
+   NFA_ERROR_REGEX_BAD_UTF8          = -19,
+   NFA_ERROR_REGEX_BAD_ESCAPE        = -20,
+   NFA_ERROR_UNKNOWN_CATEGORY        = -21,
+
+   NFA_ERROR_BAD_TEMPLATE            = -22
 };
 
 enum NfaBuildFlag {
    /* flags for character/string matching */
-   NFA_MATCH_CASE_INSENSITIVE = 1, /* note: case-insensitivity only implemented for ASCII */
+   NFA_MATCH_CASE_INSENSITIVE = 1, /* note: only ASCII for bytes; code points use Unicode simple case folding */
+   NFA_MATCH_COMPLEMENT       = 2, /* (code point matchers only) match the code points which are not in the set */
 
-   /* flags for repetition ops (zero-or-one, zero-or-more, one-or-more) */
+   /* flags for repetition ops (zero-or-one, zero-or-more, one-or-more, repeat) */
    NFA_REPEAT_NON_GREEDY = 1,
 
    /* flags for regex parsing */
    NFA_REGEX_CASE_INSENSITIVE = 1,
-   NFA_REGEX_NO_CAPTURES      = 2
+   NFA_REGEX_NO_CAPTURES      = 2,
+   NFA_REGEX_UTF8             = 4, /* match code points of UTF-8 text, and allow \p{..}, \P{..} and \x{..} */
+   NFA_REGEX_MULTILINE        = 8  /* '^' and '$' match at the start and end of each line */
+};
+
+enum NfaBuilderFlag {
+   NFA_BUILDER_OPTIMIZE = 1 /* run nfa_optimize on the NFA produced by nfa_builder_output* */
 };
 
 typedef struct NfaMachine {
@@ -118,6 +137,106 @@ typedef struct NfaMachine {
    int error;
 } NfaMachine;
 
+#ifdef NFA_EXEC_STATS
+/* counters for one machine, since nfa_exec_init* (only kept if NFA_EXEC_STATS is defined) */
+typedef struct NfaExecStats {
+   unsigned long bytes_stepped;          /* calls to nfa_exec_step */
+   unsigned long states_visited;         /* states examined by nfa_exec_step, in total */
+   int peak_states;                      /* most states examined by one step */
+   unsigned long closure_expansions;     /* states followed while computing the next state set */
+   unsigned long capture_sets_allocated; /* capture sets allocated from the pool */
+   unsigned long capture_sets_copied;    /* shared capture sets copied before being written */
+   unsigned long freelist_hits;          /* capture sets reused from the free list */
+   unsigned long pages_allocated;        /* pages in the machine's pool */
+} NfaExecStats;
+#endif
+
+typedef struct NfaBundle {
+   const void *data; /* the bundle blob (not owned) */
+   int count;        /* number of NFAs */
+} NfaBundle;
+
+typedef struct NfaJit {
+   void *data; /* private data */
+   int native; /* (bool) the matcher is machine code (otherwise it uses a transition table) */
+} NfaJit;
+
+typedef struct NfaStreamEngine {
+   void *data;       /* private data (read-only once built, so it can be shared by any number of streams) */
+   int bit_parallel; /* (bool) a stream's state is a set of NFA positions (otherwise it's a DFA state) */
+} NfaStreamEngine;
+
+/* the whole state of one stream (0 once the stream can't match) */
+typedef uint64_t NfaStreamState;
+#define NFA_STREAM_START ((NfaStreamState)1)
+
+/* size of the literal prefix and suffix reported by nfa_analyze */
+#define NFA_INFO_MAX_LITERAL  32
+
+/* what nfa_analyze finds out about an NFA (lengths are in bytes) */
+typedef struct NfaInfo {
+   int consuming_states;  /* states that consume a byte (a string or counted repeat has one per byte) */
+   int max_live_states;   /* most states that one nfa_exec_step can examine */
+   int min_length;        /* length of the shortest match */
+   int max_length;        /* length of the longest match, or -1 if there's no limit */
+   int anchored_start;    /* (bool) every match has to start at the start of the input (with '^') */
+   int anchored_end;      /* (bool) every match has to end at the end of the input (with '$') */
+   int one_pass;          /* (bool) at each step, each byte can be matched by only one thread; or -1 if unknown */
+   int ncaptures;         /* one more than the highest capture index used (0 if there are no captures) */
+   uint32_t captures_used[8]; /* capture i is used if bit (i % 32) of captures_used[i / 32] is set */
+   int prefix_length;
+   int suffix_length;
+   char prefix[NFA_INFO_MAX_LITERAL]; /* bytes that every match starts with (not NUL-terminated) */
+   char suffix[NFA_INFO_MAX_LITERAL]; /* bytes that every match ends with (not NUL-terminated) */
+   int dfa_states;        /* states in the DFA that nfa_jit_init would build, or -1 if over the budget */
+} NfaInfo;
+
+typedef struct NfaLexer {
+   NfaMachine vm;
+   int token;        /* id of the longest token matched so far, or -1 */
+   int token_length; /* length of that token (in bytes) */
+   int location;     /* input location of the start of the current token */
+   int length;       /* number of bytes stepped since the start of the current token */
+   int finished;     /* (bool) set once the current token has been decided */
+} NfaLexer;
+
+typedef struct NfaIter {
+   NfaMachine vm;
+   NfaCapture *captures; /* the captures of each match are stored here (not owned) */
+   int ncaptures;
+   int flags;            /* NfaIterFlag values */
+   const char *text;     /* the text being searched (not owned) */
+   size_t length;
+   int begin;            /* start of the last match, or -1 with NFA_ITER_COUNT_ONLY */
+   int end;              /* end of the last match */
+   int empty;            /* (bool) the last match was empty */
+   int anchored;         /* (bool) every match has to start at the start of the text */
+   int done;             /* (bool) set once there are no more matches */
+   size_t position;      /* where the search has got to */
+   int searching;        /* (bool) a search is under way (otherwise the next one starts at position) */
+} NfaIter;
+
+enum NfaIterFlag {
+   NFA_ITER_COUNT_ONLY = 1 /* only find where each match ends (no capture sets are kept) */
+};
+
+/* output for nfa_replace: a span of the input or of the template (only valid during the call);
+ * returns 0, or an error code (< 0) to stop */
+typedef int (*NfaSpanFn)(void *userdata, const char *bytes, size_t length);
+
+typedef struct NfaReplacer {
+   NfaIter iter;             /* finds the matches (iter.vm.error is the replacer's error) */
+   const char *replacement;  /* the template (not owned) */
+   NfaSpanFn fn;
+   void *userdata;
+   char *held;               /* input from held_at on, kept while a match could still start in it */
+   size_t held_at;
+   size_t held_length;
+   size_t held_size;         /* capacity of held */
+   size_t emitted;           /* the input before this location has been output (or replaced) */
+   int count;                /* replacements made so far */
+} NfaReplacer;
+
 enum NfaExecContextFlag {
    NFA_EXEC_AT_START = (1u << 0),
    NFA_EXEC_AT_END   = (1u << 1),
@@ -130,11 +249,22 @@ NFA_API const char *nfa_error_string(int error);
 /* simple NFA execution API */
 NFA_API int nfa_match(const Nfa *nfa, NfaCapture *captures, int ncaptures, const char *text, size_t length);
 
+/* line scanning: calls fn for each line (not including its '\n') that contains a match of the
+ * NFA, where '^' and '$' match at the start and end of the line; fn returns nonzero to stop.
+ * Returns the number of lines reported, or an error code. nfa_exec_scan_lines runs the scan
+ * on a machine the caller has initialised (with any allocator), which can be reused */
+typedef int (*NfaLineFn)(void *userdata, size_t offset, size_t length);
+NFA_API int nfa_scan_lines(const Nfa *nfa, const char *text, size_t length, NfaLineFn fn, void *userdata);
+NFA_API int nfa_exec_scan_lines(NfaMachine *vm, const char *text, size_t length, NfaLineFn fn, void *userdata);
+
 /* full NFA execution API */
 NFA_API int nfa_exec_init(NfaMachine *vm, const Nfa *nfa, int ncaptures);
 NFA_API int nfa_exec_init_pool(NfaMachine *vm, const Nfa *nfa, int ncaptures, void *pool, size_t pool_size);
 NFA_API int nfa_exec_init_custom(NfaMachine *vm, const Nfa *nfa, int ncaptures, NfaPageAllocFn allocf, void *userdata);
 NFA_API void nfa_exec_free(NfaMachine *vm);
+/* the pool size that nfa_exec_init_pool needs so that the machine can never run out of memory,
+ * for any input (0 if the NFA is too big for a machine) */
+NFA_API size_t nfa_exec_required_pool_size(const Nfa *nfa, int ncaptures);
 
 NFA_API int nfa_exec_start(NfaMachine *vm, int location, uint32_t context_flags);
 NFA_API int nfa_exec_step(NfaMachine *vm, char byte, int location, uint32_t context_flags);
@@ -144,11 +274,90 @@ NFA_API int nfa_exec_is_accepted(const NfaMachine *vm); /* returns 0 if the mach
 NFA_API int nfa_exec_is_rejected(const NfaMachine *vm); /* returns 1 if the machine is in an error state */
 NFA_API int nfa_exec_is_finished(const NfaMachine *vm); /* rejected || accepted */
 
+#ifdef NFA_EXEC_STATS
+NFA_API int nfa_exec_stats(const NfaMachine *vm, NfaExecStats *stats);
+#endif
+
+/* JIT API: compiles an NFA to a DFA, which gives the same result as nfa_match (without captures);
+ * the DFA is machine code on x86-64 (unless NFA_NO_JIT is defined, or the system won't allow
+ * executable pages), and a transition table otherwise; returns NFA_ERROR_NFA_TOO_LARGE if the
+ * DFA is too big */
+NFA_API int nfa_jit_init(NfaJit *jit, const Nfa *nfa);
+NFA_API void nfa_jit_free(NfaJit *jit);
+NFA_API int nfa_jit_match(const NfaJit *jit, const char *text, size_t length);
+
+/* stream API: a shared engine gives the same result as nfa_match (without captures) for input
+ * fed in pieces, with only an NfaStreamState per stream. The engine is a DFA, or for patterns
+ * whose DFA is too big, a bit-parallel NFA simulation (at most 62 byte matches, and no look
+ * assertions); returns NFA_ERROR_NFA_TOO_LARGE if neither fits */
+NFA_API int nfa_stream_init(NfaStreamEngine *engine, const Nfa *nfa);
+NFA_API void nfa_stream_free(NfaStreamEngine *engine);
+NFA_API int nfa_stream_feed(const NfaStreamEngine *engine, NfaStreamState *state, const char *bytes, size_t length); /* returns 1 once the result is decided */
+NFA_API int nfa_stream_finish(const NfaStreamEngine *engine, NfaStreamState state); /* the result at the end of the input */
+
+/* lexer API (runs an NFA built from several tokens, see nfa_build_token) */
+NFA_API int nfa_lexer_init(NfaLexer *lexer, const Nfa *nfa);
+NFA_API int nfa_lexer_init_pool(NfaLexer *lexer, const Nfa *nfa, void *pool, size_t pool_size);
+NFA_API int nfa_lexer_init_custom(NfaLexer *lexer, const Nfa *nfa, NfaPageAllocFn allocf, void *userdata);
+NFA_API void nfa_lexer_free(NfaLexer *lexer);
+
+NFA_API int nfa_lexer_start(NfaLexer *lexer, int location);
+NFA_API int nfa_lexer_feed(NfaLexer *lexer, const char *bytes, size_t length); /* returns 1 once the token is decided */
+NFA_API int nfa_lexer_finish(NfaLexer *lexer); /* signal end of input (decides the token) */
+NFA_API int nfa_lex(NfaLexer *lexer, const char *text, size_t length, int location);
+
+/* find-all API: successive leftmost non-overlapping matches, in one forward pass; an empty match
+ * can't start where the last match ended if that was empty too. Returns 1 if there's a match */
+NFA_API int nfa_iter_init(NfaIter *iter, const Nfa *nfa, NfaCapture *captures, int ncaptures, int flags);
+NFA_API int nfa_iter_init_pool(NfaIter *iter, const Nfa *nfa, NfaCapture *captures, int ncaptures, int flags, void *pool, size_t pool_size);
+NFA_API int nfa_iter_init_custom(NfaIter *iter, const Nfa *nfa, NfaCapture *captures, int ncaptures, int flags, NfaPageAllocFn allocf, void *userdata);
+/* the pool size that nfa_iter_init_pool needs so that the iterator can never run out of memory */
+NFA_API size_t nfa_iter_required_pool_size(const Nfa *nfa, int ncaptures, int flags);
+NFA_API void nfa_iter_free(NfaIter *iter);
+NFA_API int nfa_find_first(NfaIter *iter, const char *text, size_t length);
+NFA_API int nfa_find_next(NfaIter *iter);
+NFA_API int nfa_count_matches(const Nfa *nfa, const char *text, size_t length); /* returns the count, or an error */
+
+/* substitution API: replaces each match (as found by nfa_find_*) with the template, in which
+ * $0 is the match, $1 to $9 or ${n} are captures and $$ is a '$'. The output is passed to fn as
+ * spans of the input and the template, so unchanged input isn't copied. Returns the number of
+ * replacements, or an error */
+NFA_API int nfa_replace(const Nfa *nfa, const char *text, size_t length, const char *replacement, NfaSpanFn fn, void *userdata);
+/* the same, fed in chunks: input that a match could still start in is kept (copied) until
+ * the match is decided, and the rest of the output is written by nfa_replacer_finish */
+NFA_API int nfa_replacer_init(NfaReplacer *replacer, const Nfa *nfa, const char *replacement, NfaSpanFn fn, void *userdata);
+NFA_API void nfa_replacer_free(NfaReplacer *replacer);
+NFA_API int nfa_replacer_feed(NfaReplacer *replacer, const char *bytes, size_t length);
+NFA_API int nfa_replacer_finish(NfaReplacer *replacer); /* returns the number of replacements, or an error */
+
 #ifndef NFA_NO_STDIO
 NFA_API void nfa_print_machine(const Nfa *nfa, FILE *to);
+/* write a C function 'int name(const char *text, size_t length)' which gives the same result as
+ * nfa_match (without captures), using a DFA; returns NFA_ERROR_NFA_TOO_LARGE if the DFA is too big */
+NFA_API int nfa_emit_c(const Nfa *nfa, const char *name, FILE *to);
 #endif
 NFA_API size_t nfa_size(const Nfa *nfa);
 
+/* static analysis of an NFA, assuming the context flags used by nfa_match (a token counts as a
+ * match, and the literals and one_pass are left empty/unknown for NFAs too big to expand into a
+ * DFA); the DFA is only built if max_dfa_states > 0, and is given up on beyond that many states */
+NFA_API int nfa_analyze(const Nfa *nfa, NfaInfo *info, int max_dfa_states);
+
+/* check that a stored NFA (e.g., read from a file or mapped into memory) is well formed and
+ * was written by this version of libnfa; only a validated blob may be used as an Nfa */
+NFA_API int nfa_validate(const void *blob, size_t size);
+
+/* bundles: many NFAs, with names, in one blob (which can be stored in a file and mapped into memory) */
+NFA_API size_t nfa_bundle_size(const Nfa * const *nfas, const char * const *names, int count); /* names may be NULL */
+NFA_API int nfa_bundle_write(void *buffer, size_t size, const Nfa * const *nfas, const char * const *names, int count);
+NFA_API int nfa_bundle_open(NfaBundle *bundle, const void *blob, size_t size); /* validates the bundle and every NFA in it */
+NFA_API const Nfa *nfa_bundle_get(const NfaBundle *bundle, int index);
+NFA_API const char *nfa_bundle_name(const NfaBundle *bundle, int index);
+NFA_API int nfa_bundle_find(const NfaBundle *bundle, const char *name); /* returns the index, or -1 */
+
+/* simplify the NFA's control flow in place; nops_before and nops_after are optional outputs */
+NFA_API int nfa_optimize(Nfa *nfa, int *nops_before, int *nops_after);
+
 /* initialise a builder */
 NFA_API int nfa_builder_init(NfaBuilder *builder);
 NFA_API int nfa_builder_init_pool(NfaBuilder *builder, void *pool, size_t pool_size);
@@ -166,38 +375,61 @@ NFA_API int nfa_builder_output_to_buffer(NfaBuilder *builder, Nfa *nfa, size_t s
 /* matchers (push a matcher onto the stack) */
 NFA_API int nfa_build_match_empty(NfaBuilder *builder);
 NFA_API int nfa_build_match_string(NfaBuilder *builder, const char *bytes, size_t length, int flags);
+NFA_API int nfa_build_literal_set(NfaBuilder *builder, const char * const *strings, const size_t *lengths, int count, int flags); /* any of the strings (lengths may be NULL) */
 NFA_API int nfa_build_match_byte(NfaBuilder *builder, char c, int flags);
 NFA_API int nfa_build_match_byte_range(NfaBuilder *builder, char first, char last, int flags);
 NFA_API int nfa_build_match_any(NfaBuilder *builder);
 
+/* code point matchers (match the UTF-8 encoding of one code point) */
+NFA_API int nfa_build_match_codepoints(NfaBuilder *builder, const uint32_t *ranges, int nranges, int flags); /* any code point in [ranges[2*i], ranges[2*i+1]] */
+NFA_API int nfa_build_match_category(NfaBuilder *builder, const char *name, int flags); /* any code point in a general category, e.g., "L" or "Nd" */
+
 /* operators */
 NFA_API int nfa_build_join(NfaBuilder *builder); /* pop two expressions, push their concatenation */
 NFA_API int nfa_build_alt(NfaBuilder *builder);  /* pop two expressions, push their alternation */
+NFA_API int nfa_build_join_n(NfaBuilder *builder, int n); /* pop n expressions, push their concatenation */
+NFA_API int nfa_build_alt_n(NfaBuilder *builder, int n);  /* pop n expressions, push their alternation (one fork) */
 NFA_API int nfa_build_zero_or_one(NfaBuilder *builder, int flags);  /* pop expression 'e', push 'e?' */
 NFA_API int nfa_build_zero_or_more(NfaBuilder *builder, int flags); /* pop expression 'e', push 'e*' */
 NFA_API int nfa_build_one_or_more(NfaBuilder *builder, int flags);  /* pop expression 'e', push 'e+' */
+/* pop expression 'e', push 'e{min,max}' (max < 0 for no limit); a single character repeated
+ * more than a few times is encoded compactly, but executing it still takes memory for each count */
+NFA_API int nfa_build_repeat(NfaBuilder *builder, int min, int max, int flags);
 
 NFA_API int nfa_build_complement_char(NfaBuilder *builder); /* pop char-matcher 'e', push [^e] */
 
 /* sub-match capture */
 NFA_API int nfa_build_capture(NfaBuilder *builder, int id); /* pop expression 'e', push capture '(e)' */
 
+/* tokens (for use with NfaLexer) */
+NFA_API int nfa_build_token(NfaBuilder *builder, int id); /* pop expression 'e', push 'e' tagged as token 'id' */
+
 /* assertions (matchers which do not consume input) */
 NFA_API int nfa_build_assert_at_start(NfaBuilder *builder); /* push a '^' assertion */
 NFA_API int nfa_build_assert_at_end(NfaBuilder *builder); /* push a '$' assertion */
 NFA_API int nfa_build_assert_context(NfaBuilder *builder, uint32_t flag);
 
+/* assertions about the bytes either side of the position (word bytes are ASCII letters, digits and '_') */
+NFA_API int nfa_build_assert_word_boundary(NfaBuilder *builder); /* push a '\b' assertion */
+NFA_API int nfa_build_assert_not_word_boundary(NfaBuilder *builder); /* push a '\B' assertion */
+NFA_API int nfa_build_assert_line_start(NfaBuilder *builder); /* at the start, or after a '\n' */
+NFA_API int nfa_build_assert_line_end(NfaBuilder *builder); /* at the end, or before a '\n' */
+
 /* simple regex API */
 
 /* regex syntax:
  *          normal:  any non-special char
  *             any:  '.'
  *           group:  '(' e ')'
- *          anchor:  '^' | '$'
- *      repetition:  e ( '?' | '*' | '+' )
+ *          anchor:  '^' | '$' | '\b' | '\B'   (with NFA_REGEX_MULTILINE, '^' and '$' are line anchors)
+ *      repetition:  e ( '?' | '*' | '+' | '{' n '}' | '{' n ',' '}' | '{' n ',' n '}' ) '?'?
  *   concatenation:  e e
  *     alternation:  e '|' e
  *      char class:  '[' '^'? ( character ( '-' character )? )+ ']'
+ *
+ * with NFA_REGEX_UTF8, a character is a code point (encoded as UTF-8), and also:
+ *      code point:  '\x{' hex digits '}'
+ *        category:  '\p{' name '}' | '\p' letter   (and '\P' for the complement)
  */
 NFA_API int nfa_build_regex(NfaBuilder *builder, const char *pattern, size_t length, int flags);
 
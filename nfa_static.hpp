@@ -0,0 +1,563 @@
+/* libnfa compile-time regex compilation (C++17).  Copyright (C) 2014 John Bartholomew.
+ * For licensing terms, see the header file nfa.h
+ *
+ * This header compiles a regex string literal into an NFA program at compile time,
+ * and provides a matcher specialised on that program:
+ *
+ *    static constexpr auto WORD = nfa_static::compile(NFA_STATIC_PATTERN("^[a-z]+(-[a-z]+)*$"));
+ *    bool ok = nfa_static::match<WORD>(text, length);
+ *
+ * The program has the same layout as a (narrow format) Nfa, so WORD.nfa() can also be
+ * passed to the C API (e.g., nfa_match, for captures). The regex syntax is the same as
+ * nfa_build_regex; groups are compiled without captures. A syntax error is a compile
+ * error (a call to nfa_static::detail::regex_error, which names the problem).
+ *
+ * The matcher only answers whether the text matches (with the same semantics as
+ * nfa_match). Its transition tables are built at compile time, so for a fixed pattern the
+ * compiler can unroll and inline the whole state update.
+ */
+#ifndef NFA_STATIC_HPP
+#define NFA_STATIC_HPP
+
+#include "nfa.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#if !(__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#  error "nfa_static.hpp requires C++17"
+#endif
+
+#ifndef NFA_STATIC_MAX_OPS
+/* largest program that can be compiled (jump offsets are 16-bit, so at most 32766) */
+#  define NFA_STATIC_MAX_OPS  2048
+#endif
+
+namespace nfa_static {
+
+static_assert(NFA_STATIC_MAX_OPS > 0 && NFA_STATIC_MAX_OPS <= 32766, "NFA_STATIC_MAX_OPS out of range");
+
+namespace detail {
+
+/* these must match the definitions in nfa.c */
+enum : std::uint16_t {
+   OPCODE_MASK       = (255u << 8),
+   OP_MATCH_ANY      = (  1u << 8),
+   OP_MATCH_BYTE     = (  2u << 8),
+   OP_MATCH_CLASS    = (  4u << 8),
+   OP_ASSERT_CONTEXT = (  5u << 8),
+   OP_ASSERT_LOOK    = (  6u << 8),
+   OP_JUMP           = (  9u << 8),
+   OP_ACCEPT         = ( 10u << 8)
+};
+constexpr std::uint32_t MAGIC = 0x1A41464Eu;
+constexpr std::uint16_t VERSION = 4;
+constexpr std::uint16_t FORMAT_NARROW = 1;
+
+/* not constexpr: reaching this while compiling a pattern makes the compilation fail */
+inline void regex_error(const char *message) { (void)message; }
+
+struct Buffer {
+   std::uint16_t ops[NFA_STATIC_MAX_OPS] = {};
+   int n = 0;
+
+   constexpr void push(unsigned word) {
+      if (n >= NFA_STATIC_MAX_OPS) { regex_error("pattern too large (increase NFA_STATIC_MAX_OPS)"); return; }
+      ops[n++] = static_cast<std::uint16_t>(word);
+   }
+
+   /* make room for 'count' ops at 'at' */
+   constexpr void insert(int at, int count) {
+      if (n + count > NFA_STATIC_MAX_OPS) { regex_error("pattern too large (increase NFA_STATIC_MAX_OPS)"); return; }
+      for (int i = n - 1; i >= at; --i) { ops[i + count] = ops[i]; }
+      n += count;
+   }
+
+   constexpr void remove(int at, int count) {
+      for (int i = at; i + count < n; ++i) { ops[i] = ops[i + count]; }
+      n -= count;
+   }
+
+   /* jump offsets are stored as 16-bit two's complement */
+   constexpr void set_offset(int at, int offset) {
+      ops[at] = static_cast<std::uint16_t>(offset < 0 ? 65536 + offset : offset);
+   }
+};
+
+constexpr char escaped_char(char c) {
+   switch (c) {
+      case 'r': return '\r';
+      case 'n': return '\n';
+      case '0': return '\0';
+      case 't': return '\t';
+      case 'b': return '\b';
+      case 'v': return '\v';
+      default: return c;
+   }
+}
+
+/* recursive descent over the same syntax as nfa_build_regex; the code layout matches
+ * the builder's (forks before loop bodies, jumps relative to the end of the jump op) */
+class Compiler {
+public:
+   Buffer buf;
+
+   constexpr explicit Compiler(std::string_view pattern): pat(pattern), at(0), depth(0) {
+      alternation();
+      if (at < pat.size()) { regex_error("unexpected ')'"); }
+      buf.push(OP_ACCEPT);
+   }
+
+private:
+   std::string_view pat;
+   std::size_t at;
+   int depth;
+
+   constexpr bool more() const { return at < pat.size(); }
+   constexpr char peek() const { return pat[at]; }
+
+   constexpr char next_escaped() {
+      if (!more()) { regex_error("trailing slash (unfinished escape code)"); return 0; }
+      return escaped_char(pat[at++]);
+   }
+
+   constexpr void alternation() {
+      const int start = buf.n;
+      int branches[256] = {}; /* start of each alternative (relative to 'start') */
+      int jumps[256] = {};    /* jump to the end after each alternative but the last */
+      int k = 0;
+      for (;;) {
+         if (k > 255) { regex_error("too many alternatives in one group (at most 255)"); return; }
+         branches[k] = buf.n - start;
+         sequence();
+         ++k;
+         if (!more() || peek() != '|') { break; }
+         ++at;
+         jumps[k - 1] = buf.n - start;
+         buf.push(OP_JUMP | 1u);
+         buf.push(0);
+      }
+      if (k == 1) { return; }
+
+      const int end = buf.n - start;
+      for (int i = 0; i + 1 < k; ++i) { buf.set_offset(start + jumps[i] + 1, end - (jumps[i] + 2)); }
+      buf.insert(start, 1 + k);
+      buf.ops[start] = static_cast<std::uint16_t>(OP_JUMP | static_cast<unsigned>(k));
+      for (int i = 0; i < k; ++i) { buf.set_offset(start + 1 + i, branches[i]); }
+   }
+
+   constexpr void sequence() {
+      while (more() && peek() != '|' && peek() != ')') { term(); }
+   }
+
+   constexpr void term() {
+      const int start = buf.n;
+      const char c = pat[at++];
+      switch (c) {
+         case '(':
+            if (++depth >= NFA_BUILDER_MAX_STACK - 1) { regex_error("groups nested too deep"); return; }
+            alternation();
+            if (!more()) { regex_error("unclosed group"); return; }
+            ++at; /* ')' */
+            --depth;
+            break;
+         case '[': char_class(); break;
+         case '.': buf.push(OP_MATCH_ANY); break;
+         case '^': buf.push(OP_ASSERT_CONTEXT | 0u); break; /* NFA_EXEC_AT_START */
+         case '$': buf.push(OP_ASSERT_CONTEXT | 1u); break; /* NFA_EXEC_AT_END */
+         case '\\':
+            if (more() && (peek() == 'b' || peek() == 'B')) {
+               buf.push(OP_ASSERT_LOOK | (pat[at++] == 'b' ? 0u : 1u)); /* word boundary, or not */
+            } else {
+               buf.push(OP_MATCH_BYTE | static_cast<std::uint8_t>(next_escaped()));
+            }
+            break;
+         case '?': case '*': case '+': case '{':
+            regex_error("repetition of empty expression");
+            return;
+         default: buf.push(OP_MATCH_BYTE | static_cast<std::uint8_t>(c)); break;
+      }
+      while (more() && (peek() == '?' || peek() == '*' || peek() == '+' || peek() == '{')) {
+         repetition(start);
+      }
+   }
+
+   constexpr void char_class() {
+      bool set[256] = {};
+      bool negate = false, any = false;
+      if (more() && peek() == '^') { ++at; negate = true; }
+      for (;;) {
+         if (!more()) { regex_error("unclosed character class"); return; }
+         char c = pat[at++];
+         if (c == ']') {
+            if (!any) { regex_error("empty character class"); return; }
+            break;
+         }
+         const std::uint8_t first = static_cast<std::uint8_t>(c == '\\' ? next_escaped() : c);
+         std::uint8_t last = first;
+         if (more() && peek() == '-') {
+            ++at;
+            if (!more()) { regex_error("unclosed character class"); return; }
+            c = pat[at++];
+            last = static_cast<std::uint8_t>(c == '\\' ? next_escaped() : c);
+            if (first > last) { regex_error("character range is backwards (first character must be <= last character)"); return; }
+         }
+         for (int b = first; b <= last; ++b) { set[b] = true; }
+         any = true;
+      }
+
+      int nranges = 0, count = 0, single = 0;
+      for (int b = 0; b < 256; ++b) {
+         if (negate) { set[b] = !set[b]; }
+         if (set[b]) {
+            if (b == 0 || !set[b - 1]) { ++nranges; }
+            ++count;
+            single = b;
+         }
+      }
+      if (count == 0) { regex_error("empty character class"); return; }
+      if (count == 256) { buf.push(OP_MATCH_ANY); return; }
+      if (count == 1) { buf.push(OP_MATCH_BYTE | static_cast<unsigned>(single)); return; }
+      buf.push(OP_MATCH_CLASS | static_cast<unsigned>(nranges));
+      for (int b = 0; b < 256; ++b) {
+         if (set[b] && (b == 0 || !set[b - 1])) {
+            int e = b;
+            while (e < 255 && set[e + 1]) { ++e; }
+            buf.push(static_cast<unsigned>(b << 8 | e));
+         }
+      }
+   }
+
+   constexpr int count() {
+      int n = -1;
+      while (more() && peek() >= '0' && peek() <= '9') {
+         n = (n < 0 ? 0 : n*10) + (pat[at++] - '0');
+         if (n > NFA_STATIC_MAX_OPS) { n = NFA_STATIC_MAX_OPS + 1; } /* too large either way */
+      }
+      return n;
+   }
+
+   /* wrap the ops from 'start' to the end of the buffer */
+   constexpr void optional(int start, bool lazy) {
+      const int len = buf.n - start;
+      buf.insert(start, 3);
+      buf.ops[start] = OP_JUMP | 2u;
+      buf.set_offset(start + 1 + lazy, 0);
+      buf.set_offset(start + 2 - lazy, len);
+   }
+
+   constexpr void star(int start, bool lazy) {
+      const int len = buf.n - start;
+      buf.insert(start, 3);
+      buf.ops[start] = OP_JUMP | 2u;
+      buf.set_offset(start + 1 + lazy, 0);
+      buf.set_offset(start + 2 - lazy, len + 2);
+      buf.push(OP_JUMP | 1u);
+      buf.push(0);
+      buf.set_offset(buf.n - 1, -(len + 5));
+   }
+
+   constexpr void plus(int start, bool lazy) {
+      const int len = buf.n - start;
+      buf.push(OP_JUMP | 2u);
+      buf.push(0);
+      buf.push(0);
+      buf.set_offset(buf.n - 2 + lazy, -(len + 3));
+   }
+
+   constexpr void copy(int from, int len) {
+      for (int i = 0; i < len; ++i) { buf.push(buf.ops[from + i]); }
+   }
+
+   constexpr void repetition(int start) {
+      const int len = buf.n - start;
+      const char c = pat[at++];
+      int min = 0, max = 0;
+      if (c == '{') {
+         min = max = count();
+         if (min >= 0 && more() && peek() == ',') { ++at; max = count(); }
+         if (min < 0 || !more() || peek() != '}' || (max >= 0 && max < min)) {
+            regex_error("invalid repetition count (must be {n}, {n,} or {n,m} with n <= m)");
+            return;
+         }
+         ++at;
+      }
+      bool lazy = false;
+      if (more() && peek() == '?') { ++at; lazy = true; }
+      if (len == 0) { return; } /* repeating nothing is nothing */
+
+      switch (c) {
+         case '?': optional(start, lazy); return;
+         case '*': star(start, lazy); return;
+         case '+': plus(start, lazy); return;
+         default: break;
+      }
+
+      /* e{m,n} is m copies of e, then n-m copies of e?; e{m,} ends with e* instead
+       * (the copies are taken from the original, which is removed if m is 0) */
+      const int end = buf.n;
+      for (int i = 1; i < min; ++i) { copy(start, len); }
+      if (max < 0) {
+         const int s = buf.n;
+         copy(start, len);
+         star(s, lazy);
+      } else {
+         for (int i = min; i < max; ++i) {
+            const int s = buf.n;
+            copy(start, len);
+            optional(s, lazy);
+         }
+      }
+      if (min == 0) { buf.remove(start, end - start); }
+   }
+};
+
+constexpr std::uint32_t hash_word(std::uint32_t h, std::uint32_t word) {
+   for (int j = 0; j < 32; j += 8) {
+      h = (h ^ ((word >> j) & 0xFFu)) * 16777619u;
+   }
+   return h;
+}
+
+/* (the prefilter is left empty: no minimum or maximum length, no required bytes, and not anchored) */
+constexpr std::uint32_t checksum(const std::uint16_t *ops, int n) {
+   std::uint32_t h = 2166136261u;
+   for (int i = 0; i < n; ++i) { h = hash_word(h, ops[i]); }
+   h = hash_word(h, 0u);
+   h = hash_word(h, 0xFFFFFFFFu);
+   h = hash_word(h, 0u);
+   h = hash_word(h, 0u);
+   return hash_word(h, 0u);
+}
+
+} /* namespace detail */
+
+/* same layout as a narrow-format struct Nfa */
+template <std::size_t N>
+struct Program {
+   std::uint32_t magic;
+   std::uint16_t version;
+   std::uint16_t format;
+   std::int32_t nops;
+   std::uint32_t checksum;
+   std::uint32_t min_length;
+   std::uint32_t max_length;
+   std::uint8_t nrequired;
+   std::uint8_t required[3];
+   std::uint32_t folded;
+   std::uint32_t anchored;
+   std::uint16_t ops[N];
+
+   const Nfa *nfa() const { return reinterpret_cast<const Nfa*>(this); }
+   static constexpr std::size_t size() { return sizeof(Program); }
+};
+
+/* wrap a string literal so that it can be passed to compile() */
+#define NFA_STATIC_PATTERN(str) ([]() constexpr { return std::string_view(str); })
+
+template <class PatternFn>
+constexpr auto compile(PatternFn pattern) {
+   constexpr detail::Compiler c(pattern());
+   Program<static_cast<std::size_t>(c.buf.n)> prog{};
+   prog.magic = detail::MAGIC;
+   prog.version = detail::VERSION;
+   prog.format = detail::FORMAT_NARROW;
+   prog.nops = c.buf.n;
+   prog.min_length = 0;
+   prog.max_length = 0xFFFFFFFFu;
+   for (int i = 0; i < c.buf.n; ++i) { prog.ops[i] = c.buf.ops[i]; }
+   prog.checksum = detail::checksum(prog.ops, c.buf.n);
+   return prog;
+}
+
+namespace detail {
+
+/* a set of states, one bit per op */
+template <int W>
+struct StateSet {
+   std::uint64_t bits[W] = {};
+   constexpr void add(int i) { bits[i / 64] |= (std::uint64_t(1) << (i % 64)); }
+   constexpr bool has(int i) const { return (bits[i / 64] >> (i % 64)) & 1u; }
+};
+
+inline int lowest_bit(std::uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+   return __builtin_ctzll(x);
+#else
+   int i = 0;
+   while (!(x & 1u)) { x >>= 1; ++i; }
+   return i;
+#endif
+}
+
+/* byte classes for word-boundary assertions (the end of the input is a class of its own) */
+enum : int { CLASS_WORD = 0, CLASS_LINE = 1, CLASS_OTHER = 2, CLASS_END = 3 };
+
+constexpr int byte_class(int byte) {
+   if ((byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') || (byte >= '0' && byte <= '9') || byte == '_') {
+      return CLASS_WORD;
+   }
+   return (byte == '\n' ? CLASS_LINE : CLASS_OTHER);
+}
+
+constexpr int op_length(unsigned op) {
+   if ((op & OPCODE_MASK) == OP_MATCH_CLASS || (op & OPCODE_MASK) == OP_JUMP) { return 1 + int(op & 255u); }
+   return 1;
+}
+
+template <const auto &P>
+constexpr bool has_look() {
+   for (int pc = 0; pc < P.nops; pc += op_length(P.ops[pc])) {
+      if ((P.ops[pc] & OPCODE_MASK) == OP_ASSERT_LOOK) { return true; }
+   }
+   return false;
+}
+
+template <const auto &P>
+struct Tables {
+   static constexpr int N = P.nops;
+   static constexpr int W = (N + 63) / 64;
+   using Set = StateSet<W>;
+
+   /* with look assertions, the tables are indexed by the class of the byte consumed (behind)
+    * and the class of the byte after it (ahead); otherwise only by whether the input ends */
+   static constexpr bool LOOK = has_look<P>();
+   static constexpr int NBEHIND = (LOOK ? 3 : 1);
+   static constexpr int NAHEAD = (LOOK ? 4 : 2);
+
+   Set start[NAHEAD];           /* states at the start of the input (index: ahead) */
+   Set follow[NBEHIND][NAHEAD][N]; /* states after consuming the op at pc (index: behind, ahead) */
+   Set accepts[256];            /* consuming ops which accept each byte */
+
+   static constexpr int behind_index(int byte) { return (LOOK ? byte_class(byte) : 0); }
+   static constexpr int ahead_index(const char *text, std::size_t i, std::size_t length) {
+      if (i == length) { return (LOOK ? CLASS_END : 1); }
+      return (LOOK ? byte_class(static_cast<std::uint8_t>(text[i])) : 0);
+   }
+
+   static constexpr int length(int pc) { return op_length(P.ops[pc]); }
+
+   /* (as nfai_look_passes, with classes for the bytes either side) */
+   static constexpr bool look_passes(unsigned kind, int behind, int ahead) {
+      switch (kind) {
+         case 0: return ((behind == CLASS_WORD) != (ahead == CLASS_WORD)); /* word boundary */
+         case 1: return ((behind == CLASS_WORD) == (ahead == CLASS_WORD)); /* not word boundary */
+         case 2: return (behind == CLASS_LINE); /* line start */
+         default: return (ahead == CLASS_LINE || ahead == CLASS_END); /* line end */
+      }
+   }
+
+   /* consuming (and accept) states reachable from pc without consuming input */
+   static constexpr Set closure(int pc, unsigned flags, int behind, int ahead) {
+      Set out{}, seen{};
+      int stack[N + 1] = {};
+      int top = 0;
+      stack[top++] = pc;
+      while (top) {
+         pc = stack[--top];
+         if (seen.has(pc)) { continue; }
+         seen.add(pc);
+         const unsigned op = P.ops[pc];
+         switch (op & OPCODE_MASK) {
+            case OP_JUMP:
+               for (int i = int(op & 255u); i >= 1; --i) {
+                  const int offset = static_cast<std::int16_t>(P.ops[pc + i]);
+                  stack[top++] = pc + 1 + int(op & 255u) + offset;
+               }
+               break;
+            case OP_ASSERT_CONTEXT:
+               if (flags & (1u << (op & 255u))) { stack[top++] = pc + 1; }
+               break;
+            case OP_ASSERT_LOOK:
+               if (look_passes(op & 255u, behind, ahead)) { stack[top++] = pc + 1; }
+               break;
+            default:
+               out.add(pc);
+               break;
+         }
+      }
+      return out;
+   }
+
+   static constexpr bool matches(int pc, int byte) {
+      const unsigned op = P.ops[pc];
+      switch (op & OPCODE_MASK) {
+         case OP_MATCH_ANY: return true;
+         case OP_MATCH_BYTE: return int(op & 255u) == byte;
+         case OP_MATCH_CLASS:
+            for (int i = 1; i <= int(op & 255u); ++i) {
+               if (byte >= int(P.ops[pc + i] >> 8) && byte <= int(P.ops[pc + i] & 255u)) { return true; }
+            }
+            return false;
+         default: return false;
+      }
+   }
+
+   /* the class an index stands for (without look assertions, only the end matters) */
+   static constexpr int ahead_class(int a) { return (LOOK ? a : (a ? CLASS_END : CLASS_OTHER)); }
+
+   constexpr Tables(): start(), follow(), accepts() {
+      for (int a = 0; a < NAHEAD; ++a) {
+         const unsigned end = (ahead_class(a) == CLASS_END ? unsigned(NFA_EXEC_AT_END) : 0u);
+         start[a] = closure(0, NFA_EXEC_AT_START | end, CLASS_LINE, ahead_class(a));
+      }
+      for (int pc = 0; pc < N; pc += length(pc)) {
+         const unsigned op = P.ops[pc] & OPCODE_MASK;
+         if (op != OP_MATCH_ANY && op != OP_MATCH_BYTE && op != OP_MATCH_CLASS) { continue; }
+         for (int b = 0; b < NBEHIND; ++b) {
+            for (int a = 0; a < NAHEAD; ++a) {
+               const unsigned end = (ahead_class(a) == CLASS_END ? unsigned(NFA_EXEC_AT_END) : 0u);
+               follow[b][a][pc] = closure(pc + length(pc), end, (LOOK ? b : CLASS_OTHER), ahead_class(a));
+            }
+         }
+         for (int b = 0; b < 256; ++b) {
+            if (matches(pc, b)) { accepts[b].add(pc); }
+         }
+      }
+   }
+};
+
+template <const auto &P>
+inline constexpr Tables<P> TABLES{};
+
+} /* namespace detail */
+
+/* same result as nfa_match(P.nfa(), NULL, 0, text, length) */
+template <const auto &P>
+bool match(const char *text, std::size_t length) {
+   using T = detail::Tables<P>;
+   constexpr int W = T::W;
+   constexpr int ACCEPT = T::N - 1;
+   const T &tables = detail::TABLES<P>;
+   typename T::Set current = tables.start[T::ahead_index(text, 0, length)];
+
+   for (std::size_t i = 0;; ++i) {
+      if (current.has(ACCEPT)) { return true; }
+      if (i == length) { return false; }
+
+      const typename T::Set &accepts = tables.accepts[static_cast<std::uint8_t>(text[i])];
+      const auto &follow = tables.follow[T::behind_index(static_cast<std::uint8_t>(text[i]))][T::ahead_index(text, i + 1, length)];
+      typename T::Set next{};
+      std::uint64_t live = 0;
+      for (int w = 0; w < W; ++w) {
+         std::uint64_t bits = current.bits[w] & accepts.bits[w];
+         while (bits) {
+            const auto &to = follow[w*64 + detail::lowest_bit(bits)];
+            for (int v = 0; v < W; ++v) { next.bits[v] |= to.bits[v]; }
+            bits &= bits - 1;
+         }
+      }
+      for (int w = 0; w < W; ++w) { live |= next.bits[w]; }
+      if (!live) { return false; }
+      current = next;
+   }
+}
+
+template <const auto &P>
+bool match(std::string_view text) { return match<P>(text.data(), text.size()); }
+
+} /* namespace nfa_static */
+
+#endif /* NFA_STATIC_HPP */
+/* vim: set ts=8 sts=3 sw=3 et: */
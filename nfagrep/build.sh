@@ -0,0 +1,10 @@
+#!/bin/sh
+
+# builds nfagrep (from the top-level directory); e.g.:
+#   nfagrep/build.sh && /tmp/nfagrep -t 'timeout|refused' /var/log/*.log > /dev/null
+
+BUILDDIR="${BUILDDIR:-/tmp}"
+
+set -e
+gcc -std=c89 -pedantic -Wall -Wextra -Wno-unused-function -O2 -DNDEBUG -D_POSIX_C_SOURCE=200809L -pthread -I. \
+   -o "$BUILDDIR"/nfagrep nfagrep/nfagrep.c
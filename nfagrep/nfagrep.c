@@ -0,0 +1,466 @@
+/* Copyright (C) 2014 John Bartholomew. For licensing terms, see the header file nfa.h */
+
+/* nfagrep: print the lines of files that contain a match for a pattern, like grep, using
+ * libnfa. Files are memory mapped (or read in large chunks when they can't be, e.g., pipes),
+ * and split into chunks at line boundaries; a pool of worker threads matches the chunks,
+ * and the main thread prints their output in order. Lines are matched by the JIT (with the
+ * pattern prefixed by '.*'), or by nfa_exec_scan_lines if the pattern's DFA is too big.
+ * Needs POSIX (mmap and threads). See build.sh. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NFA_API static
+#include "nfa.c"
+
+enum {
+   CHUNK_SIZE = 4 << 20,   /* bytes per work item (a chunk is extended to the end of its last line) */
+   MAX_THREADS = 64
+};
+
+/* ----- OPTIONS AND PATTERN ----- */
+
+struct Options {
+   int count_only;     /* (bool) -c: print the number of matching lines for each file */
+   int ignore_case;    /* (bool) -i */
+   int with_filename;  /* (bool) prefix lines with the file name (when there's more than one file) */
+   int report;         /* (bool) -t: write throughput to stderr */
+   int nthreads;       /* -j N */
+};
+
+struct Matcher {
+   Nfa *nfa;     /* the pattern (for nfa_exec_scan_lines) */
+   Nfa *search;  /* '.*' then the pattern (for the JIT, which matches at the start of the line) */
+   NfaJit jit;
+   int use_jit;  /* (bool) */
+};
+
+static Nfa *build_pattern(const char *pattern, int flags, int search) {
+   NfaBuilder builder;
+   Nfa *nfa;
+   nfa_builder_init(&builder);
+   builder.flags = NFA_BUILDER_OPTIMIZE;
+   if (search) {
+      nfa_build_match_any(&builder);
+      nfa_build_zero_or_more(&builder, 0);
+   }
+   nfa_build_regex(&builder, pattern, -1, flags | NFA_REGEX_NO_CAPTURES);
+   if (search) { nfa_build_join(&builder); }
+   nfa = nfa_builder_output(&builder);
+   if (!nfa) { fprintf(stderr, "nfagrep: bad pattern: %s\n", nfa_error_string(builder.error)); }
+   nfa_builder_free(&builder);
+   return nfa;
+}
+
+static int init_matcher(struct Matcher *m, const char *pattern, const struct Options *opts) {
+   const int flags = (opts->ignore_case ? NFA_REGEX_CASE_INSENSITIVE : 0);
+   memset(m, 0, sizeof(*m));
+   m->nfa = build_pattern(pattern, flags, 0);
+   if (!m->nfa) { return 0; }
+   m->search = build_pattern(pattern, flags, 1);
+   if (m->search && nfa_jit_init(&m->jit, m->search) == NFA_NO_ERROR) { m->use_jit = 1; }
+   return 1;
+}
+
+static void free_matcher(struct Matcher *m) {
+   if (m->use_jit) { nfa_jit_free(&m->jit); }
+   free(m->search);
+   free(m->nfa);
+}
+
+/* ----- OUTPUT BUFFERS ----- */
+
+struct Output {
+   char *text;
+   size_t size;
+   size_t capacity;
+   int failed; /* (bool) out of memory */
+};
+
+static void output_append(struct Output *out, const char *bytes, size_t length) {
+   if (out->failed) { return; }
+   if (out->size + length > out->capacity) {
+      size_t capacity = (out->capacity ? out->capacity : 4096);
+      char *text;
+      while (capacity < out->size + length) { capacity *= 2; }
+      text = (char*)realloc(out->text, capacity);
+      if (!text) { out->failed = 1; return; }
+      out->text = text;
+      out->capacity = capacity;
+   }
+   memcpy(out->text + out->size, bytes, length);
+   out->size += length;
+}
+
+/* ----- WORK ITEMS ----- */
+
+/* Items are processed in any order but printed in the order they were queued. The last
+ * item of each file is an empty marker, which prints the count (for -c) and releases the
+ * file's memory. */
+struct Item {
+   const char *name;   /* file name */
+   const char *text;   /* lines to match (ending at a line boundary, or at the end of the file) */
+   size_t length;
+   char *owned;        /* buffer to free once printed (for streamed input) */
+   void *map;          /* (file end marker) mapping to unmap */
+   size_t map_size;
+   int file_end;       /* (bool) */
+   int done;           /* (bool) set by the worker */
+   long matches;       /* matching lines */
+   struct Output out;
+};
+
+struct Queue {
+   pthread_mutex_t lock;
+   pthread_cond_t changed;
+   struct Item *items;  /* a ring of 'window' items */
+   int window;
+   long queued;         /* items queued so far (the next item's sequence number) */
+   long taken;          /* items taken by workers */
+   long printed;        /* items printed (and released) by the main thread */
+   int closed;          /* (bool) no more items will be queued */
+   const struct Options *opts;
+   const struct Matcher *matcher;
+};
+
+struct LineContext {
+   struct Item *item;
+   const struct Options *opts;
+};
+
+static void emit_line(struct Item *item, const struct Options *opts, const char *line, size_t length) {
+   ++item->matches;
+   if (opts->count_only) { return; }
+   if (opts->with_filename) {
+      output_append(&item->out, item->name, strlen(item->name));
+      output_append(&item->out, ":", 1);
+   }
+   output_append(&item->out, line, length);
+   output_append(&item->out, "\n", 1);
+}
+
+static int scan_callback(void *userdata, size_t offset, size_t length) {
+   struct LineContext *ctx = (struct LineContext*)userdata;
+   emit_line(ctx->item, ctx->opts, ctx->item->text + offset, length);
+   return 0;
+}
+
+/* (vm is the worker's machine for the pattern, which isn't used with the JIT) */
+static void process_item(struct Item *item, const struct Matcher *matcher, const struct Options *opts, NfaMachine *vm) {
+   const char *at = item->text, *end = item->text + item->length, *newline;
+   size_t length;
+   if (matcher->use_jit) {
+      while (at < end) {
+         newline = (const char*)memchr(at, '\n', (size_t)(end - at));
+         length = (newline ? (size_t)(newline - at) : (size_t)(end - at));
+         if (nfa_jit_match(&matcher->jit, at, length) == NFA_RESULT_MATCH) { emit_line(item, opts, at, length); }
+         at += length + 1;
+      }
+   } else if (item->length) {
+      struct LineContext ctx;
+      ctx.item = item;
+      ctx.opts = opts;
+      if (nfa_exec_scan_lines(vm, item->text, item->length, &scan_callback, &ctx) < 0) { item->out.failed = 1; }
+   }
+}
+
+static void *worker(void *userdata) {
+   struct Queue *q = (struct Queue*)userdata;
+   struct Item *item;
+   NfaMachine vm;
+   /* (one machine per worker, reused for each item; an error in it fails the items) */
+   memset(&vm, 0, sizeof(vm));
+   if (!q->matcher->use_jit) { nfa_exec_init(&vm, q->matcher->nfa, 0); }
+   pthread_mutex_lock(&q->lock);
+   for (;;) {
+      while (q->taken == q->queued && !q->closed) { pthread_cond_wait(&q->changed, &q->lock); }
+      if (q->taken == q->queued) { break; }
+      item = q->items + (q->taken++ % q->window);
+      pthread_mutex_unlock(&q->lock);
+
+      if (!item->file_end) { process_item(item, q->matcher, q->opts, &vm); }
+
+      pthread_mutex_lock(&q->lock);
+      item->done = 1;
+      pthread_cond_broadcast(&q->changed);
+   }
+   pthread_mutex_unlock(&q->lock);
+   nfa_exec_free(&vm);
+   return NULL;
+}
+
+/* ----- MAIN THREAD ----- */
+
+struct Totals {
+   long matches;
+   long file_matches; /* matching lines in the file being printed */
+   double bytes;
+   int errors;
+};
+
+/* print (and release) the oldest item, waiting for it to be done */
+static void print_oldest(struct Queue *q, struct Totals *totals) {
+   struct Item *item = q->items + (q->printed % q->window);
+   pthread_mutex_lock(&q->lock);
+   while (!item->done) { pthread_cond_wait(&q->changed, &q->lock); }
+   pthread_mutex_unlock(&q->lock);
+
+   if (item->out.failed) {
+      fprintf(stderr, "nfagrep: %s: out of memory\n", item->name);
+      ++totals->errors;
+   }
+   if (item->out.size) { fwrite(item->out.text, 1, item->out.size, stdout); }
+   totals->file_matches += item->matches;
+   totals->matches += item->matches;
+   totals->bytes += (double)item->length;
+   if (item->file_end) {
+      if (q->opts->count_only) {
+         if (q->opts->with_filename) { fprintf(stdout, "%s:", item->name); }
+         fprintf(stdout, "%ld\n", totals->file_matches);
+      }
+      totals->file_matches = 0;
+      if (item->map) { munmap(item->map, item->map_size); }
+   }
+   free(item->out.text);
+   free(item->owned);
+
+   pthread_mutex_lock(&q->lock);
+   ++q->printed;
+   pthread_mutex_unlock(&q->lock);
+}
+
+static void queue_item(struct Queue *q, struct Totals *totals, const struct Item *item) {
+   if (q->queued - q->printed == q->window) { print_oldest(q, totals); }
+   pthread_mutex_lock(&q->lock);
+   q->items[q->queued % q->window] = *item;
+   ++q->queued;
+   pthread_cond_broadcast(&q->changed);
+   pthread_mutex_unlock(&q->lock);
+}
+
+/* queue a mapped file in chunks that end at line boundaries */
+static void queue_mapped(struct Queue *q, struct Totals *totals, const char *name, void *map, size_t size) {
+   const char *text = (const char*)map, *newline;
+   struct Item item;
+   size_t at, end;
+   for (at = 0; at < size; at = end) {
+      end = (size - at > CHUNK_SIZE ? at + CHUNK_SIZE : size);
+      if (end < size) {
+         newline = (const char*)memchr(text + end, '\n', size - end);
+         end = (newline ? (size_t)(newline - text) + 1 : size);
+      }
+      memset(&item, 0, sizeof(item));
+      item.name = name;
+      item.text = text + at;
+      item.length = end - at;
+      queue_item(q, totals, &item);
+   }
+   memset(&item, 0, sizeof(item));
+   item.name = name;
+   item.file_end = 1;
+   item.map = map;
+   item.map_size = size;
+   queue_item(q, totals, &item);
+}
+
+/* queue a stream in chunks read into buffers (each item owns its buffer); the part of a
+ * buffer after its last newline is carried over to the next one */
+static int queue_stream(struct Queue *q, struct Totals *totals, const char *name, int fd) {
+   struct Item item;
+   char *buf, *tail = NULL;
+   size_t carry = 0, length, keep;
+   ssize_t n;
+   int eof = 0;
+   while (!eof) {
+      buf = (char*)malloc(carry + CHUNK_SIZE);
+      if (!buf) {
+         fprintf(stderr, "nfagrep: %s: out of memory\n", name);
+         free(tail);
+         return 0;
+      }
+      if (carry) { memcpy(buf, tail, carry); }
+      free(tail);
+      tail = NULL;
+      for (length = carry; length < carry + CHUNK_SIZE; length += (size_t)n) {
+         n = read(fd, buf + length, carry + CHUNK_SIZE - length);
+         if (n < 0 && errno == EINTR) { n = 0; continue; }
+         if (n < 0) {
+            fprintf(stderr, "nfagrep: %s: %s\n", name, strerror(errno));
+            free(buf);
+            return 0;
+         }
+         if (n == 0) { eof = 1; break; }
+      }
+      for (keep = length; !eof && keep > 0 && buf[keep - 1] != '\n'; --keep) {}
+      carry = length - keep;
+      if (carry) {
+         tail = (char*)malloc(carry);
+         if (!tail) {
+            fprintf(stderr, "nfagrep: %s: out of memory\n", name);
+            free(buf);
+            return 0;
+         }
+         memcpy(tail, buf + keep, carry);
+      }
+      if (keep) {
+         memset(&item, 0, sizeof(item));
+         item.name = name;
+         item.text = buf;
+         item.length = keep;
+         item.owned = buf;
+         queue_item(q, totals, &item);
+      } else {
+         free(buf);
+      }
+   }
+   memset(&item, 0, sizeof(item));
+   item.name = name;
+   item.file_end = 1;
+   queue_item(q, totals, &item);
+   return 1;
+}
+
+static int queue_file(struct Queue *q, struct Totals *totals, const char *name) {
+   struct stat st;
+   void *map;
+   int fd, ok;
+   fd = (strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY));
+   if (fd < 0) {
+      fprintf(stderr, "nfagrep: %s: %s\n", name, strerror(errno));
+      return 0;
+   }
+   if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (off_t)(size_t)st.st_size == st.st_size) {
+      map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+         if (fd != STDIN_FILENO) { close(fd); }
+         queue_mapped(q, totals, name, map, (size_t)st.st_size);
+         return 1;
+      }
+   }
+   ok = queue_stream(q, totals, name, fd);
+   if (fd != STDIN_FILENO) { close(fd); }
+   return ok;
+}
+
+static double now_seconds(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int default_threads(void) {
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return (n < 1 ? 1 : (n > MAX_THREADS ? MAX_THREADS : (int)n));
+}
+
+static void usage(void) {
+   fprintf(stderr,
+      "usage: nfagrep [-c] [-i] [-t] [-j THREADS] PATTERN [FILE...]\n"
+      "  -c  print the number of matching lines in each file\n"
+      "  -i  ignore case (ASCII)\n"
+      "  -t  write the throughput to stderr\n"
+      "  -j  number of worker threads (default: one per processor)\n"
+      "Reads stdin if there are no files (or for '-').\n");
+}
+
+int main(int argc, char **argv) {
+   static const char * const STDIN_ONLY[] = { "-" };
+   pthread_t threads[MAX_THREADS];
+   const char * const *files;
+   struct Options opts;
+   struct Matcher matcher;
+   struct Queue q;
+   struct Totals totals;
+   double start, seconds;
+   int i, nfiles;
+
+   memset(&opts, 0, sizeof(opts));
+   opts.nthreads = default_threads();
+   for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+      if (strcmp(argv[i], "--") == 0) { ++i; break; }
+      if (strcmp(argv[i], "-c") == 0) {
+         opts.count_only = 1;
+      } else if (strcmp(argv[i], "-i") == 0) {
+         opts.ignore_case = 1;
+      } else if (strcmp(argv[i], "-t") == 0) {
+         opts.report = 1;
+      } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+         opts.nthreads = atoi(argv[++i]);
+         if (opts.nthreads > MAX_THREADS) { opts.nthreads = MAX_THREADS; }
+      } else {
+         usage();
+         return 2;
+      }
+   }
+   if (i >= argc) { usage(); return 2; }
+   if (!init_matcher(&matcher, argv[i], &opts)) { return 2; }
+   ++i;
+   files = (i < argc ? (const char * const *)(argv + i) : STDIN_ONLY);
+   nfiles = (i < argc ? argc - i : 1);
+   opts.with_filename = (nfiles > 1);
+
+   memset(&q, 0, sizeof(q));
+   memset(&totals, 0, sizeof(totals));
+   q.window = 2*opts.nthreads + 2;
+   q.items = (struct Item*)calloc((size_t)q.window, sizeof(struct Item));
+   q.opts = &opts;
+   q.matcher = &matcher;
+   if (!q.items) {
+      fprintf(stderr, "nfagrep: out of memory\n");
+      free_matcher(&matcher);
+      return 2;
+   }
+   pthread_mutex_init(&q.lock, NULL);
+   pthread_cond_init(&q.changed, NULL);
+
+   start = now_seconds();
+   for (i = 0; i < opts.nthreads; ++i) {
+      if (pthread_create(threads + i, NULL, &worker, &q) != 0) { break; }
+   }
+   if (i == 0) {
+      fprintf(stderr, "nfagrep: can't start a worker thread\n");
+      pthread_cond_destroy(&q.changed);
+      pthread_mutex_destroy(&q.lock);
+      free(q.items);
+      free_matcher(&matcher);
+      return 2;
+   }
+   opts.nthreads = i;
+
+   for (i = 0; i < nfiles; ++i) {
+      if (!queue_file(&q, &totals, files[i])) { ++totals.errors; }
+   }
+   while (q.printed < q.queued) { print_oldest(&q, &totals); }
+
+   pthread_mutex_lock(&q.lock);
+   q.closed = 1;
+   pthread_cond_broadcast(&q.changed);
+   pthread_mutex_unlock(&q.lock);
+   for (i = 0; i < opts.nthreads; ++i) { pthread_join(threads[i], NULL); }
+   fflush(stdout);
+   seconds = now_seconds() - start;
+
+   if (opts.report) {
+      fprintf(stderr, "nfagrep: %.0f bytes in %.3f s (%.1f MB/s), %ld matching lines, %s, %d threads\n",
+         totals.bytes, seconds, (seconds > 0.0 ? totals.bytes / seconds / 1e6 : 0.0), totals.matches,
+         (matcher.use_jit ? (matcher.jit.native ? "JIT (machine code)" : "JIT (transition table)") : "nfa_exec_scan_lines"),
+         opts.nthreads);
+   }
+
+   pthread_cond_destroy(&q.changed);
+   pthread_mutex_destroy(&q.lock);
+   free(q.items);
+   free_matcher(&matcher);
+   return (totals.errors ? 2 : (totals.matches ? 0 : 1));
+}
+
+/* vim: set ts=8 sts=3 sw=3 et: */
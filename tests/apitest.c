@@ -0,0 +1,1622 @@
+/* Copyright (C) 2014 John Bartholomew. For licensing terms, see the header file nfa.h */
+
+#define NFA_API static
+#define NFA_EXEC_STATS /* (so that the optional counters are tested too) */
+#include "nfa.c" /* implementation as well as interface */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+static char BUILDER_POOL[16 << 10];
+static char EXEC_POOL[16 << 10];
+
+static int fail_count = 0;
+
+#define CHECK(x) do{if(!(x)){++fail_count;fprintf(stdout,"FAIL  %s:%d: %s\n",__FILE__,__LINE__,#x);}}while(0)
+
+static Nfa *build_regex_nfa(const char *pattern, int flags) {
+   NfaBuilder builder;
+   Nfa *nfa;
+   nfa_builder_init(&builder);
+   nfa_build_regex(&builder, pattern, -1, flags);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   return nfa;
+}
+
+static int match_regex(const char *pattern, int flags, const char *text, NfaCapture *captures, int ncaptures) {
+   Nfa *nfa = build_regex_nfa(pattern, flags);
+   int result;
+   CHECK(nfa);
+   if (!nfa) { return -1; }
+   result = nfa_match(nfa, captures, ncaptures, text, strlen(text));
+   free(nfa);
+   return result;
+}
+
+static Nfa *build_lexer(void) {
+   static const char * const TOKENS[] = {
+      "if", "[a-z]+", "[0-9]+", "[ \t]+", "<=|<", "=", 0
+   };
+   NfaBuilder builder;
+   Nfa *nfa;
+   int i;
+
+   nfa_builder_init_pool(&builder, BUILDER_POOL, sizeof(BUILDER_POOL));
+   for (i = 0; TOKENS[i]; ++i) {
+      nfa_build_regex(&builder, TOKENS[i], -1, NFA_REGEX_NO_CAPTURES);
+      nfa_build_token(&builder, 100 + i);
+      if (i) { nfa_build_alt(&builder); }
+   }
+   nfa = nfa_builder_output(&builder);
+   if (!nfa) {
+      fprintf(stderr, "error: %s\n", nfa_error_string(builder.error));
+   }
+   nfa_builder_free(&builder);
+   return nfa;
+}
+
+static void test_lexer_buffer(void) {
+   static const char INPUT[] = "if iffy <= 42=x<";
+   static const int EXPECTED[] = {
+      100, 2, 103, 1, 101, 4, 103, 1, 104, 2, 103, 1, 102, 2, 105, 1, 101, 1, 104, 1, -1
+   };
+   NfaLexer lexer;
+   Nfa *nfa = build_lexer();
+   int at = 0, i = 0, ret;
+
+   CHECK(nfa);
+   if (!nfa) { return; }
+
+   nfa_lexer_init_pool(&lexer, nfa, EXEC_POOL, sizeof(EXEC_POOL));
+   while (at < (int)strlen(INPUT)) {
+      ret = nfa_lex(&lexer, INPUT + at, strlen(INPUT) - at, at);
+      CHECK(ret == NFA_RESULT_MATCH);
+      if (ret != NFA_RESULT_MATCH) { break; }
+      CHECK(lexer.token == EXPECTED[i]);
+      CHECK(lexer.token_length == EXPECTED[i+1]);
+      at += lexer.token_length;
+      i += 2;
+   }
+   CHECK(EXPECTED[i] == -1);
+
+   /* no token matches */
+   ret = nfa_lex(&lexer, "!x", 2, 0);
+   CHECK(ret == NFA_RESULT_NOMATCH);
+   CHECK(lexer.token == -1);
+
+   nfa_lexer_free(&lexer);
+   free(nfa);
+}
+
+static void test_lexer_chunks(void) {
+   static const char INPUT[] = "abc def";
+   NfaLexer lexer;
+   Nfa *nfa = build_lexer();
+   int ret;
+
+   CHECK(nfa);
+   if (!nfa) { return; }
+
+   nfa_lexer_init(&lexer, nfa);
+   nfa_lexer_start(&lexer, 0);
+   /* a token which spans chunks */
+   ret = nfa_lexer_feed(&lexer, INPUT, 2);
+   CHECK(ret == 0);
+   ret = nfa_lexer_feed(&lexer, INPUT + 2, 5);
+   CHECK(ret == 1);
+   CHECK(lexer.token == 101);
+   CHECK(lexer.token_length == 3);
+
+   /* a token which runs to the end of the input */
+   nfa_lexer_start(&lexer, 4);
+   ret = nfa_lexer_feed(&lexer, INPUT + 4, 3);
+   CHECK(ret == 0);
+   ret = nfa_lexer_finish(&lexer);
+   CHECK(ret == NFA_RESULT_MATCH);
+   CHECK(lexer.token == 101);
+   CHECK(lexer.token_length == 3);
+
+   nfa_lexer_free(&lexer);
+   free(nfa);
+}
+
+static void test_optimize(void) {
+   enum { NCHAIN = 100000 };
+   static const char * const INPUTS[] = {
+      "", "a", "ab", "abd", "c", "cd", "ccd", "xd", "abab", 0
+   };
+   char word[16];
+   NfaBuilder builder;
+   NfaCapture plain_caps[3], opt_caps[3];
+   Nfa *plain, *opt;
+   int before, after, i, j;
+
+   nfa_builder_init(&builder);
+   nfa_build_regex(&builder, "((ab|c|x)*|(b|c)?)(d|)", -1, 0);
+   plain = nfa_builder_output(&builder);
+   opt = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(plain && opt);
+   if (!plain || !opt) { free(plain); free(opt); return; }
+
+   CHECK(nfa_optimize(opt, &before, &after) == 0);
+   CHECK(before == plain->nops);
+   CHECK(after == opt->nops);
+   CHECK(after < before);
+   CHECK(nfa_size(opt) < nfa_size(plain));
+
+   for (i = 0; INPUTS[i]; ++i) {
+      int len = strlen(INPUTS[i]);
+      int r0 = nfa_match(plain, plain_caps, 3, INPUTS[i], len);
+      int r1 = nfa_match(opt, opt_caps, 3, INPUTS[i], len);
+      CHECK(r0 == r1);
+      for (j = 0; r0 == NFA_RESULT_MATCH && j < 3; ++j) {
+         CHECK(plain_caps[j].begin == opt_caps[j].begin);
+         CHECK(plain_caps[j].end == opt_caps[j].end);
+      }
+   }
+
+   /* optimizing again does nothing */
+   CHECK(nfa_optimize(opt, &before, &after) == 0);
+   CHECK(before == after);
+
+   free(plain);
+   free(opt);
+
+   /* a long chain of alternatives nests forks (and jumps to the end) very deeply */
+   nfa_builder_init(&builder);
+   builder.flags = NFA_BUILDER_OPTIMIZE;
+   for (i = 0; i < NCHAIN; ++i) {
+      sprintf(word, "w%dx", i);
+      nfa_build_match_string(&builder, word, -1, 0);
+      if (i) { nfa_build_alt(&builder); }
+   }
+   opt = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(opt);
+   if (opt) {
+      CHECK(nfa_match(opt, NULL, 0, "w0x", 3) == 1);
+      CHECK(nfa_match(opt, NULL, 0, "w99999x", 7) == 1);
+      CHECK(nfa_match(opt, NULL, 0, "w100000x", 8) == 0);
+      CHECK(nfa_validate(opt, nfa_size(opt)) == NFA_NO_ERROR);
+      CHECK(nfa_optimize(opt, &before, &after) == 0);
+      CHECK(before == after);
+   }
+   free(opt);
+}
+
+static Nfa *build_string_nfa(const char *str, int per_byte) {
+   NfaBuilder builder;
+   Nfa *nfa;
+   int i, len = strlen(str);
+
+   nfa_builder_init(&builder);
+   nfa_build_match_any(&builder);
+   nfa_build_zero_or_more(&builder, 0);
+   nfa_build_match_empty(&builder);
+   if (per_byte) {
+      for (i = 0; i < len; ++i) {
+         nfa_build_match_byte(&builder, str[i], 0);
+         nfa_build_join(&builder);
+      }
+   } else {
+      nfa_build_match_string(&builder, str, len, 0);
+      nfa_build_join(&builder);
+   }
+   nfa_build_capture(&builder, 1);
+   nfa_build_join(&builder);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   return nfa;
+}
+
+static void test_match_string(void) {
+   static const char * const INPUTS[] = {
+      "abcabd", "abcabcabd", "ababcabdx", "abcab", "xabcabdabcabd", 0
+   };
+   char long_string[600], long_input[700];
+   NfaCapture caps0[2], caps1[2];
+   Nfa *bytes, *string;
+   int i, j, r0, r1;
+
+   bytes = build_string_nfa("abcabd", 1);
+   string = build_string_nfa("abcabd", 0);
+   CHECK(bytes && string);
+   if (bytes && string) {
+      /* the string match uses fewer ops than a byte match per character */
+      CHECK(string->nops < bytes->nops);
+      for (i = 0; INPUTS[i]; ++i) {
+         r0 = nfa_match(bytes, caps0, 2, INPUTS[i], strlen(INPUTS[i]));
+         r1 = nfa_match(string, caps1, 2, INPUTS[i], strlen(INPUTS[i]));
+         CHECK(r0 == r1);
+         for (j = 0; r0 == NFA_RESULT_MATCH && j < 2; ++j) {
+            CHECK(caps0[j].begin == caps1[j].begin);
+            CHECK(caps0[j].end == caps1[j].end);
+         }
+      }
+   }
+   free(bytes);
+   free(string);
+
+   /* strings longer than 255 bytes are split across several ops */
+   for (i = 0; i < (int)sizeof(long_string) - 1; ++i) { long_string[i] = 'a' + (i % 7); }
+   long_string[sizeof(long_string) - 1] = '\0';
+   string = build_string_nfa(long_string, 0);
+   CHECK(string);
+   if (string) {
+      memset(long_input, 'a', sizeof(long_input));
+      memcpy(long_input + 50, long_string, strlen(long_string));
+      r1 = nfa_match(string, caps1, 2, long_input, sizeof(long_input));
+      CHECK(r1 == NFA_RESULT_MATCH);
+      CHECK(caps1[1].begin == 50 && caps1[1].end == 50 + (int)strlen(long_string));
+      long_input[50 + 300] = 'x';
+      CHECK(nfa_match(string, NULL, 0, long_input, sizeof(long_input)) == NFA_RESULT_NOMATCH);
+   }
+   free(string);
+}
+
+static void test_repeat(void) {
+   char input[600];
+   NfaBuilder builder;
+   NfaCapture caps[2];
+   Nfa *nfa;
+
+   /* a large count doesn't make a large NFA */
+   nfa_builder_init(&builder);
+   nfa_build_match_byte_range(&builder, 'a', 'b', 0);
+   nfa_build_repeat(&builder, 1, 500, 0);
+   nfa_build_capture(&builder, 1);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(nfa);
+   if (nfa) {
+      CHECK(nfa->nops < 20);
+      memset(input, 'a', sizeof(input));
+      CHECK(nfa_match(nfa, caps, 2, input, sizeof(input)) == NFA_RESULT_MATCH);
+      CHECK(caps[1].begin == 0 && caps[1].end == 500);
+      CHECK(nfa_match(nfa, caps, 2, "abx", 3) == NFA_RESULT_MATCH);
+      CHECK(caps[1].end == 2);
+      CHECK(nfa_match(nfa, caps, 2, "x", 1) == NFA_RESULT_NOMATCH);
+   }
+   free(nfa);
+
+   /* non-greedy, unbounded */
+   nfa = build_regex_nfa("(a{10,}?)a*", 0);
+   CHECK(nfa);
+   if (nfa) {
+      CHECK(nfa_match(nfa, caps, 2, input, 50) == NFA_RESULT_MATCH);
+      CHECK(caps[1].begin == 0 && caps[1].end == 10);
+      CHECK(nfa_match(nfa, caps, 2, input, 9) == NFA_RESULT_NOMATCH);
+   }
+   free(nfa);
+
+   /* too many states to execute */
+   nfa_builder_init(&builder);
+   nfa_build_regex(&builder, "a{40000000}", -1, 0);
+   nfa = nfa_builder_output(&builder);
+   CHECK(!nfa);
+   CHECK(builder.error == NFA_ERROR_NFA_TOO_LARGE);
+   nfa_builder_free(&builder);
+   free(nfa);
+}
+
+static void test_wide_format(void) {
+   enum { NHOSTS = 6000, NDEEP = 100000 };
+   char host[32], *input;
+   NfaBuilder builder;
+   Nfa *nfa;
+   int i, flags;
+
+   /* small NFAs use the narrow format */
+   nfa = build_regex_nfa("a(b|c)*", 0);
+   CHECK(nfa && nfa->format == NFAI_FORMAT_NARROW);
+   free(nfa);
+
+   /* a large alternation has jumps (and ops) that don't fit in 16 bits */
+   for (flags = 0; flags <= NFA_BUILDER_OPTIMIZE; flags += NFA_BUILDER_OPTIMIZE) {
+      nfa_builder_init(&builder);
+      builder.flags = flags;
+      for (i = 0; i < NHOSTS; ++i) {
+         sprintf(host, "host%d.example.com", i);
+         nfa_build_match_string(&builder, host, -1, 0);
+         if (i) { nfa_build_alt(&builder); }
+      }
+      nfa = nfa_builder_output(&builder);
+      nfa_builder_free(&builder);
+      CHECK(nfa);
+      if (!nfa) { continue; }
+      CHECK(nfa->format == NFAI_FORMAT_WIDE);
+      CHECK(nfa->nops > UINT16_MAX);
+      CHECK(nfa_match(nfa, NULL, 0, "host0.example.com", -1) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(nfa, NULL, 0, "host2961.example.com", -1) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(nfa, NULL, 0, "host5999.example.com", -1) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(nfa, NULL, 0, "host6000.example.com", -1) == NFA_RESULT_NOMATCH);
+      free(nfa);
+   }
+
+   /* chains of non-consuming transitions far deeper than the C stack could follow recursively */
+   for (flags = 0; flags <= NFA_BUILDER_OPTIMIZE; flags += NFA_BUILDER_OPTIMIZE) {
+      nfa_builder_init(&builder);
+      builder.flags = flags;
+      for (i = 0; i < NDEEP; ++i) {
+         sprintf(host, "host%d.example", i);
+         nfa_build_match_string(&builder, host, -1, 0);
+         if (i) { nfa_build_alt(&builder); }
+      }
+      nfa = nfa_builder_output(&builder);
+      nfa_builder_free(&builder);
+      CHECK(nfa);
+      if (!nfa) { continue; }
+      CHECK(nfa_match(nfa, NULL, 0, "host77.example", -1) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(nfa, NULL, 0, "host99999.example", -1) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(nfa, NULL, 0, "host100000.example", -1) == NFA_RESULT_NOMATCH);
+      free(nfa);
+   }
+   nfa = build_regex_nfa("(b?){100000}$", 0);
+   CHECK(nfa);
+   if (nfa) {
+      CHECK(nfa_match(nfa, NULL, 0, "bbb", -1) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(nfa, NULL, 0, "bbc", -1) == NFA_RESULT_NOMATCH);
+   }
+   free(nfa);
+
+   /* a repeat count that doesn't fit in 16 bits, with too many states for 16-bit state ids */
+   nfa = build_regex_nfa("^a{70000}$", 0);
+   CHECK(nfa);
+   input = (char*)malloc(70001);
+   if (nfa && input) {
+      CHECK(nfa->format == NFAI_FORMAT_WIDE);
+      memset(input, 'a', 70001);
+      CHECK(nfa_match(nfa, NULL, 0, input, 70000) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(nfa, NULL, 0, input, 69999) == NFA_RESULT_NOMATCH);
+      CHECK(nfa_match(nfa, NULL, 0, input, 70001) == NFA_RESULT_NOMATCH);
+   }
+   free(input);
+   free(nfa);
+}
+
+static int count_live_states(const Nfa *nfa, const char *prefix) {
+   NfaMachine vm;
+   int i, n;
+   nfa_exec_init(&vm, nfa, 0);
+   nfa_exec_start(&vm, 0, NFA_EXEC_AT_START);
+   for (i = 0; prefix[i]; ++i) { nfa_exec_step(&vm, prefix[i], i, 0); }
+   n = ((struct NfaiMachineData*)vm.data)->current->nstates;
+   nfa_exec_free(&vm);
+   return n;
+}
+
+static void test_literal_set(void) {
+   enum { NHOSTS = 2000 };
+   static const char * const WORDS[] = { "foo", "foobar", "bar", "Baz", "fo" };
+   static char hosts[NHOSTS][32];
+   const char *host_ptrs[NHOSTS];
+   char bytes[256];
+   const char *byte_ptrs[257];
+   size_t byte_lengths[257];
+   NfaBuilder builder;
+   NfaCapture caps[2];
+   Nfa *set, *alt;
+   int i;
+
+   /* the longest literal is preferred */
+   nfa_builder_init(&builder);
+   nfa_build_literal_set(&builder, WORDS, NULL, 5, NFA_MATCH_CASE_INSENSITIVE);
+   nfa_build_capture(&builder, 1);
+   set = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(set);
+   if (set) {
+      CHECK(nfa_match(set, caps, 2, "foobarx", 7) == NFA_RESULT_MATCH);
+      CHECK(caps[1].begin == 0 && caps[1].end == 6);
+      CHECK(nfa_match(set, caps, 2, "FOOx", 4) == NFA_RESULT_MATCH);
+      CHECK(caps[1].end == 3);
+      CHECK(nfa_match(set, caps, 2, "bAZ", 3) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(set, caps, 2, "f", 1) == NFA_RESULT_NOMATCH);
+      CHECK(nfa_match(set, caps, 2, "xfoo", 4) == NFA_RESULT_NOMATCH);
+   }
+   free(set);
+
+   /* every byte value, plus the empty string (more than 255 branches from one node) */
+   for (i = 0; i < 256; ++i) {
+      bytes[i] = (char)i;
+      byte_ptrs[i] = bytes + i;
+      byte_lengths[i] = 1;
+   }
+   byte_ptrs[256] = "";
+   byte_lengths[256] = 0;
+   nfa_builder_init(&builder);
+   nfa_build_literal_set(&builder, byte_ptrs, byte_lengths, 257, 0);
+   nfa_build_capture(&builder, 1);
+   set = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(set);
+   for (i = 0; set && i < 256; ++i) {
+      CHECK(nfa_match(set, caps, 2, bytes + i, 1) == NFA_RESULT_MATCH);
+      CHECK(caps[1].end == 1);
+   }
+   free(set);
+
+   /* a trie keeps the number of live states down, compared to an alternation */
+   for (i = 0; i < NHOSTS; ++i) {
+      sprintf(hosts[i], "host%d.example.com", i);
+      host_ptrs[i] = hosts[i];
+   }
+   nfa_builder_init(&builder);
+   nfa_build_literal_set(&builder, host_ptrs, NULL, NHOSTS, 0);
+   set = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   nfa_builder_init(&builder);
+   for (i = 0; i < NHOSTS; ++i) {
+      nfa_build_match_string(&builder, hosts[i], -1, 0);
+      if (i) { nfa_build_alt(&builder); }
+   }
+   alt = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(set && alt);
+   if (set && alt) {
+      CHECK(nfa_match(set, NULL, 0, "host1999.example.com", -1) == NFA_RESULT_MATCH);
+      CHECK(nfa_match(set, NULL, 0, "host2000.example.com", -1) == NFA_RESULT_NOMATCH);
+      CHECK(count_live_states(set, "h") <= 2);
+      CHECK(count_live_states(set, "host1") <= 13); /* a fork over 0-9, . and the end */
+      CHECK(count_live_states(alt, "h") >= NHOSTS);
+      CHECK(nfa_size(set) < nfa_size(alt));
+   }
+   free(set);
+   free(alt);
+}
+
+static void test_alt_n(void) {
+   enum { NWORDS = 1000 };
+   static char words[NWORDS][16];
+   NfaBuilder builder;
+   NfaCapture caps[3];
+   Nfa *nfa;
+   int i;
+
+   /* a single fork; the first alternative has priority */
+   nfa_builder_init(&builder);
+   nfa_build_assert_at_start(&builder);
+   nfa_build_match_string(&builder, "ab", 2, 0);
+   nfa_build_capture(&builder, 1);
+   nfa_build_match_string(&builder, "a", 1, 0);
+   nfa_build_capture(&builder, 2);
+   nfa_build_match_empty(&builder);
+   nfa_build_match_byte(&builder, 'x', 0);
+   nfa_build_alt_n(&builder, 4);
+   nfa_build_match_string(&builder, "b", 1, 0);
+   nfa_build_match_byte(&builder, 'c', 0);
+   nfa_build_match_any(&builder);
+   nfa_build_join_n(&builder, 3);
+   nfa_build_zero_or_one(&builder, 0);
+   nfa_build_assert_at_end(&builder);
+   nfa_build_join_n(&builder, 4);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(nfa);
+   if (nfa) {
+      CHECK(nfa_match(nfa, caps, 3, "abbcz", 5) == 1);
+      CHECK(caps[1].begin == 0 && caps[1].end == 2 && caps[2].end == 0);
+      CHECK(nfa_match(nfa, caps, 3, "abcz", 4) == 1);
+      CHECK(caps[1].end == 0 && caps[2].begin == 0 && caps[2].end == 1);
+      CHECK(nfa_match(nfa, NULL, 0, "", 0) == 1);
+      CHECK(nfa_match(nfa, NULL, 0, "xbc-", 4) == 1);
+      CHECK(nfa_match(nfa, NULL, 0, "y", 1) == 0);
+   }
+   free(nfa);
+
+   /* more than 255 alternatives, with more than NFA_BUILDER_MAX_STACK items on the stack */
+   nfa_builder_init(&builder);
+   for (i = 0; i < NWORDS; ++i) {
+      sprintf(words[i], "w%d.", i);
+      nfa_build_match_string(&builder, words[i], strlen(words[i]), 0);
+   }
+   nfa_build_alt_n(&builder, NWORDS);
+   nfa = nfa_builder_output(&builder);
+   CHECK(builder.error == 0);
+   nfa_builder_free(&builder);
+   CHECK(nfa);
+   if (nfa) {
+      CHECK(nfa_match(nfa, NULL, 0, "w0.", 3) == 1);
+      CHECK(nfa_match(nfa, NULL, 0, "w777.", 5) == 1);
+      CHECK(nfa_match(nfa, NULL, 0, "w999.", 5) == 1);
+      CHECK(nfa_match(nfa, NULL, 0, "w1000.", 6) == 0);
+      /* the 1000 branches, 250 forks of 4, and the root fork */
+      CHECK(count_live_states(nfa, "") == NWORDS + NWORDS / 4 + 1);
+   }
+   free(nfa);
+
+   /* too few items */
+   nfa_builder_init(&builder);
+   nfa_build_match_empty(&builder);
+   CHECK(nfa_build_alt_n(&builder, 2) == NFA_ERROR_STACK_UNDERFLOW);
+   nfa_builder_free(&builder);
+}
+
+static void test_validate(void) {
+   static const char * const INPUTS[] = { "", "a", "ab", "abcabc", "xyzzy", "0123456789abcdefghij" };
+   NfaBuilder builder;
+   Nfa *nfa, *copy, *string;
+   size_t size;
+   uint32_t word;
+   int i, j, pc, nvalid = 0;
+
+   nfa_builder_init(&builder);
+   nfa_build_regex(&builder, "^(a|bc)*[x-z0-9]+y{0,12}(abc|abd|b.c)$", -1, 0);
+   nfa_build_capture(&builder, 0);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(nfa);
+   if (!nfa) { return; }
+
+   size = nfa_size(nfa);
+   copy = (Nfa*)malloc(size);
+   CHECK(nfa_validate(nfa, size) == NFA_NO_ERROR);
+
+   /* a blob that's truncated, damaged, or from another version or byte order */
+   CHECK(nfa_validate(nfa, size - 1) == NFA_ERROR_NFA_INVALID);
+   CHECK(nfa_validate(nfa, 8) == NFA_ERROR_NFA_INVALID);
+   memcpy(copy, nfa, size);
+   copy->ops.narrow[1] ^= 1;
+   CHECK(nfa_validate(copy, size) == NFA_ERROR_NFA_INVALID);
+   memcpy(copy, nfa, size);
+   copy->version = NFAI_VERSION + 1;
+   CHECK(nfa_validate(copy, size) == NFA_ERROR_NFA_VERSION);
+   word = copy->magic;
+   copy->magic = (word >> 24) | ((word >> 8) & 0xFF00u) | ((word << 8) & 0xFF0000u) | (word << 24);
+   CHECK(nfa_validate(copy, size) == NFA_ERROR_NFA_VERSION);
+
+   /* a jump out of bounds (with a correct checksum) */
+   memcpy(copy, nfa, size);
+   for (pc = 0; pc < copy->nops; pc += nfai_nfa_op_length(copy, pc)) {
+      if ((copy->ops.narrow[pc] & NFAI_OPCODE_MASK) == NFAI_OP_JUMP) { break; }
+   }
+   CHECK(pc < copy->nops);
+   if (pc < copy->nops) {
+      copy->ops.narrow[pc + 1] = (uint16_t)copy->nops;
+      copy->checksum = nfai_checksum(copy);
+      CHECK(nfa_validate(copy, size) == NFA_ERROR_NFA_INVALID);
+   }
+
+   /* a string match of one byte (which has no virtual states) */
+   nfa_builder_init(&builder);
+   nfa_build_match_string(&builder, "ab", 2, 0);
+   string = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(string);
+   if (string) {
+      for (pc = 0; pc < string->nops; pc += nfai_nfa_op_length(string, pc)) {
+         if ((string->ops.narrow[pc] & NFAI_OPCODE_MASK) == NFAI_OP_MATCH_STRING) { break; }
+      }
+      CHECK(pc < string->nops);
+      if (pc < string->nops) {
+         CHECK(nfa_validate(string, nfa_size(string)) == NFA_NO_ERROR);
+         string->ops.narrow[pc] = (uint16_t)(NFAI_OP_MATCH_STRING | 1u);
+         string->checksum = nfai_checksum(string);
+         CHECK(nfa_validate(string, nfa_size(string)) == NFA_ERROR_NFA_INVALID);
+      }
+   }
+   free(string);
+
+   /* random damage: anything that validates must be safe to execute */
+   srand(1);
+   for (i = 0; i < 20000; ++i) {
+      memcpy(copy, nfa, size);
+      for (j = 0; j < 1 + i % 3; ++j) {
+         pc = rand() % copy->nops;
+         if (rand() & 1) {
+            copy->ops.narrow[pc] = (uint16_t)(copy->ops.narrow[pc] ^ (1u << (rand() % 16)));
+         } else {
+            copy->ops.narrow[pc] = (uint16_t)rand();
+         }
+      }
+      copy->checksum = nfai_checksum(copy);
+      if (nfa_validate(copy, size) == NFA_NO_ERROR) {
+         NfaCapture caps[2];
+         ++nvalid;
+         for (j = 0; j < (int)(sizeof(INPUTS)/sizeof(INPUTS[0])); ++j) {
+            nfa_match(copy, caps, 2, INPUTS[j], strlen(INPUTS[j]));
+         }
+      }
+   }
+   CHECK(nvalid > 0);
+
+   free(copy);
+   free(nfa);
+}
+
+static void test_bundle(void) {
+   enum { COUNT = 300 };
+   static char names[COUNT][16];
+   const char *name_ptrs[COUNT];
+   Nfa *nfas[COUNT];
+   NfaBuilder builder;
+   NfaBundle bundle;
+   uint32_t *by_name;
+   size_t size;
+   char *blob;
+   int i, ok = 1;
+
+   for (i = 0; i < COUNT; ++i) {
+      char pattern[32];
+      sprintf(names[i], "p%03d", (i * 7) % COUNT);
+      sprintf(pattern, "^x%d$", i);
+      name_ptrs[i] = names[i];
+      nfa_builder_init(&builder);
+      nfa_build_regex(&builder, pattern, -1, 0);
+      nfas[i] = nfa_builder_output(&builder);
+      nfa_builder_free(&builder);
+      if (!nfas[i]) { ok = 0; }
+   }
+   CHECK(ok);
+   if (!ok) { return; }
+
+   size = nfa_bundle_size((const Nfa * const *)nfas, name_ptrs, COUNT);
+   blob = (char*)malloc(size);
+   CHECK(nfa_bundle_write(blob, size - 1, (const Nfa * const *)nfas, name_ptrs, COUNT) == NFA_ERROR_BUFFER_TOO_SMALL);
+   CHECK(nfa_bundle_write(blob, size, (const Nfa * const *)nfas, name_ptrs, COUNT) == NFA_NO_ERROR);
+   CHECK(nfa_bundle_open(&bundle, blob, size) == NFA_NO_ERROR);
+   CHECK(bundle.count == COUNT);
+
+   /* the NFAs are used in place */
+   for (i = 0; i < COUNT && ok; ++i) {
+      char input[32];
+      const Nfa *nfa = nfa_bundle_get(&bundle, nfa_bundle_find(&bundle, names[i]));
+      sprintf(input, "x%d", i);
+      ok = (nfa && nfa_match(nfa, NULL, 0, input, strlen(input)) == NFA_RESULT_MATCH
+            && strcmp(nfa_bundle_name(&bundle, i), names[i]) == 0);
+   }
+   CHECK(ok);
+   CHECK(nfa_bundle_find(&bundle, "p") == -1);
+   CHECK(nfa_bundle_find(&bundle, "p0000") == -1);
+   CHECK(nfa_bundle_find(&bundle, "zzz") == -1);
+   CHECK(nfa_bundle_get(&bundle, COUNT) == NULL);
+
+   /* damaged bundles */
+   CHECK(nfa_bundle_open(&bundle, blob, size - 1) == NFA_ERROR_NFA_INVALID);
+   blob[size - 1] ^= 0x55; /* in the last NFA's ops */
+   CHECK(nfa_bundle_open(&bundle, blob, size) == NFA_ERROR_NFA_INVALID);
+   blob[size - 1] ^= 0x55;
+   by_name = (uint32_t*)(blob + sizeof(struct NfaiBundleHeader) + COUNT*sizeof(struct NfaiBundleEntry));
+   by_name[0] = by_name[1];
+   CHECK(nfa_bundle_open(&bundle, blob, size) == NFA_ERROR_NFA_INVALID); /* the name index is out of order */
+   ((struct NfaiBundleHeader*)blob)->version = NFAI_BUNDLE_VERSION + 1;
+   CHECK(nfa_bundle_open(&bundle, blob, size) == NFA_ERROR_NFA_VERSION);
+
+   /* no names */
+   free(blob);
+   size = nfa_bundle_size((const Nfa * const *)nfas, NULL, 2);
+   blob = (char*)malloc(size);
+   CHECK(nfa_bundle_write(blob, size, (const Nfa * const *)nfas, NULL, 2) == NFA_NO_ERROR);
+   CHECK(nfa_bundle_open(&bundle, blob, size) == NFA_NO_ERROR);
+   CHECK(bundle.count == 2 && nfa_bundle_name(&bundle, 1)[0] == '\0');
+   CHECK(nfa_bundle_find(&bundle, "") == 0);
+
+   free(blob);
+   for (i = 0; i < COUNT; ++i) { free(nfas[i]); }
+}
+
+static void test_jit(void) {
+   static const char * const PATTERNS[] = {
+      "", "^$", "bingo bango", "^(a|b)*c$", "^[a-m]*x$", ".*$", "^[^\"]*\"", "a.?b{2,4}c$",
+      "(a1|b2|c3|d4|e5|f6|g7|h8|i9|j0|k|l|m)+$", "^((ab)*|c+)[^a-c]$", "x(^|y)", "^(\\.|[^.]){3,5}$",
+      "[a-z]*\\b", "(\\B.|-)*\\bx", "(\\b[a-d]+\\b[^a-d]*)+$", 0
+   };
+   static const char ALPHABET[] = "abcdjkmx\"12.-\xff";
+   char text[24];
+   NfaJit native, table;
+   NfaBuilder builder;
+   Nfa *nfa;
+   int i, j, k, len, expected, mismatches;
+
+   for (i = 0; PATTERNS[i]; ++i) {
+      nfa_builder_init(&builder);
+      builder.flags = (i & 1 ? NFA_BUILDER_OPTIMIZE : 0);
+      nfa_build_regex(&builder, PATTERNS[i], -1, 0);
+      nfa = nfa_builder_output(&builder);
+      nfa_builder_free(&builder);
+      CHECK(nfa);
+      if (!nfa) { continue; }
+
+      CHECK(nfa_jit_init(&native, nfa) == NFA_NO_ERROR);
+      CHECK(nfai_jit_init(&table, nfa, 0) == NFA_NO_ERROR);
+#ifdef NFAI_JIT_X86_64
+      CHECK(native.native);
+#endif
+      CHECK(!table.native);
+
+      /* machine code, transition table and NFA all agree */
+      srand(i + 1);
+      mismatches = 0;
+      for (j = 0; j < 5000; ++j) {
+         len = (j < 20 ? j % 8 : rand() % (int)sizeof(text));
+         for (k = 0; k < len; ++k) { text[k] = ALPHABET[rand() % (sizeof(ALPHABET) - 1)]; }
+         expected = nfa_match(nfa, NULL, 0, text, len);
+         if (nfa_jit_match(&native, text, len) != expected) { ++mismatches; }
+         if (nfa_jit_match(&table, text, len) != expected) { ++mismatches; }
+      }
+      if (mismatches) { fprintf(stdout, "pattern /%s/: %d mismatches\n", PATTERNS[i], mismatches); }
+      CHECK(mismatches == 0);
+
+      nfa_jit_free(&native);
+      nfa_jit_free(&table);
+      free(nfa);
+   }
+
+   /* too many DFA states */
+   nfa = build_regex_nfa("(a|b)*a(a|b){14}", 0);
+   CHECK(nfa && nfa_jit_init(&native, nfa) == NFA_ERROR_NFA_TOO_LARGE);
+   CHECK(native.data == NULL);
+   free(nfa);
+
+   /* a long counted repeat has a DFA state for each count (and each is cheap to build) */
+   nfa = build_regex_nfa("x{3,4000}y", 0);
+   CHECK(nfa && nfa_jit_init(&native, nfa) == NFA_NO_ERROR);
+   if (nfa && native.data) {
+      CHECK(nfa_jit_match(&native, "xxxy", 4) == 1);
+      CHECK(nfa_jit_match(&native, "xxy", 3) == 0);
+      nfa_jit_free(&native);
+   }
+   free(nfa);
+   nfa = build_regex_nfa("x{3,5517}y", 0);
+   CHECK(nfa && nfa_jit_init(&native, nfa) == NFA_ERROR_NFA_TOO_LARGE);
+   free(nfa);
+}
+
+/* feed text to a stream in pieces of 1 to 5 bytes; the result mustn't change once it's decided */
+static int feed_stream(const NfaStreamEngine *engine, const char *text, int length) {
+   NfaStreamState state = NFA_STREAM_START;
+   int at = 0, piece, decided = -1;
+   while (at < length) {
+      piece = 1 + rand() % 5;
+      if (piece > length - at) { piece = length - at; }
+      if (nfa_stream_feed(engine, &state, text + at, piece) && decided < 0) { decided = nfa_stream_finish(engine, state); }
+      at += piece;
+   }
+   if (decided >= 0 && nfa_stream_finish(engine, state) != decided) { return -1; }
+   return nfa_stream_finish(engine, state);
+}
+
+static void test_stream(void) {
+   static const char * const PATTERNS[] = {
+      "", "^$", "bingo bango", "^(a|b)*c$", "^[a-m]*x$", ".*$", "^[^\"]*\"", "a.?b{2,4}c$",
+      "(a1|b2|c3|d4|e5|f6|g7|h8|i9|j0|k|l|m)+$", "^((ab)*|c+)[^a-c]$", "x(^|y)", "(a|b)*a(a|b){14}",
+      "[a-z]*\\b", "(\\b[a-d]+\\b[^a-d]*)+$", 0
+   };
+   static const char ALPHABET[] = "abcdjkmx\"12.-\xff";
+   char text[24];
+   NfaStreamEngine engine, bits;
+   NfaBuilder builder;
+   Nfa *nfa;
+   int i, j, k, len, expected, mismatches, has_bits;
+
+   for (i = 0; PATTERNS[i]; ++i) {
+      nfa_builder_init(&builder);
+      builder.flags = (i & 1 ? NFA_BUILDER_OPTIMIZE : 0);
+      nfa_build_regex(&builder, PATTERNS[i], -1, 0);
+      nfa = nfa_builder_output(&builder);
+      nfa_builder_free(&builder);
+      CHECK(nfa);
+      if (!nfa) { continue; }
+
+      /* a DFA if it fits, and the bit-parallel engine unless there are look assertions */
+      CHECK(nfa_stream_init(&engine, nfa) == NFA_NO_ERROR);
+      CHECK(engine.bit_parallel == (strstr(PATTERNS[i], "{14}") != NULL));
+      has_bits = (nfai_stream_init(&bits, nfa, 0) == NFA_NO_ERROR);
+      CHECK(has_bits == (strstr(PATTERNS[i], "\\b") == NULL));
+
+      srand(i + 1);
+      mismatches = 0;
+      for (j = 0; j < 3000; ++j) {
+         len = (j < 20 ? j % 8 : rand() % (int)sizeof(text));
+         for (k = 0; k < len; ++k) { text[k] = ALPHABET[rand() % (sizeof(ALPHABET) - 1)]; }
+         expected = nfa_match(nfa, NULL, 0, text, len);
+         if (feed_stream(&engine, text, len) != expected) { ++mismatches; }
+         if (has_bits && feed_stream(&bits, text, len) != expected) { ++mismatches; }
+      }
+      if (mismatches) { fprintf(stdout, "pattern /%s/: %d mismatches\n", PATTERNS[i], mismatches); }
+      CHECK(mismatches == 0);
+
+      nfa_stream_free(&engine);
+      if (has_bits) { nfa_stream_free(&bits); }
+      free(nfa);
+   }
+
+   /* too many DFA states, and too many positions for the bitset */
+   nfa = build_regex_nfa("(a|b)*a(a|b){70}", 0);
+   CHECK(nfa && nfa_stream_init(&engine, nfa) == NFA_ERROR_NFA_TOO_LARGE);
+   CHECK(engine.data == NULL);
+   free(nfa);
+}
+
+static void test_exec_stats(void) {
+   NfaMachine vm;
+   NfaExecStats stats, again;
+   Nfa *nfa;
+
+   nfa = build_regex_nfa("^(a*)(b|c)*d$", 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+
+   nfa_exec_init(&vm, nfa, 3);
+   CHECK(nfa_exec_stats(&vm, &stats) == NFA_NO_ERROR);
+   CHECK(stats.bytes_stepped == 0 && stats.states_visited == 0 && stats.closure_expansions == 0);
+   CHECK(stats.pages_allocated >= 1);
+
+   CHECK(nfa_exec_match_string(&vm, "aaabcbd", 7) == 1);
+   CHECK(nfa_exec_stats(&vm, &stats) == NFA_NO_ERROR);
+   CHECK(stats.bytes_stepped == 7);
+   CHECK(stats.peak_states >= 2);
+   CHECK(stats.states_visited >= 7 && stats.states_visited <= 7 * (unsigned long)stats.peak_states);
+   CHECK(stats.closure_expansions > stats.bytes_stepped);
+   CHECK(stats.capture_sets_allocated >= 2);
+   CHECK(stats.capture_sets_copied >= 1);
+
+   /* the second match reuses the capture sets, and the counters keep counting */
+   CHECK(nfa_exec_match_string(&vm, "aaabcbd", 7) == 1);
+   CHECK(nfa_exec_stats(&vm, &again) == NFA_NO_ERROR);
+   CHECK(again.bytes_stepped == 14);
+   CHECK(again.states_visited == 2 * stats.states_visited);
+   CHECK(again.capture_sets_allocated == stats.capture_sets_allocated);
+   CHECK(again.freelist_hits > stats.freelist_hits);
+   CHECK(again.pages_allocated == stats.pages_allocated);
+   nfa_exec_free(&vm);
+
+   /* a pool counts as one page */
+   nfa_exec_init_pool(&vm, nfa, 0, EXEC_POOL, sizeof(EXEC_POOL));
+   CHECK(nfa_exec_match_string(&vm, "abd", 3) == 1);
+   CHECK(nfa_exec_stats(&vm, &stats) == NFA_NO_ERROR);
+   CHECK(stats.pages_allocated == 1);
+   CHECK(stats.capture_sets_allocated == 0 && stats.freelist_hits == 0);
+   nfa_exec_free(&vm);
+
+   free(nfa);
+}
+
+static void test_analyze(void) {
+   NfaInfo info;
+   NfaMachine vm;
+   NfaExecStats stats;
+   Nfa *nfa;
+
+   nfa = build_regex_nfa("foo(ba+r)?(x|y)baz", 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   CHECK(nfa_analyze(nfa, &info, 100) == NFA_NO_ERROR);
+   CHECK(info.min_length == 7);
+   CHECK(info.max_length == -1);
+   CHECK(!info.anchored_start && !info.anchored_end);
+   CHECK(info.prefix_length == 3 && !memcmp(info.prefix, "foo", 3));
+   CHECK(info.suffix_length == 3 && !memcmp(info.suffix, "baz", 3));
+   CHECK(info.ncaptures == 3 && info.captures_used[0] == 6u);
+   CHECK(info.one_pass == 1);
+   CHECK(info.consuming_states == 10); /* ((x|y) is one class) */
+   CHECK(info.dfa_states > 0);
+
+   /* the live-set bound holds */
+   nfa_exec_init(&vm, nfa, info.ncaptures);
+   CHECK(nfa_exec_match_string(&vm, "foobaaarybaz", 12) == 1);
+   CHECK(nfa_exec_stats(&vm, &stats) == NFA_NO_ERROR);
+   CHECK(stats.peak_states <= info.max_live_states);
+   nfa_exec_free(&vm);
+   free(nfa);
+
+   nfa = build_regex_nfa("^(ab|ac){2,3}$", 0);
+   CHECK(nfa && nfa_analyze(nfa, &info, 100) == NFA_NO_ERROR);
+   CHECK(info.min_length == 4 && info.max_length == 6);
+   CHECK(info.anchored_start && info.anchored_end);
+   CHECK(info.prefix_length == 1 && info.prefix[0] == 'a');
+   CHECK(info.suffix_length == 0);
+   CHECK(info.one_pass == 0);
+   free(nfa);
+
+   /* the DFA is over the budget, and a big repeat is too big to expand (but has exact lengths) */
+   nfa = build_regex_nfa("(a|b)*a(a|b){6}", 0);
+   CHECK(nfa && nfa_analyze(nfa, &info, 16) == NFA_NO_ERROR);
+   CHECK(info.dfa_states == -1);
+   CHECK(info.suffix_length == 0 && info.ncaptures == 3);
+   free(nfa);
+   nfa = build_regex_nfa("x.{70000}", 0);
+   CHECK(nfa && nfa_analyze(nfa, &info, 0) == NFA_NO_ERROR);
+   CHECK(info.min_length == 70001 && info.max_length == 70001);
+   CHECK(info.consuming_states == 70001);
+   CHECK(info.one_pass == -1 && info.prefix_length == 0 && info.dfa_states == -1);
+   free(nfa);
+
+   /* a token counts as a match */
+   nfa = build_lexer();
+   CHECK(nfa && nfa_analyze(nfa, &info, 0) == NFA_NO_ERROR);
+   CHECK(info.min_length == 1 && info.max_length == -1);
+   CHECK(info.ncaptures == 0);
+   free(nfa);
+}
+
+static void test_required_pool_size(void) {
+   static const char * const PATTERNS[] = { "", "abc", "(a|b)*c", "((a)|(b)|(ab))*x{2,20}$", "(x(y)?)+z", 0 };
+   NfaCapture captures[4];
+   NfaMachine vm;
+   Nfa *nfa;
+   char *pool, text[32];
+   size_t size;
+   int i, j, k, len, result;
+
+   for (i = 0; PATTERNS[i]; ++i) {
+      nfa = build_regex_nfa(PATTERNS[i], 0);
+      CHECK(nfa);
+      if (!nfa) { continue; }
+
+      /* without captures, the size is exact */
+      size = nfa_exec_required_pool_size(nfa, 0);
+      pool = (char*)malloc(size);
+      CHECK(nfa_exec_init_pool(&vm, nfa, 0, pool, size - 1) == NFA_ERROR_OUT_OF_MEMORY);
+      nfa_exec_free(&vm);
+      CHECK(nfa_exec_init_pool(&vm, nfa, 0, pool, size) == NFA_NO_ERROR);
+      nfa_exec_free(&vm);
+      free(pool);
+
+      /* with captures, no input runs out */
+      size = nfa_exec_required_pool_size(nfa, 4);
+      CHECK(size > nfa_exec_required_pool_size(nfa, 0));
+      pool = (char*)malloc(size);
+      CHECK(nfa_exec_init_pool(&vm, nfa, 4, pool, size) == NFA_NO_ERROR);
+      srand(i + 1);
+      for (j = 0; j < 2000; ++j) {
+         len = rand() % (int)sizeof(text);
+         for (k = 0; k < len; ++k) { text[k] = "abxyz"[rand() % 5]; }
+         result = nfa_exec_match_string(&vm, text, len);
+         CHECK(result >= 0);
+         if (result < 0) { break; }
+         CHECK(result == nfa_match(nfa, captures, 4, text, len));
+      }
+      nfa_exec_free(&vm);
+      free(pool);
+      free(nfa);
+   }
+}
+
+static void test_prefilter(void) {
+   NfaCapture captures[2];
+   Nfa *nfa;
+
+   nfa = build_regex_nfa("^abc$", 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   CHECK(nfa->min_length == 3);
+   CHECK(nfa->max_length == 3);
+   CHECK(nfa->anchored == 1);
+   CHECK(nfa_match(nfa, NULL, 0, "abc", 3) == 1);
+   CHECK(nfa_match(nfa, NULL, 0, "ab", 2) == 0);
+   CHECK(nfa_match(nfa, NULL, 0, "abcd", 4) == 0);
+   free(nfa);
+
+   /* without a trailing '$' any prefix may match, so there is no maximum */
+   nfa = build_regex_nfa("(x|yz)+", 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   CHECK(nfa->min_length == 1);
+   CHECK(nfa->max_length == 0xFFFFFFFFu);
+   CHECK(nfa->nrequired == 0);
+   CHECK(nfa->anchored == 0);
+   CHECK(nfa_match(nfa, NULL, 0, "yzyzyzyzyzx!", 12) == 1);
+   free(nfa);
+
+   nfa = build_regex_nfa("(f)oo.*bar", 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   CHECK(nfa->min_length == 6);
+   CHECK(nfa->nrequired == 3);
+   CHECK(memchr(nfa->required, 'f', nfa->nrequired) != NULL);
+   CHECK(memchr(nfa->required, 'o', nfa->nrequired) != NULL);
+   CHECK(memchr(nfa->required, 'b', nfa->nrequired) != NULL);
+   CHECK(nfa_match(nfa, captures, 2, "foo--bar", 8) == 1);
+   CHECK(captures[1].begin == 0 && captures[1].end == 1);
+   /* rejected by the prefilter: the captures are still cleared */
+   CHECK(nfa_match(nfa, captures, 2, "foo--baz", 8) == 0);
+   CHECK(captures[1].begin == 0 && captures[1].end == 0);
+   CHECK(nfa_match(nfa, captures, 2, "fooba", 5) == 0);
+   CHECK(nfa_match(nfa, NULL, 0, "foo bar", (size_t)(-1)) == 1);
+   CHECK(nfa_match(nfa, NULL, 0, "foo baz", (size_t)(-1)) == 0);
+
+   /* the prefilter is covered by the checksum */
+   nfa->min_length = 2;
+   CHECK(nfa_validate(nfa, nfa_size(nfa)) == NFA_ERROR_NFA_INVALID);
+   free(nfa);
+
+   /* anchored if no path avoids the '^' */
+   nfa = build_regex_nfa("^a|^b", 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   CHECK(nfa->anchored == 1);
+   free(nfa);
+   nfa = build_regex_nfa("^a|b", 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   CHECK(nfa->anchored == 0);
+   free(nfa);
+}
+
+static void test_case_folding(void) {
+   NfaBuilder builder;
+   Nfa *nfa;
+   char text[100];
+   int c, ok;
+
+   /* a case-insensitive letter is compiled to a class of its two cases */
+   nfa_builder_init(&builder);
+   nfa_build_match_byte(&builder, 'Q', NFA_MATCH_CASE_INSENSITIVE);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   ok = 1;
+   for (c = 0; c < 256; ++c) {
+      const char byte = (char)c;
+      if (nfa_match(nfa, NULL, 0, &byte, 1) != (c == 'q' || c == 'Q')) { ok = 0; }
+   }
+   CHECK(ok);
+   free(nfa);
+
+   nfa = build_regex_nfa("hello, world", NFA_REGEX_CASE_INSENSITIVE);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   /* the letters are required in either case */
+   CHECK(nfa->nrequired == 3);
+   CHECK(nfa->folded == 7u);
+   CHECK(nfa->required[0] == 'h' && nfa->required[1] == 'e' && nfa->required[2] == 'l');
+   CHECK(nfa_match(nfa, NULL, 0, "HeLLo, WoRLD", (size_t)(-1)) == 1);
+   CHECK(nfa_match(nfa, NULL, 0, "HELLO, THERE", (size_t)(-1)) == 0);
+   CHECK(nfa_match(nfa, NULL, 0, "HELLO; WORLD", (size_t)(-1)) == 0);
+   /* long enough to be scanned a word at a time */
+   memset(text, '-', sizeof(text));
+   memcpy(text, "Hello, World", 12);
+   CHECK(nfa_match(nfa, NULL, 0, text, sizeof(text)) == 1);
+   text[0] = 'J';
+   CHECK(nfa_match(nfa, NULL, 0, text, sizeof(text)) == 0);
+   text[50] = 'H';
+   CHECK(nfa_match(nfa, NULL, 0, text, sizeof(text)) == 0);
+   CHECK(nfa_validate(nfa, nfa_size(nfa)) == NFA_NO_ERROR);
+   nfa->folded = 1u;
+   CHECK(nfa_validate(nfa, nfa_size(nfa)) == NFA_ERROR_NFA_INVALID);
+   free(nfa);
+}
+
+static void test_look_assertions(void) {
+   static const char * const TOKENS[] = { "[a-z]+", "if\\b", "[^a-z]", 0 };
+   NfaCapture captures[2];
+   NfaBuilder builder;
+   NfaLexer lexer;
+   Nfa *nfa;
+   int i;
+
+   CHECK(match_regex("cat\\b", 0, "cat", NULL, 0) == 1);
+   CHECK(match_regex("cat\\b", 0, "cat.", NULL, 0) == 1);
+   CHECK(match_regex("cat\\b", 0, "cats", NULL, 0) == 0);
+   CHECK(match_regex("cat\\B", 0, "cats", NULL, 0) == 1);
+   CHECK(match_regex("\\bcat", 0, "cat", NULL, 0) == 1);
+   CHECK(match_regex(".*\\bcat", 0, "a cat", NULL, 0) == 1);
+   CHECK(match_regex(".*\\bcat", 0, "bobcat", NULL, 0) == 0);
+   CHECK(match_regex(".*\\Bcat", 0, "bobcat", NULL, 0) == 1);
+   CHECK(match_regex("x_1\\b", 0, "x_1", NULL, 0) == 1);
+   /* inside a class, \b is a backspace */
+   CHECK(match_regex("[\\b]", 0, "\b", NULL, 0) == 1);
+
+   /* line anchors */
+   CHECK(match_regex("a$", 0, "a\nb", NULL, 0) == 0);
+   CHECK(match_regex("a$", NFA_REGEX_MULTILINE, "a\nb", NULL, 0) == 1);
+   CHECK(match_regex(".*^b", 0, "a\nb", NULL, 0) == 0);
+   CHECK(match_regex(".*^b$", NFA_REGEX_MULTILINE, "a\nb", NULL, 0) == 1);
+   CHECK(match_regex(".*^b$", NFA_REGEX_MULTILINE, "a\nbc", NULL, 0) == 0);
+   CHECK(match_regex("^$", NFA_REGEX_MULTILINE, "", NULL, 0) == 1);
+
+   /* captures follow the thread which passed the assertion */
+   CHECK(match_regex("([a-z ]+)\\b", 0, "one two  ", captures, 2) == 1);
+   CHECK(captures[1].begin == 0 && captures[1].end == 7);
+   CHECK(match_regex("([a-z]+?)\\B", 0, "abc", captures, 2) == 1);
+   CHECK(captures[1].begin == 0 && captures[1].end == 1);
+
+   /* a token which needs the next byte to end */
+   nfa_builder_init(&builder);
+   for (i = 0; TOKENS[i]; ++i) {
+      nfa_build_regex(&builder, TOKENS[i], -1, NFA_REGEX_NO_CAPTURES);
+      nfa_build_token(&builder, i);
+      if (i) { nfa_build_alt(&builder); }
+   }
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   nfa_lexer_init(&lexer, nfa);
+   /* (the higher priority token wins, whether or not it had to wait) */
+   CHECK(nfa_lex(&lexer, "if x", 4, 0) == NFA_RESULT_MATCH);
+   CHECK(lexer.token == 0 && lexer.token_length == 2);
+   CHECK(nfa_lex(&lexer, "iffy", 4, 0) == NFA_RESULT_MATCH);
+   CHECK(lexer.token == 0 && lexer.token_length == 4);
+   nfa_lexer_start(&lexer, 0);
+   CHECK(nfa_lexer_feed(&lexer, "if", 2) == 0);
+   CHECK(nfa_lexer_finish(&lexer) == NFA_RESULT_MATCH);
+   CHECK(lexer.token == 0 && lexer.token_length == 2);
+   nfa_lexer_free(&lexer);
+   free(nfa);
+
+   nfa_builder_init(&builder);
+   nfa_build_regex(&builder, "if\\b", -1, NFA_REGEX_NO_CAPTURES);
+   nfa_build_token(&builder, 1);
+   nfa_build_regex(&builder, "[a-z]+", -1, NFA_REGEX_NO_CAPTURES);
+   nfa_build_token(&builder, 2);
+   nfa_build_alt(&builder);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   nfa_lexer_init(&lexer, nfa);
+   CHECK(nfa_lex(&lexer, "if(", 3, 0) == NFA_RESULT_MATCH);
+   CHECK(lexer.token == 1 && lexer.token_length == 2);
+   nfa_lexer_start(&lexer, 0);
+   CHECK(nfa_lexer_feed(&lexer, "if", 2) == 0);
+   CHECK(nfa_lexer_feed(&lexer, " ", 1) == 1);
+   CHECK(lexer.token == 1 && lexer.token_length == 2);
+   CHECK(nfa_lex(&lexer, "ifs", 3, 0) == NFA_RESULT_MATCH);
+   CHECK(lexer.token == 2 && lexer.token_length == 3);
+   nfa_lexer_free(&lexer);
+   free(nfa);
+}
+
+struct LineSpans {
+   size_t spans[8][2];
+   int n;
+   int stop_after;
+};
+
+static int collect_line(void *userdata, size_t offset, size_t length) {
+   struct LineSpans *lines = (struct LineSpans*)userdata;
+   if (lines->n < 8) {
+      lines->spans[lines->n][0] = offset;
+      lines->spans[lines->n][1] = length;
+   }
+   ++lines->n;
+   return (lines->n == lines->stop_after);
+}
+
+static int scan_lines(const char *pattern, int flags, const char *text, struct LineSpans *lines) {
+   Nfa *nfa = build_regex_nfa(pattern, flags | NFA_REGEX_NO_CAPTURES);
+   int result;
+   CHECK(nfa);
+   if (!nfa) { return -1; }
+   lines->n = 0;
+   result = nfa_scan_lines(nfa, text, strlen(text), &collect_line, lines);
+   free(nfa);
+   return result;
+}
+
+static void test_scan_lines(void) {
+   static const char TEXT[] = "foo\nbar baz\n\nfoobar\nbarn";
+   struct LineSpans lines;
+   NfaMachine vm;
+   Nfa *nfa;
+   void *pool;
+   size_t size;
+
+   lines.stop_after = 0;
+   /* a match anywhere in a line counts */
+   CHECK(scan_lines("ba", 0, TEXT, &lines) == 3);
+   CHECK(lines.n == 3);
+   CHECK(lines.spans[0][0] == 4 && lines.spans[0][1] == 7);
+   CHECK(lines.spans[1][0] == 13 && lines.spans[1][1] == 6);
+   CHECK(lines.spans[2][0] == 20 && lines.spans[2][1] == 4);
+   /* anchors apply to each line */
+   CHECK(scan_lines("^bar", 0, TEXT, &lines) == 2);
+   CHECK(lines.spans[0][0] == 4 && lines.spans[1][0] == 20);
+   CHECK(scan_lines("r$", 0, TEXT, &lines) == 1);
+   CHECK(lines.spans[0][0] == 13);
+   CHECK(scan_lines("^$", 0, TEXT, &lines) == 1);
+   CHECK(lines.spans[0][0] == 12 && lines.spans[0][1] == 0);
+   CHECK(scan_lines("\\bbar\\b", 0, TEXT, &lines) == 1);
+   CHECK(lines.spans[0][0] == 4);
+   CHECK(scan_lines("o+b|z$", 0, TEXT, &lines) == 2);
+   CHECK(scan_lines("x", 0, TEXT, &lines) == 0);
+   /* a trailing newline doesn't start another line */
+   CHECK(scan_lines("^", 0, "a\nb\n", &lines) == 2);
+   CHECK(scan_lines("", 0, "", &lines) == 0);
+   /* the callback can stop the scan */
+   lines.stop_after = 2;
+   CHECK(scan_lines("a", 0, TEXT, &lines) == 2);
+   CHECK(lines.n == 2);
+
+   /* a machine from the caller (here with a fixed pool) can be reused for several scans */
+   nfa = build_regex_nfa("^ba|oo", 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   size = nfa_exec_required_pool_size(nfa, 0);
+   pool = malloc(size);
+   CHECK(pool);
+   if (pool) {
+      lines.stop_after = 0;
+      CHECK(nfa_exec_init_pool(&vm, nfa, 0, pool, size) == NFA_NO_ERROR);
+      lines.n = 0;
+      CHECK(nfa_exec_scan_lines(&vm, TEXT, strlen(TEXT), &collect_line, &lines) == 4);
+      CHECK(lines.spans[0][0] == 0 && lines.spans[1][0] == 4 && lines.spans[2][0] == 13 && lines.spans[3][0] == 20);
+      lines.n = 0;
+      CHECK(nfa_exec_scan_lines(&vm, "xoo\nxba", (size_t)(-1), &collect_line, &lines) == 1);
+      CHECK(lines.spans[0][0] == 0 && lines.spans[0][1] == 3);
+      nfa_exec_free(&vm);
+      /* a machine in an error state gives its error */
+      CHECK(nfa_exec_init_pool(&vm, nfa, 0, pool, 16) == NFA_ERROR_OUT_OF_MEMORY);
+      CHECK(nfa_exec_scan_lines(&vm, TEXT, strlen(TEXT), &collect_line, &lines) == NFA_ERROR_OUT_OF_MEMORY);
+      nfa_exec_free(&vm);
+      free(pool);
+   }
+   free(nfa);
+}
+
+/* finds all matches of the pattern, stores their spans in spans[2*i], spans[2*i+1], and checks
+ * that nfa_count_matches agrees; returns the number of matches */
+static int find_all(const char *pattern, const char *text, int *spans, int max_spans) {
+   NfaIter iter;
+   Nfa *nfa;
+   int ret, n = 0;
+   nfa = build_regex_nfa(pattern, 0);
+   CHECK(nfa);
+   if (!nfa) { return -1; }
+   CHECK(nfa_iter_init(&iter, nfa, NULL, 0, 0) == NFA_NO_ERROR);
+   for (ret = nfa_find_first(&iter, text, -1); ret == NFA_RESULT_MATCH; ret = nfa_find_next(&iter)) {
+      if (n < max_spans) {
+         spans[2*n] = iter.begin;
+         spans[2*n + 1] = iter.end;
+      }
+      ++n;
+   }
+   CHECK(ret == NFA_RESULT_NOMATCH);
+   CHECK(nfa_find_next(&iter) == NFA_RESULT_NOMATCH);
+   nfa_iter_free(&iter);
+   CHECK(nfa_count_matches(nfa, text, -1) == n);
+   free(nfa);
+   return n;
+}
+
+/* finds the first match of the pattern, and returns how many bytes the search stepped over
+ * (it stops once the match is decided) */
+static long find_first_steps(const char *pattern, const char *text) {
+   NfaIter iter;
+   NfaExecStats stats;
+   Nfa *nfa;
+   nfa = build_regex_nfa(pattern, 0);
+   CHECK(nfa);
+   if (!nfa) { return -1; }
+   CHECK(nfa_iter_init(&iter, nfa, NULL, 0, 0) == NFA_NO_ERROR);
+   CHECK(nfa_find_first(&iter, text, -1) == NFA_RESULT_MATCH);
+   CHECK(nfa_exec_stats(&iter.vm, &stats) == NFA_NO_ERROR);
+   nfa_iter_free(&iter);
+   free(nfa);
+   return (long)stats.bytes_stepped;
+}
+
+static void test_find_all(void) {
+   NfaCapture captures[3];
+   NfaIter iter;
+   Nfa *nfa;
+   char *text;
+   void *pool;
+   size_t size;
+   int spans[16];
+
+   CHECK(find_all("a+", "baaacaa", spans, 8) == 2);
+   CHECK(spans[0] == 1 && spans[1] == 4 && spans[2] == 5 && spans[3] == 7);
+   CHECK(find_all("z", "baaacaa", spans, 8) == 0);
+   /* an empty match can follow a non-empty one, but not another empty one at the same place */
+   CHECK(find_all("a*", "baaa", spans, 8) == 3);
+   CHECK(spans[0] == 0 && spans[1] == 0 && spans[2] == 1 && spans[3] == 4 && spans[4] == 4 && spans[5] == 4);
+   CHECK(find_all("x*|b", "b", spans, 8) == 3);
+   CHECK(spans[0] == 0 && spans[1] == 0 && spans[2] == 0 && spans[3] == 1 && spans[4] == 1 && spans[5] == 1);
+   CHECK(find_all("", "", spans, 8) == 1);
+   CHECK(find_all("\\b", "ab cd", spans, 8) == 4);
+   CHECK(spans[0] == 0 && spans[2] == 2 && spans[4] == 3 && spans[6] == 5);
+   /* matches are leftmost and non-overlapping */
+   CHECK(find_all("aba", "abababa", spans, 8) == 2);
+   CHECK(spans[0] == 0 && spans[2] == 4);
+   CHECK(find_all("^a", "aaa", spans, 8) == 1);
+   CHECK(find_all("a$", "aaa", spans, 8) == 1);
+   CHECK(spans[0] == 2);
+
+   /* captures are stored for each match */
+   nfa = build_regex_nfa("([a-z]+)=([0-9]+)", 0);
+   CHECK(nfa);
+   CHECK(nfa_iter_init(&iter, nfa, captures, 3, 0) == NFA_NO_ERROR);
+   CHECK(nfa_find_first(&iter, "a=1, bc=23", -1) == NFA_RESULT_MATCH);
+   CHECK(iter.begin == 0 && iter.end == 3);
+   CHECK(captures[1].begin == 0 && captures[1].end == 1 && captures[2].begin == 2 && captures[2].end == 3);
+   CHECK(nfa_find_next(&iter) == NFA_RESULT_MATCH);
+   CHECK(iter.begin == 5 && iter.end == 10);
+   CHECK(captures[1].begin == 5 && captures[1].end == 7 && captures[2].begin == 8 && captures[2].end == 10);
+   CHECK(nfa_find_next(&iter) == NFA_RESULT_NOMATCH);
+   nfa_iter_free(&iter);
+
+   /* count-only mode doesn't know where matches start */
+   CHECK(nfa_iter_init(&iter, nfa, NULL, 0, NFA_ITER_COUNT_ONLY) == NFA_NO_ERROR);
+   CHECK(nfa_find_first(&iter, "x=0", -1) == NFA_RESULT_MATCH);
+   CHECK(iter.begin == -1 && iter.end == 3);
+   nfa_iter_free(&iter);
+
+   /* with a fixed pool of the required size */
+   size = nfa_iter_required_pool_size(nfa, 3, 0);
+   CHECK(size > nfa_iter_required_pool_size(nfa, 0, NFA_ITER_COUNT_ONLY));
+   pool = malloc(size);
+   CHECK(pool);
+   if (pool) {
+      CHECK(nfa_iter_init_pool(&iter, nfa, captures, 3, 0, pool, size) == NFA_NO_ERROR);
+      CHECK(nfa_find_first(&iter, "a=1, bc=23, def=456", -1) == NFA_RESULT_MATCH);
+      CHECK(nfa_find_next(&iter) == NFA_RESULT_MATCH);
+      CHECK(nfa_find_next(&iter) == NFA_RESULT_MATCH);
+      CHECK(iter.begin == 12 && iter.end == 19);
+      CHECK(captures[1].begin == 12 && captures[1].end == 15 && captures[2].begin == 16 && captures[2].end == 19);
+      CHECK(nfa_find_next(&iter) == NFA_RESULT_NOMATCH);
+      nfa_iter_free(&iter);
+      CHECK(nfa_iter_init_pool(&iter, nfa, captures, 3, 0, pool, 16) == NFA_ERROR_OUT_OF_MEMORY);
+      CHECK(nfa_find_first(&iter, "a=1", -1) == NFA_ERROR_OUT_OF_MEMORY);
+      nfa_iter_free(&iter);
+      free(pool);
+   }
+   free(nfa);
+
+   /* a match is decided as soon as no higher priority thread is left, even if the pattern ends
+    * with a group (the states before the accept include the ones that led to it) */
+   CHECK(find_first_steps("ab", "abc") == 2);
+   CHECK(find_first_steps("(ab)", "abc") == 2);
+   CHECK(find_first_steps("a(b)", "abc") == 2);
+   CHECK(find_first_steps("a(b)|abc", "abc") == 2);
+   CHECK(find_first_steps("x(ab)?", "xabc") == 3);
+   /* but not while a longer (greedy) match or a look assertion could still win */
+   CHECK(find_first_steps("(ab)+", "abc") == 3);
+   CHECK(find_first_steps("ab\\b", "ab c") == 3);
+   CHECK(find_first_steps("(a|ab)(c|bcd)", "abcx") == 4);
+
+   /* dense matches are found in one pass */
+   text = (char*)malloc(100001);
+   CHECK(text);
+   if (text) {
+      memset(text, 'a', 100000);
+      text[100000] = '\0';
+      nfa = build_regex_nfa("a", 0);
+      CHECK(nfa);
+      CHECK(nfa_count_matches(nfa, text, 100000) == 100000);
+      free(nfa);
+      free(text);
+   }
+}
+
+struct Output {
+   char text[128];
+   size_t length;
+   const char *spans[16]; /* where each span was */
+   int nspans;
+};
+
+static int append_span(void *userdata, const char *bytes, size_t length) {
+   struct Output *out = (struct Output*)userdata;
+   CHECK(length > 0);
+   if (out->length + length > sizeof(out->text)) { return NFA_ERROR_BUFFER_TOO_SMALL; }
+   memcpy(out->text + out->length, bytes, length);
+   out->length += length;
+   if (out->nspans < 16) { out->spans[out->nspans] = bytes; }
+   ++out->nspans;
+   return 0;
+}
+
+/* replaces matches of the pattern in the text, returning the number of replacements; the
+ * output is checked against nfa_replacer_feed with the text in chunks of each size up to 4 */
+static int replace(const char *pattern, const char *replacement, const char *text, struct Output *out) {
+   NfaReplacer replacer;
+   struct Output chunked;
+   Nfa *nfa;
+   int ret, chunk;
+   size_t at, length = strlen(text);
+   nfa = build_regex_nfa(pattern, 0);
+   CHECK(nfa);
+   if (!nfa) { return -1; }
+   memset(out, 0, sizeof(*out));
+   ret = nfa_replace(nfa, text, length, replacement, &append_span, out);
+   for (chunk = 1; chunk <= 4; ++chunk) {
+      memset(&chunked, 0, sizeof(chunked));
+      nfa_replacer_init(&replacer, nfa, replacement, &append_span, &chunked);
+      for (at = 0; at < length; at += chunk) {
+         nfa_replacer_feed(&replacer, text + at, (length - at < (size_t)chunk ? length - at : (size_t)chunk));
+      }
+      CHECK(nfa_replacer_finish(&replacer) == ret);
+      CHECK(chunked.length == out->length && memcmp(chunked.text, out->text, out->length) == 0);
+      nfa_replacer_free(&replacer);
+   }
+   free(nfa);
+   return ret;
+}
+
+#define OUTPUT_IS(out, str) ((out).length == strlen(str) && memcmp((out).text, (str), (out).length) == 0)
+
+/* feeds the text to an NfaReplacer as one chunk, and stores the output written before
+ * nfa_replacer_finish */
+static void replace_fed(const char *pattern, const char *text, struct Output *out) {
+   NfaReplacer replacer;
+   Nfa *nfa;
+   memset(out, 0, sizeof(*out));
+   nfa = build_regex_nfa(pattern, 0);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   CHECK(nfa_replacer_init(&replacer, nfa, "[X]", &append_span, out) == NFA_NO_ERROR);
+   CHECK(nfa_replacer_feed(&replacer, text, strlen(text)) >= 0);
+   nfa_replacer_free(&replacer);
+   free(nfa);
+}
+
+static void test_replace(void) {
+   static const char LOG[] = "user=alice ip=10.0.0.1 user=bob";
+   struct Output out;
+   Nfa *nfa;
+
+   /* captures and the whole match can be used in the template */
+   CHECK(replace("user=([a-z]+)", "user=<$1>", LOG, &out) == 2);
+   CHECK(OUTPUT_IS(out, "user=<alice> ip=10.0.0.1 user=<bob>"));
+   CHECK(replace("[0-9]+", "#", LOG, &out) == 4);
+   CHECK(OUTPUT_IS(out, "user=alice ip=#.#.#.# user=bob"));
+   CHECK(replace("(a)|(b)", "[${2}$1]", "abc", &out) == 2);
+   CHECK(OUTPUT_IS(out, "[a][b]c"));
+   CHECK(replace("b+", "$$$0$$", "abbc", &out) == 1);
+   CHECK(OUTPUT_IS(out, "a$bb$c"));
+   /* empty matches are replaced too */
+   CHECK(replace("x*", "-", "abxd", &out) == 5);
+   CHECK(OUTPUT_IS(out, "-a-b--d-"));
+   CHECK(replace("z", "-", "", &out) == 0);
+   CHECK(out.length == 0);
+
+   /* unchanged input and captures are passed straight from the input */
+   CHECK(replace("ip=([0-9.]+)", "$1", LOG, &out) == 1);
+   CHECK(OUTPUT_IS(out, "user=alice 10.0.0.1 user=bob"));
+   CHECK(out.nspans == 3);
+   CHECK(out.spans[0] == LOG && out.spans[1] == LOG + 14 && out.spans[2] == LOG + 22);
+
+   /* a chunk's match is written as soon as no higher priority thread is left, even if the
+    * pattern ends with a group (the last byte is held until it's known whether it's the end) */
+   replace_fed("ab", "abc", &out);
+   CHECK(OUTPUT_IS(out, "[X]"));
+   replace_fed("(ab)", "abc", &out);
+   CHECK(OUTPUT_IS(out, "[X]"));
+   replace_fed("a(b)", "abc", &out);
+   CHECK(OUTPUT_IS(out, "[X]"));
+   replace_fed("a(b)|abc", "abc", &out);
+   CHECK(OUTPUT_IS(out, "[X]"));
+   replace_fed("x(ab)?", "xabc", &out);
+   CHECK(OUTPUT_IS(out, "[X]"));
+   /* but not while a longer (greedy) match or a look assertion could still win */
+   replace_fed("(ab)+", "abc", &out);
+   CHECK(out.length == 0);
+   replace_fed("ab\\b", "abc", &out);
+   CHECK(out.length == 0);
+   replace_fed("(a|ab)(c|bcd)", "abcx", &out);
+   CHECK(out.length == 0);
+
+   nfa = build_regex_nfa("a", 0);
+   CHECK(nfa);
+   CHECK(nfa_replace(nfa, "a", 1, "$", &append_span, &out) == NFA_ERROR_BAD_TEMPLATE);
+   CHECK(nfa_replace(nfa, "a", 1, "${x}", &append_span, &out) == NFA_ERROR_BAD_TEMPLATE);
+   CHECK(nfa_replace(nfa, "a", 1, "${256}", &append_span, &out) == NFA_ERROR_BAD_TEMPLATE);
+   /* errors from the output function are returned */
+   memset(&out, 0, sizeof(out));
+   out.length = sizeof(out.text);
+   CHECK(nfa_replace(nfa, "bab", 3, "x", &append_span, &out) == NFA_ERROR_BUFFER_TOO_SMALL);
+   free(nfa);
+}
+
+static void test_unicode(void) {
+   static const uint32_t RANGES[] = { 0x41, 0x5A, 0x3B1, 0x3C9, 0x7FF, 0x801, 0xD000, 0xE0FF, 0xFFF0, 0x10010 };
+   static const char * const INVALID[] = { "\xC0\x80", "\xED\xA0\x80", "\xE0\x9F\xBF", "\xF4\x90\x80\x80", "\x80", "\xC3", 0 };
+   NfaBuilder builder;
+   Nfa *nfa;
+   uint32_t cp;
+   char text[4];
+   int i, n;
+
+   /* every code point (as UTF-8) against the set; the surrogates are skipped */
+   nfa_builder_init(&builder);
+   nfa_build_match_codepoints(&builder, RANGES, 5, 0);
+   nfa_build_assert_at_end(&builder);
+   nfa_build_join(&builder);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   CHECK(nfa);
+   if (!nfa) { return; }
+   for (cp = 0; cp <= 0x10FFFF; cp += (cp < 0x11000 ? 1 : 97)) {
+      if (cp >= 0xD800 && cp <= 0xDFFF) { continue; }
+      n = nfai_utf8_encode(cp, (uint8_t*)text);
+      for (i = 0; i < 5 && (cp < RANGES[2*i] || cp > RANGES[2*i + 1]); ++i) {}
+      if (nfa_match(nfa, NULL, 0, text, n) != (i < 5)) {
+         CHECK(!"code point set mismatch");
+         break;
+      }
+   }
+   /* invalid UTF-8 (overlong, surrogate, too large, truncated) never matches */
+   for (i = 0; INVALID[i]; ++i) {
+      CHECK(nfa_match(nfa, NULL, 0, INVALID[i], strlen(INVALID[i])) == 0);
+   }
+   free(nfa);
+
+   nfa_builder_init(&builder);
+   CHECK(nfa_build_match_category(&builder, "Xy", 0) == NFA_ERROR_UNKNOWN_CATEGORY);
+   nfa_builder_free(&builder);
+
+   /* code points are matched as a unit */
+   CHECK(match_regex("^\xC3\xA9+$", NFA_REGEX_UTF8, "\xC3\xA9\xC3\xA9", NULL, 0) == 1);
+   CHECK(match_regex("^.$", NFA_REGEX_UTF8, "\xE2\x82\xAC", NULL, 0) == 1);
+   CHECK(match_regex("^.$", NFA_REGEX_UTF8, "\xE2\x82", NULL, 0) == 0);
+   CHECK(match_regex("^[^a]$", NFA_REGEX_UTF8, "\xF0\x9D\x84\x9E", NULL, 0) == 1);
+   CHECK(match_regex("^[\xC3\xA0-\xC3\xBF]+$", NFA_REGEX_UTF8, "\xC3\xA0\xC3\xA9\xC3\xBF", NULL, 0) == 1);
+   CHECK(match_regex("^[\xC3\xA0-\xC3\xBF]+$", NFA_REGEX_UTF8, "\xC3\x9F", NULL, 0) == 0);
+   CHECK(match_regex("^\\x{20AC}\\x{1D11E}$", NFA_REGEX_UTF8, "\xE2\x82\xAC\xF0\x9D\x84\x9E", NULL, 0) == 1);
+
+   /* general categories */
+   CHECK(match_regex("^\\p{Lu}\\p{Ll}\\pN$", NFA_REGEX_UTF8, "\xD0\x96\xD0\xB6\xD9\xA3", NULL, 0) == 1);
+   CHECK(match_regex("^\\p{Lu}", NFA_REGEX_UTF8, "\xD0\xB6", NULL, 0) == 0);
+   CHECK(match_regex("^[\\p{Nd}_]+$", NFA_REGEX_UTF8, "4_\xD9\xA3", NULL, 0) == 1);
+   CHECK(match_regex("^\\P{L}$", NFA_REGEX_UTF8, "\xE2\x82\xAC", NULL, 0) == 1);
+   CHECK(match_regex("^[^\\P{L}]$", NFA_REGEX_UTF8, "\xE2\x82\xAC", NULL, 0) == 0);
+
+   /* simple case folding */
+   CHECK(match_regex("\xD0\xB6", NFA_REGEX_UTF8 | NFA_REGEX_CASE_INSENSITIVE, "\xD0\x96", NULL, 0) == 1);
+   CHECK(match_regex("k", NFA_REGEX_UTF8 | NFA_REGEX_CASE_INSENSITIVE, "\xE2\x84\xAA", NULL, 0) == 1); /* KELVIN SIGN */
+   CHECK(match_regex("^\xCF\x83+$", NFA_REGEX_UTF8 | NFA_REGEX_CASE_INSENSITIVE, "\xCE\xA3\xCF\x82\xCF\x83", NULL, 0) == 1);
+   CHECK(match_regex("[^\xC3\xA9]", NFA_REGEX_UTF8 | NFA_REGEX_CASE_INSENSITIVE, "\xC3\x89", NULL, 0) == 0);
+   CHECK(match_regex("\xC4\xB1", NFA_REGEX_UTF8 | NFA_REGEX_CASE_INSENSITIVE, "I", NULL, 0) == 0); /* dotless i doesn't fold */
+
+   /* errors */
+   nfa_builder_init(&builder);
+   CHECK(nfa_build_regex(&builder, "a\xC3(", -1, NFA_REGEX_UTF8) == NFA_ERROR_REGEX_BAD_UTF8);
+   nfa_builder_free(&builder);
+   nfa_builder_init(&builder);
+   CHECK(nfa_build_regex(&builder, "\\x{D800}", -1, NFA_REGEX_UTF8) == NFA_ERROR_REGEX_BAD_ESCAPE);
+   nfa_builder_free(&builder);
+   nfa_builder_init(&builder);
+   CHECK(nfa_build_regex(&builder, "[\\p{Foo}]", -1, NFA_REGEX_UTF8) == NFA_ERROR_UNKNOWN_CATEGORY);
+   nfa_builder_free(&builder);
+}
+
+typedef void (*TestFn)(void);
+
+static const struct {
+   const char *name;
+   TestFn fn;
+} TESTS[] = {
+   { "lexer (buffer)", test_lexer_buffer },
+   { "lexer (chunks)", test_lexer_chunks },
+   { "optimize", test_optimize },
+   { "match string", test_match_string },
+   { "repeat", test_repeat },
+   { "wide format", test_wide_format },
+   { "literal set", test_literal_set },
+   { "n-ary alternation", test_alt_n },
+   { "validate", test_validate },
+   { "bundle", test_bundle },
+   { "jit", test_jit },
+   { "stream", test_stream },
+   { "exec stats", test_exec_stats },
+   { "analyze", test_analyze },
+   { "required pool size", test_required_pool_size },
+   { "prefilter", test_prefilter },
+   { "unicode", test_unicode },
+   { "case folding", test_case_folding },
+   { "look assertions", test_look_assertions },
+   { "scan lines", test_scan_lines },
+   { "find all", test_find_all },
+   { "replace", test_replace },
+   { 0, 0 }
+};
+
+int main(void) {
+   int i;
+   for (i = 0; TESTS[i].name; ++i) {
+      int before = fail_count;
+      TESTS[i].fn();
+      fprintf(stdout, "%s  %s\n", (fail_count == before ? " ok " : "FAIL"), TESTS[i].name);
+   }
+   fprintf(stdout, "%d checks failed\n", fail_count);
+   return (fail_count ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+/* vim: set ts=8 sts=3 sw=3 et: */
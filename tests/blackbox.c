@@ -9,13 +9,14 @@
 static char BUILDER_POOL[8 << 10];
 static char EXEC_POOL[16 << 10];
 
-static Nfa *build_nfa(const char *pattern) {
+static Nfa *build_nfa(const char *pattern, int flags) {
    NfaBuilder builder;
    Nfa *nfa = NULL;
 
    assert(pattern);
 
    nfa_builder_init_pool(&builder, BUILDER_POOL, sizeof(BUILDER_POOL));
+   builder.flags = flags;
    nfa_build_regex(&builder, pattern, -1, 0);
    nfa = nfa_builder_output(&builder);
    if (!nfa) {
@@ -64,7 +65,9 @@ static int match_nfa(const Nfa *nfa, const char *string) {
 static void run_tests(FILE *fl) {
    char buf[512];
    char pattern[512];
-   Nfa *nfa = NULL;
+   Nfa *nfa = NULL, *opt_nfa = NULL;
+   NfaJit jit;
+   int have_jit = 0;
    int pattern_count = 0, test_count = 0, fail_count = 0, skip_count = 0;
 
    while (1) {
@@ -90,8 +93,11 @@ static void run_tests(FILE *fl) {
 
       if ((line[0] == 'p' || line[0] == 'e') && line[1] == ' ') {
          free(nfa);
+         free(opt_nfa);
+         if (have_jit) { nfa_jit_free(&jit); }
          pattern[0] = '\0';
-         nfa = NULL;
+         nfa = opt_nfa = NULL;
+         have_jit = 0;
          if (line[0] == 'e') {
             ++test_count;
             if (!build_bad_nfa(line + 2)) {
@@ -100,9 +106,12 @@ static void run_tests(FILE *fl) {
             }
          } else {
             strcpy(pattern, line + 2);
-            nfa = build_nfa(line + 2);
+            nfa = build_nfa(line + 2, 0);
+            opt_nfa = build_nfa(line + 2, NFA_BUILDER_OPTIMIZE);
             ++pattern_count;
-            if (!nfa) { ++skip_count; }
+            if (!nfa || !opt_nfa) { ++skip_count; }
+            /* (the DFA for some patterns is too big for the JIT) */
+            have_jit = (nfa && nfa_jit_init(&jit, nfa) == NFA_NO_ERROR);
             /* nfa_print_machine(nfa, stdout); */
          }
       } else {
@@ -126,9 +135,27 @@ static void run_tests(FILE *fl) {
                fprintf(stdout, "FAIL  (/%s/ %s '%s')\n", pattern, (matched ? "~=" : "~!"), line + 2);
             }
          }
+         if (opt_nfa) {
+            ++test_count;
+            matched = match_nfa(opt_nfa, line + 2);
+            if (matched != expected) {
+               ++fail_count;
+               fprintf(stdout, "FAIL  (/%s/ %s '%s') (optimized)\n", pattern, (matched ? "~=" : "~!"), line + 2);
+            }
+         }
+         if (have_jit) {
+            ++test_count;
+            matched = nfa_jit_match(&jit, line + 2, strlen(line + 2));
+            if (matched != expected) {
+               ++fail_count;
+               fprintf(stdout, "FAIL  (/%s/ %s '%s') (jit)\n", pattern, (matched ? "~=" : "~!"), line + 2);
+            }
+         }
       }
    }
    free(nfa);
+   free(opt_nfa);
+   if (have_jit) { nfa_jit_free(&jit); }
 
    fprintf(stdout, "%d patterns (%d skipped)\n", pattern_count, skip_count);
    fprintf(stdout, "%d / %d tests failed\n", fail_count, test_count);
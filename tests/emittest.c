@@ -0,0 +1,125 @@
+/* Copyright (C) 2014 John Bartholomew. For licensing terms, see the header file nfa.h */
+
+/* Generates a C program from a test set (see tests.txt): a matcher function for each
+ * pattern (written by nfa_emit_c, from both the plain and the optimized NFA), and a main
+ * function which checks that they agree with nfa_match on each of the pattern's inputs.
+ * See test_emit.sh */
+
+#define NFA_API static
+#include "nfa.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+struct Case {
+   int pattern;
+   char input[512];
+   int expected;
+};
+
+static struct Case CASES[4096];
+static int ncases = 0;
+
+static Nfa *build_nfa(const char *pattern, int flags) {
+   NfaBuilder builder;
+   Nfa *nfa;
+   nfa_builder_init(&builder);
+   builder.flags = flags;
+   nfa_build_regex(&builder, pattern, -1, 0);
+   nfa = nfa_builder_output(&builder);
+   nfa_builder_free(&builder);
+   return nfa;
+}
+
+static void write_string(FILE *to, const char *s) {
+   fputc('"', to);
+   for (; *s; ++s) {
+      if (*s == '"' || *s == '\\') {
+         fprintf(to, "\\%c", *s);
+      } else if (*s >= 32 && *s < 127 && *s != '?') {
+         fputc(*s, to);
+      } else {
+         fprintf(to, "\\%03o", (unsigned)(unsigned char)*s);
+      }
+   }
+   fputc('"', to);
+}
+
+int main(int argc, char **argv) {
+   char buf[512];
+   char patterns[256][512];
+   int npatterns = 0, emitted[256][2], i, j, nskipped = 0;
+   Nfa *nfa = NULL;
+   FILE *fl, *to = stdout;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: emittest testset > generated.c\n");
+      return 1;
+   }
+   fl = fopen(argv[1], "r");
+   if (!fl) {
+      fprintf(stderr, "could not open '%s'\n", argv[1]);
+      return 1;
+   }
+
+   fprintf(to, "#include <stddef.h>\n#include <stdio.h>\n#include <string.h>\n\n");
+   while (fgets(buf, sizeof(buf), fl)) {
+      size_t len = strlen(buf);
+      if (len && buf[len - 1] == '\n') { buf[--len] = '\0'; }
+      if (len < 2 || buf[1] != ' ') { continue; }
+
+      if (buf[0] == 'p') {
+         free(nfa);
+         nfa = NULL;
+         if (npatterns >= 256) { continue; }
+         strcpy(patterns[npatterns], buf + 2);
+         for (j = 0; j < 2; ++j) {
+            char name[32];
+            Nfa *emit_nfa = build_nfa(buf + 2, (j ? NFA_BUILDER_OPTIMIZE : 0));
+            sprintf(name, "match_%d_%d", npatterns, j);
+            emitted[npatterns][j] = (emit_nfa && nfa_emit_c(emit_nfa, name, to) == NFA_NO_ERROR);
+            if (!emitted[npatterns][j]) { ++nskipped; }
+            free(emit_nfa);
+         }
+         nfa = build_nfa(buf + 2, 0);
+         ++npatterns;
+      } else if ((buf[0] == 'y' || buf[0] == 'n') && nfa && ncases < (int)(sizeof(CASES)/sizeof(CASES[0]))) {
+         CASES[ncases].pattern = npatterns - 1;
+         strcpy(CASES[ncases].input, buf + 2);
+         CASES[ncases].expected = nfa_match(nfa, NULL, 0, buf + 2, len - 2);
+         ++ncases;
+      }
+   }
+   free(nfa);
+   fclose(fl);
+
+   fprintf(to, "\nstatic const struct { int (*fn)(const char*, size_t); const char *pattern; const char *input; int expected; } CASES[] = {\n");
+   for (i = 0; i < ncases; ++i) {
+      for (j = 0; j < 2; ++j) {
+         if (!emitted[CASES[i].pattern][j]) { continue; }
+         fprintf(to, "   { match_%d_%d, ", CASES[i].pattern, j);
+         write_string(to, patterns[CASES[i].pattern]);
+         fprintf(to, ", ");
+         write_string(to, CASES[i].input);
+         fprintf(to, ", %d },\n", CASES[i].expected);
+      }
+   }
+   fprintf(to, "   { 0, 0, 0, 0 }\n};\n\n");
+   fprintf(to,
+      "int main(void) {\n"
+      "   int i, fail_count = 0;\n"
+      "   for (i = 0; CASES[i].fn; ++i) {\n"
+      "      if (CASES[i].fn(CASES[i].input, strlen(CASES[i].input)) != CASES[i].expected) {\n"
+      "         ++fail_count;\n"
+      "         printf(\"FAIL  (/%%s/ %%s '%%s')\\n\", CASES[i].pattern, (CASES[i].expected ? \"~!\" : \"~=\"), CASES[i].input);\n"
+      "      }\n"
+      "   }\n"
+      "   printf(\"%d patterns (%d matchers skipped)\\n\");\n"
+      "   printf(\"%%d / %%d tests failed\\n\", fail_count, i);\n"
+      "   return (fail_count ? 1 : 0);\n"
+      "}\n", npatterns, nskipped);
+   return 0;
+}
+/* vim: set ts=8 sts=3 sw=3 et: */
@@ -0,0 +1,109 @@
+/* Copyright (C) 2014 John Bartholomew. For licensing terms, see the header file nfa.h */
+
+/* build with a C++17 compiler, e.g.: g++ -std=c++17 -I. tests/statictest.cpp */
+
+#define NFA_API static
+#include "nfa.c" /* implementation as well as interface */
+#include "nfa_static.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+static int fail_count = 0;
+
+#define CHECK(x) do{if(!(x)){++fail_count;fprintf(stdout,"FAIL  %s:%d: %s\n",__FILE__,__LINE__,#x);}}while(0)
+
+#define PATTERN(name, str) static constexpr auto name = nfa_static::compile(NFA_STATIC_PATTERN(str))
+
+PATTERN(P_EMPTY, "");
+PATTERN(P_ANCHORS, "^$$^^$");
+PATTERN(P_PREFIX, "bingo bango");
+PATTERN(P_ALT, "(abc|^)$");
+PATTERN(P_ALT3, "^(a|bc|)(d|e|f|)$");
+PATTERN(P_STAR, "^(a|b)*c$");
+PATTERN(P_LAZY, "^a+?b*?c??$");
+PATTERN(P_CLASS, "^[a-c][^a-c][\\]x-z-]$");
+PATTERN(P_ESCAPE, "^a\\.\\*\\n$");
+PATTERN(P_REPEAT, "^(ab){2,3}c{0,2}d{2,}$");
+PATTERN(P_ZERO, "^x{0}y(z{0})$");
+PATTERN(P_NESTED, "^((a*)*|b)+c$");
+PATTERN(P_DOTS, "^.{3,}x$");
+PATTERN(P_USELESS, "abc(^|)def$");
+PATTERN(P_WORDS, "(\\b[a-e]+\\b[^a-e]*)*x\\B");
+
+/* the program can be used with the C API too */
+static_assert(P_STAR.ops[P_STAR.nops - 1] == (10u << 8), "ends with an accept");
+
+struct Case {
+   const char *pattern;
+   const Nfa *program;
+   size_t program_size;
+   bool (*match)(const char *text, size_t length);
+};
+
+#define CASE(name, str) { str, name.nfa(), name.size(), &nfa_static::match<name> }
+
+static void test_static(void) {
+   static const Case CASES[] = {
+      CASE(P_EMPTY, ""),
+      CASE(P_ANCHORS, "^$$^^$"),
+      CASE(P_PREFIX, "bingo bango"),
+      CASE(P_ALT, "(abc|^)$"),
+      CASE(P_ALT3, "^(a|bc|)(d|e|f|)$"),
+      CASE(P_STAR, "^(a|b)*c$"),
+      CASE(P_LAZY, "^a+?b*?c??$"),
+      CASE(P_CLASS, "^[a-c][^a-c][\\]x-z-]$"),
+      CASE(P_ESCAPE, "^a\\.\\*\\n$"),
+      CASE(P_REPEAT, "^(ab){2,3}c{0,2}d{2,}$"),
+      CASE(P_ZERO, "^x{0}y(z{0})$"),
+      CASE(P_NESTED, "^((a*)*|b)+c$"),
+      CASE(P_DOTS, "^.{3,}x$"),
+      CASE(P_USELESS, "abc(^|)def$"),
+      CASE(P_WORDS, "(\\b[a-e]+\\b[^a-e]*)*x\\B")
+   };
+   static const char ALPHABET[] = "abcdexyz-].*\nbingo ";
+   char text[16];
+   int i, j, k;
+
+   for (i = 0; i < (int)(sizeof(CASES)/sizeof(CASES[0])); ++i) {
+      const Case &c = CASES[i];
+      NfaBuilder builder;
+      Nfa *nfa;
+      int mismatches = 0;
+
+      CHECK(nfa_validate(c.program, c.program_size) == NFA_NO_ERROR);
+
+      nfa_builder_init(&builder);
+      nfa_build_regex(&builder, c.pattern, -1, NFA_REGEX_NO_CAPTURES);
+      nfa = nfa_builder_output(&builder);
+      nfa_builder_free(&builder);
+      CHECK(nfa);
+      if (!nfa) { continue; }
+
+      /* the static matcher, the static program and the builder's NFA all agree */
+      srand(i + 1);
+      for (j = 0; j < 3000; ++j) {
+         const int len = (j < 20 ? j % 8 : rand() % (int)sizeof(text));
+         for (k = 0; k < len; ++k) { text[k] = ALPHABET[rand() % (sizeof(ALPHABET) - 1)]; }
+         const int expected = nfa_match(nfa, NULL, 0, text, len);
+         if (nfa_match(c.program, NULL, 0, text, len) != expected) { ++mismatches; }
+         if ((int)c.match(text, len) != expected) { ++mismatches; }
+      }
+      if (mismatches) { fprintf(stdout, "pattern /%s/: %d mismatches\n", c.pattern, mismatches); }
+      CHECK(mismatches == 0);
+      free(nfa);
+   }
+
+   CHECK(nfa_static::match<P_STAR>("abbac"));
+   CHECK(!nfa_static::match<P_STAR>("abbacx"));
+   CHECK(nfa_static::match<P_PREFIX>("bingo bango bongo"));
+}
+
+int main(void) {
+   test_static();
+   fprintf(stdout, "%s  %s\n", (fail_count ? "FAIL" : " ok "), "static patterns");
+   fprintf(stdout, "%d checks failed\n", fail_count);
+   return (fail_count ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+/* vim: set ts=8 sts=3 sw=3 et: */
@@ -0,0 +1,13 @@
+#!/bin/sh
+
+# checks that the matchers written by nfa_emit_c agree with nfa_match on the test set
+# (run from the top-level directory)
+
+BUILDDIR="${BUILDDIR:-/tmp}"
+TESTSET="${1:-tests/tests.txt}"
+
+set -e
+gcc -std=c89 -pedantic -Wall -Wextra -Wno-unused-function -O1 -g -I. -o "$BUILDDIR"/emittest tests/emittest.c
+"$BUILDDIR"/emittest "$TESTSET" > "$BUILDDIR"/emitted.c
+gcc -std=c89 -pedantic -Wall -Wextra -Werror -O1 -o "$BUILDDIR"/emitted "$BUILDDIR"/emitted.c
+"$BUILDDIR"/emitted